@@ -21,12 +21,25 @@
 #include <stddef.h>
 #include <stdbool.h>
 #include <string.h>
+#include "flash_crc.h"
+
+#ifndef ENABLED
+    #define ENABLED    1
+#endif
+#ifndef DISABLED
+    #define DISABLED   0
+#endif
 
 #if USE_PERF_COUNTER == ENABLED
     #include "perf_counter.h"
 #else
 #ifndef safe_atom_code
     #include "cmsis_compiler.h"	
+#ifndef SAFE_NAME
+    #define __FLASH_CONNECT3(__A, __B, __C)   __A##__B##__C
+    #define FLASH_CONNECT3(__A, __B, __C)     __FLASH_CONNECT3(__A, __B, __C)
+    #define SAFE_NAME(__NAME)                 FLASH_CONNECT3(__, __NAME, __LINE__)
+#endif
     #define safe_atom_code()                                         \
             for(  uint32_t SAFE_NAME(temp) =                          \
 					({uint32_t SAFE_NAME(temp2)=__get_PRIMASK();       \
@@ -39,6 +52,96 @@
 #endif
 #endif
 
+/*
+ * Coalesce small/unaligned writes in a per-device page buffer. The tail of
+ * a write may then stay in RAM until target_flash_sync()/_uninit().
+ */
+#ifndef FLASH_BLOB_USE_PAGE_BUF
+    #define FLASH_BLOB_USE_PAGE_BUF     DISABLED
+#endif
+/* Bytes of page buffer per device, larger programming pages are handled in slices */
+#ifndef FLASH_BLOB_PAGE_BUF_SIZE
+    #define FLASH_BLOB_PAGE_BUF_SIZE    1024
+#endif
+/* Second page buffer filled while the first one programs, for devices with ProgramStart/ProgramPoll */
+#ifndef FLASH_BLOB_USE_PROG_PIPELINE
+    #define FLASH_BLOB_USE_PROG_PIPELINE    DISABLED
+#endif
+/* Most bytes programmed or read with IRQs masked, a sector erase is always one window */
+#ifndef FLASH_BLOB_ATOM_MAX_SIZE
+    #define FLASH_BLOB_ATOM_MAX_SIZE    256
+#endif
+/* target_flash_update(): compare with flash contents before erasing/programming */
+#ifndef FLASH_BLOB_USE_DIFF_WRITE
+    #define FLASH_BLOB_USE_DIFF_WRITE   ENABLED
+#endif
+/* Bytes compared per step by target_flash_update(), multiple of the write granularity */
+#ifndef FLASH_BLOB_DIFF_CHUNK_SIZE
+    #define FLASH_BLOB_DIFF_CHUNK_SIZE  256
+#endif
+/* RAM read cache for devices with a Read op that point to a flash_cache_t */
+#ifndef FLASH_BLOB_USE_READ_CACHE
+    #define FLASH_BLOB_USE_READ_CACHE   DISABLED
+#endif
+/* Reads of at least this many bytes go to the device and leave the read cache as it is */
+#ifndef FLASH_BLOB_CACHE_BYPASS_SIZE
+    #define FLASH_BLOB_CACHE_BYPASS_SIZE    512
+#endif
+
+/* Per-device operation counters and latency histograms, nothing is compiled in when disabled */
+#ifndef FLASH_BLOB_USE_STAT
+    #define FLASH_BLOB_USE_STAT         DISABLED
+#endif
+/* Sectors with their own erase counter, erases of higher indexes share the last one */
+#ifndef FLASH_BLOB_STAT_SECTOR_NUM
+    #define FLASH_BLOB_STAT_SECTOR_NUM  64
+#endif
+/* log2 latency buckets per operation */
+#ifndef FLASH_BLOB_STAT_HIST_NUM
+    #define FLASH_BLOB_STAT_HIST_NUM    16
+#endif
+/* Running CRC32 (and SHA-256) of the data written per device and per session */
+#ifndef FLASH_BLOB_USE_DIGEST
+    #define FLASH_BLOB_USE_DIGEST       ENABLED
+#endif
+/* Read back after Program: FLASH_VERIFY_OFF, FLASH_VERIFY_SAMPLED or FLASH_VERIFY_FULL */
+#ifndef FLASH_BLOB_VERIFY_POLICY
+    #define FLASH_BLOB_VERIFY_POLICY    FLASH_VERIFY_FULL
+#endif
+/* Block sizes a device can list in flash_erase_caps_t */
+#ifndef FLASH_BLOB_ERASE_BLOCK_NUM
+    #define FLASH_BLOB_ERASE_BLOCK_NUM  3
+#endif
+/* Most sectors erased by one EraseSectors call */
+#ifndef FLASH_BLOB_ERASE_RUN_MAX
+    #define FLASH_BLOB_ERASE_RUN_MAX    8
+#endif
+/* Ring buffer of the most recent operations */
+#ifndef FLASH_BLOB_USE_TRACE
+    #define FLASH_BLOB_USE_TRACE        DISABLED
+#endif
+/* Trace entries, power of two */
+#ifndef FLASH_BLOB_TRACE_DEPTH
+    #define FLASH_BLOB_TRACE_DEPTH      64
+#endif
+/* Banks per device tracked for read-while-write scheduling (at most 8), further banks share the last one */
+#ifndef FLASH_BLOB_BANK_MAX
+    #define FLASH_BLOB_BANK_MAX         2
+#endif
+/* Tasks work on different devices at the same time, scratch buffers are kept per device.
+   Required by the per-device locks of FLASH_BLOB_OS, so on by default with them */
+#ifndef FLASH_BLOB_USE_PARALLEL
+    #if defined(FLASH_BLOB_OS)
+        #define FLASH_BLOB_USE_PARALLEL ENABLED
+    #else
+        #define FLASH_BLOB_USE_PARALLEL DISABLED
+    #endif
+#endif
+/* Devices flash_dev_register() can add to FLASH_DEV_TABLE at runtime */
+#ifndef FLASH_DEV_REG_NUM
+    #define FLASH_DEV_REG_NUM           0
+#endif
+
 #define VERS       1           // Interface Version 1.01
 
 #define UNKNOWN    0           // Unknown
@@ -84,16 +187,291 @@ typedef struct {
     int32_t (*Read)(uint32_t adr, uint32_t sz, uint8_t* buf);
 } flash_ops_t;
 
+/*
+ * Optional erase operations and typical erase times of a device. Block
+ * erase also covers bank erase: list the bank size as a block size. An
+ * operation is only planned where the times make it faster, and where it
+ * masks IRQs only if it takes no longer than one sector erase.
+ */
+typedef struct {
+    int32_t (*EraseSectors)(uint32_t adr, uint32_t num);    // num sectors of equal size from adr, 0 - OK
+    int32_t (*EraseBlock)(uint32_t adr, uint32_t sz);       // sz bytes aligned to sz within the device, 0 - OK
+    uint32_t wBlockSize[FLASH_BLOB_ERASE_BLOCK_NUM];        // ascending, each a multiple of the previous, 0 unused
+    uint32_t wBlockTime[FLASH_BLOB_ERASE_BLOCK_NUM];        // ms per block erase
+    uint32_t wSectorTime;                                   // ms per sector erase, 0 means toErase
+    uint32_t wRunSectorTime;                                // ms per sector of an EraseSectors run, 0 never plans runs
+    uint32_t wChipTime;                                     // ms per EraseChip, 0 never plans a chip erase
+} flash_erase_caps_t;
+
+/*
+ * Optional split program operation, e.g. a DMA transfer to the device or a
+ * page program command whose end is polled. ProgramStart returns once the
+ * device is busy and buf stays untouched until ProgramPoll reports the end.
+ * Used for page buffer flushes when FLASH_BLOB_USE_PROG_PIPELINE is enabled,
+ * never for steps that run with IRQs masked.
+ */
+#define FLASH_PROG_BUSY     2
+
+typedef struct {
+    int32_t (*ProgramStart)(uint32_t adr, uint32_t sz, uint8_t *buf);  // within one programming page, 0 - OK
+    int32_t (*ProgramPoll)(void);       // 0 - done, 1 - failed, FLASH_PROG_BUSY - still programming
+} flash_prog_async_t;
+
+/* One sector region of a device, flattened from flash_dev_t::sectors[] */
+typedef struct {
+    uint32_t wOffset;               // region start, offset from DevAdr
+    uint32_t wSize;                 // sector size within the region
+    uint32_t wFirst;                // linear index of the first sector of the region
+    uint8_t  chShift;               // log2(wSize), 0 if wSize is not a power of two
+} flash_region_t;
+
+/*
+ * Sector geometry worked out at build time, e.g. by tools/flm2c.py. A
+ * device that points to one is indexed without flattening sectors[].
+ */
+typedef struct {
+    uint32_t wSectorNum;            // sectors of the device
+    uint8_t  chRegionNum;           // used entries of tRegion[], ascending wOffset
+    flash_region_t tRegion[SECTOR_NUM];
+} flash_geometry_t;
+
+/* When erase/program/read steps of a device run with IRQs masked */
+typedef enum {
+    FLASH_IRQ_MASK_AUTO = 0,        // ONCHIP devices only: code and vectors may live in the flash being changed
+    FLASH_IRQ_MASK_ALWAYS,          // e.g. an external device whose bus is also used from an ISR
+    FLASH_IRQ_MASK_NEVER,
+} flash_irq_mask_t;
+
+typedef struct {
+    uint32_t wLine;                 // line address | 1, 0 when the way is empty
+    uint32_t wUsed;                 // flash_cache_t::wClock of the last hit, for LRU
+} flash_cache_way_t;
+
+typedef struct {
+    uint32_t wHits;                 // lines served from RAM
+    uint32_t wMisses;               // lines read from the device
+    uint32_t wPrefetches;           // next lines read along with a sequential miss
+    uint32_t wBypassed;             // reads of FLASH_BLOB_CACHE_BYPASS_SIZE and more, not cached
+    uint32_t wInvalidated;          // lines dropped by erase, or by a failed program
+} flash_cache_stat_t;
+
+/*
+ * Set-associative read cache of one device, defined with
+ * FLASH_CACHE_DEFINE(). Reads of a device with a Read op go through it;
+ * programs update the cached lines they touch and erases drop them, as
+ * long as the device is only changed through target_flash_*. A miss that
+ * continues the previous read also fetches the line after it, with the
+ * same Read call when both lines land in the same way.
+ */
+typedef struct {
+    uint16_t hwSets;                // power of two
+    uint16_t hwLineSize;            // bytes per line, power of two, 4 or more
+    uint8_t  chWays;
+    flash_cache_way_t *ptWay;       // hwSets * chWays tags, way by way
+    uint8_t *pchData;               // line data, same order as ptWay[]
+    uint32_t wClock;
+    uint32_t wNext;                 // line a sequential read needs next
+    flash_cache_stat_t tStat;
+} flash_cache_t;
+
+/* Defines the cache __NAME and its arena: __SETS * __WAYS lines of __LINE bytes */
+#define FLASH_CACHE_DEFINE(__NAME, __SETS, __WAYS, __LINE)                      \
+    static flash_cache_way_t __NAME##_way[(__SETS) * (__WAYS)];                 \
+    static uint8_t __NAME##_data[(__SETS) * (__WAYS) * (__LINE)];               \
+    flash_cache_t __NAME = {                                                    \
+        .hwSets = (__SETS), .hwLineSize = (__LINE), .chWays = (__WAYS),         \
+        .ptWay = __NAME##_way, .pchData = __NAME##_data,                        \
+        .wNext = 0xFFFFFFFFu,                                                   \
+    }
+
 typedef struct flash_blob_t flash_blob_t;
 typedef struct flash_blob_t{
     flash_dev_t const *ptFlashDev;
     flash_ops_t tFlashops;
+    uint32_t wWriteGranularity;     // smallest programmable unit in bytes, 0 means 4
+    const flash_erase_caps_t *ptErase;  // NULL erases sector by sector
+    uint8_t chIrqMask;              // flash_irq_mask_t
+    uint32_t wBankSize;             // equal banks that read while the others write, 0 for one bank
+    const flash_prog_async_t *ptProgAsync;  // NULL programs with Program only
+    const flash_geometry_t *ptGeometry;     // NULL flattens sectors[] when the device is indexed
+    flash_cache_t *ptCache;         // NULL reads through Read every time, ignored for memory mapped devices
 } flash_blob_t;
 
-extern void flash_dev_register(flash_blob_t *ptFlashDevice);
+typedef enum {
+    FLASH_ERASE_SECTOR = 0,         // EraseSector
+    FLASH_ERASE_SECTORS,            // EraseSectors
+    FLASH_ERASE_BLOCK,              // EraseBlock
+    FLASH_ERASE_CHIP,               // EraseChip
+} flash_erase_kind_t;
+
+/* One erase operation chosen by the erase planner */
+typedef struct {
+    uint32_t wAddr;
+    uint32_t wSize;                 // bytes erased
+    uint32_t wTime;                 // modelled time in ms
+    uint8_t  chKind;                // flash_erase_kind_t
+} flash_erase_step_t;
+
+typedef struct {
+    uint32_t wAddr;                 // sector start address
+    uint32_t wSize;                 // sector size in bytes
+    uint32_t wIndex;                // linear sector index within the device
+} flash_sector_t;
+
+typedef struct {
+    uint32_t wAddr;                 // bank start address
+    uint32_t wSize;                 // bank size in bytes
+    uint8_t  chIndex;               // bank number within the device
+    bool     bCode;                 // holds FLASH_BLOB_CODE_ADDR(), the code running the update
+    bool     bStall;                // erase/program stalls the CPU: the flash algorithm, and ISRs
+                                    // enabled meanwhile, must run from RAM; IRQs are masked
+} flash_bank_t;
+
+typedef struct {
+    uint32_t wAddr;
+    size_t   wSize;
+} flash_range_t;
+
+typedef struct {
+    uint32_t wLastCall;             // longest IRQ-masked window of the last call to mask IRQs, in ticks
+    uint32_t wMax;                  // longest IRQ-masked window since reset, in ticks
+    uint32_t wWindows;              // IRQ-masked steps since reset
+} flash_irq_stat_t;
+
+typedef struct {
+    uint32_t wBytesSkipped;         // requested bytes not passed to Program
+    uint32_t wBytesProgrammed;      // bytes passed to Program, including padding
+    uint32_t wSectorsSkipped;       // sectors already holding the target data
+    uint32_t wErasesAvoided;        // changed sectors programmed without erase
+    uint32_t wErases;               // sectors that had to be erased
+} flash_diff_stat_t;
+
+/* How the data passed to Program is checked afterwards */
+typedef enum {
+    FLASH_VERIFY_OFF = 0,           // trust the Program op
+    FLASH_VERIFY_SAMPLED,           // read back the first and last write unit of every piece
+    FLASH_VERIFY_FULL,              // read back every programmed byte
+} flash_verify_t;
+
+typedef enum {
+    FLASH_REQ_ERASE = 0,
+    FLASH_REQ_WRITE,
+} flash_req_op_t;
+
+typedef enum {
+    FLASH_REQ_IDLE = 0,             // never submitted
+    FLASH_REQ_PENDING,              // queued or in progress
+    FLASH_REQ_DONE,                 // completed successfully
+    FLASH_REQ_FAILED,               // stopped at wDone bytes
+    FLASH_REQ_CANCELLED,            // background request given up for a foreground one at wDone bytes
+} flash_req_status_t;
+
+typedef struct flash_req_t flash_req_t;
+typedef void flash_req_cb_t(flash_req_t *ptReq);
+
+/*
+ * Asynchronous request, owned by the library until its status leaves
+ * FLASH_REQ_PENDING, or with a callback until the callback returned. Only
+ * then may it be reused or go out of scope.
+ */
+struct flash_req_t {
+    flash_req_t *ptNext;
+    flash_req_cb_t *fnDone;         // optional completion callback, called from target_flash_poll*()
+    void *pTarget;                  // user data for the callback
+    const uint8_t *pchBuf;          // write source, must stay valid until completion
+    uint32_t wAddr;                 // start address, sector aligned for erase
+    size_t wSize;                   // bytes to process
+    size_t wDone;                   // bytes processed so far
+    uint8_t chOp;                   // flash_req_op_t
+    volatile uint8_t chStatus;      // flash_req_status_t
+    bool bIdle;                     // background request, see target_flash_erase_idle()
+};
+
+typedef enum {
+    FLASH_OP_ERASE = 0,             // EraseSector
+    FLASH_OP_PROGRAM,               // Program, one call never crosses a page
+    FLASH_OP_READ,                  // Read, or a direct read of a memory mapped device
+    FLASH_OP_NUM,
+} flash_op_t;
+
+typedef struct {
+    uint32_t wCalls;
+    uint32_t wFailures;
+    uint64_t dwBytes;
+    uint64_t dwTicks;               // sum of the latencies, FLASH_BLOB_GET_TICK() units
+    uint32_t wMaxTicks;
+    uint32_t wHist[FLASH_BLOB_STAT_HIST_NUM];   // bucket n: latencies below 2^n ticks, the last one takes the rest
+} flash_op_stat_t;
+
+typedef struct {
+    flash_op_stat_t tOp[FLASH_OP_NUM];
+    uint32_t wSectorErases[FLASH_BLOB_STAT_SECTOR_NUM]; // erases per sector index
+} flash_dev_stat_t;
+
+typedef struct {
+    uint32_t wStart;                // tick the operation started
+    uint32_t wTicks;                // duration
+    uint32_t wAddr;
+    uint32_t wSize;
+    uint8_t  chDev;                 // flash_dev_id(), the position in FLASH_DEV_TABLE, then registered devices
+    uint8_t  chOp;                  // flash_op_t
+    uint8_t  chFailed;
+} flash_trace_t;
+
+/* One segment of a vectored write */
+typedef struct {
+    const void *pBase;
+    size_t wLen;
+} flash_iovec_t;
+
+/* Streaming write session, erases each sector just before the cursor enters it */
+typedef struct {
+    uint32_t wBase;                 // session start, sector aligned
+    uint32_t wLimit;                // end of the session range
+    uint32_t wCursor;               // next address to be written
+    volatile uint32_t wErased;      // erased high-water mark, [wBase, wErased) is erased
+    flash_req_t tErase;             // erase-ahead request
+#if FLASH_BLOB_USE_DIGEST == ENABLED
+    flash_digest_t tDigest;         // digest of the data appended so far
+#endif
+} flash_session_t;
+
+extern bool flash_dev_register(const flash_blob_t *ptFlashDevice);
+extern bool flash_dev_index_build(void);
+extern const flash_blob_t *flash_dev_find(uint32_t addr);
+extern int32_t flash_dev_id(uint32_t addr);
 extern bool target_flash_init(uint32_t addr);
 extern bool target_flash_uninit(uint32_t addr);
 extern int32_t target_flash_write(uint32_t addr, const uint8_t *buf, size_t size);
 extern int32_t target_flash_erase(uint32_t addr, size_t size);
+extern int32_t target_flash_erase_ex(uint32_t addr, size_t size, flash_range_t *ptErased);
+extern bool target_flash_sector_info(uint32_t addr, flash_sector_t *ptSector);
+extern bool target_flash_sector_at(uint32_t addr, uint32_t wIndex, flash_sector_t *ptSector);
+extern bool target_flash_bank_info(uint32_t addr, flash_bank_t *ptBank);
+extern uint32_t target_flash_erase_plan(uint32_t addr, size_t size, flash_erase_step_t *ptSteps, uint32_t wMax,
+                                        uint32_t *pwTime);
+extern int32_t target_flash_writev(uint32_t addr, const flash_iovec_t *ptVec, uint32_t wCount);
 extern int32_t target_flash_read(uint32_t addr, uint8_t *buf, size_t size);
+extern const uint8_t *target_flash_map(uint32_t addr, size_t size);
+extern uint32_t target_flash_checksum(uint32_t addr, size_t size);
+extern bool target_flash_digest(uint32_t addr, flash_digest_t *ptDigest, bool bReset);
+extern bool target_flash_verify_policy(uint32_t addr, flash_verify_t tPolicy);
+extern bool target_flash_sync(uint32_t addr);
+extern bool target_flash_erase_async(flash_req_t *ptReq, uint32_t addr, size_t size,
+                                     flash_req_cb_t *fnDone, void *pTarget);
+extern bool target_flash_erase_idle(flash_req_t *ptReq, uint32_t addr, size_t size,
+                                    flash_req_cb_t *fnDone, void *pTarget);
+extern bool target_flash_write_async(flash_req_t *ptReq, uint32_t addr, const uint8_t *buf, size_t size,
+                                     flash_req_cb_t *fnDone, void *pTarget);
+extern bool target_flash_poll(void);
+extern bool target_flash_poll_dev(uint32_t addr);
+extern bool target_flash_session_open(flash_session_t *ptSession, uint32_t addr, size_t size);
+extern int32_t target_flash_session_append(flash_session_t *ptSession, const uint8_t *buf, size_t size);
+extern bool target_flash_session_close(flash_session_t *ptSession);
+extern bool target_flash_stat(uint32_t addr, flash_dev_stat_t *ptStat, bool bReset);
+extern uint32_t target_flash_trace_read(flash_trace_t *ptTrace, uint32_t wMax, uint32_t *pwLost);
+extern void target_flash_irq_stat(flash_irq_stat_t *ptStat, bool bReset);
+extern int32_t target_flash_update(uint32_t addr, const uint8_t *buf, size_t size);
+extern bool target_flash_diff_stat(uint32_t addr, flash_diff_stat_t *ptStat, bool bReset);
+extern bool target_flash_cache_stat(uint32_t addr, flash_cache_stat_t *ptStat, bool bReset);
 #endif
@@ -0,0 +1,63 @@
+/****************************************************************************
+*  Copyright 2022 KK (https://github.com/WALI-KANG)                                    *
+*                                                                           *
+*  Licensed under the Apache License, Version 2.0 (the "License");          *
+*  you may not use this file except in compliance with the License.         *
+*  You may obtain a copy of the License at                                  *
+*                                                                           *
+*     http://www.apache.org/licenses/LICENSE-2.0                            *
+*                                                                           *
+*  Unless required by applicable law or agreed to in writing, software      *
+*  distributed under the License is distributed on an "AS IS" BASIS,        *
+*  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. *
+*  See the License for the specific language governing permissions and      *
+*  limitations under the License.                                           *
+*                                                                           *
+****************************************************************************/
+
+#ifndef FLASH_CRC_H
+#define FLASH_CRC_H
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#ifndef ENABLED
+    #define ENABLED    1
+#endif
+#ifndef DISABLED
+    #define DISABLED   0
+#endif
+
+/* CRC32 with eight 1kB tables (slice-by-8), otherwise one table, bytewise */
+#ifndef FLASH_CRC_USE_SLICE8
+    #define FLASH_CRC_USE_SLICE8        ENABLED
+#endif
+/* SHA-256 next to the CRC32 in every flash_digest_t */
+#ifndef FLASH_CRC_USE_SHA256
+    #define FLASH_CRC_USE_SHA256        DISABLED
+#endif
+
+typedef struct {
+    uint32_t wState[8];
+    uint64_t dwBytes;               // message length so far
+    uint8_t  chBlock[64];           // partial block
+} flash_sha256_t;
+
+/* Running digest of a byte stream */
+typedef struct {
+    uint32_t wCrc;                  // CRC32 of the bytes so far
+    uint32_t wSize;                 // number of bytes so far
+#if FLASH_CRC_USE_SHA256 == ENABLED
+    flash_sha256_t tSha;
+#endif
+} flash_digest_t;
+
+extern uint32_t flash_crc32(uint32_t wCrc, const void *pData, size_t wLen);
+extern void flash_digest_init(flash_digest_t *ptDigest);
+extern void flash_digest_update(flash_digest_t *ptDigest, const void *pData, size_t wLen);
+#if FLASH_CRC_USE_SHA256 == ENABLED
+extern void flash_sha256_init(flash_sha256_t *ptSha);
+extern void flash_sha256_update(flash_sha256_t *ptSha, const void *pData, size_t wLen);
+extern void flash_sha256_final(flash_sha256_t *ptSha, uint8_t chHash[32]);
+#endif
+#endif
@@ -0,0 +1,137 @@
+/****************************************************************************
+*  Copyright 2022 KK (https://github.com/WALI-KANG)                                    *
+*                                                                           *
+*  Licensed under the Apache License, Version 2.0 (the "License");          *
+*  you may not use this file except in compliance with the License.         *
+*  You may obtain a copy of the License at                                  *
+*                                                                           *
+*     http://www.apache.org/licenses/LICENSE-2.0                            *
+*                                                                           *
+*  Unless required by applicable law or agreed to in writing, software      *
+*  distributed under the License is distributed on an "AS IS" BASIS,        *
+*  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. *
+*  See the License for the specific language governing permissions and      *
+*  limitations under the License.                                           *
+*                                                                           *
+****************************************************************************/
+
+#ifndef FLASH_FLM_H
+#define FLASH_FLM_H
+#include "flash_blob.h"
+
+/*
+ * Running Keil FLM flash algorithms in place.
+ *
+ * An FLM is built position independent: PrgCode runs wherever it is copied
+ * and reaches PrgData through r9 (the static base). Each call therefore
+ * loads r9 with the address PrgData was copied to and restores it
+ * afterwards, so the application does not need -ffixed-r9.
+ *
+ * Drivers come from tools/flm2c.py at build time, or are loaded at runtime
+ * by flash_flm_load() from an FLM image in RAM or in a flash partition.
+ * The loader copies PrgCode/PrgData into an execution region given by the
+ * caller and registers the device with flash_dev_register(). It uses no
+ * heap: the caller owns the flash_flm_t and the region, and the flash_ops_t
+ * of a loaded device are the trampolines of one of FLASH_FLM_SLOT_NUM
+ * static slots, since the FLM style operations carry no context pointer.
+ * Both the slot and the registration are kept until reset.
+ */
+
+/* Loaded algorithms at the same time, each takes a slot of trampolines (at most 4) */
+#ifndef FLASH_FLM_SLOT_NUM
+    #define FLASH_FLM_SLOT_NUM      1
+#endif
+/* Makes copied code executable, e.g. cleans the D-cache and invalidates the I-cache of the region */
+#ifndef FLASH_FLM_CODE_SYNC
+    #if defined(__arm__)
+        #define FLASH_FLM_CODE_SYNC(__ADDR, __SIZE)     __asm volatile ("dsb\n isb" ::: "memory")
+    #else
+        #define FLASH_FLM_CODE_SYNC(__ADDR, __SIZE)
+    #endif
+#endif
+
+/* Where the generated PrgCode/PrgData arrays go, they must be executable RAM for on-chip flash */
+#ifndef FLASH_FLM_CODE_SECTION
+    #define FLASH_FLM_CODE_SECTION
+#endif
+
+/*
+ * Function: flash_flm_call
+ * Description: Calls an entry point of a flash algorithm.
+ * Parameters:
+ *   - wEntry: Address of the function, Thumb bit set.
+ *   - pStaticBase: Where PrgData of the algorithm lives.
+ *   - wArg0, wArg1, wArg2: Arguments, unused ones are ignored. Pointers are
+ *     passed as uintptr_t, the same as uint32_t on the target.
+ * Returns: The return value of the function, 0 - OK.
+ */
+#if defined(__arm__) && !defined(FLASH_FLM_CALL)
+static inline int32_t flash_flm_call(uintptr_t wEntry, void *pStaticBase, uintptr_t wArg0, uintptr_t wArg1,
+                                     uintptr_t wArg2)
+{
+    register uint32_t r0 __asm("r0") = wArg0;
+    register uint32_t r1 __asm("r1") = wArg1;
+    register uint32_t r2 __asm("r2") = wArg2;
+    register uint32_t r3 __asm("r3") = (uint32_t)pStaticBase;
+    register uint32_t r12 __asm("r12") = wEntry;
+
+    __asm volatile (
+        "push {r9, lr}      \n"
+        "mov  r9, r3        \n"
+        "blx  r12           \n"
+        "pop  {r9, lr}      \n"
+        : "+r"(r0), "+r"(r1), "+r"(r2), "+r"(r3), "+r"(r12)
+        :
+        : "lr", "memory", "cc");
+
+    return (int32_t)r0;
+}
+#elif !defined(FLASH_FLM_CALL)
+/* other hosts cannot run Thumb code, every call fails */
+static inline int32_t flash_flm_call(uintptr_t wEntry, void *pStaticBase, uintptr_t wArg0, uintptr_t wArg1,
+                                     uintptr_t wArg2)
+{
+    (void)wEntry; (void)pStaticBase; (void)wArg0; (void)wArg1; (void)wArg2;
+    return 1;
+}
+#else
+    #define flash_flm_call(__ENTRY, __SB, __A0, __A1, __A2)     FLASH_FLM_CALL(__ENTRY, __SB, __A0, __A1, __A2)
+#endif
+
+/* Entry points of an algorithm, index of flash_flm_t::wEntry[] */
+typedef enum {
+    FLASH_FLM_INIT = 0,
+    FLASH_FLM_UNINIT,
+    FLASH_FLM_ERASE_CHIP,           // optional
+    FLASH_FLM_ERASE_SECTOR,
+    FLASH_FLM_PROGRAM_PAGE,
+    FLASH_FLM_ENTRY_NUM,
+} flash_flm_entry_t;
+
+/* Result of flash_flm_load() */
+typedef enum {
+    FLASH_FLM_OK = 0,
+    FLASH_FLM_ERR_READ,             // the image is truncated or cannot be read
+    FLASH_FLM_ERR_ELF,              // not a 32-bit little endian ARM ELF file
+    FLASH_FLM_ERR_SECTION,          // PrgCode/PrgData/DevDscr missing, PrgCode not at 0 or PrgData not after it
+    FLASH_FLM_ERR_SYMBOL,           // an entry point is missing or not Thumb code in PrgCode
+    FLASH_FLM_ERR_DEVDSCR,          // the FlashDevice description is inconsistent
+    FLASH_FLM_ERR_EXEC,             // the execution region is too small or not word aligned
+    FLASH_FLM_ERR_SLOT,             // all slots are taken, or ptFlm is loaded already
+    FLASH_FLM_ERR_REGISTER,         // flash_dev_register() refused the device
+} flash_flm_err_t;
+
+/* A loaded algorithm, owned by the caller and kept as long as the device is used */
+typedef struct {
+    flash_blob_t tBlob;             // the registered device, its ops run the algorithm
+    flash_dev_t tDev;               // DevDscr of the image, DevName cut to 31 characters
+    uintptr_t wEntry[FLASH_FLM_ENTRY_NUM];  // in the execution region, Thumb bit set, 0 if absent
+    void *pStaticBase;              // PrgData in the execution region, loaded into r9
+    size_t wExecUsed;               // bytes of the execution region taken by PrgCode and PrgData
+} flash_flm_t;
+
+extern flash_flm_err_t flash_flm_load(flash_flm_t *ptFlm, const void *pImage, size_t wSize, void *pExec,
+                                      size_t wExecSize);
+extern flash_flm_err_t flash_flm_load_from(flash_flm_t *ptFlm, uint32_t addr, size_t wSize, void *pExec,
+                                           size_t wExecSize);
+#endif
@@ -0,0 +1,71 @@
+/****************************************************************************
+*  Copyright 2022 KK (https://github.com/WALI-KANG)                                    *
+*                                                                           *
+*  Licensed under the Apache License, Version 2.0 (the "License");          *
+*  you may not use this file except in compliance with the License.         *
+*  You may obtain a copy of the License at                                  *
+*                                                                           *
+*     http://www.apache.org/licenses/LICENSE-2.0                            *
+*                                                                           *
+*  Unless required by applicable law or agreed to in writing, software      *
+*  distributed under the License is distributed on an "AS IS" BASIS,        *
+*  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. *
+*  See the License for the specific language governing permissions and      *
+*  limitations under the License.                                           *
+*                                                                           *
+****************************************************************************/
+
+#ifndef FLASH_KV_H
+#define FLASH_KV_H
+#include "flash_blob.h"
+
+/*
+ * Log-structured key-value store on top of target_flash_*.
+ *
+ * The store occupies two or more equally sized sectors used as a ring of
+ * segments. Every set or delete appends one record to the active segment;
+ * a RAM hash index built by one scan at mount points at the latest record
+ * of every key. When the ring runs out of erased segments, the live records
+ * of the oldest segment are copied into the last erased one and the oldest
+ * segment is erased.
+ */
+
+/* Slots of the RAM index, power of two, keep the load below ~75% */
+#ifndef FLASH_KV_INDEX_NUM
+    #define FLASH_KV_INDEX_NUM      128
+#endif
+/* Longest key in bytes */
+#ifndef FLASH_KV_KEY_MAX
+    #define FLASH_KV_KEY_MAX        32
+#endif
+/* Longest value in bytes */
+#ifndef FLASH_KV_VALUE_MAX
+    #define FLASH_KV_VALUE_MAX      256
+#endif
+
+typedef struct {
+    uint32_t wHash;                 // FNV-1a of the key
+    uint32_t wAddr;                 // latest record of the key, FLASH_KV_ADDR_NONE if free
+} flash_kv_slot_t;
+
+typedef struct {
+    uint32_t wBase;                 // start of the store, sector aligned
+    uint32_t wSegSize;              // sector size
+    uint32_t wUnit;                 // record alignment, the write granularity
+    uint8_t  chEmpty;               // valEmpty of the device
+    uint16_t hwSegNum;              // number of segments
+    uint16_t hwHead;                // segment records are appended to
+    uint16_t hwTail;                // oldest segment in use
+    uint16_t hwKeys;                // occupied index slots
+    uint32_t wSeq;                  // sequence number of the head segment
+    uint32_t wWrite;                // next record address in the head segment
+    uint32_t wGcRuns;               // segments compacted since mount
+    uint32_t wErases;               // sectors erased since mount
+    flash_kv_slot_t tIndex[FLASH_KV_INDEX_NUM];
+} flash_kv_t;
+
+extern bool flash_kv_mount(flash_kv_t *ptKv, uint32_t addr, size_t size);
+extern int32_t flash_kv_get(flash_kv_t *ptKv, const char *pchKey, void *pBuf, size_t wSize);
+extern bool flash_kv_set(flash_kv_t *ptKv, const char *pchKey, const void *pValue, size_t wSize);
+extern bool flash_kv_delete(flash_kv_t *ptKv, const char *pchKey);
+#endif
@@ -0,0 +1,96 @@
+/****************************************************************************
+*  Copyright 2022 KK (https://github.com/WALI-KANG)                                    *
+*                                                                           *
+*  Licensed under the Apache License, Version 2.0 (the "License");          *
+*  you may not use this file except in compliance with the License.         *
+*  You may obtain a copy of the License at                                  *
+*                                                                           *
+*     http://www.apache.org/licenses/LICENSE-2.0                            *
+*                                                                           *
+*  Unless required by applicable law or agreed to in writing, software      *
+*  distributed under the License is distributed on an "AS IS" BASIS,        *
+*  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. *
+*  See the License for the specific language governing permissions and      *
+*  limitations under the License.                                           *
+*                                                                           *
+****************************************************************************/
+
+#ifndef FLASH_LOCK_H
+#define FLASH_LOCK_H
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Read/write locks of flash_blob.c on top of an RTOS.
+ *
+ * FLASH_BLOB_OS selects the port in port/OS. A port provides a mutex,
+ * flash_os_mutex_t and flash_os_mutex_init/lock/unlock(), with priority
+ * inheritance where the OS offers it, and a binary semaphore,
+ * flash_os_sem_t and flash_os_sem_init/take/give(). Everything else is
+ * built on them in src/flash_lock.c, so all ports share the same lock
+ * semantics. A writer holds a mutex for as long as it holds the lock, so a
+ * low priority task erasing a device is boosted while a higher priority one
+ * waits for it. Only a writer waiting for readers to leave waits on the
+ * semaphore.
+ *
+ * With FLASH_OS_NONE nothing is compiled in and flash_blob.c keeps its
+ * FLASH_BLOB_DEV_LOCK() / FLASH_BLOB_LOCK() hooks.
+ */
+#define FLASH_OS_NONE       0
+#define FLASH_OS_RTTHREAD   1
+#define FLASH_OS_FREERTOS   2
+#define FLASH_OS_POSIX      3
+
+#ifndef FLASH_BLOB_OS
+    #define FLASH_BLOB_OS   FLASH_OS_NONE
+#endif
+
+#if FLASH_BLOB_OS == FLASH_OS_RTTHREAD
+    #include <rtthread.h>
+    typedef struct rt_mutex flash_os_mutex_t;
+    typedef struct rt_semaphore flash_os_sem_t;
+#elif FLASH_BLOB_OS == FLASH_OS_FREERTOS
+    #include "FreeRTOS.h"
+    #include "semphr.h"
+    typedef struct {
+        StaticSemaphore_t tBuffer;
+        SemaphoreHandle_t hSem;
+    } flash_os_sem_t;
+    typedef flash_os_sem_t flash_os_mutex_t;
+#elif FLASH_BLOB_OS == FLASH_OS_POSIX
+    #include <pthread.h>
+    #include <semaphore.h>
+    typedef pthread_mutex_t flash_os_mutex_t;
+    typedef sem_t flash_os_sem_t;
+#endif
+
+#if FLASH_BLOB_OS != FLASH_OS_NONE
+/*
+ * Writer preferring read/write lock: any number of readers, or a single
+ * writer. A waiting writer holds the gate, so readers arriving after it
+ * queue up behind it instead of starving it.
+ */
+typedef struct {
+    flash_os_mutex_t tGate;         // passed by readers, held by a writer
+    flash_os_mutex_t tCount;        // guards hwReaders and bDrain
+    flash_os_sem_t tDrained;        // given by the last reader to a waiting writer
+    uint16_t hwReaders;             // readers holding the lock
+    bool bDrain;                    // a writer waits for hwReaders to drop to 0
+    bool bReady;                    // mutexes and semaphore are initialised
+} flash_rwlock_t;
+
+/* port/OS/flash_os_<os>.c */
+extern bool flash_os_mutex_init(flash_os_mutex_t *ptMutex);
+extern void flash_os_mutex_lock(flash_os_mutex_t *ptMutex);
+extern void flash_os_mutex_unlock(flash_os_mutex_t *ptMutex);
+extern bool flash_os_sem_init(flash_os_sem_t *ptSem, uint32_t wValue);
+extern void flash_os_sem_take(flash_os_sem_t *ptSem);
+extern void flash_os_sem_give(flash_os_sem_t *ptSem);
+
+extern bool flash_rwlock_init(flash_rwlock_t *ptLock);
+extern void flash_rwlock_read(flash_rwlock_t *ptLock);
+extern void flash_rwlock_read_release(flash_rwlock_t *ptLock);
+extern void flash_rwlock_write(flash_rwlock_t *ptLock);
+extern void flash_rwlock_write_release(flash_rwlock_t *ptLock);
+#endif
+#endif
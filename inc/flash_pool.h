@@ -0,0 +1,88 @@
+/****************************************************************************
+*  Copyright 2022 KK (https://github.com/WALI-KANG)                                    *
+*                                                                           *
+*  Licensed under the Apache License, Version 2.0 (the "License");          *
+*  you may not use this file except in compliance with the License.         *
+*  You may obtain a copy of the License at                                  *
+*                                                                           *
+*     http://www.apache.org/licenses/LICENSE-2.0                            *
+*                                                                           *
+*  Unless required by applicable law or agreed to in writing, software      *
+*  distributed under the License is distributed on an "AS IS" BASIS,        *
+*  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. *
+*  See the License for the specific language governing permissions and      *
+*  limitations under the License.                                           *
+*                                                                           *
+****************************************************************************/
+
+#ifndef FLASH_POOL_H
+#define FLASH_POOL_H
+#include "flash_blob.h"
+
+/*
+ * Pre-erased sectors for log and recording regions.
+ *
+ * The sectors of a region are handed to the writer in ring order by
+ * flash_pool_take() and given back by flash_pool_release() once their data
+ * is no longer needed. flash_pool_idle(), called from an idle hook or a low
+ * priority task, erases the sectors next in line in the background until
+ * the target number is ready, so a writer only waits for an erase when the
+ * pool ran dry. The background erases are target_flash_erase_idle()
+ * requests: any foreground operation on the device cancels them.
+ *
+ * flash_pool_idle() and the writer's calls decide which sector is erased
+ * by whom, so they must not run at the same time: call them from the same
+ * task, or map FLASH_POOL_LOCK()/FLASH_POOL_UNLOCK() to a mutex when the
+ * idle hook and the writer are different tasks.
+ */
+
+/* Sectors of one pool */
+#ifndef FLASH_POOL_SECTOR_MAX
+    #define FLASH_POOL_SECTOR_MAX       256
+#endif
+#ifndef FLASH_POOL_LOCK
+    #define FLASH_POOL_LOCK(__POOL)
+    #define FLASH_POOL_UNLOCK(__POOL)
+#endif
+
+typedef enum {
+    FLASH_POOL_UNKNOWN = 0,         // not looked at since init, may be blank
+    FLASH_POOL_DIRTY,               // released, holds old data
+    FLASH_POOL_ERASING,             // background erase queued
+    FLASH_POOL_READY,               // erased, not handed out yet
+    FLASH_POOL_OWNED,               // handed to the writer, or claimed at init
+} flash_pool_state_t;
+
+typedef struct {
+    uint32_t wTaken;                // sectors handed out
+    uint32_t wMisses;               // handed out before they were erased, the writer waited
+    uint32_t wErased;               // background erases completed
+    uint32_t wBlank;                // sectors found blank, no erase needed
+    uint32_t wCancelled;            // background erases cancelled by foreground work
+    uint16_t hwDepth;               // erased sectors ready in line now
+    uint16_t hwMinDepth;            // lowest depth seen by flash_pool_take()
+} flash_pool_stat_t;
+
+typedef struct {
+    uint32_t wAddr;                 // region start, sector aligned
+    uint32_t wSize;                 // region size, whole sectors
+    uint16_t hwSectors;
+    uint16_t hwTarget;              // erased sectors to keep ready
+    uint16_t hwNext;                // sector flash_pool_take() hands out next
+    uint16_t hwErasing;             // sector of tReq
+    uint16_t hwChecking;            // sector being blank checked
+    uint32_t wChecked;              // bytes of it found blank so far
+    uint32_t wFirst;                // device sector index of the first sector
+    uint8_t  chState[FLASH_POOL_SECTOR_MAX];    // flash_pool_state_t
+    flash_req_t tReq;               // background erase
+    volatile bool bBusy;            // tReq queued, until flash_pool_erased() returned
+    flash_pool_stat_t tStat;
+} flash_pool_t;
+
+extern bool flash_pool_init(flash_pool_t *ptPool, uint32_t addr, size_t size, uint16_t hwTarget);
+extern bool flash_pool_claim(flash_pool_t *ptPool, uint32_t addr);
+extern bool flash_pool_take(flash_pool_t *ptPool, flash_sector_t *ptSector);
+extern bool flash_pool_release(flash_pool_t *ptPool, uint32_t addr);
+extern bool flash_pool_idle(flash_pool_t *ptPool);
+extern void flash_pool_stat(flash_pool_t *ptPool, flash_pool_stat_t *ptStat, bool bReset);
+#endif
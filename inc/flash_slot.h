@@ -0,0 +1,96 @@
+/****************************************************************************
+*  Copyright 2022 KK (https://github.com/WALI-KANG)                                    *
+*                                                                           *
+*  Licensed under the Apache License, Version 2.0 (the "License");          *
+*  you may not use this file except in compliance with the License.         *
+*  You may obtain a copy of the License at                                  *
+*                                                                           *
+*     http://www.apache.org/licenses/LICENSE-2.0                            *
+*                                                                           *
+*  Unless required by applicable law or agreed to in writing, software      *
+*  distributed under the License is distributed on an "AS IS" BASIS,        *
+*  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. *
+*  See the License for the specific language governing permissions and      *
+*  limitations under the License.                                           *
+*                                                                           *
+****************************************************************************/
+
+#ifndef FLASH_SLOT_H
+#define FLASH_SLOT_H
+#include "flash_blob.h"
+
+/*
+ * A/B firmware slots on top of target_flash_*.
+ *
+ * Two slots each hold a complete image and the boot loader starts the
+ * active one where it is, so an update is written once and never copied.
+ * Which slot is active, whether it is still on trial and the size and
+ * CRC32 of each image live in a status log: two sectors of fixed size
+ * records, each appended with one program. Activating, confirming and
+ * rolling back append one record. When a log sector is full, the state is
+ * restated in the other sector and the full one is erased.
+ *
+ * Dual-bank parts that boot the bank selected by an option bit set
+ * flash_slot_cfg_t::SwapBanks, the log then only remembers the choice.
+ */
+
+/* Boots of a slot on trial before flash_slot_boot() rolls back to the other one */
+#ifndef FLASH_SLOT_TRIAL_BOOTS
+    #define FLASH_SLOT_TRIAL_BOOTS      3
+#endif
+/* flash_slot_boot() checks the CRC32 of the image it returns */
+#ifndef FLASH_SLOT_BOOT_VERIFY
+    #define FLASH_SLOT_BOOT_VERIFY      ENABLED
+#endif
+
+#define FLASH_SLOT_NUM      2
+#define FLASH_SLOT_NONE     0xFF
+#define FLASH_SLOT_ADDR_NONE    0xFFFFFFFFu
+
+/* One slot, sector aligned */
+typedef struct {
+    uint32_t wAddr;
+    uint32_t wSize;
+} flash_slot_desc_t;
+
+typedef struct {
+    flash_slot_desc_t tSlot[FLASH_SLOT_NUM];
+    uint32_t wLogAddr;              // status log: two sectors of equal size, outside the slots
+    /* dual-bank parts only, NULL otherwise */
+    bool (*SwapBanks)(uint8_t chSlot);  // boot chSlot from the next reset on
+    uint8_t (*MappedSlot)(void);    // slot mapped at tSlot[0].wAddr right now, NULL for slot 0
+} flash_slot_cfg_t;
+
+/* What a slot holds */
+typedef struct {
+    uint32_t wSize;                 // image size, 0 if the slot holds no complete image
+    uint32_t wCrc;                  // CRC32 of the image
+} flash_slot_image_t;
+
+typedef struct {
+    const flash_slot_cfg_t *ptCfg;
+    flash_slot_image_t tImage[FLASH_SLOT_NUM];
+    uint8_t  chActive;              // slot to boot, FLASH_SLOT_NONE before the first activation
+    uint8_t  chUpdate;              // slot an update is written to, FLASH_SLOT_NONE if none is open
+    bool     bTrial;                // chActive is not confirmed yet
+    uint8_t  chBoots;               // boots of chActive while on trial
+    uint8_t  chEmpty;               // valEmpty of the log device
+    uint8_t  chLog;                 // log sector appended to
+    uint32_t wSector;               // log sector size
+    uint32_t wRecSize;              // record size, the write granularity at least
+    uint32_t wWrite;                // next record address
+    uint32_t wSeq;                  // sequence number of the next record
+    uint32_t wLogBytes;             // status bytes programmed since mount
+    uint32_t wLogErases;            // log sectors erased since mount
+} flash_slot_t;
+
+extern bool flash_slot_mount(flash_slot_t *ptSlot, const flash_slot_cfg_t *ptCfg);
+extern uint8_t flash_slot_boot(flash_slot_t *ptSlot);
+extern uint32_t flash_slot_addr(const flash_slot_t *ptSlot, uint8_t chSlot);
+extern uint32_t flash_slot_update_begin(flash_slot_t *ptSlot);
+extern bool flash_slot_update_end(flash_slot_t *ptSlot, size_t wSize, const uint32_t *pwCrc);
+extern bool flash_slot_validate(flash_slot_t *ptSlot, uint8_t chSlot);
+extern bool flash_slot_activate(flash_slot_t *ptSlot, uint8_t chSlot);
+extern bool flash_slot_confirm(flash_slot_t *ptSlot);
+extern bool flash_slot_rollback(flash_slot_t *ptSlot);
+#endif
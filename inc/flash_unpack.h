@@ -0,0 +1,58 @@
+/****************************************************************************
+*  Copyright 2022 KK (https://github.com/WALI-KANG)                                    *
+*                                                                           *
+*  Licensed under the Apache License, Version 2.0 (the "License");          *
+*  you may not use this file except in compliance with the License.         *
+*  You may obtain a copy of the License at                                  *
+*                                                                           *
+*     http://www.apache.org/licenses/LICENSE-2.0                            *
+*                                                                           *
+*  Unless required by applicable law or agreed to in writing, software      *
+*  distributed under the License is distributed on an "AS IS" BASIS,        *
+*  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. *
+*  See the License for the specific language governing permissions and      *
+*  limitations under the License.                                           *
+*                                                                           *
+****************************************************************************/
+
+#ifndef FLASH_UNPACK_H
+#define FLASH_UNPACK_H
+#include "flash_blob.h"
+
+/*
+ * Decompressing write stage in front of a write session.
+ *
+ * The input is a heatshrink (LZSS) stream as produced by
+ * "heatshrink -e -w FLASH_UNPACK_WINDOW_BITS -l FLASH_UNPACK_LOOKAHEAD_BITS".
+ * It may be fed in pieces of any size, e.g. as YMODEM packets arrive.
+ * Decoded bytes go to a ring of 2^FLASH_UNPACK_WINDOW_BITS bytes, which is
+ * the back-reference window. Finished runs of the ring are appended to the
+ * session, so the page buffer programs whole pages.
+ */
+
+/* log2 of the window, must match the -w of the encoder */
+#ifndef FLASH_UNPACK_WINDOW_BITS
+    #define FLASH_UNPACK_WINDOW_BITS        10
+#endif
+/* log2 of the longest back-reference, must match the -l of the encoder */
+#ifndef FLASH_UNPACK_LOOKAHEAD_BITS
+    #define FLASH_UNPACK_LOOKAHEAD_BITS     4
+#endif
+
+typedef struct {
+    flash_session_t tSession;       // decoded data is appended here
+    uint32_t wBits;                 // input bits not consumed yet, MSB first
+    uint8_t  chBitNum;              // number of valid bits in wBits
+    uint8_t  chState;               // decoder state
+    uint16_t hwIndex;               // back-reference distance - 1
+    uint16_t hwCount;               // bytes of the back-reference left to copy
+    uint16_t hwHead;                // next ring position to be written
+    uint16_t hwPending;             // bytes before hwHead not yet appended to the session
+    uint32_t wOut;                  // decoded bytes so far
+    uint8_t  chWindow[1u << FLASH_UNPACK_WINDOW_BITS];
+} flash_unpack_t;
+
+extern bool flash_unpack_open(flash_unpack_t *ptUnpack, uint32_t addr, size_t size);
+extern int32_t flash_unpack_feed(flash_unpack_t *ptUnpack, const uint8_t *buf, size_t size);
+extern bool flash_unpack_close(flash_unpack_t *ptUnpack);
+#endif
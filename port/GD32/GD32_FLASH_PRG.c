@@ -61,11 +61,8 @@ static int32_t ProgramPage(uint32_t addr, uint32_t sz, uint8_t* buf)
     int32_t result = 0;
     uint32_t end_addr   = addr + sz;
     while (addr < end_addr) {
+        /* readback is done by flash_blob, see target_flash_verify_policy() */
         if (fmc_word_program(addr, *((uint32_t *)buf)) == FMC_READY) {
-            if (*(uint32_t *)addr != *(uint32_t *)buf) {
-                result = 1;
-                break;
-            }
             addr += 4;
             buf  += 4;
         } else {
@@ -81,7 +78,7 @@ static flash_blob_t  flash_device = {
     .tFlashops.UnInit = UnInit,  
     .tFlashops.EraseChip = EraseChip,  
     .tFlashops.EraseSector = EraseSector,  
-    .tFlashops.ProgramPage = ProgramPage,  
+    .tFlashops.Program = ProgramPage,  
     .tFlashops.Read = NULL,
     .ptFlashDev = &FlashDevice,
 };
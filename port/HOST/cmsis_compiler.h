@@ -0,0 +1,32 @@
+/*
+ * Host stand-in for the CMSIS core intrinsics used by safe_atom_code().
+ * PRIMASK is simulated with a plain variable so the critical sections of
+ * flash_blob.c can be observed on the host. Every thread has its own, like
+ * every core has its own PRIMASK.
+ */
+#ifndef HOST_CMSIS_COMPILER_H
+#define HOST_CMSIS_COMPILER_H
+#include <stdint.h>
+
+extern __thread volatile uint32_t g_wHostPrimask;
+
+static inline uint32_t __get_PRIMASK(void)
+{
+    return g_wHostPrimask;
+}
+
+static inline void __set_PRIMASK(uint32_t wPriMask)
+{
+    g_wHostPrimask = wPriMask;
+}
+
+static inline void __disable_irq(void)
+{
+    g_wHostPrimask = 1;
+}
+
+static inline void __enable_irq(void)
+{
+    g_wHostPrimask = 0;
+}
+#endif
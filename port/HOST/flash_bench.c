@@ -0,0 +1,2946 @@
+/****************************************************************************
+*  Copyright 2022 KK (https://github.com/WALI-KANG)                                    *
+*                                                                           *
+*  Licensed under the Apache License, Version 2.0 (the "License");          *
+*  you may not use this file except in compliance with the License.         *
+*  You may obtain a copy of the License at                                  *
+*                                                                           *
+*     http://www.apache.org/licenses/LICENSE-2.0                            *
+*                                                                           *
+*  Unless required by applicable law or agreed to in writing, software      *
+*  distributed under the License is distributed on an "AS IS" BASIS,        *
+*  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. *
+*  See the License for the specific language governing permissions and      *
+*  limitations under the License.                                           *
+*                                                                           *
+****************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "flash_blob.h"
+#include "flash_lock.h"
+#include "flash_blob_cfg.h"
+#include "flash_kv.h"
+#include "flash_unpack.h"
+#include "flash_flm.h"
+#include "flash_slot.h"
+#include "flash_pool.h"
+
+/*
+ * Throughput benchmark of the flash_blob abstraction layer on top of the
+ * host simulation. "wall" figures are the host CPU time spent in the
+ * abstraction layer plus the simulator, "flash" figures are the modelled
+ * device time derived from toProg/toErase.
+ */
+
+typedef struct {
+    const char         *pchName;
+    const flash_blob_t *ptBlob;
+    host_flash_sim_t   *ptSim;
+} bench_dev_t;
+
+typedef struct {
+    const char *pchName;
+    const char *pchHelp;
+    int (*fnRun)(void);
+} bench_suite_t;
+
+static const bench_dev_t c_tBenchDevs[] = {
+    {"uniform", &host_uniform_flash_device, &host_uniform_flash_device_sim},
+    {"mixed",   &host_mixed_flash_device,   &host_mixed_flash_device_sim},
+    {"spinor",  &host_spinor_flash_device,  &host_spinor_flash_device_sim},
+};
+
+#define BENCH_DEV_NUM       (sizeof(c_tBenchDevs) / sizeof(c_tBenchDevs[0]))
+#define BENCH_REGION_SIZE   (256 * 1024)
+
+static uint8_t s_chPattern[BENCH_REGION_SIZE];
+static uint8_t s_chReadBack[BENCH_REGION_SIZE];
+static int s_iRounds = 3;
+static const char *s_pchTraceFile = NULL;
+
+static void bench_report(const char *pchDev, const char *pchOp, size_t wChunk,
+                         uint64_t wCalls, uint64_t wBytes, uint64_t wWallNs, uint64_t wFlashNs)
+{
+    double fWallMBs  = wWallNs  ? (double)wBytes * 1000.0 / (double)wWallNs  : 0.0;
+    double fFlashMBs = wFlashNs ? (double)wBytes * 1000.0 / (double)wFlashNs : 0.0;
+
+    printf("%-8s %-6s %7zu %8llu %12.1f %10.1f %12.3f %10.1f\n",
+           pchDev, pchOp, wChunk, (unsigned long long)wCalls,
+           fWallMBs, wCalls ? (double)wWallNs / (double)wCalls : 0.0,
+           fFlashMBs, wCalls ? (double)wFlashNs / (double)wCalls / 1000.0 : 0.0);
+}
+
+static int bench_throughput(void)
+{
+    static const size_t c_wChunks[] = {128, 256, 1024, 4096, 16384};
+    int iFailed = 0;
+
+    printf("%-8s %-6s %7s %8s %12s %10s %12s %10s\n",
+           "device", "op", "chunk", "calls", "wall MB/s", "ns/call", "flash MB/s", "us/call");
+
+    for (size_t d = 0; d < BENCH_DEV_NUM; d++) {
+        bench_dev_t const *ptDev = &c_tBenchDevs[d];
+        uint32_t wBase = ptDev->ptBlob->ptFlashDev->DevAdr;
+
+        target_flash_init(wBase);
+
+        for (size_t c = 0; c < sizeof(c_wChunks) / sizeof(c_wChunks[0]); c++) {
+            size_t wChunk = c_wChunks[c];
+            uint64_t wCalls = 0, wWall = 0, wFlash = 0, wBytes = 0;
+
+            /* erase */
+            for (int r = 0; r < s_iRounds; r++) {
+                uint64_t wBusy = ptDev->ptSim->tStat.wBusyNs;
+                uint64_t wStart = host_flash_sim_now_ns();
+                int32_t nErased = target_flash_erase(wBase, BENCH_REGION_SIZE);
+                wWall += host_flash_sim_now_ns() - wStart;
+                wFlash += ptDev->ptSim->tStat.wBusyNs - wBusy;
+                wBytes += BENCH_REGION_SIZE;
+                wCalls++;
+                if (nErased < BENCH_REGION_SIZE) {
+                    iFailed++;
+                }
+
+                /* write, the last round is kept for the read pass */
+                wBusy = ptDev->ptSim->tStat.wBusyNs;
+                wStart = host_flash_sim_now_ns();
+                for (size_t o = 0; o < BENCH_REGION_SIZE; o += wChunk) {
+                    if (target_flash_write(wBase + o, &s_chPattern[o], wChunk) != (int32_t)wChunk) {
+                        iFailed++;
+                    }
+                }
+                uint64_t wWriteWall = host_flash_sim_now_ns() - wStart;
+                uint64_t wWriteFlash = ptDev->ptSim->tStat.wBusyNs - wBusy;
+                if (r == s_iRounds - 1) {
+                    if (c == 0) {
+                        bench_report(ptDev->pchName, "erase", BENCH_REGION_SIZE, wCalls, wBytes, wWall, wFlash);
+                    }
+                    bench_report(ptDev->pchName, "write", wChunk, BENCH_REGION_SIZE / wChunk,
+                                 BENCH_REGION_SIZE, wWriteWall, wWriteFlash);
+                }
+            }
+
+            /* read */
+            wCalls = 0;
+            wBytes = 0;
+            uint64_t wBusy = ptDev->ptSim->tStat.wBusyNs;
+            uint64_t wStart = host_flash_sim_now_ns();
+            for (int r = 0; r < s_iRounds; r++) {
+                for (size_t o = 0; o < BENCH_REGION_SIZE; o += wChunk) {
+                    if (target_flash_read(wBase + o, &s_chReadBack[o], wChunk) != (int32_t)wChunk) {
+                        iFailed++;
+                    }
+                    wCalls++;
+                    wBytes += wChunk;
+                }
+            }
+            bench_report(ptDev->pchName, "read", wChunk, wCalls, wBytes,
+                         host_flash_sim_now_ns() - wStart, ptDev->ptSim->tStat.wBusyNs - wBusy);
+
+            if (memcmp(s_chPattern, s_chReadBack, BENCH_REGION_SIZE) != 0) {
+                printf("%-8s readback mismatch with %zu byte chunks\n", ptDev->pchName, wChunk);
+                iFailed++;
+            }
+        }
+
+        target_flash_uninit(wBase);
+    }
+
+    return iFailed;
+}
+
+/* the scan flash_dev_find() used before the sorted range index */
+static const flash_blob_t *const c_ptBenchTable[] = FLASH_DEV_TABLE;
+
+static const flash_blob_t *bench_linear_find(uint32_t addr, size_t wNum)
+{
+    for (uint16_t i = 0; i < wNum; i++) {
+        if(addr >= c_ptBenchTable[i]->ptFlashDev->DevAdr &&
+           addr < c_ptBenchTable[i]->ptFlashDev->DevAdr + c_ptBenchTable[i]->ptFlashDev->szDev) {
+            return c_ptBenchTable[i];
+        }
+    }
+    return NULL;
+}
+
+static int bench_lookup(void)
+{
+    enum { LOOKUPS = 4096 };
+    static uint32_t s_wAddrs[LOOKUPS];
+    static const flash_blob_t *volatile s_ptSink;
+    (void)s_ptSink;
+    size_t wTableLen = sizeof(c_ptBenchTable) / sizeof(c_ptBenchTable[0]);
+    int iFailed = 0;
+
+    if (!flash_dev_index_build()) {
+        printf("device table has overlapping ranges\n");
+        iFailed++;
+    }
+
+    printf("%7s %16s %16s %16s %16s\n", "devices", "linear rnd ns", "index rnd ns",
+           "linear seq ns", "index seq ns");
+
+    for (size_t wNum = 1; wNum <= wTableLen; wNum = (wNum * 2 > wTableLen && wNum != wTableLen) ? wTableLen : wNum * 2) {
+        uint64_t wTime[4] = {0};
+
+        for (int p = 0; p < 2; p++) {
+            /* p == 0: random devices, p == 1: runs on the same device */
+            for (size_t i = 0; i < LOOKUPS; i++) {
+                size_t wDev = (p == 0) ? (size_t)rand() % wNum : (i / 64) % wNum;
+                flash_dev_t const *ptDev = c_ptBenchTable[wDev]->ptFlashDev;
+                s_wAddrs[i] = ptDev->DevAdr + (uint32_t)rand() % ptDev->szDev;
+            }
+
+            for (int r = 0; r < s_iRounds; r++) {
+                uint64_t wStart = host_flash_sim_now_ns();
+                for (size_t i = 0; i < LOOKUPS; i++) {
+                    s_ptSink = bench_linear_find(s_wAddrs[i], wNum);
+                }
+                wTime[p * 2] += host_flash_sim_now_ns() - wStart;
+
+                wStart = host_flash_sim_now_ns();
+                for (size_t i = 0; i < LOOKUPS; i++) {
+                    s_ptSink = flash_dev_find(s_wAddrs[i]);
+                }
+                wTime[p * 2 + 1] += host_flash_sim_now_ns() - wStart;
+            }
+
+            for (size_t i = 0; i < LOOKUPS; i++) {
+                if (flash_dev_find(s_wAddrs[i]) != bench_linear_find(s_wAddrs[i], wTableLen)) {
+                    iFailed++;
+                }
+            }
+        }
+
+        double fDiv = (double)LOOKUPS * s_iRounds;
+        printf("%7zu %16.1f %16.1f %16.1f %16.1f\n", wNum, wTime[0] / fDiv, wTime[1] / fDiv,
+               wTime[2] / fDiv, wTime[3] / fDiv);
+        if (wNum == wTableLen) {
+            break;
+        }
+    }
+
+    if (flash_dev_find(0x00000000) != NULL || flash_dev_find(0xFFFFFFFF) != NULL) {
+        iFailed++;
+    }
+
+    /* a rebuild after first use keeps the devices as they are: ids, buffered data */
+    static const uint8_t c_chTail[16] = {0x11, 0x22, 0x33, 0x44};
+    uint32_t wBase = host_uniform_flash_device.ptFlashDev->DevAdr;
+    uint8_t chBack[sizeof(c_chTail)];
+    target_flash_erase(wBase, 2048);
+    target_flash_write(wBase + 0x40, c_chTail, sizeof(c_chTail));
+    bool bKept = flash_dev_index_build() && flash_dev_id(wBase) == 0 &&
+                 flash_dev_id(host_dual_flash_device.ptFlashDev->DevAdr) == 4 &&
+                 target_flash_sync(wBase) && target_flash_read(wBase + 0x40, chBack, sizeof(chBack)) == sizeof(chBack) &&
+                 memcmp(chBack, c_chTail, sizeof(c_chTail)) == 0;
+    printf("rebuild after use %s\n", bKept ? "ok" : "FAILED");
+    iFailed += !bKept;
+
+    return iFailed;
+}
+
+static int bench_sectors(void)
+{
+    int iFailed = 0;
+
+    printf("%-8s %8s %12s %14s %20s\n", "device", "sectors", "ns/lookup", "erase request", "erased range");
+
+    for (size_t d = 0; d < BENCH_DEV_NUM; d++) {
+        bench_dev_t const *ptDev = &c_tBenchDevs[d];
+        flash_dev_t const *ptFlash = ptDev->ptBlob->ptFlashDev;
+        flash_sector_t tSector, tByIndex;
+        flash_range_t tErased;
+        uint32_t wNum = 0;
+
+        /* walk the device sector by sector, index and address must agree */
+        for (uint32_t wAddr = ptFlash->DevAdr; wAddr - ptFlash->DevAdr < ptFlash->szDev; wAddr += tSector.wSize) {
+            if (!target_flash_sector_info(wAddr, &tSector) || tSector.wAddr != wAddr ||
+                !target_flash_sector_at(wAddr, tSector.wIndex, &tByIndex) ||
+                tByIndex.wAddr != wAddr || tByIndex.wSize != tSector.wSize || tSector.wIndex != wNum) {
+                iFailed++;
+                break;
+            }
+            wNum++;
+        }
+        if (wNum != ptDev->ptSim->wSectorNum && ptDev->ptSim->wSectorNum != 0) {
+            iFailed++;
+        }
+
+        uint64_t wStart = host_flash_sim_now_ns();
+        for (uint32_t i = 0; i < 65536; i++) {
+            target_flash_sector_info(ptFlash->DevAdr + (i * 2654435761u) % ptFlash->szDev, &tSector);
+        }
+        double fNs = (double)(host_flash_sim_now_ns() - wStart) / 65536.0;
+
+        /* an unaligned request is widened to whole sectors */
+        uint32_t wReq = ptFlash->DevAdr + ptFlash->szDev / 2 + 100;
+        int32_t nErased = target_flash_erase_ex(wReq, 200000, &tErased);
+        target_flash_sector_info(wReq, &tSector);
+        if (nErased <= 0 || tErased.wAddr != tSector.wAddr || (size_t)nErased != tErased.wSize ||
+            tErased.wAddr + tErased.wSize < wReq + 200000) {
+            iFailed++;
+        }
+
+        printf("%-8s %8u %12.1f %6s+%-7u 0x%08x+%-9zu\n", ptDev->pchName, (unsigned)wNum, fNs,
+               "mid", 200000u, (unsigned)tErased.wAddr, tErased.wSize);
+    }
+
+#if FLASH_BLOB_USE_PAGE_BUF == ENABLED
+    /* data still buffered in the tail of an erased sector must not come back on sync */
+    uint32_t wBase = c_tBenchDevs[0].ptBlob->ptFlashDev->DevAdr;
+    flash_range_t tRange;
+    uint8_t chByte = 0;
+    memset(s_chPattern, 0x00, 16);
+    if (target_flash_erase(wBase, 0x1000) != 0x1000 || target_flash_write(wBase + 0xC00, s_chPattern, 16) != 16 ||
+        target_flash_erase_ex(wBase + 0x800, 16, &tRange) != 0x800 || tRange.wAddr != wBase + 0x800 ||
+        tRange.wSize != 0x800 || !target_flash_sync(wBase) || target_flash_read(wBase + 0xC00, &chByte, 1) != 1 ||
+        chByte != 0xFF) {
+        iFailed++;
+    }
+#endif
+
+    return iFailed;
+}
+
+static int bench_coalesce(void)
+{
+    static const size_t c_wChunks[] = {1, 13, 128, 133, 1029};
+    int iFailed = 0;
+
+    printf("%-8s %7s %8s %10s %12s %10s %12s\n",
+           "device", "chunk", "writes", "prog calls", "prog bytes", "min calls", "flash ms");
+
+    for (size_t d = 0; d < BENCH_DEV_NUM; d++) {
+        bench_dev_t const *ptDev = &c_tBenchDevs[d];
+        uint32_t wBase = ptDev->ptBlob->ptFlashDev->DevAdr;
+        uint32_t wPage = ptDev->ptBlob->ptFlashDev->szPage;
+        size_t wSize = BENCH_REGION_SIZE / 4;
+
+        target_flash_init(wBase);
+
+        for (size_t c = 0; c < sizeof(c_wChunks) / sizeof(c_wChunks[0]); c++) {
+            size_t wChunk = c_wChunks[c];
+            uint64_t wWrites = 0;
+
+            target_flash_erase(wBase, wSize);
+            host_flash_sim_stat_reset(ptDev->ptSim);
+
+            /* stream the region in odd sized pieces, as a YMODEM receiver would */
+            for (size_t o = 0; o < wSize; o += wChunk) {
+                size_t wLen = (wSize - o < wChunk) ? wSize - o : wChunk;
+                if (target_flash_write(wBase + o, &s_chPattern[o], wLen) != (int32_t)wLen) {
+                    iFailed++;
+                }
+                wWrites++;
+            }
+
+            /* buffered data must already be visible to reads */
+            memset(s_chReadBack, 0, wSize);
+            target_flash_read(wBase, s_chReadBack, wSize);
+            if (memcmp(s_chPattern, s_chReadBack, wSize) != 0) {
+                printf("%-8s readback mismatch before sync with %zu byte chunks\n", ptDev->pchName, wChunk);
+                iFailed++;
+            }
+
+            if (!target_flash_sync(wBase)) {
+                iFailed++;
+            }
+            memset(s_chReadBack, 0, wSize);
+            target_flash_read(wBase, s_chReadBack, wSize);
+            if (memcmp(s_chPattern, s_chReadBack, wSize) != 0 ||
+                ptDev->ptSim->tStat.wViolations != 0) {
+                printf("%-8s readback mismatch after sync with %zu byte chunks\n", ptDev->pchName, wChunk);
+                iFailed++;
+            }
+
+            printf("%-8s %7zu %8llu %10llu %12llu %10zu %12.3f\n", ptDev->pchName, wChunk,
+                   (unsigned long long)wWrites,
+                   (unsigned long long)ptDev->ptSim->tStat.wProgCalls,
+                   (unsigned long long)ptDev->ptSim->tStat.wProgBytes,
+                   wSize / wPage, (double)ptDev->ptSim->tStat.wBusyNs / 1e6);
+        }
+
+        target_flash_uninit(wBase);
+    }
+
+    return iFailed;
+}
+
+static int bench_update(void)
+{
+    static const char *const c_pchSteps[] = {"erase+write", "update new", "update same", "update 1->0", "update 0->1"};
+    static uint8_t s_chImage[BENCH_REGION_SIZE / 4];
+    size_t wSize = sizeof(s_chImage);
+    int iFailed = 0;
+
+    printf("%-8s %-12s %10s %8s %10s %10s %8s %8s %10s\n", "device", "step", "prog bytes", "erases",
+           "flash ms", "skipped", "sec skip", "no erase", "diff erase");
+
+    for (size_t d = 0; d < BENCH_DEV_NUM; d++) {
+        bench_dev_t const *ptDev = &c_tBenchDevs[d];
+        uint32_t wBase = ptDev->ptBlob->ptFlashDev->DevAdr;
+        flash_diff_stat_t tStat;
+
+        /* firmware like image, the last quarter is erased padding */
+        memcpy(s_chImage, s_chPattern, wSize);
+        memset(&s_chImage[wSize * 3 / 4], ptDev->ptBlob->ptFlashDev->valEmpty, wSize / 4);
+
+        target_flash_init(wBase);
+        target_flash_erase(wBase, wSize);
+
+        for (size_t t = 0; t < sizeof(c_pchSteps) / sizeof(c_pchSteps[0]); t++) {
+            host_flash_sim_stat_reset(ptDev->ptSim);
+            target_flash_diff_stat(wBase, NULL, true);
+
+            if (t == 0) {
+                /* the plain way, for reference */
+                target_flash_erase(wBase, wSize);
+                if (target_flash_write(wBase, s_chImage, wSize) != (int32_t)wSize || !target_flash_sync(wBase)) {
+                    iFailed++;
+                }
+            } else {
+                if (t == 3) {
+                    /* clear a few bits, no erase needed */
+                    s_chImage[100] &= 0x0F;
+                    s_chImage[wSize / 2] &= 0xF0;
+                } else if (t == 4) {
+                    /* set a bit back to 1 in one sector */
+                    s_chImage[wSize / 2] |= 0x01;
+                }
+                if (target_flash_update(wBase, s_chImage, wSize) != (int32_t)wSize) {
+                    iFailed++;
+                }
+            }
+
+            target_flash_diff_stat(wBase, &tStat, false);
+            printf("%-8s %-12s %10llu %8llu %10.3f %10u %8u %8u %10u\n", ptDev->pchName, c_pchSteps[t],
+                   (unsigned long long)ptDev->ptSim->tStat.wProgBytes,
+                   (unsigned long long)ptDev->ptSim->tStat.wEraseCalls,
+                   (double)ptDev->ptSim->tStat.wBusyNs / 1e6,
+                   (unsigned)tStat.wBytesSkipped, (unsigned)tStat.wSectorsSkipped,
+                   (unsigned)tStat.wErasesAvoided, (unsigned)tStat.wErases);
+
+            if (t == 0) {
+                target_flash_erase(wBase, wSize);
+            } else {
+                memset(s_chReadBack, 0, wSize);
+                target_flash_read(wBase, s_chReadBack, wSize);
+                if (memcmp(s_chImage, s_chReadBack, wSize) != 0 || ptDev->ptSim->tStat.wViolations != 0) {
+                    printf("%-8s readback mismatch after %s\n", ptDev->pchName, c_pchSteps[t]);
+                    iFailed++;
+                }
+            }
+        }
+
+        /* a range inside a sector: bits cleared in place, an erase that would drop neighbours refused */
+        flash_sector_t tSector;
+        uint8_t chOld[16], chNew[16];
+        target_flash_sector_info(wBase, &tSector);
+        uint32_t wMid = wBase + tSector.wSize / 2;
+        target_flash_read(wMid, chOld, sizeof(chOld));
+        for (size_t i = 0; i < sizeof(chNew); i++) {
+            chNew[i] = chOld[i] & 0x3C;
+        }
+        bool bKept = target_flash_update(wMid, chNew, sizeof(chNew)) == sizeof(chNew);
+        chNew[0] |= 0x80;
+        bKept = bKept && target_flash_update(wMid, chNew, sizeof(chNew)) == 0 &&
+                target_flash_read(wBase, s_chReadBack, tSector.wSize) == (int)tSector.wSize;
+        chNew[0] &= 0x3C;
+        bKept = bKept && memcmp(&s_chReadBack[tSector.wSize / 2], chNew, sizeof(chNew)) == 0 &&
+                memcmp(s_chReadBack, s_chImage, tSector.wSize / 2) == 0 &&
+                memcmp(&s_chReadBack[tSector.wSize / 2 + 16], &s_chImage[tSector.wSize / 2 + 16],
+                       tSector.wSize / 2 - 16) == 0;
+        if (!bKept) {
+            printf("%-8s partial sector update lost data\n", ptDev->pchName);
+            iFailed++;
+        }
+
+        target_flash_uninit(wBase);
+    }
+
+    return iFailed;
+}
+
+static int bench_latency(void)
+{
+    static const char *const c_pchOps[] = {"erase", "write", "read"};
+    size_t wSize = BENCH_REGION_SIZE / 4;
+    int iFailed = 0;
+
+    printf("%-8s %-6s %8s %12s %14s %8s %8s\n",
+           "device", "op", "windows", "call us", "max masked us", "yields", "masked");
+
+    for (size_t d = 0; d < BENCH_DEV_NUM; d++) {
+        bench_dev_t const *ptDev = &c_tBenchDevs[d];
+        uint32_t wBase = ptDev->ptBlob->ptFlashDev->DevAdr;
+
+        target_flash_init(wBase);
+
+        for (size_t t = 0; t < sizeof(c_pchOps) / sizeof(c_pchOps[0]); t++) {
+            flash_irq_stat_t tStat;
+            uint32_t wMasked;
+            int32_t nDone = 0;
+
+            target_flash_irq_stat(NULL, true);
+            host_flash_sim_yields(NULL);
+            uint64_t wStart = host_flash_sim_clock_ns();
+            if (t == 0) {
+                nDone = target_flash_erase(wBase, wSize);
+            } else if (t == 1) {
+                nDone = target_flash_write(wBase, s_chPattern, wSize);
+                target_flash_sync(wBase);
+            } else {
+                nDone = target_flash_read(wBase, s_chReadBack, wSize);
+            }
+            uint64_t wCallUs = (host_flash_sim_clock_ns() - wStart) / 1000;
+            target_flash_irq_stat(&tStat, false);
+            uint32_t wYields = host_flash_sim_yields(&wMasked);
+
+            /* IRQs must come back between steps and never stay masked for the whole call,
+               memory mapped devices are read and external devices are driven without
+               masking them at all */
+            bool bUnmasked = (t == 2 && ptDev->ptBlob->tFlashops.Read == NULL) ||
+                             ptDev->ptBlob->ptFlashDev->DevType != ONCHIP;
+            if (nDone < (int32_t)wSize || wMasked != 0 ||
+                (bUnmasked ? tStat.wWindows != 0 : (tStat.wWindows < 2 || tStat.wMax >= wCallUs))) {
+                iFailed++;
+            }
+
+            printf("%-8s %-6s %8u %12llu %14u %8u %8u\n", ptDev->pchName, c_pchOps[t],
+                   (unsigned)tStat.wWindows, (unsigned long long)wCallUs,
+                   (unsigned)tStat.wMax, (unsigned)wYields, (unsigned)wMasked);
+        }
+
+        target_flash_uninit(wBase);
+    }
+
+    return iFailed;
+}
+
+static void bench_async_done(flash_req_t *ptReq)
+{
+    uint32_t *pwOrder = (uint32_t *)ptReq->pTarget;
+
+    /* record the completion order, one nibble per request */
+    pwOrder[0] = (pwOrder[0] << 4) | (uint32_t)(ptReq->chOp + 1);
+    pwOrder[2]++;
+    if (ptReq->chStatus != FLASH_REQ_DONE) {
+        pwOrder[1]++;
+    }
+}
+
+static int bench_async(void)
+{
+    size_t wSize = BENCH_REGION_SIZE / 4;
+    int iFailed = 0;
+
+    printf("%-8s %8s %10s %12s %12s %10s\n", "device", "steps", "callbacks", "total us", "max step us", "readback");
+
+    for (size_t d = 0; d < BENCH_DEV_NUM; d++) {
+        bench_dev_t const *ptDev = &c_tBenchDevs[d];
+        uint32_t wBase = ptDev->ptBlob->ptFlashDev->DevAdr;
+        flash_req_t tErase = {0}, tWrite = {0}, tTail = {0};
+        uint32_t wOrder[3] = {0, 0, 0};   // order, failures, callbacks
+        uint64_t wSteps = 0, wMaxStep = 0;
+
+        target_flash_init(wBase);
+
+        /* erase, write, then an unaligned tail, all queued before any progress */
+        if (!target_flash_erase_async(&tErase, wBase, wSize, bench_async_done, wOrder) ||
+            !target_flash_write_async(&tWrite, wBase, s_chPattern, wSize - 100, bench_async_done, wOrder) ||
+            !target_flash_write_async(&tTail, wBase + wSize - 100, &s_chPattern[wSize - 100], 100,
+                                      bench_async_done, wOrder) ||
+            target_flash_write_async(&tWrite, wBase, s_chPattern, wSize, NULL, NULL)) {
+            iFailed++;
+        }
+
+        /* the superloop, every step is bounded to one sector or one page */
+        uint64_t wStart = host_flash_sim_clock_ns();
+        bool bPending = true;
+        while (bPending) {
+            uint64_t wStep = host_flash_sim_clock_ns();
+            bPending = target_flash_poll();
+            wStep = host_flash_sim_clock_ns() - wStep;
+            wMaxStep = (wStep > wMaxStep) ? wStep : wMaxStep;
+            wSteps++;
+        }
+        uint64_t wTotal = host_flash_sim_clock_ns() - wStart;
+
+        target_flash_sync(wBase);
+        memset(s_chReadBack, 0, wSize);
+        target_flash_read(wBase, s_chReadBack, wSize);
+        bool bMatch = (memcmp(s_chPattern, s_chReadBack, wSize) == 0);
+        if (!bMatch || wOrder[0] != 0x122 || wOrder[1] != 0 || tErase.wDone < wSize ||
+            tWrite.chStatus != FLASH_REQ_DONE || wSteps < 2) {
+            iFailed++;
+        }
+
+        printf("%-8s %8llu %10u %12llu %12llu %10s\n", ptDev->pchName, (unsigned long long)wSteps,
+               (unsigned)wOrder[2],
+               (unsigned long long)(wTotal / 1000), (unsigned long long)(wMaxStep / 1000),
+               bMatch ? "ok" : "mismatch");
+
+        target_flash_uninit(wBase);
+    }
+
+    return iFailed;
+}
+
+/* one 1024 byte YMODEM packet at 921600 baud, 10 bits per byte */
+#define BENCH_LINK_PACKET       1024
+#define BENCH_LINK_PACKET_NS    (BENCH_LINK_PACKET * 10ull * 1000000000ull / 921600)
+
+/*
+ * Waits for the next packet. bPoll: the application drives queued flash
+ * work while the link is busy, otherwise it just waits.
+ */
+static void bench_link_wait(bool bPoll)
+{
+    uint64_t wDeadline = host_flash_sim_clock_ns() + BENCH_LINK_PACKET_NS;
+
+    while (bPoll && host_flash_sim_clock_ns() < wDeadline && target_flash_poll());
+
+    uint64_t wNow = host_flash_sim_clock_ns();
+    if (wNow < wDeadline) {
+        host_flash_sim_idle(wDeadline - wNow);
+    }
+}
+
+static int bench_session(void)
+{
+    size_t wSize = BENCH_REGION_SIZE;
+    int iFailed = 0;
+
+    printf("%-8s %10s %10s %12s %12s %10s\n", "device", "link ms", "flash ms", "erase+recv ms",
+           "session ms", "readback");
+
+    for (size_t d = 0; d < BENCH_DEV_NUM; d++) {
+        bench_dev_t const *ptDev = &c_tBenchDevs[d];
+        uint32_t wBase = ptDev->ptBlob->ptFlashDev->DevAdr;
+        uint64_t wTotal[2], wFlash = 0;
+
+        target_flash_init(wBase);
+
+        for (int m = 0; m < 2; m++) {
+            flash_session_t tSession;
+
+            /* start from a programmed region, so both variants really erase */
+            target_flash_erase(wBase, wSize);
+            target_flash_write(wBase, s_chReadBack, wSize);
+            target_flash_sync(wBase);
+
+            uint64_t wBusy = ptDev->ptSim->tStat.wBusyNs;
+            uint64_t wStart = host_flash_sim_clock_ns();
+            if (m == 0) {
+                /* the readme way: erase the whole image, then receive */
+                target_flash_erase(wBase, wSize);
+                for (size_t o = 0; o < wSize; o += BENCH_LINK_PACKET) {
+                    bench_link_wait(false);
+                    target_flash_write(wBase + o, &s_chPattern[o], BENCH_LINK_PACKET);
+                }
+                target_flash_sync(wBase);
+            } else {
+                if (!target_flash_session_open(&tSession, wBase, wSize)) {
+                    iFailed++;
+                }
+                for (size_t o = 0; o < wSize; o += BENCH_LINK_PACKET) {
+                    bench_link_wait(true);
+                    if (target_flash_session_append(&tSession, &s_chPattern[o], BENCH_LINK_PACKET)
+                        != BENCH_LINK_PACKET) {
+                        iFailed++;
+                    }
+                }
+                if (!target_flash_session_close(&tSession) || tSession.wCursor != wBase + wSize ||
+                    tSession.wErased != wBase + wSize) {
+                    iFailed++;
+                }
+            }
+            wTotal[m] = host_flash_sim_clock_ns() - wStart;
+            wFlash = ptDev->ptSim->tStat.wBusyNs - wBusy;
+        }
+
+        memset(s_chReadBack, 0, wSize);
+        target_flash_read(wBase, s_chReadBack, wSize);
+        bool bMatch = (memcmp(s_chPattern, s_chReadBack, wSize) == 0);
+        if (!bMatch || wTotal[1] >= wTotal[0]) {
+            iFailed++;
+        }
+
+        printf("%-8s %10.1f %10.1f %12.1f %12.1f %10s\n", ptDev->pchName,
+               (double)(wSize / BENCH_LINK_PACKET * BENCH_LINK_PACKET_NS) / 1e6, (double)wFlash / 1e6,
+               (double)wTotal[0] / 1e6, (double)wTotal[1] / 1e6, bMatch ? "ok" : "mismatch");
+
+        target_flash_uninit(wBase);
+    }
+
+    return iFailed;
+}
+
+static int bench_writev(void)
+{
+    /* a packet chain: header, odd sized body fragments, CRC trailer */
+    static const size_t c_wSegs[] = {12, 500, 733, 64, 203, 4};
+    static uint8_t s_chStage[2048];
+    size_t wPacket = 0, wPackets;
+    int iFailed = 0;
+
+    for (size_t i = 0; i < sizeof(c_wSegs) / sizeof(c_wSegs[0]); i++) {
+        wPacket += c_wSegs[i];
+    }
+    wPackets = (BENCH_REGION_SIZE / 4) / wPacket;
+
+    printf("%-8s %-12s %8s %10s %12s %12s %10s\n", "device", "method", "packets", "prog calls",
+           "prog bytes", "ns/packet", "readback");
+
+    for (size_t d = 0; d < BENCH_DEV_NUM; d++) {
+        bench_dev_t const *ptDev = &c_tBenchDevs[d];
+        uint32_t wBase = ptDev->ptBlob->ptFlashDev->DevAdr;
+        uint64_t wCopyCalls = 0;
+
+        target_flash_init(wBase);
+
+        for (int m = 0; m < 2; m++) {
+            target_flash_erase(wBase, wPackets * wPacket);
+            host_flash_sim_stat_reset(ptDev->ptSim);
+
+            uint64_t wStart = host_flash_sim_now_ns();
+            for (size_t p = 0; p < wPackets; p++) {
+                flash_iovec_t tVec[sizeof(c_wSegs) / sizeof(c_wSegs[0])];
+                size_t wOff = p * wPacket;
+
+                for (size_t i = 0; i < sizeof(c_wSegs) / sizeof(c_wSegs[0]); i++) {
+                    tVec[i].pBase = &s_chPattern[wOff];
+                    tVec[i].wLen = c_wSegs[i];
+                    wOff += c_wSegs[i];
+                }
+
+                if (m == 0) {
+                    /* gather into one buffer first */
+                    size_t wLen = 0;
+                    for (size_t i = 0; i < sizeof(c_wSegs) / sizeof(c_wSegs[0]); i++) {
+                        memcpy(&s_chStage[wLen], tVec[i].pBase, tVec[i].wLen);
+                        wLen += tVec[i].wLen;
+                    }
+                    if (target_flash_write(wBase + p * wPacket, s_chStage, wLen) != (int32_t)wLen) {
+                        iFailed++;
+                    }
+                } else if (target_flash_writev(wBase + p * wPacket, tVec, sizeof(c_wSegs) / sizeof(c_wSegs[0]))
+                           != (int32_t)wPacket) {
+                    iFailed++;
+                }
+            }
+            target_flash_sync(wBase);
+            uint64_t wWall = host_flash_sim_now_ns() - wStart;
+
+            memset(s_chReadBack, 0, wPackets * wPacket);
+            target_flash_read(wBase, s_chReadBack, wPackets * wPacket);
+            bool bMatch = (memcmp(s_chPattern, s_chReadBack, wPackets * wPacket) == 0) &&
+                          ptDev->ptSim->tStat.wViolations == 0;
+            if (!bMatch) {
+                iFailed++;
+            }
+#if FLASH_BLOB_USE_PAGE_BUF == ENABLED
+            /* the segments fill the page buffer like one write, no extra Program calls */
+            if (m == 0) {
+                wCopyCalls = ptDev->ptSim->tStat.wProgCalls;
+            } else if (ptDev->ptSim->tStat.wProgCalls > wCopyCalls) {
+                iFailed++;
+            }
+#endif
+            (void)wCopyCalls;
+
+            printf("%-8s %-12s %8zu %10llu %12llu %12.1f %10s\n", ptDev->pchName,
+                   (m == 0) ? "copy+write" : "writev", wPackets,
+                   (unsigned long long)ptDev->ptSim->tStat.wProgCalls,
+                   (unsigned long long)ptDev->ptSim->tStat.wProgBytes,
+                   (double)wWall / (double)wPackets, bMatch ? "ok" : "mismatch");
+        }
+
+        target_flash_uninit(wBase);
+    }
+
+    return iFailed;
+}
+
+static const char *const c_pchOpNames[FLASH_OP_NUM] = {"erase", "program", "read"};
+
+/*
+ * Writes trace entries as Chrome trace event JSON (chrome://tracing,
+ * ui.perfetto.dev), one thread per device. Ticks are simulated us.
+ */
+static bool bench_trace_export(const char *pchPath, const flash_trace_t *ptTrace, uint32_t wNum)
+{
+    FILE *ptFile = fopen(pchPath, "w");
+
+    if (ptFile == NULL) {
+        return false;
+    }
+
+    fprintf(ptFile, "{\"displayTimeUnit\":\"us\",\"traceEvents\":[\n");
+    for (size_t d = 0; d < sizeof(c_ptBenchTable) / sizeof(c_ptBenchTable[0]); d++) {
+        fprintf(ptFile, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%zu,"
+                "\"args\":{\"name\":\"%s\"}},\n", d, c_ptBenchTable[d]->ptFlashDev->DevName);
+    }
+    for (uint32_t i = 0; i < wNum; i++) {
+        fprintf(ptFile, "{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%u,\"dur\":%u,"
+                "\"args\":{\"addr\":\"0x%08x\",\"size\":%u,\"failed\":%u}}%s\n",
+                c_pchOpNames[ptTrace[i].chOp], ptTrace[i].chDev, (unsigned)ptTrace[i].wStart,
+                (unsigned)ptTrace[i].wTicks, (unsigned)ptTrace[i].wAddr, (unsigned)ptTrace[i].wSize,
+                ptTrace[i].chFailed, (i + 1 < wNum) ? "," : "");
+    }
+    fprintf(ptFile, "]}\n");
+
+    return fclose(ptFile) == 0;
+}
+
+static int bench_stat(void)
+{
+    static flash_trace_t s_tTrace[8192];
+    static flash_dev_stat_t s_tStat;
+    size_t wSize = BENCH_REGION_SIZE / 4;
+    uint64_t wCalls = 0;
+    uint32_t wLost;
+    int iFailed = 0;
+
+    /* start from empty counters and an empty trace */
+    while (target_flash_trace_read(s_tTrace, 8192, &wLost) != 0);
+
+    printf("%-8s %-8s %8s %6s %10s %10s %10s  %s\n", "device", "op", "calls", "fails", "bytes",
+           "avg us", "max us", "latency histogram (us < 2^n: count)");
+
+    for (size_t d = 0; d < BENCH_DEV_NUM; d++) {
+        bench_dev_t const *ptDev = &c_tBenchDevs[d];
+        uint32_t wBase = ptDev->ptBlob->ptFlashDev->DevAdr;
+
+        target_flash_stat(wBase, NULL, true);
+        host_flash_sim_stat_reset(ptDev->ptSim);
+        target_flash_init(wBase);
+        target_flash_erase(wBase, wSize);
+        target_flash_write(wBase, s_chPattern, wSize);
+        target_flash_sync(wBase);
+        target_flash_read(wBase, s_chReadBack, wSize);
+        s_chPattern[wSize / 2] ^= 0x80;
+        target_flash_update(wBase, s_chPattern, wSize);
+        s_chPattern[wSize / 2] ^= 0x80;
+        target_flash_uninit(wBase);
+
+        if (!target_flash_stat(wBase, &s_tStat, false)) {
+            iFailed++;
+            continue;
+        }
+
+        uint64_t wErases = 0;
+        for (size_t i = 0; i < FLASH_BLOB_STAT_SECTOR_NUM; i++) {
+            wErases += s_tStat.wSectorErases[i];
+        }
+        /* the simulator must have seen exactly the counted calls, a block
+           or multi-sector erase is one call that wears several sectors */
+        if (wErases != ptDev->ptSim->tStat.wEraseCalls ||
+            s_tStat.tOp[FLASH_OP_ERASE].wCalls > wErases ||
+            s_tStat.tOp[FLASH_OP_PROGRAM].wCalls != ptDev->ptSim->tStat.wProgCalls ||
+            s_tStat.tOp[FLASH_OP_PROGRAM].dwBytes != ptDev->ptSim->tStat.wProgBytes) {
+            iFailed++;
+        }
+
+        for (int o = 0; o < FLASH_OP_NUM; o++) {
+            flash_op_stat_t *ptOp = &s_tStat.tOp[o];
+            printf("%-8s %-8s %8u %6u %10llu %10.1f %10u ", ptDev->pchName, c_pchOpNames[o],
+                   (unsigned)ptOp->wCalls, (unsigned)ptOp->wFailures, (unsigned long long)ptOp->dwBytes,
+                   ptOp->wCalls ? (double)ptOp->dwTicks / (double)ptOp->wCalls : 0.0, (unsigned)ptOp->wMaxTicks);
+            for (int b = 0; b < FLASH_BLOB_STAT_HIST_NUM; b++) {
+                if (ptOp->wHist[b] != 0) {
+                    printf(" %d:%u", b, (unsigned)ptOp->wHist[b]);
+                }
+            }
+            printf("\n");
+            wCalls += ptOp->wCalls;
+        }
+    }
+
+    /* every operation shows up in the trace */
+    uint32_t wNum = target_flash_trace_read(s_tTrace, 8192, &wLost);
+    printf("trace: %u entries, %u lost\n", (unsigned)wNum, (unsigned)wLost);
+    if (wNum + wLost != wCalls) {
+        iFailed++;
+    }
+    if (s_pchTraceFile != NULL) {
+        if (!bench_trace_export(s_pchTraceFile, s_tTrace, wNum)) {
+            iFailed++;
+        }
+        printf("trace written to %s\n", s_pchTraceFile);
+    }
+
+    return iFailed;
+}
+
+#define BENCH_KV_KEYS       20
+#define BENCH_KV_SEGS       4
+
+static int bench_kv(void)
+{
+    static flash_kv_t s_tKv, s_tRemount;
+    static uint32_t s_wExpect[BENCH_KV_KEYS][6];
+    uint32_t wUpdates = (uint32_t)s_iRounds * 1000;
+    int iFailed = 0;
+
+    printf("%-8s %8s %8s %8s %10s %12s %10s %10s %10s\n", "device", "updates", "erases", "gc runs",
+           "prog calls", "bytes/update", "reads/get", "naive ers", "remount");
+
+    for (size_t d = 0; d < BENCH_DEV_NUM; d++) {
+        bench_dev_t const *ptDev = &c_tBenchDevs[d];
+        uint32_t wBase = ptDev->ptBlob->ptFlashDev->DevAdr;
+        flash_sector_t tSector;
+        char chKey[16];
+
+        target_flash_init(wBase);
+        target_flash_sector_info(wBase, &tSector);
+        target_flash_erase(wBase, BENCH_KV_SEGS * tSector.wSize);
+        if (!flash_kv_mount(&s_tKv, wBase, BENCH_KV_SEGS * tSector.wSize)) {
+            printf("%-8s mount failed\n", ptDev->pchName);
+            iFailed++;
+            continue;
+        }
+
+        /* small records rewritten over and over, as for counters and settings */
+        host_flash_sim_stat_reset(ptDev->ptSim);
+        for (uint32_t u = 0; u < wUpdates; u++) {
+            uint32_t k = (u * 7) % BENCH_KV_KEYS;
+            snprintf(chKey, sizeof(chKey), "cfg.%u", (unsigned)k);
+            for (int w = 0; w < 6; w++) {
+                s_wExpect[k][w] = u * 6 + w;
+            }
+            if (!flash_kv_set(&s_tKv, chKey, s_wExpect[k], 4 * (1 + k % 6))) {
+                iFailed++;
+            }
+        }
+        host_flash_sim_stat_t tSet = ptDev->ptSim->tStat;
+
+        /* lookups go through the index: the key check and the record itself, never a scan */
+        uint32_t wValue[6];
+        for (uint32_t k = 0; k < BENCH_KV_KEYS; k++) {
+            snprintf(chKey, sizeof(chKey), "cfg.%u", (unsigned)k);
+            if (flash_kv_get(&s_tKv, chKey, wValue, sizeof(wValue)) != (int32_t)(4 * (1 + k % 6)) ||
+                memcmp(wValue, s_wExpect[k], 4 * (1 + k % 6)) != 0) {
+                iFailed++;
+            }
+        }
+        uint64_t wReads = ptDev->ptSim->tStat.wReadCalls - tSet.wReadCalls;
+
+        /* deletes survive a remount, so do the values */
+        for (uint32_t k = 0; k < BENCH_KV_KEYS; k += 4) {
+            snprintf(chKey, sizeof(chKey), "cfg.%u", (unsigned)k);
+            if (!flash_kv_delete(&s_tKv, chKey)) {
+                iFailed++;
+            }
+        }
+        bool bRemount = flash_kv_mount(&s_tRemount, wBase, BENCH_KV_SEGS * tSector.wSize) &&
+                        s_tRemount.hwKeys == s_tKv.hwKeys && s_tRemount.wWrite == s_tKv.wWrite;
+        for (uint32_t k = 0; bRemount && k < BENCH_KV_KEYS; k++) {
+            int32_t nLen;
+            snprintf(chKey, sizeof(chKey), "cfg.%u", (unsigned)k);
+            nLen = flash_kv_get(&s_tRemount, chKey, wValue, sizeof(wValue));
+            if (k % 4 == 0) {
+                bRemount = (nLen < 0);
+            } else {
+                bRemount = (nLen == (int32_t)(4 * (1 + k % 6)) && memcmp(wValue, s_wExpect[k], nLen) == 0);
+            }
+        }
+
+        /* a reset while the source of a compaction is erased keeps the compacted copy */
+        uint8_t *pchTail = malloc(tSector.wSize);
+        bool bResumed = false;
+        for (uint32_t u = 0; pchTail != NULL && bRemount && !bResumed && u < 8 * wUpdates; u++) {
+            uint16_t hwTail = s_tKv.hwTail;
+            uint32_t wRuns = s_tKv.wGcRuns;
+            uint32_t wTail = wBase + (uint32_t)hwTail * tSector.wSize;
+
+            target_flash_read(wTail, pchTail, tSector.wSize);
+            s_wExpect[1][0] = ~u;
+            if (!flash_kv_set(&s_tKv, "cfg.1", s_wExpect[1], 8)) {
+                break;
+            }
+            if (s_tKv.wGcRuns == wRuns) {
+                continue;
+            }
+            /*put the source back as if its erase never happened*/
+            target_flash_write(wTail, pchTail, tSector.wSize);
+            target_flash_sync(wTail);
+            bResumed = flash_kv_mount(&s_tRemount, wBase, BENCH_KV_SEGS * tSector.wSize) &&
+                       s_tRemount.hwKeys == s_tKv.hwKeys && s_tRemount.hwTail == s_tKv.hwTail;
+            for (uint32_t k = 1; bResumed && k < BENCH_KV_KEYS; k += (k % 4 == 3) ? 2 : 1) {
+                snprintf(chKey, sizeof(chKey), "cfg.%u", (unsigned)k);
+                bResumed = (flash_kv_get(&s_tRemount, chKey, wValue, sizeof(wValue)) == (int32_t)(4 * (1 + k % 6)) &&
+                            memcmp(wValue, s_wExpect[k], 4 * (1 + k % 6)) == 0);
+            }
+        }
+        free(pchTail);
+        if (!bResumed) {
+            printf("%-8s !! compaction lost after a reset in the source erase\n", ptDev->pchName);
+        }
+
+        if (!bRemount || !bResumed || tSet.wEraseCalls * 10 > wUpdates) {
+            iFailed++;
+        }
+
+        printf("%-8s %8u %8llu %8u %10llu %12.1f %10.1f %10u %10s\n", ptDev->pchName, (unsigned)wUpdates,
+               (unsigned long long)tSet.wEraseCalls, (unsigned)s_tKv.wGcRuns,
+               (unsigned long long)tSet.wProgCalls, (double)tSet.wProgBytes / wUpdates,
+               (double)wReads / BENCH_KV_KEYS, (unsigned)wUpdates, bRemount ? "ok" : "mismatch");
+
+        target_flash_uninit(wBase);
+    }
+
+    return iFailed;
+}
+
+static int bench_map(void)
+{
+    size_t wSize = BENCH_REGION_SIZE;
+    int iFailed = 0;
+
+    printf("%-8s %-10s %12s %10s %12s %10s\n", "device", "method", "wall MB/s", "read calls",
+           "irq windows", "verify");
+
+    for (size_t d = 0; d < BENCH_DEV_NUM; d++) {
+        bench_dev_t const *ptDev = &c_tBenchDevs[d];
+        uint32_t wBase = ptDev->ptBlob->ptFlashDev->DevAdr;
+        bool bMapped = (ptDev->ptBlob->tFlashops.Read == NULL);
+
+        target_flash_init(wBase);
+        target_flash_erase(wBase, wSize);
+        target_flash_write(wBase, s_chPattern, wSize);
+        target_flash_sync(wBase);
+
+        /* image verification: the old byte loop, a bulk read into RAM, in place */
+        for (int m = 0; m < 3; m++) {
+            static const char *c_pchMethods[] = {"bytewise", "read", "map"};
+            flash_irq_stat_t tIrq;
+            uint64_t wReads = ptDev->ptSim->tStat.wReadCalls;
+            uint64_t wWall = 0;
+            bool bMatch = true;
+
+            if (m != 1 && !bMapped) {
+                continue;
+            }
+            target_flash_irq_stat(NULL, true);
+            for (int r = 0; r < s_iRounds; r++) {
+                uint64_t wStart = host_flash_sim_now_ns();
+                if (m == 0) {
+                    const volatile uint8_t *pchSrc = host_flash_sim_map(wBase);
+                    for (size_t i = 0; i < wSize; i++) {
+                        s_chReadBack[i] = pchSrc[i];
+                    }
+                    bMatch &= (memcmp(s_chReadBack, s_chPattern, wSize) == 0);
+                } else if (m == 1) {
+                    bMatch &= (target_flash_read(wBase, s_chReadBack, wSize) == (int32_t)wSize &&
+                               memcmp(s_chReadBack, s_chPattern, wSize) == 0);
+                } else {
+                    const uint8_t *pchImage = target_flash_map(wBase, wSize);
+                    bMatch &= (pchImage != NULL && memcmp(pchImage, s_chPattern, wSize) == 0);
+                }
+                wWall += host_flash_sim_now_ns() - wStart;
+            }
+            target_flash_irq_stat(&tIrq, false);
+            if (!bMatch || (bMapped && m > 0 && tIrq.wWindows != 0)) {
+                iFailed++;
+            }
+
+            printf("%-8s %-10s %12.1f %10llu %12u %10s\n", ptDev->pchName, c_pchMethods[m],
+                   wWall ? (double)wSize * s_iRounds * 1000.0 / (double)wWall : 0.0,
+                   (unsigned long long)(ptDev->ptSim->tStat.wReadCalls - wReads),
+                   (unsigned)tIrq.wWindows, bMatch ? "ok" : "mismatch");
+        }
+
+        /* only memory mapped devices can be mapped */
+        if ((target_flash_map(wBase, wSize) != NULL) != bMapped) {
+            iFailed++;
+        }
+        target_flash_uninit(wBase);
+    }
+
+    return iFailed;
+}
+
+static uint32_t bench_crc32_bitwise(uint32_t wCrc, const uint8_t *pchData, size_t wLen)
+{
+    wCrc = ~wCrc;
+    while (wLen--) {
+        wCrc ^= *pchData++;
+        for (int b = 0; b < 8; b++) {
+            wCrc = (wCrc >> 1) ^ (0xEDB88320 & -(wCrc & 1));
+        }
+    }
+    return ~wCrc;
+}
+
+static int bench_verify(void)
+{
+    static const char *const c_pchPolicies[] = {"off", "sampled", "full"};
+    size_t wSize = BENCH_REGION_SIZE / 4;
+    int iFailed = 0;
+
+    /* known answers */
+    if (flash_crc32(0, "123456789", 9) != 0xCBF43926 ||
+        flash_crc32(flash_crc32(0, "1234", 4), "56789", 5) != 0xCBF43926) {
+        iFailed++;
+    }
+#if FLASH_CRC_USE_SHA256 == ENABLED
+    static const uint8_t c_chAbc[32] = {
+        0xBA, 0x78, 0x16, 0xBF, 0x8F, 0x01, 0xCF, 0xEA, 0x41, 0x41, 0x40, 0xDE, 0x5D, 0xAE, 0x22, 0x23,
+        0xB0, 0x03, 0x61, 0xA3, 0x96, 0x17, 0x7A, 0x9C, 0xB4, 0x10, 0xFF, 0x61, 0xF2, 0x00, 0x15, 0xAD,
+    };
+    flash_sha256_t tSha;
+    uint8_t chHash[32];
+    flash_sha256_init(&tSha);
+    flash_sha256_update(&tSha, "a", 1);
+    flash_sha256_update(&tSha, "bc", 2);
+    flash_sha256_final(&tSha, chHash);
+    if (memcmp(chHash, c_chAbc, 32) != 0) {
+        iFailed++;
+    }
+#endif
+
+    /* engine throughput */
+    uint64_t wStart = host_flash_sim_now_ns();
+    uint32_t wRef = bench_crc32_bitwise(0, s_chPattern, BENCH_REGION_SIZE);
+    uint64_t wBitNs = host_flash_sim_now_ns() - wStart;
+    wStart = host_flash_sim_now_ns();
+    uint32_t wFast = 0;
+    for (int r = 0; r < s_iRounds; r++) {
+        wFast = flash_crc32(0, s_chPattern, BENCH_REGION_SIZE);
+    }
+    uint64_t wFastNs = (host_flash_sim_now_ns() - wStart) / s_iRounds;
+    if (wFast != wRef) {
+        iFailed++;
+    }
+    printf("crc32: bitwise %.1f MB/s, flash_crc32 %.1f MB/s\n",
+           (double)BENCH_REGION_SIZE * 1000.0 / (double)wBitNs, (double)BENCH_REGION_SIZE * 1000.0 / (double)wFastNs);
+
+    printf("%-8s %-8s %10s %10s %12s %12s %12s\n", "device", "verify", "read calls", "write ms",
+           "digest", "checksum ms", "checksum");
+
+    for (size_t d = 0; d < BENCH_DEV_NUM; d++) {
+        bench_dev_t const *ptDev = &c_tBenchDevs[d];
+        uint32_t wBase = ptDev->ptBlob->ptFlashDev->DevAdr;
+        uint32_t wExpect = flash_crc32(0, s_chPattern, wSize);
+
+        target_flash_init(wBase);
+
+        for (int p = FLASH_VERIFY_OFF; p <= FLASH_VERIFY_FULL; p++) {
+            flash_session_t tSession;
+            bool bOk = target_flash_verify_policy(wBase, (flash_verify_t)p);
+
+            /* the image arrives in packets, the digest is kept on the way */
+            target_flash_erase(wBase, wSize);
+            uint64_t wReads = ptDev->ptSim->tStat.wReadCalls;
+            uint64_t wClock = host_flash_sim_clock_ns();
+            bOk &= target_flash_session_open(&tSession, wBase, wSize);
+            for (size_t o = 0; o < wSize; o += 1024) {
+                bOk &= (target_flash_session_append(&tSession, &s_chPattern[o], 1024) == 1024);
+            }
+            bOk &= target_flash_session_close(&tSession);
+            uint64_t wWriteNs = host_flash_sim_clock_ns() - wClock;
+            wReads = ptDev->ptSim->tStat.wReadCalls - wReads;
+
+            /* the second pass the digest makes unnecessary */
+            wClock = host_flash_sim_clock_ns();
+            uint32_t wCheck = target_flash_checksum(wBase, wSize);
+            uint64_t wCheckNs = host_flash_sim_clock_ns() - wClock;
+
+            bool bMatch = (tSession.tDigest.wCrc == wExpect && tSession.tDigest.wSize == wSize);
+            if (!bOk || !bMatch || wCheck != wExpect) {
+                iFailed++;
+            }
+            printf("%-8s %-8s %10llu %10.2f %12s %12.3f %12s\n", ptDev->pchName, c_pchPolicies[p],
+                   (unsigned long long)wReads, (double)wWriteNs / 1e6, bMatch ? "ok" : "mismatch",
+                   (double)wCheckNs / 1e6, (wCheck == wExpect) ? "ok" : "mismatch");
+        }
+
+        /* the device digest follows plain writes too */
+        flash_digest_t tDigest;
+        target_flash_erase(wBase, wSize);
+        target_flash_digest(wBase, NULL, true);
+        target_flash_write(wBase, s_chPattern, wSize / 2);
+        target_flash_write(wBase + wSize / 2, &s_chPattern[wSize / 2], wSize / 2);
+        if (!target_flash_digest(wBase, &tDigest, true) || tDigest.wCrc != wExpect) {
+            iFailed++;
+        }
+
+        target_flash_verify_policy(wBase, FLASH_BLOB_VERIFY_POLICY);
+        target_flash_uninit(wBase);
+    }
+
+    return iFailed;
+}
+
+#define BENCH_IMAGE_SIZE    (128 * 1024)
+
+/*
+ * Greedy LZSS encoder producing the heatshrink bit stream the decoder
+ * expects (the role of "heatshrink -e -w 10 -l 4" on the build machine).
+ */
+static size_t bench_lzss_encode(const uint8_t *pchIn, size_t wLen, uint8_t *pchOut)
+{
+    const size_t wWindow = 1u << FLASH_UNPACK_WINDOW_BITS;
+    const size_t wMaxMatch = 1u << FLASH_UNPACK_LOOKAHEAD_BITS;
+    size_t wOut = 0;
+    uint32_t wBits = 0;
+    int iBitNum = 0;
+
+#define BENCH_PUT_BITS(__N, __V)                                    \
+    do {                                                            \
+        wBits = (wBits << (__N)) | (uint32_t)(__V);                 \
+        iBitNum += (__N);                                           \
+        while (iBitNum >= 8) {                                      \
+            iBitNum -= 8;                                           \
+            pchOut[wOut++] = (uint8_t)(wBits >> iBitNum);           \
+        }                                                           \
+    } while (0)
+
+    for (size_t i = 0; i < wLen;) {
+        size_t wBest = 0, wDist = 0;
+        for (size_t d = 1; d <= wWindow && d <= i; d++) {
+            size_t n = 0;
+            while (n < wMaxMatch && i + n < wLen && pchIn[i + n] == pchIn[i + n - d]) {
+                n++;
+            }
+            if (n > wBest) {
+                wBest = n;
+                wDist = d;
+                if (n == wMaxMatch) {
+                    break;
+                }
+            }
+        }
+        /* a back-reference costs 1 + w + l bits, a literal 9 */
+        if (wBest * 9 > 1 + FLASH_UNPACK_WINDOW_BITS + FLASH_UNPACK_LOOKAHEAD_BITS) {
+            BENCH_PUT_BITS(1, 0);
+            BENCH_PUT_BITS(FLASH_UNPACK_WINDOW_BITS, wDist - 1);
+            BENCH_PUT_BITS(FLASH_UNPACK_LOOKAHEAD_BITS, wBest - 1);
+            i += wBest;
+        } else {
+            BENCH_PUT_BITS(1, 1);
+            BENCH_PUT_BITS(8, pchIn[i]);
+            i++;
+        }
+    }
+    if (iBitNum > 0) {
+        BENCH_PUT_BITS(8 - iBitNum, 0);
+    }
+#undef BENCH_PUT_BITS
+
+    return wOut;
+}
+
+/* Something shaped like a Cortex-M image: vectors, Thumb code, strings, erased tail */
+static void bench_image_build(uint8_t *pchImage, size_t wSize)
+{
+    static const uint16_t c_hwOps[] = {
+        0xB580, 0xAF00, 0xBD80, 0x4770, 0x2000, 0x2101, 0x6818, 0x6018, 0x4B00, 0x4A00,
+        0x3301, 0x1C40, 0xF000, 0xF800, 0x46BD, 0xB082, 0x9001, 0x9B01, 0xE7FE, 0xD1F0,
+    };
+    static const char *const c_pchWords[] = {
+        "flash", "error", "init", "timeout", "sector", "erase", "write", "read", "uart", "ok",
+        "boot", "image", "crc", "failed", "config", "version", " ", " ", "\n", ": ",
+    };
+    size_t i = 0;
+
+    for (; i < 192; i += 4) {
+        uint32_t wVector = 0x08000101u + (uint32_t)(rand() % 64) * 8;
+        memcpy(&pchImage[i], &wVector, 4);
+    }
+    for (; i < wSize * 6 / 10; i += 2) {
+        uint16_t hwOp = c_hwOps[rand() % 20];
+        if (rand() % 4 == 0) {
+            hwOp |= (uint16_t)(rand() & 0x3F);
+        }
+        memcpy(&pchImage[i], &hwOp, 2);
+    }
+    while (i < wSize * 8 / 10) {
+        const char *pchWord = c_pchWords[rand() % 20];
+        size_t n = strlen(pchWord);
+        memcpy(&pchImage[i], pchWord, n);
+        i += n;
+    }
+    memset(&pchImage[i], 0xFF, wSize - i);
+}
+
+static int bench_unpack(void)
+{
+    static uint8_t s_chImage[BENCH_IMAGE_SIZE];
+    static uint8_t s_chPacked[BENCH_IMAGE_SIZE * 9 / 8 + 16];
+    static flash_unpack_t s_tUnpack;
+    int iFailed = 0;
+
+    bench_image_build(s_chImage, sizeof(s_chImage));
+    size_t wPacked = bench_lzss_encode(s_chImage, sizeof(s_chImage), s_chPacked);
+    uint32_t wExpect = flash_crc32(0, s_chImage, sizeof(s_chImage));
+
+    printf("image %u bytes, compressed %u bytes (%.2fx), window %u bytes\n", (unsigned)sizeof(s_chImage),
+           (unsigned)wPacked, (double)sizeof(s_chImage) / (double)wPacked, 1u << FLASH_UNPACK_WINDOW_BITS);
+    printf("%-8s %-6s %10s %10s %10s %10s %10s\n", "device", "stream", "packets", "total ms", "prog calls",
+           "prog bytes", "readback");
+
+    for (size_t d = 0; d < BENCH_DEV_NUM; d++) {
+        bench_dev_t const *ptDev = &c_tBenchDevs[d];
+        uint32_t wBase = ptDev->ptBlob->ptFlashDev->DevAdr;
+
+        target_flash_init(wBase);
+
+        for (int m = 0; m < 2; m++) {
+            const uint8_t *pchStream = (m == 0) ? s_chImage : s_chPacked;
+            size_t wStream = (m == 0) ? sizeof(s_chImage) : wPacked;
+            flash_session_t tSession, *ptSession = (m == 0) ? &tSession : &s_tUnpack.tSession;
+            bool bOk = true;
+
+            /* start from a programmed region, so both variants really erase */
+            target_flash_erase(wBase, sizeof(s_chImage));
+            target_flash_write(wBase, s_chPattern, sizeof(s_chImage));
+            target_flash_sync(wBase);
+
+            host_flash_sim_stat_reset(ptDev->ptSim);
+            uint64_t wStart = host_flash_sim_clock_ns();
+            bOk &= (m == 0) ? target_flash_session_open(&tSession, wBase, sizeof(s_chImage))
+                            : flash_unpack_open(&s_tUnpack, wBase, sizeof(s_chImage));
+            for (size_t o = 0; o < wStream; o += BENCH_LINK_PACKET) {
+                size_t wLen = (wStream - o < BENCH_LINK_PACKET) ? wStream - o : BENCH_LINK_PACKET;
+                bench_link_wait(true);
+                if (m == 0) {
+                    bOk &= (target_flash_session_append(&tSession, &pchStream[o], wLen) == (int32_t)wLen);
+                } else {
+                    bOk &= (flash_unpack_feed(&s_tUnpack, &pchStream[o], wLen) >= 0);
+                }
+            }
+            bOk &= (m == 0) ? target_flash_session_close(&tSession) : flash_unpack_close(&s_tUnpack);
+            uint64_t wTotal = host_flash_sim_clock_ns() - wStart;
+
+            bool bMatch = bOk && ptSession->wCursor == wBase + sizeof(s_chImage) &&
+                          ptSession->tDigest.wCrc == wExpect && target_flash_checksum(wBase, sizeof(s_chImage)) == wExpect;
+            if (!bMatch) {
+                iFailed++;
+            }
+            printf("%-8s %-6s %10u %10.1f %10llu %10llu %10s\n", ptDev->pchName, (m == 0) ? "raw" : "packed",
+                   (unsigned)((wStream + BENCH_LINK_PACKET - 1) / BENCH_LINK_PACKET), (double)wTotal / 1e6,
+                   (unsigned long long)ptDev->ptSim->tStat.wProgCalls,
+                   (unsigned long long)ptDev->ptSim->tStat.wProgBytes, bMatch ? "ok" : "mismatch");
+        }
+
+        target_flash_uninit(wBase);
+    }
+
+    /* symbols split across pieces of any size */
+    uint32_t wBase = c_tBenchDevs[0].ptBlob->ptFlashDev->DevAdr;
+    target_flash_init(wBase);
+    target_flash_erase(wBase, sizeof(s_chImage));
+    bool bOk = flash_unpack_open(&s_tUnpack, wBase, sizeof(s_chImage));
+    for (size_t o = 0; o < wPacked; o += 1 + o % 7) {
+        size_t wLen = 1 + o % 7;
+        bOk &= (flash_unpack_feed(&s_tUnpack, &s_chPacked[o], (wPacked - o < wLen) ? wPacked - o : wLen) >= 0);
+    }
+    bOk &= flash_unpack_close(&s_tUnpack) && s_tUnpack.tSession.tDigest.wCrc == wExpect;
+    /* a stream decoding past the range is refused */
+    target_flash_erase(wBase, sizeof(s_chImage));
+    bOk &= flash_unpack_open(&s_tUnpack, wBase, sizeof(s_chImage) / 2) &&
+           flash_unpack_feed(&s_tUnpack, s_chPacked, wPacked) < 0;
+    flash_unpack_close(&s_tUnpack);
+    target_flash_uninit(wBase);
+    printf("odd sized pieces and overrun check: %s\n", bOk ? "ok" : "failed");
+    if (!bOk) {
+        iFailed++;
+    }
+
+    return iFailed;
+}
+
+#define BENCH_PLAN_STEPS    1024
+
+static int bench_plan(void)
+{
+    static const char *const c_pchKinds[] = {"sector", "sectors", "block", "chip"};
+    static flash_erase_step_t s_tSteps[BENCH_PLAN_STEPS];
+    int iFailed = 0;
+
+    printf("%-8s %-10s %10s %6s %-24s %10s %10s %10s %8s\n", "device", "range", "bytes", "steps",
+           "ops (kind:count)", "plan ms", "sector ms", "busy ms", "erased");
+
+    for (size_t d = 0; d < BENCH_DEV_NUM; d++) {
+        bench_dev_t const *ptDev = &c_tBenchDevs[d];
+        flash_dev_t const *ptFlashDev = ptDev->ptBlob->ptFlashDev;
+        uint32_t wBase = ptFlashDev->DevAdr;
+        struct {
+            const char *pchName;
+            uint32_t wAddr;
+            uint32_t wSize;
+        } const c_tRanges[] = {
+            {"aligned", wBase, BENCH_REGION_SIZE},
+            {"unaligned", wBase + 0x1800, BENCH_REGION_SIZE - 0x3000},
+            {"device", wBase, ptFlashDev->szDev},
+        };
+
+        target_flash_init(wBase);
+
+        for (size_t r = 0; r < sizeof(c_tRanges) / sizeof(c_tRanges[0]); r++) {
+            uint32_t wAddr = c_tRanges[r].wAddr, wSize = c_tRanges[r].wSize;
+            uint32_t wCount[4] = {0, 0, 0, 0}, wPlanMs = 0, wSectorMs = 0;
+            flash_sector_t tSector;
+            bool bErased = true;
+            char chOps[32];
+
+            /* the sector by sector cost the planner competes with */
+            target_flash_sector_info(wAddr, &tSector);
+            for (uint32_t a = tSector.wAddr; a < wAddr + wSize && target_flash_sector_info(a, &tSector);
+                 a += tSector.wSize) {
+                wSectorMs += ptFlashDev->toErase;
+            }
+
+            uint32_t wSteps = target_flash_erase_plan(wAddr, wSize, s_tSteps, BENCH_PLAN_STEPS, &wPlanMs);
+            for (uint32_t i = 0; i < wSteps && i < BENCH_PLAN_STEPS; i++) {
+                wCount[s_tSteps[i].chKind]++;
+            }
+            int iLen = 0;
+            for (int k = 0; k < 4; k++) {
+                if (wCount[k] != 0) {
+                    iLen += snprintf(chOps + iLen, sizeof(chOps) - (size_t)iLen, "%s%s:%u", iLen ? " " : "",
+                                     c_pchKinds[k], (unsigned)wCount[k]);
+                }
+            }
+            if (iLen == 0) {
+                snprintf(chOps, sizeof(chOps), "-");
+            }
+
+            /* dirty the ends and the middle so the erase has something to do */
+            target_flash_write(wAddr, s_chPattern, 256);
+            target_flash_write(wAddr + wSize / 2, s_chPattern, 256);
+            target_flash_write(wAddr + wSize - 256, s_chPattern, 256);
+            target_flash_sync(wAddr);
+
+            host_flash_sim_stat_reset(ptDev->ptSim);
+            int32_t nDone = target_flash_erase(wAddr, wSize);
+            double dBusyMs = (double)ptDev->ptSim->tStat.wBusyNs / 1e6;
+            double dPlanMs = (double)host_flash_sim_ms_to_ns(wPlanMs) / 1e6;
+
+            for (uint32_t o = 0; o < wSize && bErased; o += BENCH_REGION_SIZE) {
+                uint32_t wLen = (wSize - o < BENCH_REGION_SIZE) ? wSize - o : BENCH_REGION_SIZE;
+                target_flash_read(wAddr + o, s_chReadBack, wLen);
+                for (uint32_t i = 0; i < wLen; i++) {
+                    if (s_chReadBack[i] != ptFlashDev->valEmpty) {
+                        bErased = false;
+                        break;
+                    }
+                }
+            }
+
+            /* the device must spend the planned time (busy is on the -s time scale),
+               which never exceeds the sector by sector time */
+            if (nDone < (int32_t)wSize || !bErased || wPlanMs > wSectorMs ||
+                dBusyMs > dPlanMs * 1.001 + 0.01 || dBusyMs < dPlanMs * 0.999 - 0.01) {
+                iFailed++;
+            }
+
+            printf("%-8s %-10s %10u %6u %-24s %10u %10u %10.1f %8s\n", ptDev->pchName, c_tRanges[r].pchName,
+                   (unsigned)wSize, (unsigned)wSteps, chOps, (unsigned)wPlanMs, (unsigned)wSectorMs, dBusyMs,
+                   bErased ? "ok" : "FAIL");
+        }
+
+        target_flash_uninit(wBase);
+    }
+
+    return iFailed;
+}
+
+static int bench_qspi(void)
+{
+    spi_nor_t *ptNor = &host_qspi_flash_device_nor;
+    uint32_t wBase = ptNor->tDev.DevAdr;
+    uint64_t wReadNs[3] = {0, 0, 0};
+    int iFailed = 0;
+
+    /* what the driver learnt from the SFDP table of the model */
+    printf("jedec %02X%02X%02X, %lu kB, page %lu, sector %lu (0x%02X, %u ms)",
+           ptNor->chJedecId[0], ptNor->chJedecId[1], ptNor->chJedecId[2], ptNor->tDev.szDev / 1024,
+           ptNor->tDev.szPage, ptNor->tDev.sectors[0].szSector, ptNor->chSectorCmd,
+           (unsigned)ptNor->tErase.wSectorTime);
+    for (int i = 0; i < FLASH_BLOB_ERASE_BLOCK_NUM && ptNor->tErase.wBlockSize[i] != 0; i++) {
+        printf(", block %u (0x%02X, %u ms)", (unsigned)ptNor->tErase.wBlockSize[i], ptNor->chBlockCmd[i],
+               (unsigned)ptNor->tErase.wBlockTime[i]);
+    }
+    printf(", chip %u ms\n", (unsigned)ptNor->tErase.wChipTime);
+    if (ptNor->tDev.szDev != host_qspi_array_sim.ptFlashDev->szDev || ptNor->tDev.szPage != 256 ||
+        ptNor->tDev.sectors[0].szSector != 0x1000 || ptNor->tErase.wBlockSize[1] != 0x10000) {
+        iFailed++;
+    }
+
+    printf("%-6s %8s %10s %10s %10s %10s %8s %10s %8s %10s\n", "lines", "read cmd", "erase ms", "write ms",
+           "read ms", "read MB/s", "polls", "fixed ms", "rejected", "readback");
+
+    for (int l = 0; l < 3; l++) {
+        flash_erase_step_t tSteps[16];
+        uint64_t wFixedNs = 0;
+
+        /* the read command follows the wiring */
+        host_qspi_bus.chLines = (uint8_t)(1 << l);
+        if (!spi_nor_probe(ptNor)) {
+            iFailed++;
+            continue;
+        }
+        target_flash_init(wBase);
+        uint32_t wPolls = ptNor->wPolls;
+        uint64_t wRejected = host_qspi_model.tStat.wRejected;
+
+        uint64_t wStart = host_flash_sim_clock_ns();
+        target_flash_erase(wBase, BENCH_REGION_SIZE);
+        uint64_t wEraseNs = host_flash_sim_clock_ns() - wStart;
+
+        wStart = host_flash_sim_clock_ns();
+        target_flash_write(wBase, s_chPattern, BENCH_REGION_SIZE);
+        target_flash_sync(wBase);
+        uint64_t wWriteNs = host_flash_sim_clock_ns() - wStart;
+
+        memset(s_chReadBack, 0, BENCH_REGION_SIZE);
+        wStart = host_flash_sim_clock_ns();
+        target_flash_read(wBase, s_chReadBack, BENCH_REGION_SIZE);
+        wReadNs[l] = host_flash_sim_clock_ns() - wStart;
+        bool bOk = memcmp(s_chReadBack, s_chPattern, BENCH_REGION_SIZE) == 0;
+
+        /* the same work with fixed waits of the datasheet maximum instead of polling */
+        uint32_t wSteps = target_flash_erase_plan(wBase, BENCH_REGION_SIZE, tSteps, 16, NULL);
+        for (uint32_t i = 0; i < wSteps && i < 16; i++) {
+            uint32_t wMaxMs = ptNor->tDev.toErase;
+            for (int b = 0; tSteps[i].chKind == FLASH_ERASE_BLOCK && b < FLASH_BLOB_ERASE_BLOCK_NUM; b++) {
+                wMaxMs = (ptNor->tErase.wBlockSize[b] == tSteps[i].wSize) ? ptNor->wBlockTimeoutMs[b] : wMaxMs;
+            }
+            wFixedNs += host_flash_sim_ms_to_ns(wMaxMs);
+        }
+        wFixedNs += (uint64_t)(BENCH_REGION_SIZE / ptNor->tDev.szPage) * host_flash_sim_ms_to_ns(1) *
+                    ptNor->wProgTimeoutUs / 1000;
+
+        wPolls = ptNor->wPolls - wPolls;
+        wRejected = host_qspi_model.tStat.wRejected - wRejected;
+        if (!bOk || wRejected != 0 || wPolls == 0 || ptNor->chReadLines != (1 << l) ||
+            wFixedNs < wEraseNs + wWriteNs) {
+            iFailed++;
+        }
+        target_flash_uninit(wBase);
+
+        printf("%-6d     0x%02X %10.2f %10.2f %10.3f %10.1f %8u %10.2f %8llu %10s\n", 1 << l, ptNor->chReadCmd,
+               (double)wEraseNs / 1e6, (double)wWriteNs / 1e6, (double)wReadNs[l] / 1e6,
+               (double)BENCH_REGION_SIZE / ((double)wReadNs[l] / 1e9) / 1e6, (unsigned)wPolls,
+               (double)wFixedNs / 1e6, (unsigned long long)wRejected, bOk ? "ok" : "FAIL");
+    }
+
+    /* more data lines, shorter reads */
+    if (!(wReadNs[2] < wReadNs[1] && wReadNs[1] < wReadNs[0])) {
+        iFailed++;
+    }
+    /* QE is set already, probing again must not wear the non-volatile status register */
+    host_qspi_bus.chLines = 4;
+    uint64_t wStatusWrites = host_qspi_model.tStat.wStatusWrites;
+    if (!spi_nor_probe(ptNor) || host_qspi_model.tStat.wStatusWrites != wStatusWrites) {
+        iFailed++;
+    }
+
+    return iFailed;
+}
+
+/* one device of the parallel suite: erase a region, then write it */
+typedef struct {
+    uint32_t wAddr;
+    size_t wErase;                  // bytes erased first, 0 for none
+    size_t wWrite;                  // bytes of s_chPattern written after the erase, 0 for none
+    flash_req_t tErase;
+    flash_req_t tWrite;
+} bench_job_t;
+
+/*
+ * Runs the jobs one device after the other with the blocking API, or
+ * queues all of them at once for the executor. Returns the wall time.
+ */
+static uint64_t bench_jobs_run(bench_job_t *ptJobs, uint32_t wNum, bool bParallel, int *piFailed)
+{
+    uint32_t wAddr[HOST_FLASH_EXEC_DEV_MAX];
+    uint64_t wStart = host_flash_sim_now_ns();
+
+    if (!bParallel) {
+        for (uint32_t i = 0; i < wNum; i++) {
+            bench_job_t *ptJob = &ptJobs[i];
+            if ((ptJob->wErase != 0 && target_flash_erase(ptJob->wAddr, ptJob->wErase) < (int32_t)ptJob->wErase) ||
+                (ptJob->wWrite != 0 &&
+                 target_flash_write(ptJob->wAddr, s_chPattern, ptJob->wWrite) != (int32_t)ptJob->wWrite) ||
+                !target_flash_sync(ptJob->wAddr)) {
+                (*piFailed)++;
+            }
+        }
+        return host_flash_sim_now_ns() - wStart;
+    }
+
+    for (uint32_t i = 0; i < wNum; i++) {
+        wAddr[i] = ptJobs[i].wAddr;
+    }
+    if (!host_flash_exec_start(wAddr, wNum)) {
+        (*piFailed)++;
+    }
+    for (uint32_t i = 0; i < wNum; i++) {
+        bench_job_t *ptJob = &ptJobs[i];
+        ptJob->tErase.chStatus = ptJob->tWrite.chStatus = FLASH_REQ_DONE;
+        if ((ptJob->wErase != 0 &&
+             !target_flash_erase_async(&ptJob->tErase, ptJob->wAddr, ptJob->wErase, NULL, NULL)) ||
+            (ptJob->wWrite != 0 &&
+             !target_flash_write_async(&ptJob->tWrite, ptJob->wAddr, s_chPattern, ptJob->wWrite, NULL, NULL))) {
+            (*piFailed)++;
+        }
+    }
+    for (uint32_t i = 0; i < wNum; i++) {
+        bench_job_t *ptJob = &ptJobs[i];
+        while (ptJob->tErase.chStatus == FLASH_REQ_PENDING || ptJob->tWrite.chStatus == FLASH_REQ_PENDING) {
+            host_flash_sim_idle(50000);
+        }
+        if (ptJob->tErase.chStatus != FLASH_REQ_DONE || ptJob->tWrite.chStatus != FLASH_REQ_DONE ||
+            !target_flash_sync(ptJob->wAddr)) {
+            (*piFailed)++;
+        }
+    }
+    uint64_t wTime = host_flash_sim_now_ns() - wStart;
+    host_flash_exec_stop();
+
+    return wTime;
+}
+
+/* counts the jobs whose device does not hold the pattern */
+static int bench_jobs_check(const bench_job_t *ptJobs, uint32_t wNum)
+{
+    int iFailed = 0;
+
+    for (uint32_t i = 0; i < wNum; i++) {
+        memset(s_chReadBack, 0, ptJobs[i].wWrite);
+        if (target_flash_read(ptJobs[i].wAddr, s_chReadBack, ptJobs[i].wWrite) != (int32_t)ptJobs[i].wWrite ||
+            memcmp(s_chReadBack, s_chPattern, ptJobs[i].wWrite) != 0) {
+            iFailed++;
+        }
+    }
+    return iFailed;
+}
+
+static int bench_parallel(void)
+{
+    static bench_job_t s_tJobs[8];
+    host_flash_sim_mode_t tMode = host_flash_sim_get_mode();
+    int iFailed = 0;
+
+    /* threads only overlap in real time; sleep the busy time, so one core is enough */
+    host_flash_sim_set_mode(HOST_FLASH_SIM_REALTIME);
+    host_flash_sim_set_spin(0);
+
+    /*
+     * erase+write the same amount on 1..8 identical devices; the wall time
+     * depends on the host, whether the executor works is told by how much
+     * of the modelled busy time the devices spent at the same time
+     */
+    printf("%-8s %8s %10s %12s %10s %12s %8s %8s %10s\n", "devices", "kB", "serial ms", "serial MB/s",
+           "exec ms", "exec MB/s", "speedup", "overlap", "readback");
+    for (uint32_t n = 1; n <= 8; n <<= 1) {
+        uint64_t wTime[2], wOverlap[2], wBusy[2];
+        int iBad = 0;
+
+        for (uint32_t i = 0; i < n; i++) {
+            memset(&s_tJobs[i], 0, sizeof(s_tJobs[i]));
+            s_tJobs[i].wAddr = HOST_SMALL_FLASH_BASE + i * HOST_SMALL_FLASH_SIZE;
+            s_tJobs[i].wErase = HOST_SMALL_FLASH_SIZE;
+            s_tJobs[i].wWrite = HOST_SMALL_FLASH_SIZE;
+            target_flash_init(s_tJobs[i].wAddr);
+        }
+        for (int m = 0; m < 2; m++) {
+            host_flash_sim_overlap_ns(NULL);
+            wTime[m] = bench_jobs_run(s_tJobs, n, m == 1, &iFailed);
+            wOverlap[m] = host_flash_sim_overlap_ns(&wBusy[m]);
+            iBad += bench_jobs_check(s_tJobs, n);
+        }
+        for (uint32_t i = 0; i < n; i++) {
+            target_flash_uninit(s_tJobs[i].wAddr);
+        }
+
+        double fBytes = (double)n * HOST_SMALL_FLASH_SIZE;
+        double fSpeedup = (double)wTime[0] / (double)wTime[1];
+        double fOverlap = wBusy[1] ? (double)wOverlap[1] / (double)wBusy[1] : 0;
+        /* one device never overlaps; with more, most of the busy time should */
+        if (iBad != 0 || wOverlap[0] != 0 || (n > 1 && fOverlap < 0.5)) {
+            iFailed++;
+        }
+        printf("%-8u %8u %10.1f %12.2f %10.1f %12.2f %7.2fx %7.0f%% %10s\n", (unsigned)n,
+               (unsigned)(n * HOST_SMALL_FLASH_SIZE / 1024),
+               (double)wTime[0] / 1e6, fBytes * 1e3 / (double)wTime[0],
+               (double)wTime[1] / 1e6, fBytes * 1e3 / (double)wTime[1], fSpeedup, fOverlap * 100,
+               iBad ? "FAIL" : "ok");
+    }
+
+    /* erase the external NOR while programming on-chip flash */
+    {
+        uint64_t wTime[2], wOverlap[2], wBusy[2];
+        int iBad = 0;
+
+        memset(s_tJobs, 0, 2 * sizeof(s_tJobs[0]));
+        s_tJobs[0].wAddr = host_spinor_flash_device.ptFlashDev->DevAdr;
+        s_tJobs[0].wErase = 1024 * 1024;
+        s_tJobs[1].wAddr = host_uniform_flash_device.ptFlashDev->DevAdr;
+        s_tJobs[1].wWrite = BENCH_REGION_SIZE;
+        target_flash_init(s_tJobs[0].wAddr);
+        target_flash_init(s_tJobs[1].wAddr);
+
+        printf("%-8s %10s %10s %8s %8s %10s\n", "job", "serial ms", "exec ms", "speedup", "overlap", "readback");
+        for (int m = 0; m < 2; m++) {
+            /* the image goes into an already erased on-chip region */
+            target_flash_erase(s_tJobs[1].wAddr, BENCH_REGION_SIZE);
+            host_flash_sim_overlap_ns(NULL);
+            wTime[m] = bench_jobs_run(s_tJobs, 2, m == 1, &iFailed);
+            wOverlap[m] = host_flash_sim_overlap_ns(&wBusy[m]);
+            iBad += bench_jobs_check(&s_tJobs[1], 1);
+        }
+        target_flash_uninit(s_tJobs[0].wAddr);
+        target_flash_uninit(s_tJobs[1].wAddr);
+
+        /* the NOR erases in the background, the on-chip writes should fall into it */
+        double fOverlap = wBusy[1] ? (double)wOverlap[1] / (double)wBusy[1] : 0;
+        if (iBad != 0 || wOverlap[0] != 0 || fOverlap < 0.5) {
+            iFailed++;
+        }
+        printf("%-8s %10.1f %10.1f %7.2fx %7.0f%% %10s\n", "nor+mcu", (double)wTime[0] / 1e6,
+               (double)wTime[1] / 1e6, (double)wTime[0] / (double)wTime[1], fOverlap * 100, iBad ? "FAIL" : "ok");
+    }
+
+    host_flash_sim_set_spin(HOST_FLASH_SIM_SPIN_NS);
+    host_flash_sim_set_mode(tMode);
+
+    return iFailed;
+}
+
+/* lock probe of the locks suite: takes the lock once, flags when it got it */
+typedef struct {
+    flash_rwlock_t *ptLock;
+    bool bWrite;
+    volatile bool bGot;
+    volatile bool bRelease;
+} bench_lock_probe_t;
+
+static void *bench_lock_probe(void *pArg)
+{
+    bench_lock_probe_t *ptProbe = (bench_lock_probe_t *)pArg;
+
+    if (ptProbe->bWrite) {
+        flash_rwlock_write(ptProbe->ptLock);
+    } else {
+        flash_rwlock_read(ptProbe->ptLock);
+    }
+    ptProbe->bGot = true;
+    while (!ptProbe->bRelease) {
+        usleep(100);
+    }
+    if (ptProbe->bWrite) {
+        flash_rwlock_write_release(ptProbe->ptLock);
+    } else {
+        flash_rwlock_read_release(ptProbe->ptLock);
+    }
+    return NULL;
+}
+
+static void bench_lock_probe_start(bench_lock_probe_t *ptProbe, pthread_t *ptThread,
+                                   flash_rwlock_t *ptLock, bool bWrite)
+{
+    ptProbe->ptLock = ptLock;
+    ptProbe->bWrite = bWrite;
+    ptProbe->bGot = ptProbe->bRelease = false;
+    pthread_create(ptThread, NULL, bench_lock_probe, ptProbe);
+    /* long enough for the probe to block or get the lock */
+    usleep(20000);
+}
+
+/* reader thread of the locks suite: 4kB reads of one device until stopped */
+typedef struct {
+    uint32_t wAddr;
+    volatile bool bStop;
+    uint32_t wReads;
+    uint32_t wErrors;
+    uint64_t wMaxNs;
+    uint8_t chBuf[4096];
+} bench_reader_t;
+
+static void *bench_reader(void *pArg)
+{
+    bench_reader_t *ptReader = (bench_reader_t *)pArg;
+
+    while (!ptReader->bStop) {
+        uint64_t wStart = host_flash_sim_now_ns();
+        if (target_flash_read(ptReader->wAddr, ptReader->chBuf, sizeof(ptReader->chBuf)) !=
+            (int32_t)sizeof(ptReader->chBuf)) {
+            ptReader->wErrors++;
+        }
+        uint64_t wNs = host_flash_sim_now_ns() - wStart;
+        ptReader->wMaxNs = (wNs > ptReader->wMaxNs) ? wNs : ptReader->wMaxNs;
+        ptReader->wReads++;
+        host_flash_sim_idle(200000);
+    }
+    return NULL;
+}
+
+static int bench_locks(void)
+{
+    enum {BENCH_READERS = 4};
+    static bench_reader_t s_tReaders[BENCH_READERS];
+    static bench_job_t s_tJobs[2];
+    host_flash_sim_mode_t tMode = host_flash_sim_get_mode();
+    flash_rwlock_t tLock = {0};
+    bench_lock_probe_t tProbe[3];
+    pthread_t tThread[BENCH_READERS];
+    int iFailed = 0;
+
+    /* readers share the lock, a writer excludes them, readers arriving after a waiting writer queue behind it */
+    if (!flash_rwlock_init(&tLock)) {
+        return 1;
+    }
+    flash_rwlock_read(&tLock);
+    bench_lock_probe_start(&tProbe[0], &tThread[0], &tLock, false);
+    bool bShared = tProbe[0].bGot;
+    bench_lock_probe_start(&tProbe[1], &tThread[1], &tLock, true);
+    bool bExcluded = !tProbe[1].bGot;
+    bench_lock_probe_start(&tProbe[2], &tThread[2], &tLock, false);
+    bool bQueued = !tProbe[2].bGot;
+    flash_rwlock_read_release(&tLock);
+    tProbe[0].bRelease = true;
+    pthread_join(tThread[0], NULL);
+    usleep(20000);
+    bool bWriter = tProbe[1].bGot && !tProbe[2].bGot;
+    tProbe[1].bRelease = tProbe[2].bRelease = true;
+    pthread_join(tThread[1], NULL);
+    pthread_join(tThread[2], NULL);
+    iFailed += !(bShared && bExcluded && bQueued && bWriter);
+    printf("rwlock: readers shared %s, writer exclusive %s, late reader queued %s, writer next %s\n",
+           bShared ? "ok" : "FAIL", bExcluded ? "ok" : "FAIL", bQueued ? "ok" : "FAIL", bWriter ? "ok" : "FAIL");
+
+    /* 4 tasks reading on-chip flash while the executor erases the NOR / writes the on-chip flash */
+    host_flash_sim_set_mode(HOST_FLASH_SIM_REALTIME);
+    host_flash_sim_set_spin(0);
+
+    uint32_t wRead = host_mixed_flash_device.ptFlashDev->DevAdr;
+    printf("%-12s %10s %8s %12s %10s %8s\n", "busy", "busy ms", "reads", "max read ms", "step ms", "result");
+    for (int c = 0; c < 2; c++) {
+        flash_erase_step_t tSteps[64];
+        uint32_t wStepMax = 0;
+        uint64_t wBusy;
+        bool bOk = true;
+
+        memset(s_tJobs, 0, sizeof(s_tJobs));
+        if (c == 0) {
+            s_tJobs[0].wAddr = host_spinor_flash_device.ptFlashDev->DevAdr;
+            s_tJobs[0].wErase = 1024 * 1024;
+            uint32_t wSteps = target_flash_erase_plan(s_tJobs[0].wAddr, s_tJobs[0].wErase, tSteps, 64, NULL);
+            for (uint32_t i = 0; i < wSteps && i < 64; i++) {
+                wStepMax = (tSteps[i].wTime > wStepMax) ? tSteps[i].wTime : wStepMax;
+            }
+        } else {
+            /* the same device: reads wait for one page program at most */
+            s_tJobs[0].wAddr = wRead + BENCH_REGION_SIZE;
+            s_tJobs[0].wWrite = BENCH_REGION_SIZE / 4;
+            target_flash_erase(s_tJobs[0].wAddr, s_tJobs[0].wWrite);
+            wStepMax = (uint32_t)host_mixed_flash_device.ptFlashDev->toProg;
+        }
+        target_flash_init(s_tJobs[0].wAddr);
+        target_flash_init(wRead);
+
+        for (int r = 0; r < BENCH_READERS; r++) {
+            memset(&s_tReaders[r], 0, sizeof(s_tReaders[r]));
+            s_tReaders[r].wAddr = wRead + r * sizeof(s_tReaders[r].chBuf);
+            pthread_create(&tThread[r], NULL, bench_reader, &s_tReaders[r]);
+        }
+        wBusy = bench_jobs_run(s_tJobs, 1, true, &iFailed);
+
+        uint32_t wReads = 0;
+        uint64_t wMaxNs = 0;
+        for (int r = 0; r < BENCH_READERS; r++) {
+            s_tReaders[r].bStop = true;
+            pthread_join(tThread[r], NULL);
+            wReads += s_tReaders[r].wReads;
+            wMaxNs = (s_tReaders[r].wMaxNs > wMaxNs) ? s_tReaders[r].wMaxNs : wMaxNs;
+            bOk &= (s_tReaders[r].wErrors == 0);
+        }
+        target_flash_uninit(s_tJobs[0].wAddr);
+        target_flash_uninit(wRead);
+
+        /* reads never wait for the whole job, nor for a step of another device */
+        uint64_t wStepNs = host_flash_sim_ms_to_ns(wStepMax);
+        bOk &= (wReads >= BENCH_READERS && wMaxNs < wBusy / 4 && (c != 0 || wMaxNs < wStepNs / 2));
+        iFailed += !bOk;
+        printf("%-12s %10.1f %8u %12.3f %10.3f %8s\n", c ? "mixed write" : "spinor erase",
+               (double)wBusy / 1e6, (unsigned)wReads, (double)wMaxNs / 1e6, (double)wStepNs / 1e6,
+               bOk ? "ok" : "FAIL");
+    }
+
+    host_flash_sim_set_spin(HOST_FLASH_SIM_SPIN_NS);
+    host_flash_sim_set_mode(tMode);
+
+    return iFailed;
+}
+
+/* completion order of the banks suite */
+static uint32_t s_wBankDone[2];
+static uint32_t s_wBankDoneNum;
+
+static void bench_bank_done(flash_req_t *ptReq)
+{
+    s_wBankDone[s_wBankDoneNum++ & 1] = (uint32_t)(uintptr_t)ptReq->pTarget;
+}
+
+static int bench_banks(void)
+{
+    const flash_blob_t *ptBlob = &host_dual_flash_device;
+    uint32_t wBase = ptBlob->ptFlashDev->DevAdr;
+    uint32_t wBank[2] = {wBase, wBase + ptBlob->wBankSize};
+    size_t wSize = 64 * 1024;
+    int iFailed = 0;
+
+    target_flash_init(wBase);
+
+    /* IRQs are masked only for steps on the bank the code runs from */
+    printf("%-6s %-6s %8s %10s %14s %8s\n", "code", "bank", "windows", "call ms", "max masked us", "stall");
+    for (int c = 0; c < 2; c++) {
+        host_flash_sim_set_code_addr(c ? wBank[0] + 0x100 : 0);
+        for (int b = 0; b < 2; b++) {
+            uint32_t wAddr = wBank[b] + ptBlob->wBankSize / 2;
+            flash_irq_stat_t tStat;
+            flash_bank_t tBank;
+
+            target_flash_irq_stat(NULL, true);
+            uint64_t wStart = host_flash_sim_clock_ns();
+            bool bOk = target_flash_erase(wAddr, wSize) == (int32_t)wSize &&
+                       target_flash_write(wAddr, s_chPattern, wSize) == (int32_t)wSize &&
+                       target_flash_sync(wAddr);
+            uint64_t wCall = host_flash_sim_clock_ns() - wStart;
+            target_flash_irq_stat(&tStat, false);
+
+            bool bStall = (c == 1 && b == 0);
+            bOk &= target_flash_bank_info(wAddr, &tBank) && tBank.chIndex == b && tBank.bStall == bStall &&
+                   (bStall ? tStat.wWindows > 0 : tStat.wWindows == 0);
+            iFailed += !bOk;
+            printf("%-6s %-6d %8u %10.1f %14u %8s%s\n", c ? "bank 0" : "RAM", b, (unsigned)tStat.wWindows,
+                   (double)wCall / 1e6, (unsigned)tStat.wMax, tBank.bStall ? "yes" : "no", bOk ? "" : "  FAIL");
+        }
+    }
+
+    /* two queued writes, one per bank: which one the device works on first */
+    printf("%-6s %-8s %-8s %-10s %8s\n", "code", "reading", "queued", "done first", "polls");
+    for (int c = 0; c < 3; c++) {
+        static flash_req_t s_tReq[2];
+        uint8_t chProbe[256];
+        uint32_t wFirst = (c == 2) ? 1 : 0;     // bank of the request queued first
+        uint32_t wExpect = (c == 0) ? 0 : 1 - wFirst;
+        uint32_t wPolls = 0;
+
+        host_flash_sim_set_code_addr(c == 1 ? wBank[0] + 0x100 : 0);
+        for (uint32_t b = 0; b < 2; b++) {
+            target_flash_erase(wBank[b] + ptBlob->wBankSize / 2, wSize);
+        }
+        s_wBankDoneNum = 0;
+        for (uint32_t i = 0; i < 2; i++) {
+            uint32_t b = i ? 1 - wFirst : wFirst;
+            s_tReq[i].chStatus = FLASH_REQ_DONE;
+            if (!target_flash_write_async(&s_tReq[i], wBank[b] + ptBlob->wBankSize / 2, s_chPattern, wSize,
+                                          bench_bank_done, (void *)(uintptr_t)b)) {
+                iFailed++;
+            }
+        }
+        do {
+            if (c == 2) {
+                /* the application keeps reading the bank queued first */
+                target_flash_read(wBank[wFirst], chProbe, sizeof(chProbe));
+            }
+            wPolls++;
+        } while (target_flash_poll_dev(wBase));
+        target_flash_sync(wBase);
+
+        bool bOk = s_wBankDoneNum == 2 && s_wBankDone[0] == wExpect &&
+                   s_tReq[0].chStatus == FLASH_REQ_DONE && s_tReq[1].chStatus == FLASH_REQ_DONE;
+        for (uint32_t b = 0; b < 2; b++) {
+            bOk &= target_flash_read(wBank[b] + ptBlob->wBankSize / 2, s_chReadBack, wSize) == (int32_t)wSize &&
+                   memcmp(s_chReadBack, s_chPattern, wSize) == 0;
+        }
+        iFailed += !bOk;
+        printf("%-6s %-8s bank %-3u bank %-5u %8u%s\n", c == 1 ? "bank 0" : "RAM", c == 2 ? "bank 1" : "-",
+               (unsigned)wFirst, (unsigned)s_wBankDone[0], (unsigned)wPolls, bOk ? "" : "  FAIL");
+    }
+
+    host_flash_sim_set_code_addr(0);
+    target_flash_uninit(wBase);
+
+    return iFailed;
+}
+
+/*
+ * Writes wSize bytes a programming page at a time, with wProduceNs of
+ * simulated work before each page. bBlocking waits for every page before
+ * producing the next one, as without the program pipeline. Returns the
+ * virtual time, pwWall optionally receives the simulated clock time, which
+ * includes how long the host took.
+ */
+static uint64_t bench_pipe_run(uint32_t wAddr, size_t wSize, uint32_t wPage, uint64_t wProduceNs, bool bBlocking,
+                               uint64_t *pwWall, bool *pbOk)
+{
+    *pbOk &= target_flash_erase(wAddr, wSize) == (int32_t)wSize;
+
+    uint64_t wStart = host_flash_sim_clock_ns();
+    uint64_t wVirtual = host_flash_sim_virtual_ns();
+    for (size_t i = 0; i < wSize; i += wPage) {
+        host_flash_sim_idle(wProduceNs);
+        *pbOk &= target_flash_write(wAddr + i, s_chPattern + i, wPage) == (int32_t)wPage;
+        if (bBlocking) {
+            *pbOk &= target_flash_sync(wAddr);
+        }
+    }
+    *pbOk &= target_flash_sync(wAddr);
+    uint64_t wTime = host_flash_sim_virtual_ns() - wVirtual;
+    if (pwWall != NULL) {
+        *pwWall = host_flash_sim_clock_ns() - wStart;
+    }
+
+    *pbOk &= target_flash_read(wAddr, s_chReadBack, wSize) == (int32_t)wSize &&
+             memcmp(s_chReadBack, s_chPattern, wSize) == 0;
+    return wTime;
+}
+
+static int bench_pipeline(void)
+{
+    const flash_blob_t *ptBlobs[2] = {&host_qspi_flash_device, &host_spinor_flash_device};
+    size_t wSize = 32 * 1024;
+    host_flash_sim_mode_t tMode = host_flash_sim_get_mode();
+    uint32_t wNum, wDen;
+    int iFailed = 0;
+
+    /*
+     * At the default scale the bus transfer of a page, which the CPU does
+     * and which cannot overlap, takes longer than programming it. Real time
+     * would add the host sleep granularity to every status poll. The checks
+     * use virtual time only, the posted devices finish in it as well, so a
+     * slow host (or a sanitizer build) does not change the result.
+     */
+    host_flash_sim_get_time_scale(&wNum, &wDen);
+    host_flash_sim_set_time_scale(1, 10);
+    host_flash_sim_set_mode(HOST_FLASH_SIM_VIRTUAL);
+    printf("%-8s %9s %11s %11s %12s %12s %8s %8s %8s\n", "device", "produce", "produce ms", "flash ms",
+           "blocking ms", "pipelined ms", "speedup", "vs max", "wall");
+    for (int d = 0; d < 2; d++) {
+        uint32_t wAddr = ptBlobs[d]->ptFlashDev->DevAdr;
+        uint32_t wPage = ptBlobs[d]->ptFlashDev->szPage;
+        uint32_t wPages = wSize / wPage;
+        bool bOk = true;
+
+        target_flash_init(wAddr);
+        /* flash time alone: no production, every page waited for */
+        uint64_t wFlashNs = bench_pipe_run(wAddr, wSize, wPage, 0, true, NULL, &bOk);
+
+        /* producer at half, equal and twice the flash speed */
+        for (int p = 1; p <= 4; p *= 2) {
+            uint64_t wProduceNs = wFlashNs / wPages * p / 2;
+            uint64_t wWall[2];
+            uint64_t wBlocking = bench_pipe_run(wAddr, wSize, wPage, wProduceNs, true, &wWall[0], &bOk);
+            uint64_t wPipelined = bench_pipe_run(wAddr, wSize, wPage, wProduceNs, false, &wWall[1], &bOk);
+            uint64_t wMax = (wProduceNs * wPages > wFlashNs) ? wProduceNs * wPages : wFlashNs;
+            double dSpeedup = (double)wBlocking / (double)wPipelined;
+            double dVsMax = (double)wPipelined / (double)wMax;
+
+            /*
+             * overlap: close to the slower of the two, plus the page transfers
+             * and readbacks the CPU does itself; devices without ProgramStart keep blocking
+             */
+            bool bRow = bOk && (ptBlobs[d]->ptProgAsync != NULL ? (dVsMax < 1.3 && dSpeedup > 1.25)
+                                                                 : (dSpeedup < 1.1 && dSpeedup > 0.9));
+            iFailed += !bRow;
+            printf("%-8s %7.1fx %11.2f %11.2f %12.2f %12.2f %8.2f %8.2f %7.2fx%s\n", d ? "spinor" : "qspi",
+                   (double)p / 2, (double)(wProduceNs * wPages) / 1e6, (double)wFlashNs / 1e6,
+                   (double)wBlocking / 1e6, (double)wPipelined / 1e6, dSpeedup, dVsMax,
+                   (double)wWall[0] / (double)wWall[1], bRow ? "" : "  FAIL");
+        }
+        target_flash_uninit(wAddr);
+    }
+    host_flash_sim_set_time_scale(wNum, wDen);
+    host_flash_sim_set_mode(tMode);
+
+    return iFailed;
+}
+
+/* Variants of the FLM images bench_flm_build() makes */
+enum {
+    BENCH_FLM_NO_PROGRAM = 1,       // ProgramPage missing from .symtab
+    BENCH_FLM_ARM_ENTRY = 2,        // EraseSector without the Thumb bit
+    BENCH_FLM_NO_END = 4,           // sector list not terminated inside DevDscr
+    BENCH_FLM_NOBITS = 8,           // zero initialised PrgData, i.e. host_flm_sim[0]
+};
+
+static void bench_put16(uint8_t *pchBuf, uint32_t wValue)
+{
+    pchBuf[0] = (uint8_t)wValue;
+    pchBuf[1] = (uint8_t)(wValue >> 8);
+}
+
+static void bench_put32(uint8_t *pchBuf, uint32_t wValue)
+{
+    bench_put16(pchBuf, wValue);
+    bench_put16(pchBuf + 2, wValue >> 16);
+}
+
+static uint32_t bench_str_add(uint8_t *pchTab, uint32_t *pwLen, const char *pchStr)
+{
+    uint32_t wOffset = *pwLen;
+
+    memcpy(pchTab + wOffset, pchStr, strlen(pchStr) + 1);
+    *pwLen += (uint32_t)strlen(pchStr) + 1;
+    return wOffset;
+}
+
+/*
+ * An FLM image for host_flash_flm_call(): what the linker of an algorithm
+ * writes, minus debug sections. Each entry point is 8 bytes of PrgCode
+ * holding its flash_flm_entry_t, PrgData holds the simulated device.
+ */
+static size_t bench_flm_build(uint8_t *pchImage, const flash_dev_t *ptDev, uint32_t wSim, uint32_t wFlags)
+{
+    static const char *const c_pchEntries[] = {"Init", "UnInit", "EraseChip", "EraseSector", "ProgramPage"};
+    enum { CODE = 52, CODE_SIZE = 0x40, DATA = CODE + CODE_SIZE, DSCR = DATA + 4 };
+    uint32_t wSym, wStr, wShstr, wShdr, wEnd;
+    uint32_t wStrLen = 1, wShstrLen = 1, wSymNum = 1;     // string tables start with an empty string
+    uint32_t wName[6], wSectors = 0;
+
+    memset(pchImage, 0, 4096);
+
+    /* PrgCode and PrgData */
+    for (uint32_t e = 0; e < FLASH_FLM_ENTRY_NUM; e++) {
+        bench_put32(&pchImage[CODE + e * 8], e);
+    }
+    bench_put32(&pchImage[DATA], wSim);
+
+    /* DevDscr, DevName grows to 128 characters */
+    bench_put16(&pchImage[DSCR], ptDev->Vers);
+    memcpy(&pchImage[DSCR + 2], ptDev->DevName, sizeof(ptDev->DevName));
+    bench_put16(&pchImage[DSCR + 130], ptDev->DevType);
+    bench_put32(&pchImage[DSCR + 132], (uint32_t)ptDev->DevAdr);
+    bench_put32(&pchImage[DSCR + 136], (uint32_t)ptDev->szDev);
+    bench_put32(&pchImage[DSCR + 140], (uint32_t)ptDev->szPage);
+    bench_put32(&pchImage[DSCR + 144], (uint32_t)ptDev->Res);
+    pchImage[DSCR + 148] = ptDev->valEmpty;
+    bench_put32(&pchImage[DSCR + 152], (uint32_t)ptDev->toProg);
+    bench_put32(&pchImage[DSCR + 156], (uint32_t)ptDev->toErase);
+    do {
+        bench_put32(&pchImage[DSCR + 160 + wSectors * 8], (uint32_t)ptDev->sectors[wSectors].szSector);
+        bench_put32(&pchImage[DSCR + 164 + wSectors * 8], (uint32_t)ptDev->sectors[wSectors].AddrSector);
+    } while (ptDev->sectors[wSectors++].szSector != 0xFFFFFFFF);
+    if (wFlags & BENCH_FLM_NO_END) {
+        wSectors--;
+    }
+
+    /* .strtab and .symtab: the entry points, then the FlashDevice object */
+    wSym = (DSCR + 160 + wSectors * 8 + 3) & ~3u;
+    wStr = wSym + 7 * 16;
+    for (uint32_t e = 0; e < FLASH_FLM_ENTRY_NUM; e++) {
+        wName[e] = bench_str_add(&pchImage[wStr], &wStrLen, c_pchEntries[e]);
+    }
+    wName[5] = bench_str_add(&pchImage[wStr], &wStrLen, "FlashDevice");
+    for (uint32_t e = 0; e <= FLASH_FLM_ENTRY_NUM; e++) {
+        uint8_t *pchSym = &pchImage[wSym + wSymNum * 16];
+        if (e == FLASH_FLM_PROGRAM_PAGE && (wFlags & BENCH_FLM_NO_PROGRAM)) {
+            continue;
+        }
+        bench_put32(&pchSym[0], wName[e]);
+        if (e < FLASH_FLM_ENTRY_NUM) {
+            bool bArm = (e == FLASH_FLM_ERASE_SECTOR) && (wFlags & BENCH_FLM_ARM_ENTRY);
+            bench_put32(&pchSym[4], e * 8 + (bArm ? 0 : 1));
+            pchSym[12] = (1 << 4) | 2;          // GLOBAL FUNC
+            bench_put16(&pchSym[14], 1);        // PrgCode
+        } else {
+            bench_put32(&pchSym[4], DATA - CODE + 4);
+            pchSym[12] = (1 << 4) | 1;          // GLOBAL OBJECT
+            bench_put16(&pchSym[14], 3);        // DevDscr
+        }
+        wSymNum++;
+    }
+
+    /* .shstrtab and the section headers */
+    wShstr = (wStr + wStrLen + 3) & ~3u;
+    static const char *const c_pchSections[] = {"", "PrgCode", "PrgData", "DevDscr", ".symtab", ".strtab",
+                                                ".shstrtab"};
+    uint32_t wSecName[7];
+    for (uint32_t i = 0; i < 7; i++) {
+        wSecName[i] = (i == 0) ? 0 : bench_str_add(&pchImage[wShstr], &wShstrLen, c_pchSections[i]);
+    }
+    wShdr = (wShstr + wShstrLen + 3) & ~3u;
+    const uint32_t c_wSec[7][6] = {
+        /* type, addr, offset, size, link, entsize */
+        {0, 0, 0, 0, 0, 0},
+        {1, 0, CODE, CODE_SIZE, 0, 0},
+        {(wFlags & BENCH_FLM_NOBITS) ? 8 : 1, CODE_SIZE, DATA, 4, 0, 0},
+        {1, DATA - CODE + 4, DSCR, 160 + wSectors * 8, 0, 0},
+        {2, 0, wSym, wSymNum * 16, 5, 16},
+        {3, 0, wStr, wStrLen, 0, 0},
+        {3, 0, wShstr, wShstrLen, 0, 0},
+    };
+    for (uint32_t i = 0; i < 7; i++) {
+        uint8_t *pchShdr = &pchImage[wShdr + i * 40];
+        bench_put32(&pchShdr[0], wSecName[i]);
+        bench_put32(&pchShdr[4], c_wSec[i][0]);
+        bench_put32(&pchShdr[12], c_wSec[i][1]);
+        bench_put32(&pchShdr[16], c_wSec[i][2]);
+        bench_put32(&pchShdr[20], c_wSec[i][3]);
+        bench_put32(&pchShdr[24], c_wSec[i][4]);
+        bench_put32(&pchShdr[36], c_wSec[i][5]);
+    }
+    wEnd = wShdr + 7 * 40;
+
+    /* ELF header: ET_EXEC, EM_ARM */
+    memcpy(pchImage, "\x7f" "ELF\x01\x01\x01", 7);
+    bench_put16(&pchImage[16], 2);
+    bench_put16(&pchImage[18], 40);
+    bench_put32(&pchImage[20], 1);
+    bench_put32(&pchImage[32], wShdr);
+    bench_put16(&pchImage[40], 52);
+    bench_put16(&pchImage[46], 40);
+    bench_put16(&pchImage[48], 7);
+    bench_put16(&pchImage[50], 6);
+
+    return wEnd;
+}
+
+static bool bench_flm_same_dev(const flash_dev_t *ptA, const flash_dev_t *ptB)
+{
+    for (int i = 0; i < SECTOR_NUM; i++) {
+        if (ptA->sectors[i].szSector != ptB->sectors[i].szSector ||
+            ptA->sectors[i].AddrSector != ptB->sectors[i].AddrSector) {
+            return false;
+        }
+        if (ptA->sectors[i].szSector == 0xFFFFFFFF) {
+            break;
+        }
+    }
+    return ptA->Vers == ptB->Vers && strcmp(ptA->DevName, ptB->DevName) == 0 && ptA->DevType == ptB->DevType &&
+           ptA->DevAdr == ptB->DevAdr && ptA->szDev == ptB->szDev && ptA->szPage == ptB->szPage &&
+           ptA->valEmpty == ptB->valEmpty && ptA->toProg == ptB->toProg && ptA->toErase == ptB->toErase;
+}
+
+static int bench_flm(void)
+{
+    static const char *const c_pchErr[] = {"OK", "READ", "ELF", "SECTION", "SYMBOL", "DEVDSCR", "EXEC", "SLOT",
+                                           "REGISTER"};
+    static uint8_t s_chImage[4096];
+    static uint32_t s_wExec[3][64];     // execution regions, word aligned
+    static flash_flm_t s_tFlm[3];
+    const flash_dev_t *ptSpi = host_flm_sim[0].ptFlashDev;
+    const flash_dev_t *ptMixed = host_flm_sim[1].ptFlashDev;
+    flash_dev_t tThird = *ptSpi;
+    uint32_t wPart = host_uniform_flash_device.ptFlashDev->DevAdr + host_uniform_flash_device.ptFlashDev->szDev -
+                     0x2000;
+    int iFailed = 0;
+
+    tThird.DevAdr = ptSpi->DevAdr + 0x00200000;
+
+    typedef struct {
+        const char *pchName;
+        flash_flm_err_t tExpect;
+    } bench_flm_case_t;
+    static const bench_flm_case_t c_tCases[] = {
+        {"bad magic", FLASH_FLM_ERR_ELF},
+        {"big endian", FLASH_FLM_ERR_ELF},
+        {"truncated", FLASH_FLM_ERR_READ},
+        {"no ProgramPage", FLASH_FLM_ERR_SYMBOL},
+        {"ARM state entry", FLASH_FLM_ERR_SYMBOL},
+        {"sectors not ended", FLASH_FLM_ERR_DEVDSCR},
+        {"exec region short", FLASH_FLM_ERR_EXEC},
+        {"exec misaligned", FLASH_FLM_ERR_EXEC},
+        {"spi from RAM", FLASH_FLM_OK},
+        {"spi again, other obj", FLASH_FLM_ERR_REGISTER},
+        {"spi again, same obj", FLASH_FLM_ERR_SLOT},
+        {"mixed from partition", FLASH_FLM_OK},
+        {"third device", FLASH_FLM_ERR_SLOT},
+    };
+
+    printf("%-22s %8s %8s %9s\n", "image", "result", "expect", "load us");
+    for (size_t c = 0; c < sizeof(c_tCases) / sizeof(c_tCases[0]); c++) {
+        size_t wSize = bench_flm_build(s_chImage, ptSpi, 0, BENCH_FLM_NOBITS);
+        void *pExec = s_wExec[0];
+        size_t wExecSize = sizeof(s_wExec[0]);
+        flash_flm_t *ptFlm = &s_tFlm[0];
+        flash_flm_err_t tErr;
+        uint64_t wStart;
+
+        switch (c) {
+            case 0: s_chImage[0] = 0; break;
+            case 1: s_chImage[5] = 2; break;
+            case 2: wSize /= 2; break;
+            case 3: wSize = bench_flm_build(s_chImage, ptSpi, 0, BENCH_FLM_NO_PROGRAM); break;
+            case 4: wSize = bench_flm_build(s_chImage, ptSpi, 0, BENCH_FLM_ARM_ENTRY); break;
+            case 5: wSize = bench_flm_build(s_chImage, ptSpi, 0, BENCH_FLM_NO_END); break;
+            case 6: wExecSize = 0x40; break;
+            case 7: pExec = (uint8_t *)s_wExec[0] + 2; break;
+            case 9: ptFlm = &s_tFlm[1]; pExec = s_wExec[1]; break;
+            case 11: ptFlm = &s_tFlm[1]; pExec = s_wExec[1]; break;
+            case 12: ptFlm = &s_tFlm[2]; pExec = s_wExec[2];
+                     wSize = bench_flm_build(s_chImage, &tThird, 0, 0); break;
+            default: break;
+        }
+
+        wStart = host_flash_sim_now_ns();
+        if (c == 11) {
+            /* the image sits in a partition of the uniform device */
+            wSize = bench_flm_build(s_chImage, ptMixed, 1, 0);
+            target_flash_init(wPart);
+            target_flash_erase(wPart, 0x2000);
+            target_flash_write(wPart, s_chImage, wSize);
+            target_flash_sync(wPart);
+            memset(s_chImage, 0, sizeof(s_chImage));
+            wStart = host_flash_sim_now_ns();
+            tErr = flash_flm_load_from(ptFlm, wPart, wSize, pExec, wExecSize);
+        } else {
+            tErr = flash_flm_load(ptFlm, s_chImage, wSize, pExec, wExecSize);
+        }
+        double fUs = (double)(host_flash_sim_now_ns() - wStart) / 1000.0;
+
+        printf("%-22s %8s %8s %9.1f\n", c_tCases[c].pchName, c_pchErr[tErr], c_pchErr[c_tCases[c].tExpect], fUs);
+        if (tErr != c_tCases[c].tExpect) {
+            iFailed++;
+        }
+    }
+
+    /* the loaded devices are indexed and work through the target_flash_* API */
+    printf("%-8s %10s %8s %11s %11s\n", "device", "found", "same dev", "prog calls", "readback");
+    for (int d = 0; d < 2; d++) {
+        const flash_blob_t *ptBlob = &s_tFlm[d].tBlob;
+        const flash_dev_t *ptSrc = host_flm_sim[d].ptFlashDev;
+        uint32_t wAddr = ptSrc->DevAdr + ptSrc->szDev / 2;
+        size_t wSize = 64 * 1024;
+        flash_sector_t tSector;
+        bool bFound = flash_dev_find(ptSrc->DevAdr) == ptBlob &&
+                      flash_dev_find(ptSrc->DevAdr + ptSrc->szDev - 1) == ptBlob;
+        bool bSame = bench_flm_same_dev(&s_tFlm[d].tDev, ptSrc);
+        bool bOk;
+
+        host_flash_sim_stat_reset(&host_flm_sim[d]);
+        bOk = target_flash_init(ptSrc->DevAdr) &&
+              target_flash_erase(wAddr, wSize) >= (int32_t)wSize &&
+              target_flash_write(wAddr, s_chPattern, wSize) == (int32_t)wSize &&
+              target_flash_sync(wAddr) &&
+              target_flash_read(wAddr, s_chReadBack, wSize) == (int32_t)wSize &&
+              memcmp(s_chPattern, s_chReadBack, wSize) == 0 &&
+              target_flash_sector_info(wAddr, &tSector) && tSector.wAddr == wAddr;
+        target_flash_uninit(ptSrc->DevAdr);
+
+        printf("%-8s %10s %8s %11llu %11s\n", d == 0 ? "flm spi" : "flm mix", bFound ? "yes" : "no",
+               bSame ? "yes" : "no", (unsigned long long)host_flm_sim[d].tStat.wProgCalls, bOk ? "ok" : "FAIL");
+        if (!bFound || !bSame || !bOk || host_flm_sim[d].tStat.wProgCalls == 0) {
+            iFailed++;
+        }
+    }
+
+    return iFailed;
+}
+
+#define BENCH_SLOT_IMAGE    (240 * 1024)
+#define BENCH_SLOT_CHUNK    4096
+
+typedef struct {
+    const char *pchName;
+    host_flash_sim_t *ptSim;
+    flash_slot_cfg_t tCfg;
+} bench_slot_layout_t;
+
+static uint32_t s_wSlotSwaps;
+static uint8_t s_chSlotBank = FLASH_SLOT_NONE;
+
+/* option bit of a dual-bank part, the simulation keeps the address map */
+static bool bench_slot_swap(uint8_t chSlot)
+{
+    s_chSlotBank = chSlot;
+    s_wSlotSwaps++;
+    return true;
+}
+
+static const bench_slot_layout_t c_tSlotLayouts[] = {
+    /* single bank: log in the 16kB sectors, slots of 3 x 128kB */
+    {"mixed", &host_mixed_flash_device_sim,
+     {{{0x10020000, 0x60000}, {0x10080000, 0x60000}}, 0x10000000, NULL, NULL}},
+    /* two 256kB banks, the log in the last two sectors of bank 2 */
+    {"uniform", &host_uniform_flash_device_sim,
+     {{{0x08000000, 0x3F000}, {0x08040000, 0x3F000}}, 0x0807F000, bench_slot_swap, NULL}},
+};
+
+/* image of version chVer, differs from every other version in each byte */
+static const uint8_t *bench_slot_image(uint8_t chVer)
+{
+    for (size_t i = 0; i < BENCH_SLOT_IMAGE; i++) {
+        s_chReadBack[i] = s_chPattern[i] ^ chVer;
+    }
+    return s_chReadBack;
+}
+
+/*
+ * Function: bench_slot_update
+ * Description: Downloads an image into the inactive slot through a write
+ *              session and finishes it against the CRC32 of the manifest.
+ * Parameters:
+ *   - ptSlot: Mounted slot manager.
+ *   - chVer: Image version.
+ * Returns: The slot written, FLASH_SLOT_NONE on failure.
+ */
+static uint8_t bench_slot_update(flash_slot_t *ptSlot, uint8_t chVer)
+{
+    const uint8_t *pchImage = bench_slot_image(chVer);
+    uint32_t wCrc = flash_crc32(0, pchImage, BENCH_SLOT_IMAGE);
+    uint32_t wAddr = flash_slot_update_begin(ptSlot);
+    uint8_t chSlot = ptSlot->chUpdate;
+    flash_session_t tSession;
+
+    if (wAddr == FLASH_SLOT_ADDR_NONE ||
+        !target_flash_session_open(&tSession, wAddr, BENCH_SLOT_IMAGE)) {
+        return FLASH_SLOT_NONE;
+    }
+    for (size_t o = 0; o < BENCH_SLOT_IMAGE; o += BENCH_SLOT_CHUNK) {
+        if (target_flash_session_append(&tSession, &pchImage[o], BENCH_SLOT_CHUNK) != BENCH_SLOT_CHUNK) {
+            return FLASH_SLOT_NONE;
+        }
+    }
+    if (!target_flash_session_close(&tSession) || !flash_slot_update_end(ptSlot, BENCH_SLOT_IMAGE, &wCrc)) {
+        return FLASH_SLOT_NONE;
+    }
+    return chSlot;
+}
+
+static bool bench_slot_state(const flash_slot_t *ptSlot, uint8_t chActive, bool bTrial)
+{
+    return ptSlot->chActive == chActive && ptSlot->bTrial == bTrial;
+}
+
+static int bench_slot(void)
+{
+    static flash_slot_t s_tSlot;
+    static uint8_t s_chCopy[BENCH_SLOT_CHUNK];
+    int iFailed = 0;
+
+    printf("%-8s %-6s %10s %8s %10s %10s %8s\n", "device", "scheme", "prog kB", "erases", "meta B",
+           "flash ms", "swaps");
+
+    for (size_t l = 0; l < sizeof(c_tSlotLayouts) / sizeof(c_tSlotLayouts[0]); l++) {
+        const bench_slot_layout_t *ptLayout = &c_tSlotLayouts[l];
+        const flash_slot_cfg_t *ptCfg = &ptLayout->tCfg;
+        host_flash_sim_t *ptSim = ptLayout->ptSim;
+        flash_sector_t tLog;
+        bool bTrial = true, bRollback = true, bCorrupt = true, bTorn = true, bCompact = true;
+
+        target_flash_init(ptCfg->wLogAddr);
+        target_flash_sector_info(ptCfg->wLogAddr, &tLog);
+        target_flash_erase(ptCfg->wLogAddr, 2 * tLog.wSize);
+        s_wSlotSwaps = 0;
+
+        /* factory image: nothing to boot before it is activated */
+        if (!flash_slot_mount(&s_tSlot, ptCfg) || flash_slot_boot(&s_tSlot) != FLASH_SLOT_NONE ||
+            bench_slot_update(&s_tSlot, 1) != 0 || !flash_slot_activate(&s_tSlot, 0) ||
+            flash_slot_boot(&s_tSlot) != 0 || !flash_slot_confirm(&s_tSlot)) {
+            printf("%-8s install failed\n", ptLayout->pchName);
+            iFailed++;
+            continue;
+        }
+
+        /* update: download into the other slot, activate, reset, trial boot, confirm */
+        host_flash_sim_stat_reset(ptSim);
+        uint32_t wMeta = s_tSlot.wLogBytes;
+        bool bOk = bench_slot_update(&s_tSlot, 2) == 1 && flash_slot_activate(&s_tSlot, 1);
+        wMeta = s_tSlot.wLogBytes - wMeta;
+        bOk = bOk && flash_slot_mount(&s_tSlot, ptCfg) && bench_slot_state(&s_tSlot, 1, true) &&
+              flash_slot_boot(&s_tSlot) == 1 && flash_slot_confirm(&s_tSlot) &&
+              bench_slot_state(&s_tSlot, 1, false) && flash_slot_validate(&s_tSlot, 0);
+        wMeta += s_tSlot.wLogBytes;
+        host_flash_sim_stat_t tAb = ptSim->tStat;
+        if (!bOk || (ptCfg->SwapBanks != NULL && s_chSlotBank != 1)) {
+            iFailed++;
+        }
+
+        /* the same update staged and copied over the boot image, as a single image loader does */
+        host_flash_sim_stat_reset(ptSim);
+        uint32_t wStage = ptCfg->tSlot[0].wAddr, wBoot = ptCfg->tSlot[1].wAddr;
+        const uint8_t *pchImage = bench_slot_image(2);
+        bOk = target_flash_erase(wStage, BENCH_SLOT_IMAGE) >= BENCH_SLOT_IMAGE &&
+              target_flash_write(wStage, pchImage, BENCH_SLOT_IMAGE) == BENCH_SLOT_IMAGE &&
+              target_flash_erase(wBoot, BENCH_SLOT_IMAGE) >= BENCH_SLOT_IMAGE;
+        for (size_t o = 0; bOk && o < BENCH_SLOT_IMAGE; o += BENCH_SLOT_CHUNK) {
+            bOk = target_flash_read(wStage + o, s_chCopy, BENCH_SLOT_CHUNK) == BENCH_SLOT_CHUNK &&
+                  target_flash_write(wBoot + o, s_chCopy, BENCH_SLOT_CHUNK) == BENCH_SLOT_CHUNK;
+        }
+        bOk = bOk && target_flash_sync(wBoot) && target_flash_checksum(wBoot, BENCH_SLOT_IMAGE) ==
+                                                 flash_crc32(0, pchImage, BENCH_SLOT_IMAGE);
+        host_flash_sim_stat_t tCopy = ptSim->tStat;
+        if (!bOk) {
+            iFailed++;
+        }
+
+        /* the copy overwrote slot 0 with v2, put v1 back and confirm the remount sees it valid */
+        target_flash_erase(wStage, BENCH_SLOT_IMAGE);
+        target_flash_write(wStage, bench_slot_image(1), BENCH_SLOT_IMAGE);
+        target_flash_sync(wStage);
+
+        printf("%-8s %-6s %10.1f %8llu %10u %10.1f %8s\n", ptLayout->pchName, "a/b",
+               tAb.wProgBytes / 1024.0, (unsigned long long)tAb.wEraseCalls, (unsigned)wMeta,
+               tAb.wBusyNs / 1e6, ptCfg->SwapBanks ? "1" : "-");
+        printf("%-8s %-6s %10.1f %8llu %10s %10.1f %8s\n", ptLayout->pchName, "copy",
+               tCopy.wProgBytes / 1024.0, (unsigned long long)tCopy.wEraseCalls, "-",
+               tCopy.wBusyNs / 1e6, "-");
+        if (tAb.wProgBytes * 3 > tCopy.wProgBytes * 2 || tAb.wBusyNs * 3 > tCopy.wBusyNs * 2) {
+            iFailed++;
+        }
+
+        /* v3 into slot 0, never confirmed: given up after FLASH_SLOT_TRIAL_BOOTS resets */
+        bTrial = bench_slot_update(&s_tSlot, 3) == 0 && flash_slot_activate(&s_tSlot, 0);
+        for (int b = 0; bTrial && b < FLASH_SLOT_TRIAL_BOOTS; b++) {
+            bTrial = flash_slot_mount(&s_tSlot, ptCfg) && flash_slot_boot(&s_tSlot) == 0;
+        }
+        bTrial = bTrial && flash_slot_mount(&s_tSlot, ptCfg) && flash_slot_boot(&s_tSlot) == 1 &&
+                 bench_slot_state(&s_tSlot, 1, false) && flash_slot_mount(&s_tSlot, ptCfg) &&
+                 bench_slot_state(&s_tSlot, 1, false) && flash_slot_boot(&s_tSlot) == 1;
+
+        /* explicit rollback of a trial costs one record, as does the activation */
+        uint32_t wBytes = s_tSlot.wLogBytes;
+        bRollback = flash_slot_activate(&s_tSlot, 0) && flash_slot_rollback(&s_tSlot) &&
+                    bench_slot_state(&s_tSlot, 1, false) && s_tSlot.wLogBytes - wBytes == 2 * s_tSlot.wRecSize &&
+                    flash_slot_mount(&s_tSlot, ptCfg) && bench_slot_state(&s_tSlot, 1, false);
+        /* and a confirmed image can be rolled back to the previous one */
+        bRollback = bRollback && flash_slot_rollback(&s_tSlot) && bench_slot_state(&s_tSlot, 0, false) &&
+                    flash_slot_rollback(&s_tSlot) && bench_slot_state(&s_tSlot, 1, false);
+
+        /* a damaged image is neither activated nor rolled back to */
+        flash_sector_t tFirst;
+        target_flash_sector_info(ptCfg->tSlot[0].wAddr, &tFirst);
+        target_flash_erase(tFirst.wAddr, tFirst.wSize);
+        bCorrupt = !flash_slot_validate(&s_tSlot, 0) && !flash_slot_activate(&s_tSlot, 0) &&
+                   !flash_slot_rollback(&s_tSlot) && flash_slot_boot(&s_tSlot) == 1;
+
+        /* a record torn by a reset is skipped and the log goes on after it */
+        static const uint8_t c_chTorn[8] = {0x00, 0x12, 0x00, 0x00, 0x05, 0x00, 0x00, 0x00};
+        uint32_t wTorn = s_tSlot.wWrite;
+        bTorn = target_flash_write(wTorn, c_chTorn, sizeof(c_chTorn)) == sizeof(c_chTorn) &&
+                target_flash_sync(wTorn) && flash_slot_mount(&s_tSlot, ptCfg) &&
+                s_tSlot.wWrite == wTorn + s_tSlot.wRecSize && bench_slot_state(&s_tSlot, 1, false) &&
+                bench_slot_update(&s_tSlot, 4) == 0 && flash_slot_mount(&s_tSlot, ptCfg) &&
+                flash_slot_validate(&s_tSlot, 0) && flash_slot_validate(&s_tSlot, 1);
+
+        /* activate/rollback until the log wrapped twice: compaction keeps the state */
+        for (uint32_t i = 0; bCompact && s_tSlot.wLogErases < 4 && i < 100000; i++) {
+            bCompact = flash_slot_activate(&s_tSlot, 0) && flash_slot_rollback(&s_tSlot);
+        }
+        bCompact = bCompact && s_tSlot.wLogErases >= 4 && flash_slot_activate(&s_tSlot, 0) &&
+                   flash_slot_mount(&s_tSlot, ptCfg) && bench_slot_state(&s_tSlot, 0, true) &&
+                   flash_slot_validate(&s_tSlot, 0) && flash_slot_validate(&s_tSlot, 1) &&
+                   flash_slot_boot(&s_tSlot) == 0 && flash_slot_confirm(&s_tSlot);
+
+        printf("%-8s trial rollback %s, rollback %s, damaged image %s, torn record %s, compaction %s "
+               "(%u B per record, %u bank swaps)\n", ptLayout->pchName,
+               bTrial ? "ok" : "FAILED", bRollback ? "ok" : "FAILED", bCorrupt ? "ok" : "FAILED",
+               bTorn ? "ok" : "FAILED", bCompact ? "ok" : "FAILED", (unsigned)s_tSlot.wRecSize,
+               (unsigned)s_wSlotSwaps);
+        iFailed += !bTrial + !bRollback + !bCorrupt + !bTorn + !bCompact;
+        if (ptCfg->SwapBanks != NULL && s_chSlotBank != 0) {
+            iFailed++;
+        }
+
+        target_flash_uninit(ptCfg->wLogAddr);
+    }
+
+    return iFailed;
+}
+
+#define BENCH_POOL_BASE     0x08000000
+#define BENCH_POOL_SECTORS  64
+#define BENCH_POOL_RECORD   256
+#define BENCH_POOL_BURST    40      // records per burst, 5 sectors of 2kB
+#define BENCH_POOL_BURSTS   24
+#define BENCH_POOL_LIVE     8       // sectors the writer keeps before releasing the oldest
+
+static int bench_u64_cmp(const void *pA, const void *pB)
+{
+    uint64_t wA = *(const uint64_t *)pA, wB = *(const uint64_t *)pB;
+    return (wA > wB) - (wA < wB);
+}
+
+static void bench_pool_done(flash_req_t *ptReq)
+{
+    (*(uint32_t *)ptReq->pTarget)++;
+}
+
+/*
+ * Function: bench_pool_log
+ * Description: Appends bursts of records to a ring of sectors taken from
+ *              the pool, with up to hwIdle flash_pool_idle() steps between
+ *              the bursts, two per erased sector. pwLatency receives the modelled device time of every
+ *              record: the erase on a miss, programming and sync.
+ * Parameters:
+ *   - ptPool: Pool, freshly initialised.
+ *   - hwIdle: Idle steps between bursts.
+ *   - pwLatency: BENCH_POOL_BURST * BENCH_POOL_BURSTS entries.
+ * Returns: True if every record was written and the live sectors read back.
+ */
+static bool bench_pool_log(flash_pool_t *ptPool, uint16_t hwIdle, uint64_t *pwLatency)
+{
+    host_flash_sim_t *ptSim = &host_uniform_flash_device_sim;
+    uint32_t wLive[BENCH_POOL_LIVE], wLiveNum = 0, n = 0;
+    flash_sector_t tSector = {0, 0, 0};
+    uint32_t wOffset = 0;
+    bool bOk = true;
+
+    for (uint32_t b = 0; bOk && b < BENCH_POOL_BURSTS; b++) {
+        for (uint32_t r = 0; bOk && r < BENCH_POOL_BURST; r++, n++) {
+            uint64_t wBusy = ptSim->tStat.wBusyNs;
+            const uint8_t *pchRec = &s_chPattern[(n * BENCH_POOL_RECORD) % BENCH_REGION_SIZE];
+
+            if (wOffset == tSector.wSize) {
+                if (wLiveNum == BENCH_POOL_LIVE) {
+                    /*the consumer is done with the oldest sector*/
+                    bOk &= flash_pool_release(ptPool, wLive[0]);
+                    memmove(wLive, wLive + 1, sizeof(wLive[0]) * (BENCH_POOL_LIVE - 1));
+                    wLiveNum--;
+                }
+                bOk &= flash_pool_take(ptPool, &tSector);
+                wLive[wLiveNum++] = tSector.wAddr;
+                wOffset = 0;
+            }
+            bOk &= target_flash_write(tSector.wAddr + wOffset, pchRec, BENCH_POOL_RECORD) == BENCH_POOL_RECORD &&
+                   target_flash_sync(tSector.wAddr);
+            wOffset += BENCH_POOL_RECORD;
+            pwLatency[n] = ptSim->tStat.wBusyNs - wBusy;
+        }
+        for (uint16_t i = 0; i < hwIdle && flash_pool_idle(ptPool); i++);
+    }
+
+    /* the records of the live sectors survived the background erases */
+    uint32_t wFirst = n - ((wLiveNum - 1) * tSector.wSize + wOffset) / BENCH_POOL_RECORD;
+    for (uint32_t i = 0; bOk && i < wLiveNum; i++) {
+        for (uint32_t o = 0; bOk && o < tSector.wSize && wFirst < n; o += BENCH_POOL_RECORD, wFirst++) {
+            bOk = target_flash_read(wLive[i] + o, s_chReadBack, BENCH_POOL_RECORD) == BENCH_POOL_RECORD &&
+                  memcmp(s_chReadBack, &s_chPattern[(wFirst * BENCH_POOL_RECORD) % BENCH_REGION_SIZE],
+                         BENCH_POOL_RECORD) == 0;
+        }
+    }
+    return bOk;
+}
+
+static int bench_pool(void)
+{
+    static flash_pool_t s_tPool;
+    static uint64_t s_wLatency[BENCH_POOL_BURST * BENCH_POOL_BURSTS];
+    static const uint16_t c_hwIdle[] = {0, 4, 10, 32};
+    const uint32_t wRegion = BENCH_POOL_SECTORS * 2048, wRecords = BENCH_POOL_BURST * BENCH_POOL_BURSTS;
+    int iFailed = 0;
+
+    target_flash_init(BENCH_POOL_BASE);
+
+    printf("%-8s %6s %6s %6s %6s %8s %10s %10s %10s\n", "idle", "target", "taken", "misses", "erased",
+           "min dep", "p50 us", "p99 us", "max us");
+    for (size_t c = 0; c < sizeof(c_hwIdle) / sizeof(c_hwIdle[0]); c++) {
+        flash_pool_stat_t tStat;
+
+        /* the region holds old data everywhere, nothing is blank */
+        target_flash_erase(BENCH_POOL_BASE, wRegion);
+        target_flash_write(BENCH_POOL_BASE, s_chPattern, wRegion);
+        target_flash_sync(BENCH_POOL_BASE);
+        if (!flash_pool_init(&s_tPool, BENCH_POOL_BASE, wRegion, 8)) {
+            iFailed++;
+            continue;
+        }
+        /* steady state: let the pool fill before the first burst */
+        while (c_hwIdle[c] != 0 && flash_pool_idle(&s_tPool));
+        flash_pool_stat(&s_tPool, NULL, true);
+
+        bool bOk = bench_pool_log(&s_tPool, c_hwIdle[c], s_wLatency);
+        flash_pool_stat(&s_tPool, &tStat, false);
+        qsort(s_wLatency, wRecords, sizeof(s_wLatency[0]), bench_u64_cmp);
+
+        char chIdle[16];
+        snprintf(chIdle, sizeof(chIdle), c_hwIdle[c] ? "%u/burst" : "inline", (unsigned)c_hwIdle[c]);
+        printf("%-8s %6u %6u %6u %6u %8u %10.1f %10.1f %10.1f\n", chIdle, (unsigned)s_tPool.hwTarget,
+               (unsigned)tStat.wTaken, (unsigned)tStat.wMisses, (unsigned)tStat.wErased,
+               (unsigned)tStat.hwMinDepth, s_wLatency[wRecords / 2] / 1e3, s_wLatency[wRecords * 99 / 100] / 1e3,
+               s_wLatency[wRecords - 1] / 1e3);
+
+        /* enough idle time between bursts turns every take into a hit */
+        if (!bOk || (c_hwIdle[c] >= 10 && (tStat.wMisses != 0 ||
+                                          s_wLatency[wRecords - 1] * 4 > s_wLatency[0] * 5))) {
+            iFailed++;
+        }
+        if (c_hwIdle[c] == 0 && tStat.wMisses != tStat.wTaken) {
+            iFailed++;
+        }
+    }
+
+    /* background erases: refused behind foreground work, cancelled by it */
+    static const uint8_t c_chRec[BENCH_POOL_RECORD] = {0x5A};
+    flash_req_t tIdle = {0}, tFore = {0}, tIdle2 = {0};
+    uint32_t wDone = 0;
+    bool bCancel = target_flash_erase_async(&tFore, BENCH_POOL_BASE, 2048, NULL, NULL) &&
+                   !target_flash_erase_idle(&tIdle, BENCH_POOL_BASE + 2048, 2048, bench_pool_done, &wDone) &&
+                   target_flash_sync(BENCH_POOL_BASE) && tFore.chStatus == FLASH_REQ_DONE;
+    bCancel = bCancel && target_flash_erase_idle(&tIdle, BENCH_POOL_BASE + 2048, 4096, bench_pool_done, &wDone) &&
+              target_flash_erase_idle(&tIdle2, BENCH_POOL_BASE + 8192, 2048, bench_pool_done, &wDone) &&
+              target_flash_poll_dev(BENCH_POOL_BASE) && tIdle.wDone == 2048 &&
+              target_flash_write(BENCH_POOL_BASE, c_chRec, sizeof(c_chRec)) == sizeof(c_chRec) &&
+              tIdle.chStatus == FLASH_REQ_CANCELLED && tIdle.wDone == 2048 &&
+              tIdle2.chStatus == FLASH_REQ_CANCELLED && tIdle2.wDone == 0 && wDone == 2 &&
+              !target_flash_poll_dev(BENCH_POOL_BASE);
+
+    /* a taken sector whose background erase is queued: cancelled and erased in the foreground */
+    target_flash_write(BENCH_POOL_BASE, s_chPattern, 4 * 2048);
+    target_flash_sync(BENCH_POOL_BASE);
+    flash_pool_stat_t tStat;
+    flash_sector_t tSector;
+    bCancel = bCancel && flash_pool_init(&s_tPool, BENCH_POOL_BASE, 4 * 2048, 2) &&
+              flash_pool_idle(&s_tPool) && s_tPool.chState[0] == FLASH_POOL_ERASING &&
+              flash_pool_take(&s_tPool, &tSector) && tSector.wAddr == BENCH_POOL_BASE;
+    flash_pool_stat(&s_tPool, &tStat, false);
+    bCancel = bCancel && tStat.wMisses == 1 && tStat.wCancelled == 1 && s_tPool.chState[0] == FLASH_POOL_OWNED &&
+              target_flash_read(BENCH_POOL_BASE, s_chReadBack, 2048) == 2048 && s_chReadBack[0] == 0xFF &&
+              s_chReadBack[2047] == 0xFF;
+
+    /* a region found half blank: blank sectors are taken as they are */
+    target_flash_erase(BENCH_POOL_BASE, wRegion);
+    for (uint32_t i = 0; i < BENCH_POOL_SECTORS; i += 2) {
+        target_flash_write(BENCH_POOL_BASE + i * 2048 + 100, c_chRec, 1);
+    }
+    target_flash_sync(BENCH_POOL_BASE);
+    bool bBlank = flash_pool_init(&s_tPool, BENCH_POOL_BASE, wRegion, BENCH_POOL_SECTORS);
+    /* one step reads a piece of the sector, not all of it */
+    bBlank = bBlank && flash_pool_idle(&s_tPool) && s_tPool.chState[0] == FLASH_POOL_UNKNOWN &&
+             s_tPool.wChecked != 0 && s_tPool.wChecked < 100;
+    while (bBlank && flash_pool_idle(&s_tPool));
+    flash_pool_stat(&s_tPool, &tStat, false);
+    bBlank = bBlank && tStat.wBlank == BENCH_POOL_SECTORS / 2 && tStat.wErased == BENCH_POOL_SECTORS / 2 &&
+             tStat.hwDepth == BENCH_POOL_SECTORS;
+
+    printf("cancellation %s, blank check %s (%u blank, %u erased)\n", bCancel ? "ok" : "FAILED",
+           bBlank ? "ok" : "FAILED", (unsigned)tStat.wBlank, (unsigned)tStat.wErased);
+    iFailed += !bCancel + !bBlank;
+
+    target_flash_uninit(BENCH_POOL_BASE);
+    return iFailed;
+}
+
+#define BENCH_CACHE_REGION  0x00040000
+#define BENCH_CACHE_READS   20000
+
+/*
+ * One read pattern on the cached device and on the uncached SPI NOR:
+ * p == 0: headers and glyphs, 9 of 10 reads hit a 4kB hot area,
+ * p == 1: a file parsed front to back in 16 byte pieces,
+ * p == 2: 4kB blocks streamed out.
+ */
+static bool bench_cache_run(const flash_blob_t *ptBlob, host_flash_sim_t *ptSim, int p)
+{
+    uint32_t wBase = ptBlob->ptFlashDev->DevAdr;
+    bool bOk = true;
+
+    srand(25);
+    host_flash_sim_stat_reset(ptSim);
+    for (uint32_t i = 0, o = 0; i < BENCH_CACHE_READS && bOk; i++) {
+        size_t wLen = 16;
+
+        if (p == 0) {
+            wLen = 8 + (size_t)(rand() % 57);
+            o = (rand() % 10 != 0) ? (uint32_t)(rand() % 4096) : (uint32_t)(rand() % (BENCH_CACHE_REGION - 64));
+        } else if (p == 2) {
+            wLen = 4096;
+        }
+        if (o + wLen > BENCH_CACHE_REGION) {
+            o = 0;
+        }
+        bOk = target_flash_read(wBase + o, s_chReadBack, wLen) == (int)wLen &&
+              memcmp(s_chReadBack, &s_chPattern[o], wLen) == 0;
+        if (p != 0) {
+            o += wLen;
+        }
+    }
+    return bOk;
+}
+
+static int bench_cache(void)
+{
+    static const char *c_pchPattern[] = {"hot", "sequential", "bulk"};
+    const flash_blob_t *ptBlobs[2] = {&host_spinor_flash_device, &host_cached_flash_device};
+    host_flash_sim_t *ptSims[2] = {&host_spinor_flash_device_sim, &host_cached_flash_device_sim};
+    uint32_t wCached = host_cached_flash_device.ptFlashDev->DevAdr;
+    uint64_t wCalls[2] = {0};
+    flash_cache_stat_t tStat;
+    int iFailed = 0;
+
+    for (int d = 0; d < 2; d++) {
+        uint32_t wBase = ptBlobs[d]->ptFlashDev->DevAdr;
+
+        target_flash_init(wBase);
+        target_flash_erase(wBase, BENCH_CACHE_REGION);
+        target_flash_write(wBase, s_chPattern, BENCH_CACHE_REGION);
+        target_flash_sync(wBase);
+    }
+
+    printf("%-11s %-8s %10s %12s %12s %8s %10s\n", "pattern", "device", "Read calls", "Read kB", "busy ms",
+           "hit %", "prefetch");
+    for (int p = 0; p < 3; p++) {
+        for (int d = 0; d < 2; d++) {
+            target_flash_init(ptBlobs[d]->ptFlashDev->DevAdr);
+            target_flash_cache_stat(wCached, NULL, true);
+            bool bOk = bench_cache_run(ptBlobs[d], ptSims[d], p);
+            bool bStat = target_flash_cache_stat(ptBlobs[d]->ptFlashDev->DevAdr, &tStat, false);
+            uint32_t wLines = tStat.wHits + tStat.wMisses;
+
+            char chHit[16] = "-", chPrefetch[16] = "-";
+            if (bStat) {
+                snprintf(chHit, sizeof(chHit), "%.1f", wLines ? 100.0 * tStat.wHits / wLines : 0.0);
+                snprintf(chPrefetch, sizeof(chPrefetch), "%u", (unsigned)tStat.wPrefetches);
+            }
+            wCalls[d] = ptSims[d]->tStat.wReadCalls;
+            printf("%-11s %-8s %10llu %12.1f %12.3f %8s %10s\n", c_pchPattern[p], d ? "cached" : "spinor",
+                   (unsigned long long)wCalls[d], ptSims[d]->tStat.wReadBytes / 1024.0,
+                   ptSims[d]->tStat.wBusyNs / 1e6, chHit, chPrefetch);
+            iFailed += !bOk;
+        }
+        /* hot reads mostly hit, a sequential parse needs half a Read per line, bulk reads pass by */
+        if ((p == 0 && wCalls[1] * 4 > wCalls[0]) || (p == 1 && wCalls[1] * 3 > wCalls[0]) ||
+            (p == 2 && wCalls[1] != wCalls[0])) {
+            iFailed++;
+        }
+    }
+
+    /* cached lines follow writes, updates and erases, hot reads come from RAM */
+    static const uint8_t c_chNew[40] = {0x12, 0x34, 0x56, 0x78};
+    uint8_t chHeader[64];
+    target_flash_read(wCached + 0x1000, chHeader, sizeof(chHeader));
+    host_flash_sim_stat_reset(&host_cached_flash_device_sim);
+    bool bCoherent = target_flash_read(wCached + 0x1000, chHeader, sizeof(chHeader)) == sizeof(chHeader) &&
+                     host_cached_flash_device_sim.tStat.wReadCalls == 0;
+    target_flash_erase(wCached + 0x1000, 0x1000);
+    target_flash_read(wCached + 0x1000, chHeader, sizeof(chHeader));
+    bCoherent = bCoherent && chHeader[0] == 0xFF && chHeader[63] == 0xFF;
+    target_flash_write(wCached + 0x1010, c_chNew, sizeof(c_chNew));
+    target_flash_sync(wCached);
+    target_flash_read(wCached + 0x1000, chHeader, sizeof(chHeader));
+    bCoherent = bCoherent && chHeader[0] == 0xFF && memcmp(&chHeader[0x10], c_chNew, sizeof(c_chNew)) == 0 &&
+                chHeader[0x38] == 0xFF;
+    memcpy(s_chReadBack, &s_chPattern[0x2000], 0x1000);
+    memset(&s_chReadBack[0x20], 0xA5, 8);
+    target_flash_read(wCached + 0x2000, chHeader, sizeof(chHeader));
+    bCoherent = bCoherent && target_flash_update(wCached + 0x2000, s_chReadBack, 0x1000) == 0x1000 &&
+                target_flash_read(wCached + 0x2000, chHeader, sizeof(chHeader)) == sizeof(chHeader) &&
+                memcmp(chHeader, s_chReadBack, sizeof(chHeader)) == 0;
+    /* what the cache holds is what the device holds */
+    host_flash_sim_stat_reset(&host_cached_flash_device_sim);
+    target_flash_read(wCached + 0x1000, s_chReadBack, 0x2000);
+    bCoherent = bCoherent && host_cached_flash_device_sim.tStat.wReadCalls != 0 &&
+                target_flash_read(wCached + 0x1000, chHeader, sizeof(chHeader)) == sizeof(chHeader) &&
+                memcmp(chHeader, s_chReadBack, sizeof(chHeader)) == 0 &&
+                target_flash_read(wCached + 0x2000, chHeader, sizeof(chHeader)) == sizeof(chHeader) &&
+                memcmp(chHeader, &s_chReadBack[0x1000], sizeof(chHeader)) == 0;
+    target_flash_cache_stat(wCached, &tStat, false);
+    bool bMapped = !target_flash_cache_stat(host_uniform_flash_device.ptFlashDev->DevAdr, NULL, false);
+
+    printf("coherency %s (%u lines invalidated), memory mapped devices bypass %s\n", bCoherent ? "ok" : "FAILED",
+           (unsigned)tStat.wInvalidated, bMapped ? "ok" : "FAILED");
+    iFailed += !bCoherent + !bMapped;
+
+    target_flash_uninit(ptBlobs[0]->ptFlashDev->DevAdr);
+    target_flash_uninit(wCached);
+    return iFailed;
+}
+
+static const bench_suite_t c_tSuites[] = {
+    {"throughput", "MB/s and per call latency of write/read/erase", bench_throughput},
+    {"lookup",     "address to device dispatch cost vs. device count", bench_lookup},
+    {"sectors",    "sector map lookups and sector aligned range erase", bench_sectors},
+    {"coalesce",   "Program() calls for small unaligned writes through the page buffer", bench_coalesce},
+    {"update",     "differential update vs. erase+write of a mostly unchanged image", bench_update},
+    {"latency",    "longest IRQ-masked window per call vs. call duration", bench_latency},
+    {"async",      "queued erase/write driven by target_flash_poll() steps", bench_async},
+    {"session",    "streaming session with erase-ahead vs. erase-all-then-receive", bench_session},
+    {"writev",     "scatter-gather packet chains vs. gathering into one buffer", bench_writev},
+    {"stat",       "per-device op counters, latency histograms and trace (-t exports JSON)", bench_stat},
+    {"kv",         "log-structured key-value updates vs. one erase per update", bench_kv},
+    {"map",        "in place access of memory mapped devices vs. copying reads", bench_map},
+    {"verify",     "CRC32 engine, write digests vs. a checksum pass, readback verify policies", bench_verify},
+    {"unpack",     "compressed image over the link, decoded into a write session", bench_unpack},
+    {"plan",       "planned chip/block/multi-sector erases vs. sector by sector", bench_plan},
+    {"qspi",       "generic SPI NOR driver on the opcode level model, 1/2/4 data lines", bench_qspi},
+    {"parallel",   "erase+write on several devices, one after the other vs. a worker per device", bench_parallel},
+    {"locks",      "read/write device locks: tasks reading one device while others erase/write", bench_locks},
+    {"banks",      "dual-bank part: IRQ masking and request order by code and read bank", bench_banks},
+    {"pipeline",   "page writes overlapped with ProgramStart/ProgramPoll vs. waiting for each page", bench_pipeline},
+    {"flm",        "FLM images checked, loaded and registered at runtime, malformed ones refused", bench_flm},
+    {"slot",       "A/B slot update, activation and rollback vs. staging and copying the image", bench_slot},
+    {"pool",       "write latency of a recording ring with idle-time pre-erase vs. erasing inline", bench_pool},
+    {"cache",      "Read calls of hot, sequential and bulk reads with and without the RAM read cache", bench_cache},
+};
+
+static void bench_usage(const char *pchSelf)
+{
+    printf("usage: %s [-r] [-s num/den] [-n rounds] [-t trace.json] [suite ...]\n", pchSelf);
+    printf("  -r          spend the modelled flash time in real time\n");
+    printf("  -s num/den  scale of toProg/toErase to typical op time (default 1/100)\n");
+    printf("  -n rounds   repetitions per measurement (default %d)\n", s_iRounds);
+    printf("  -t file     Chrome trace JSON of the operations of the stat suite\n");
+    for (size_t i = 0; i < sizeof(c_tSuites) / sizeof(c_tSuites[0]); i++) {
+        printf("  %-11s %s\n", c_tSuites[i].pchName, c_tSuites[i].pchHelp);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    int iOpt, iFailed = 0;
+    unsigned int wNum, wDen;
+
+    while ((iOpt = getopt(argc, argv, "rs:n:t:h")) != -1) {
+        switch (iOpt) {
+            case 'r':
+                host_flash_sim_set_mode(HOST_FLASH_SIM_REALTIME);
+                break;
+            case 's':
+                if (sscanf(optarg, "%u/%u", &wNum, &wDen) != 2 || wDen == 0) {
+                    bench_usage(argv[0]);
+                    return 2;
+                }
+                host_flash_sim_set_time_scale(wNum, wDen);
+                break;
+            case 'n':
+                s_iRounds = atoi(optarg) > 0 ? atoi(optarg) : 1;
+                break;
+            case 't':
+                s_pchTraceFile = optarg;
+                break;
+            default:
+                bench_usage(argv[0]);
+                return iOpt == 'h' ? 0 : 2;
+        }
+    }
+
+    srand(1);
+    for (size_t i = 0; i < sizeof(s_chPattern); i++) {
+        s_chPattern[i] = (uint8_t)rand();
+    }
+
+    /* the SPI NOR on the QSPI model has no geometry until it is probed */
+    if (!host_spi_nor_open(&host_qspi_model) || !spi_nor_probe(&host_qspi_flash_device_nor)) {
+        printf("!! qspi: probe failed\n");
+        iFailed++;
+    }
+
+    for (size_t i = 0; i < sizeof(c_tSuites) / sizeof(c_tSuites[0]); i++) {
+        bool bSelected = (optind >= argc);
+        for (int a = optind; a < argc; a++) {
+            bSelected |= (strcmp(argv[a], c_tSuites[i].pchName) == 0);
+        }
+        if (!bSelected) {
+            continue;
+        }
+        printf("== %s ==\n", c_tSuites[i].pchName);
+        int iSuiteFailed = c_tSuites[i].fnRun();
+        if (iSuiteFailed != 0) {
+            printf("!! %s: %d failures\n", c_tSuites[i].pchName, iSuiteFailed);
+        }
+        iFailed += iSuiteFailed;
+    }
+
+    return iFailed == 0 ? 0 : 1;
+}
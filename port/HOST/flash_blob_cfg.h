@@ -0,0 +1,76 @@
+#ifndef FLASH_BLOB_CFG_H
+#define FLASH_BLOB_CFG_H
+#include "host_flash_sim.h"
+#include "host_spi_nor.h"
+#include "host_flash_exec.h"
+
+/* IRQ window measurement in microseconds of simulated time */
+#define FLASH_BLOB_GET_TICK()   ((uint32_t)(host_flash_sim_clock_ns() / 1000))
+#define FLASH_BLOB_YIELD()      host_flash_sim_yield()
+/* on-chip devices are read in place from the backing store of the simulator */
+#define FLASH_BLOB_MAP_ADDR(__ADDR) host_flash_sim_map(__ADDR)
+/* the simulated CPU runs from RAM unless a benchmark moves it into a bank */
+#define FLASH_BLOB_CODE_ADDR()      host_flash_sim_code_addr()
+/* locks come from FLASH_BLOB_OS (POSIX port), this wakes the per-device workers */
+#define FLASH_BLOB_DEV_NOTIFY(__ID) host_flash_notify(__ID)
+
+extern const flash_blob_t host_uniform_flash_device;
+extern const flash_blob_t host_mixed_flash_device;
+extern const flash_blob_t host_spinor_flash_device;
+extern host_flash_sim_t host_uniform_flash_device_sim;
+extern host_flash_sim_t host_mixed_flash_device_sim;
+extern host_flash_sim_t host_spinor_flash_device_sim;
+extern const flash_blob_t host_dual_flash_device;
+extern host_flash_sim_t host_dual_flash_device_sim;
+extern const flash_blob_t host_cached_flash_device;
+extern host_flash_sim_t host_cached_flash_device_sim;
+extern flash_cache_t host_cached_flash_cache;
+/* generic SPI NOR driver on the QSPI model, spi_nor_probe() before first use */
+extern const flash_blob_t host_qspi_flash_device;
+extern spi_nor_t host_qspi_flash_device_nor;
+extern spi_nor_bus_t host_qspi_bus;
+extern host_spi_nor_t host_qspi_model;
+extern host_flash_sim_t host_qspi_array_sim;
+
+#define HOST_SMALL_FLASH_NUM    29
+#define HOST_SMALL_FLASH_BASE   0x60000000
+#define HOST_SMALL_FLASH_SIZE   0x00010000
+#define HOST_SMALL_FLASH_DECLARE(__N)   extern const flash_blob_t host_small_flash_device##__N
+HOST_SMALL_FLASH_DECLARE(0);  HOST_SMALL_FLASH_DECLARE(1);  HOST_SMALL_FLASH_DECLARE(2);
+HOST_SMALL_FLASH_DECLARE(3);  HOST_SMALL_FLASH_DECLARE(4);  HOST_SMALL_FLASH_DECLARE(5);
+HOST_SMALL_FLASH_DECLARE(6);  HOST_SMALL_FLASH_DECLARE(7);  HOST_SMALL_FLASH_DECLARE(8);
+HOST_SMALL_FLASH_DECLARE(9);  HOST_SMALL_FLASH_DECLARE(10); HOST_SMALL_FLASH_DECLARE(11);
+HOST_SMALL_FLASH_DECLARE(12); HOST_SMALL_FLASH_DECLARE(13); HOST_SMALL_FLASH_DECLARE(14);
+HOST_SMALL_FLASH_DECLARE(15); HOST_SMALL_FLASH_DECLARE(16); HOST_SMALL_FLASH_DECLARE(17);
+HOST_SMALL_FLASH_DECLARE(18); HOST_SMALL_FLASH_DECLARE(19); HOST_SMALL_FLASH_DECLARE(20);
+HOST_SMALL_FLASH_DECLARE(21); HOST_SMALL_FLASH_DECLARE(22); HOST_SMALL_FLASH_DECLARE(23);
+HOST_SMALL_FLASH_DECLARE(24); HOST_SMALL_FLASH_DECLARE(25); HOST_SMALL_FLASH_DECLARE(26);
+HOST_SMALL_FLASH_DECLARE(27); HOST_SMALL_FLASH_DECLARE(28);
+
+/* runtime loaded FLM images (flash_flm_load()) run on these simulated devices */
+#define HOST_FLM_SIM_NUM    2
+extern host_flash_sim_t host_flm_sim[HOST_FLM_SIM_NUM];
+extern int32_t host_flash_flm_call(uintptr_t wEntry, void *pStaticBase, uintptr_t wArg0, uintptr_t wArg1,
+                                   uintptr_t wArg2);
+#define FLASH_FLM_CALL(__ENTRY, __SB, __A0, __A1, __A2)     host_flash_flm_call(__ENTRY, __SB, __A0, __A1, __A2)
+
+#define FLASH_DEV_TABLE                 \
+{                                       \
+    &host_uniform_flash_device,         \
+    &host_mixed_flash_device,           \
+    &host_spinor_flash_device,          \
+    &host_qspi_flash_device,            \
+    &host_dual_flash_device,            \
+    &host_cached_flash_device,          \
+    &host_small_flash_device0,  &host_small_flash_device1,  &host_small_flash_device2,  \
+    &host_small_flash_device3,  &host_small_flash_device4,  &host_small_flash_device5,  \
+    &host_small_flash_device6,  &host_small_flash_device7,  &host_small_flash_device8,  \
+    &host_small_flash_device9,  &host_small_flash_device10, &host_small_flash_device11, \
+    &host_small_flash_device12, &host_small_flash_device13, &host_small_flash_device14, \
+    &host_small_flash_device15, &host_small_flash_device16, &host_small_flash_device17, \
+    &host_small_flash_device18, &host_small_flash_device19, &host_small_flash_device20, \
+    &host_small_flash_device21, &host_small_flash_device22, &host_small_flash_device23, \
+    &host_small_flash_device24, &host_small_flash_device25, &host_small_flash_device26, \
+    &host_small_flash_device27, &host_small_flash_device28, \
+}
+#endif
@@ -0,0 +1,305 @@
+#include "host_flash_sim.h"
+#include "host_spi_nor.h"
+#include "flash_blob_cfg.h"
+#include "flash_flm.h"
+
+/*
+ * Simulated devices used by the host build. The geometries mirror the
+ * on-chip parts shipped in port/ plus a typical external SPI NOR, and one
+ * more SPI NOR driven through the generic port/SPI_NOR driver.
+ */
+
+/* STM32F10x High-density style: uniform 2kB sectors, 1kB program page */
+static flash_dev_t const HostUniformDevice = {
+    FLASH_DRV_VERS,             // Driver Version, do not modify!
+    "HOST Uniform 512kB Flash", // Device Name (512kB)
+    ONCHIP,                     // Device Type
+    0x08000000,                 // Device Start Address
+    0x00080000,                 // Device Size in Bytes (512kB)
+    1024,                       // Programming Page Size
+    0,                          // Reserved, must be 0
+    0xFF,                       // Initial Content of Erased Memory
+    100,                        // Program Page Timeout 100 mSec
+    500,                        // Erase Sector Timeout 500 mSec
+
+// Specify Size and Address of Sectors
+    0x0800, 0x000000,           // Sector Size 2kB (256 Sectors)
+    SECTOR_END
+};
+
+/* STM32F4xx 1MB style: 4 x 16kB, 1 x 64kB, 7 x 128kB */
+static flash_dev_t const HostMixedDevice = {
+    FLASH_DRV_VERS,             // Driver Version, do not modify!
+    "HOST Mixed 1MB Flash",     // Device Name (1024kB)
+    ONCHIP,                     // Device Type
+    0x10000000,                 // Device Start Address
+    0x00100000,                 // Device Size in Bytes (1024kB)
+    1024,                       // Programming Page Size
+    0,                          // Reserved, must be 0
+    0xFF,                       // Initial Content of Erased Memory
+    100,                        // Program Page Timeout 100 mSec
+    6000,                       // Erase Sector Timeout 6000 mSec
+
+// Specify Size and Address of Sectors
+    0x04000, 0x000000,          // Sector Size  16kB (4 Sectors)
+    0x10000, 0x010000,          // Sector Size  64kB (1 Sectors)
+    0x20000, 0x020000,          // Sector Size 128kB (7 Sectors)
+    SECTOR_END
+};
+
+/* sectors[] above flattened at build time, as tools/flm2c.py emits it */
+static const flash_geometry_t HostMixedGeometry = {
+    12,                         // sectors
+    3,                          // regions
+    {
+        {0x00000000, 0x00004000, 0, 14},
+        {0x00010000, 0x00010000, 4, 16},
+        {0x00020000, 0x00020000, 5, 17},
+    },
+};
+
+/* W25Q32 style SPI NOR: 4kB sectors, 256 byte program page */
+static flash_dev_t const HostSpiNorDevice = {
+    FLASH_DRV_VERS,             // Driver Version, do not modify!
+    "HOST SPI NOR 4MB Flash",   // Device Name (4096kB)
+    EXTSPI,                     // Device Type
+    0x90000000,                 // Device Start Address
+    0x00400000,                 // Device Size in Bytes (4096kB)
+    256,                        // Programming Page Size
+    0,                          // Reserved, must be 0
+    0xFF,                       // Initial Content of Erased Memory
+    3,                          // Program Page Timeout 3 mSec
+    400,                        // Erase Sector Timeout 400 mSec
+
+// Specify Size and Address of Sectors
+    0x1000, 0x000000,           // Sector Size 4kB (1024 Sectors)
+    SECTOR_END
+};
+
+/* SPI NOR holding fonts and parameters, read through a RAM cache */
+static flash_dev_t const HostCachedDevice = {
+    FLASH_DRV_VERS,             // Driver Version, do not modify!
+    "HOST SPI NOR 1MB cached",  // Device Name (1024kB)
+    EXTSPI,                     // Device Type
+    0x94000000,                 // Device Start Address
+    0x00100000,                 // Device Size in Bytes (1024kB)
+    256,                        // Programming Page Size
+    0,                          // Reserved, must be 0
+    0xFF,                       // Initial Content of Erased Memory
+    3,                          // Program Page Timeout 3 mSec
+    400,                        // Erase Sector Timeout 400 mSec
+
+// Specify Size and Address of Sectors
+    0x1000, 0x000000,           // Sector Size 4kB (256 Sectors)
+    SECTOR_END
+};
+
+/* STM32F10x XL-density style: two 512kB banks, one is programmed while code runs from the other */
+static flash_dev_t const HostDualDevice = {
+    FLASH_DRV_VERS,             // Driver Version, do not modify!
+    "HOST Dual Bank 1MB Flash", // Device Name (1024kB)
+    ONCHIP,                     // Device Type
+    0x0C000000,                 // Device Start Address
+    0x00100000,                 // Device Size in Bytes (1024kB)
+    1024,                       // Programming Page Size
+    0,                          // Reserved, must be 0
+    0xFF,                       // Initial Content of Erased Memory
+    100,                        // Program Page Timeout 100 mSec
+    500,                        // Erase Sector Timeout 500 mSec
+
+// Specify Size and Address of Sectors
+    0x0800, 0x000000,           // Sector Size 2kB (512 Sectors)
+    SECTOR_END
+};
+
+static const flash_erase_caps_t HostUniformErase;
+static const flash_erase_caps_t HostMixedErase;
+static const flash_erase_caps_t HostSpiNorErase;
+
+/* on-chip devices are memory mapped, like the drivers in port/ */
+HOST_FLASH_SIM_DEFINE_EX(host_uniform_flash_device, HostUniformDevice, NULL, &HostUniformErase);
+HOST_FLASH_SIM_DEFINE_GEO(host_mixed_flash_device, HostMixedDevice, &HostMixedErase, &HostMixedGeometry);
+HOST_FLASH_SIM_DEFINE_EX(host_spinor_flash_device, HostSpiNorDevice, host_spinor_flash_device_read,
+                         &HostSpiNorErase);
+HOST_FLASH_SIM_DEFINE_BANKS(host_dual_flash_device, HostDualDevice, 0x00080000);
+/* 8kB arena: 64 sets of 4 ways, 32 byte lines */
+FLASH_CACHE_DEFINE(host_cached_flash_cache, 64, 4, 32);
+HOST_FLASH_SIM_DEFINE_CACHED(host_cached_flash_device, HostCachedDevice, &host_cached_flash_cache);
+
+/* multi-page erase (FLASH_CR.PER with NbPages) and a mass erase */
+static const flash_erase_caps_t HostUniformErase = {
+    .EraseSectors = host_uniform_flash_device_erase_sectors,
+    .wChipTime = 500,
+};
+
+/* multi-sector erase and a mass erase about 2.7x one 128kB sector */
+static const flash_erase_caps_t HostMixedErase = {
+    .EraseSectors = host_mixed_flash_device_erase_sectors,
+    .wChipTime = 16000,
+};
+
+/* W25Q32 style 0x20 / 0x52 / 0xD8 / 0xC7 erase commands, typical timings */
+static const flash_erase_caps_t HostSpiNorErase = {
+    .EraseBlock = host_spinor_flash_device_erase_block,
+    .wBlockSize = {0x8000, 0x10000},
+    .wBlockTime = {1600, 2000},
+    .wSectorTime = 400,
+    .wChipTime = 50000,
+};
+
+/*
+ * W25Q128 style QSPI NOR model. Only the memory array is described here,
+ * the generic driver learns size, erase types and timing from the SFDP
+ * table the model generates and talks to it over the bus hooks.
+ */
+static flash_dev_t const HostQspiArray = {
+    FLASH_DRV_VERS,             // Driver Version, do not modify!
+    "HOST QSPI NOR 16MB array", // Device Name (16384kB)
+    EXTSPI,                     // Device Type
+    0x00000000,                 // Address on the SPI bus
+    0x01000000,                 // Device Size in Bytes (16384kB)
+    256,                        // Programming Page Size
+    0,                          // Reserved, must be 0
+    0xFF,                       // Initial Content of Erased Memory
+    2,                          // Program Page Timeout 2 mSec
+    400,                        // Erase Sector Timeout 400 mSec
+
+// Specify Size and Address of Sectors
+    0x1000, 0x000000,           // Sector Size 4kB (4096 Sectors)
+    SECTOR_END
+};
+
+/* block and chip erase timing of the array, data only */
+static const flash_erase_caps_t HostQspiTiming = {
+    .wBlockSize = {0x8000, 0x10000},
+    .wBlockTime = {1600, 2000},
+    .wSectorTime = 400,
+    .wChipTime = 50000,
+};
+
+host_flash_sim_t host_qspi_array_sim = {.ptFlashDev = &HostQspiArray, .iFd = -1, .ptErase = &HostQspiTiming};
+host_spi_nor_t host_qspi_model = {
+    .ptSim = &host_qspi_array_sim,
+    .wClockHz = 50000000,
+    .chJedecId = {0xEF, 0x40, 0x18},
+};
+spi_nor_bus_t host_qspi_bus = {
+    .Transfer = host_spi_nor_transfer,
+    .Delay = host_spi_nor_delay,
+    .pBus = &host_qspi_model,
+    .chLines = 4,
+};
+SPI_NOR_FLASH_DEFINE(host_qspi_flash_device, host_qspi_bus, 0xA0000000);
+
+/*
+ * A row of small 64kB devices, only used to grow the device table for the
+ * address lookup benchmark.
+ */
+#define HOST_SMALL_FLASH_DEFINE(__N)                                            \
+    static flash_dev_t const HostSmallDevice##__N = {                          \
+        FLASH_DRV_VERS, "HOST Small 64kB Flash " #__N, EXT16BIT,               \
+        0x60000000 + (__N) * 0x10000, 0x00010000, 256, 0, 0xFF, 3, 100,        \
+        0x1000, 0x000000, SECTOR_END                                           \
+    };                                                                         \
+    HOST_FLASH_SIM_DEFINE(host_small_flash_device##__N, HostSmallDevice##__N)
+
+HOST_SMALL_FLASH_DEFINE(0);  HOST_SMALL_FLASH_DEFINE(1);  HOST_SMALL_FLASH_DEFINE(2);
+HOST_SMALL_FLASH_DEFINE(3);  HOST_SMALL_FLASH_DEFINE(4);  HOST_SMALL_FLASH_DEFINE(5);
+HOST_SMALL_FLASH_DEFINE(6);  HOST_SMALL_FLASH_DEFINE(7);  HOST_SMALL_FLASH_DEFINE(8);
+HOST_SMALL_FLASH_DEFINE(9);  HOST_SMALL_FLASH_DEFINE(10); HOST_SMALL_FLASH_DEFINE(11);
+HOST_SMALL_FLASH_DEFINE(12); HOST_SMALL_FLASH_DEFINE(13); HOST_SMALL_FLASH_DEFINE(14);
+HOST_SMALL_FLASH_DEFINE(15); HOST_SMALL_FLASH_DEFINE(16); HOST_SMALL_FLASH_DEFINE(17);
+HOST_SMALL_FLASH_DEFINE(18); HOST_SMALL_FLASH_DEFINE(19); HOST_SMALL_FLASH_DEFINE(20);
+HOST_SMALL_FLASH_DEFINE(21); HOST_SMALL_FLASH_DEFINE(22); HOST_SMALL_FLASH_DEFINE(23);
+HOST_SMALL_FLASH_DEFINE(24); HOST_SMALL_FLASH_DEFINE(25); HOST_SMALL_FLASH_DEFINE(26);
+HOST_SMALL_FLASH_DEFINE(27); HOST_SMALL_FLASH_DEFINE(28);
+
+/*
+ * Targets of the FLM images the bench loads at runtime. They are not in
+ * FLASH_DEV_TABLE: each image carries one of these descriptions in DevDscr.
+ * Host code cannot run Thumb code, so the PrgCode of such an image holds at
+ * each entry point the flash_flm_entry_t it stands for, and its PrgData
+ * the number of the simulated device below.
+ */
+static flash_dev_t const HostFlmSpiDevice = {
+    FLASH_DRV_VERS,             // Driver Version, do not modify!
+    "HOST FLM SPI 1MB",         // Device Name (1024kB)
+    EXTSPI,                     // Device Type
+    0xC0000000,                 // Device Start Address
+    0x00100000,                 // Device Size in Bytes (1024kB)
+    256,                        // Programming Page Size
+    0,                          // Reserved, must be 0
+    0xFF,                       // Initial Content of Erased Memory
+    3,                          // Program Page Timeout 3 mSec
+    400,                        // Erase Sector Timeout 400 mSec
+
+// Specify Size and Address of Sectors
+    0x1000, 0x000000,           // Sector Size 4kB (256 Sectors)
+    SECTOR_END
+};
+
+static flash_dev_t const HostFlmMixedDevice = {
+    FLASH_DRV_VERS,             // Driver Version, do not modify!
+    "HOST FLM Mixed 256kB",     // Device Name (256kB)
+    ONCHIP,                     // Device Type
+    0xC0100000,                 // Device Start Address
+    0x00040000,                 // Device Size in Bytes (256kB)
+    1024,                       // Programming Page Size
+    0,                          // Reserved, must be 0
+    0xFF,                       // Initial Content of Erased Memory
+    100,                        // Program Page Timeout 100 mSec
+    6000,                       // Erase Sector Timeout 6000 mSec
+
+// Specify Size and Address of Sectors
+    0x04000, 0x000000,          // Sector Size  16kB (4 Sectors)
+    0x10000, 0x010000,          // Sector Size  64kB (3 Sectors)
+    SECTOR_END
+};
+
+host_flash_sim_t host_flm_sim[HOST_FLM_SIM_NUM] = {
+    {.ptFlashDev = &HostFlmSpiDevice, .iFd = -1},
+    {.ptFlashDev = &HostFlmMixedDevice, .iFd = -1},
+};
+
+/*
+ * Function: host_flash_flm_call
+ * Description: FLASH_FLM_CALL() of the host, runs an entry point of an FLM
+ *              image built for host_flm_sim[].
+ * Parameters:
+ *   - wEntry: Entry point in the execution region, Thumb bit set.
+ *   - pStaticBase: PrgData in the execution region.
+ *   - wArg0, wArg1, wArg2: Arguments of the entry point.
+ * Returns: The result of the simulated operation, 1 for a bad image.
+ */
+int32_t host_flash_flm_call(uintptr_t wEntry, void *pStaticBase, uintptr_t wArg0, uintptr_t wArg1,
+                            uintptr_t wArg2)
+{
+    uint32_t wOp, wDev;
+    host_flash_sim_t *ptSim;
+
+    if ((wEntry & 1) == 0) {
+        /*a BX to an even address would switch to ARM state*/
+        return 1;
+    }
+    memcpy(&wOp, (const void *)(wEntry - 1), sizeof(wOp));
+    memcpy(&wDev, pStaticBase, sizeof(wDev));
+    if (wDev >= HOST_FLM_SIM_NUM) {
+        return 1;
+    }
+    ptSim = &host_flm_sim[wDev];
+
+    switch (wOp) {
+        case FLASH_FLM_INIT:
+            return host_flash_sim_init(ptSim, (uint32_t)wArg0, (uint32_t)wArg1, (uint32_t)wArg2);
+        case FLASH_FLM_UNINIT:
+            return host_flash_sim_uninit(ptSim, (uint32_t)wArg0);
+        case FLASH_FLM_ERASE_CHIP:
+            return host_flash_sim_erase_chip(ptSim);
+        case FLASH_FLM_ERASE_SECTOR:
+            return host_flash_sim_erase_sector(ptSim, (uint32_t)wArg0);
+        case FLASH_FLM_PROGRAM_PAGE:
+            return host_flash_sim_program(ptSim, (uint32_t)wArg0, (uint32_t)wArg1, (uint8_t *)wArg2);
+        default:
+            return 1;
+    }
+}
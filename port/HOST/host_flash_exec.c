@@ -0,0 +1,137 @@
+/****************************************************************************
+*  Copyright 2022 KK (https://github.com/WALI-KANG)                                    *
+*                                                                           *
+*  Licensed under the Apache License, Version 2.0 (the "License");          *
+*  you may not use this file except in compliance with the License.         *
+*  You may obtain a copy of the License at                                  *
+*                                                                           *
+*     http://www.apache.org/licenses/LICENSE-2.0                            *
+*                                                                           *
+*  Unless required by applicable law or agreed to in writing, software      *
+*  distributed under the License is distributed on an "AS IS" BASIS,        *
+*  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. *
+*  See the License for the specific language governing permissions and      *
+*  limitations under the License.                                           *
+*                                                                           *
+****************************************************************************/
+#include <pthread.h>
+#include "host_flash_exec.h"
+
+typedef struct {
+    pthread_t       tThread;
+    pthread_cond_t  tWake;
+    uint32_t        wAddr;          // any address of the device
+    int32_t         nId;            // flash_dev_id(wAddr)
+    bool            bWake;          // a request was queued since the last poll
+} host_flash_worker_t;
+
+/* guards the worker table and the wake-up flags */
+static pthread_mutex_t s_tExecLock = PTHREAD_MUTEX_INITIALIZER;
+static host_flash_worker_t s_tWorker[HOST_FLASH_EXEC_DEV_MAX];
+static uint32_t s_wWorkerNum = 0;
+static volatile bool s_bRunning = false;
+
+/*
+ * Function: host_flash_notify
+ * Description: FLASH_BLOB_DEV_NOTIFY() of the host port, wakes the worker of
+ *              the device if the executor runs one.
+ * Parameters:
+ *   - nId: Device number.
+ */
+void host_flash_notify(int32_t nId)
+{
+    pthread_mutex_lock(&s_tExecLock);
+    for (uint32_t i = 0; i < s_wWorkerNum; i++) {
+        if (s_tWorker[i].nId == nId) {
+            s_tWorker[i].bWake = true;
+            pthread_cond_signal(&s_tWorker[i].tWake);
+        }
+    }
+    pthread_mutex_unlock(&s_tExecLock);
+}
+
+static void *host_flash_worker(void *pArg)
+{
+    host_flash_worker_t *ptWorker = (host_flash_worker_t *)pArg;
+
+    pthread_mutex_lock(&s_tExecLock);
+    while (s_bRunning) {
+        if (!ptWorker->bWake) {
+            pthread_cond_wait(&ptWorker->tWake, &s_tExecLock);
+            continue;
+        }
+        ptWorker->bWake = false;
+        pthread_mutex_unlock(&s_tExecLock);
+
+        /* requests queued meanwhile set bWake again and get another round */
+        while (target_flash_poll_dev(ptWorker->wAddr));
+
+        pthread_mutex_lock(&s_tExecLock);
+    }
+    pthread_mutex_unlock(&s_tExecLock);
+
+    return NULL;
+}
+
+/*
+ * Function: host_flash_exec_start
+ * Description: Starts one worker thread per device. Requests already queued
+ *              for the devices are picked up at once.
+ * Parameters:
+ *   - pwAddr: Any address of each device.
+ *   - wNum: Number of devices.
+ * Returns: True if every device exists and got its worker.
+ */
+bool host_flash_exec_start(const uint32_t *pwAddr, uint32_t wNum)
+{
+    bool bResult = true;
+
+    host_flash_exec_stop();
+    if (wNum > HOST_FLASH_EXEC_DEV_MAX) {
+        return false;
+    }
+
+    s_bRunning = true;
+    for (uint32_t i = 0; i < wNum; i++) {
+        host_flash_worker_t *ptWorker = &s_tWorker[s_wWorkerNum];
+
+        ptWorker->wAddr = pwAddr[i];
+        ptWorker->nId = flash_dev_id(pwAddr[i]);
+        ptWorker->bWake = true;
+        if (ptWorker->nId < 0 || pthread_cond_init(&ptWorker->tWake, NULL) != 0) {
+            bResult = false;
+            continue;
+        }
+        pthread_mutex_lock(&s_tExecLock);
+        if (pthread_create(&ptWorker->tThread, NULL, host_flash_worker, ptWorker) == 0) {
+            s_wWorkerNum++;
+        } else {
+            pthread_cond_destroy(&ptWorker->tWake);
+            bResult = false;
+        }
+        pthread_mutex_unlock(&s_tExecLock);
+    }
+
+    return bResult;
+}
+
+/*
+ * Function: host_flash_exec_stop
+ * Description: Stops the workers once they have finished their current
+ *              round. Requests still queued stay queued.
+ */
+void host_flash_exec_stop(void)
+{
+    pthread_mutex_lock(&s_tExecLock);
+    s_bRunning = false;
+    for (uint32_t i = 0; i < s_wWorkerNum; i++) {
+        pthread_cond_signal(&s_tWorker[i].tWake);
+    }
+    pthread_mutex_unlock(&s_tExecLock);
+
+    for (uint32_t i = 0; i < s_wWorkerNum; i++) {
+        pthread_join(s_tWorker[i].tThread, NULL);
+        pthread_cond_destroy(&s_tWorker[i].tWake);
+    }
+    s_wWorkerNum = 0;
+}
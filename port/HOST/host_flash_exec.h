@@ -0,0 +1,37 @@
+/****************************************************************************
+*  Copyright 2022 KK (https://github.com/WALI-KANG)                                    *
+*                                                                           *
+*  Licensed under the Apache License, Version 2.0 (the "License");          *
+*  you may not use this file except in compliance with the License.         *
+*  You may obtain a copy of the License at                                  *
+*                                                                           *
+*     http://www.apache.org/licenses/LICENSE-2.0                            *
+*                                                                           *
+*  Unless required by applicable law or agreed to in writing, software      *
+*  distributed under the License is distributed on an "AS IS" BASIS,        *
+*  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. *
+*  See the License for the specific language governing permissions and      *
+*  limitations under the License.                                           *
+*                                                                           *
+****************************************************************************/
+
+#ifndef HOST_FLASH_EXEC_H
+#define HOST_FLASH_EXEC_H
+#include "flash_blob.h"
+
+/*
+ * Threaded executor of the host port, the locks of flash_blob.c come from
+ * port/OS/flash_os_posix.c. The executor runs a worker thread per device:
+ * the worker sleeps until FLASH_BLOB_DEV_NOTIFY() reports a new request and then calls
+ * target_flash_poll_dev() until the queue of its device is empty, so the
+ * requests of different devices are worked off at the same time.
+ */
+
+/* Most devices with a worker */
+#define HOST_FLASH_EXEC_DEV_MAX     64
+
+extern void host_flash_notify(int32_t nId);
+
+extern bool host_flash_exec_start(const uint32_t *pwAddr, uint32_t wNum);
+extern void host_flash_exec_stop(void);
+#endif
@@ -0,0 +1,704 @@
+/****************************************************************************
+*  Copyright 2022 KK (https://github.com/WALI-KANG)                                    *
+*                                                                           *
+*  Licensed under the Apache License, Version 2.0 (the "License");          *
+*  you may not use this file except in compliance with the License.         *
+*  You may obtain a copy of the License at                                  *
+*                                                                           *
+*     http://www.apache.org/licenses/LICENSE-2.0                            *
+*                                                                           *
+*  Unless required by applicable law or agreed to in writing, software      *
+*  distributed under the License is distributed on an "AS IS" BASIS,        *
+*  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. *
+*  See the License for the specific language governing permissions and      *
+*  limitations under the License.                                           *
+*                                                                           *
+****************************************************************************/
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "host_flash_sim.h"
+
+/* simulated PRIMASK used by the host cmsis_compiler.h */
+__thread volatile uint32_t g_wHostPrimask = 0;
+
+static host_flash_sim_mode_t s_tMode = HOST_FLASH_SIM_VIRTUAL;
+static uint32_t s_wScaleNum = 1;
+static uint32_t s_wScaleDen = 100;
+static uint64_t s_wSpinNs = HOST_FLASH_SIM_SPIN_NS;
+static uint64_t s_wVirtualNs = 0;       // modelled time not spent in VIRTUAL mode
+static uint32_t s_wYields = 0;
+static uint32_t s_wMaskedYields = 0;
+static uint32_t s_wCodeAddr = 0;        // where the simulated CPU executes from
+
+/* REALTIME busy times of the devices, see host_flash_sim_overlap_ns() */
+static pthread_mutex_t s_tBusyLock = PTHREAD_MUTEX_INITIALIZER;
+static uint32_t s_wBusyNow = 0;         // devices in a busy time
+static uint64_t s_wBusyMark = 0;        // host time s_wBusyNow last changed
+static uint64_t s_wSleptNs = 0;         // time at least one device was busy
+static uint64_t s_wOverlapNs = 0;       // time at least two devices were busy
+
+/* opened devices, searched by host_flash_sim_map() */
+#define HOST_FLASH_SIM_OPEN_MAX     64
+static host_flash_sim_t *s_ptOpened[HOST_FLASH_SIM_OPEN_MAX];
+
+/*
+ * Function: host_flash_sim_now_ns
+ * Description: Reads the host monotonic clock.
+ * Returns: Current time in nanoseconds.
+ */
+uint64_t host_flash_sim_now_ns(void)
+{
+    struct timespec tNow;
+    clock_gettime(CLOCK_MONOTONIC, &tNow);
+    return (uint64_t)tNow.tv_sec * 1000000000ull + (uint64_t)tNow.tv_nsec;
+}
+
+/*
+ * Function: host_flash_sim_clock_ns
+ * Description: Reads the simulated clock, the host clock plus all modelled
+ *              device time that VIRTUAL mode did not actually spend.
+ * Returns: Current simulated time in nanoseconds.
+ */
+uint64_t host_flash_sim_clock_ns(void)
+{
+    return host_flash_sim_now_ns() + s_wVirtualNs;
+}
+
+/*
+ * Function: host_flash_sim_virtual_ns
+ * Description: Reads the modelled time VIRTUAL mode did not spend, which
+ *              unlike host_flash_sim_clock_ns() does not depend on how fast
+ *              the host runs the code in between.
+ * Returns: Virtual time in nanoseconds.
+ */
+uint64_t host_flash_sim_virtual_ns(void)
+{
+    return s_wVirtualNs;
+}
+
+/* clock of the posted devices: in VIRTUAL mode they only finish in modelled time */
+static uint64_t host_flash_sim_posted_ns(void)
+{
+    return (s_tMode == HOST_FLASH_SIM_REALTIME) ? host_flash_sim_clock_ns() : s_wVirtualNs;
+}
+
+/*
+ * Function: host_flash_sim_idle
+ * Description: Lets simulated time pass outside the flash devices, e.g. to
+ *              model a communication link. VIRTUAL mode only advances the
+ *              simulated clock, REALTIME mode sleeps.
+ * Parameters:
+ *   - wNs: Nanoseconds to pass.
+ */
+void host_flash_sim_idle(uint64_t wNs)
+{
+    if (s_tMode != HOST_FLASH_SIM_REALTIME) {
+        s_wVirtualNs += wNs;
+        return;
+    }
+
+    struct timespec tSleep = {
+        .tv_sec  = (time_t)(wNs / 1000000000ull),
+        .tv_nsec = (long)(wNs % 1000000000ull),
+    };
+    nanosleep(&tSleep, NULL);
+}
+
+/*
+ * Function: host_flash_sim_yield
+ * Description: FLASH_BLOB_YIELD() hook of the host port, counts the calls
+ *              and those made while the simulated PRIMASK was still set,
+ *              then lets other threads run.
+ */
+void host_flash_sim_yield(void)
+{
+    s_wYields++;
+    if (g_wHostPrimask != 0) {
+        s_wMaskedYields++;
+    }
+    sched_yield();
+}
+
+/*
+ * Function: host_flash_sim_yields
+ * Description: Reads and clears the yield hook counters.
+ * Parameters:
+ *   - pwMasked: Optional, receives the number of yields with IRQs masked.
+ * Returns: Number of yields since the last call.
+ */
+uint32_t host_flash_sim_yields(uint32_t *pwMasked)
+{
+    uint32_t wYields = s_wYields;
+
+    if (pwMasked != NULL) {
+        *pwMasked = s_wMaskedYields;
+    }
+    s_wYields = 0;
+    s_wMaskedYields = 0;
+    return wYields;
+}
+
+/*
+ * Function: host_flash_sim_overlap_ns
+ * Description: Reads and clears how long at least two devices were busy
+ *              at the same time in REALTIME mode, i.e. how much the threads
+ *              driving them really overlapped. A posted device counts from
+ *              the start of a busy time of another device until it is ready.
+ * Parameters:
+ *   - pwBusy: Optional, receives how long at least one device was busy.
+ * Returns: Overlapped busy time in ns since the last call.
+ */
+uint64_t host_flash_sim_overlap_ns(uint64_t *pwBusy)
+{
+    uint64_t wOverlap;
+
+    pthread_mutex_lock(&s_tBusyLock);
+    if (pwBusy != NULL) {
+        *pwBusy = s_wSleptNs;
+    }
+    wOverlap = s_wOverlapNs;
+    s_wSleptNs = 0;
+    s_wOverlapNs = 0;
+    pthread_mutex_unlock(&s_tBusyLock);
+
+    return wOverlap;
+}
+
+/* a device enters (iDelta 1, with wPosted ns of posted devices still busy) or leaves a busy time */
+static void host_flash_sim_busy_count(int iDelta, uint64_t wPosted)
+{
+    uint64_t wNow = host_flash_sim_now_ns();
+
+    pthread_mutex_lock(&s_tBusyLock);
+    if (s_wBusyNow >= 1) {
+        s_wSleptNs += wNow - s_wBusyMark;
+    }
+    if (s_wBusyNow >= 2) {
+        s_wOverlapNs += wNow - s_wBusyMark;
+    } else if (s_wBusyNow == 0) {
+        s_wOverlapNs += wPosted;
+    }
+    s_wBusyNow += iDelta;
+    s_wBusyMark = wNow;
+    pthread_mutex_unlock(&s_tBusyLock);
+}
+
+/*
+ * Function: host_flash_sim_set_code_addr
+ * Description: Moves the simulated code, FLASH_BLOB_CODE_ADDR() of the host
+ *              port. Outside all devices the code runs from RAM.
+ * Parameters:
+ *   - wAddr: Address the CPU executes from.
+ */
+void host_flash_sim_set_code_addr(uint32_t wAddr)
+{
+    s_wCodeAddr = wAddr;
+}
+
+/*
+ * Function: host_flash_sim_code_addr
+ * Description: Reads the address set by host_flash_sim_set_code_addr().
+ * Returns: Address the CPU executes from, 0 by default.
+ */
+uint32_t host_flash_sim_code_addr(void)
+{
+    return s_wCodeAddr;
+}
+
+/*
+ * Function: host_flash_sim_set_mode
+ * Description: Selects whether modelled latency is only accounted or also spent.
+ *              Posted operations still running are finished, their clock
+ *              changes with the mode.
+ * Parameters:
+ *   - tMode: HOST_FLASH_SIM_VIRTUAL or HOST_FLASH_SIM_REALTIME.
+ */
+void host_flash_sim_set_mode(host_flash_sim_mode_t tMode)
+{
+    if (tMode != s_tMode) {
+        for (uint32_t i = 0; i < HOST_FLASH_SIM_OPEN_MAX; i++) {
+            if (s_ptOpened[i] != NULL) {
+                __atomic_store_n(&s_ptOpened[i]->wReadyNs, 0, __ATOMIC_RELAXED);
+            }
+        }
+    }
+    s_tMode = tMode;
+}
+
+/*
+ * Function: host_flash_sim_get_mode
+ * Description: Reads the mode selected by host_flash_sim_set_mode().
+ * Returns: HOST_FLASH_SIM_VIRTUAL or HOST_FLASH_SIM_REALTIME.
+ */
+host_flash_sim_mode_t host_flash_sim_get_mode(void)
+{
+    return s_tMode;
+}
+
+/*
+ * Function: host_flash_sim_set_spin
+ * Description: Sets how much of a REALTIME busy time is spun instead of
+ *              slept. Spinning is exact, sleeping frees the CPU, so busy
+ *              devices driven by different threads overlap even on one core.
+ * Parameters:
+ *   - wNs: Spun tail in ns, 0 sleeps the whole busy time.
+ */
+void host_flash_sim_set_spin(uint64_t wNs)
+{
+    s_wSpinNs = wNs;
+}
+
+/*
+ * Function: host_flash_sim_set_time_scale
+ * Description: Sets the ratio between the toProg/toErase timeouts of a device
+ *              and the modelled typical operation time (default 1/100).
+ * Parameters:
+ *   - wNum: Numerator of the scale.
+ *   - wDen: Denominator of the scale, must not be 0.
+ */
+void host_flash_sim_set_time_scale(uint32_t wNum, uint32_t wDen)
+{
+    if (wDen != 0) {
+        s_wScaleNum = wNum;
+        s_wScaleDen = wDen;
+    }
+}
+
+/*
+ * Function: host_flash_sim_get_time_scale
+ * Description: Reads the scale set by host_flash_sim_set_time_scale().
+ * Parameters:
+ *   - pwNum: Receives the numerator.
+ *   - pwDen: Receives the denominator.
+ */
+void host_flash_sim_get_time_scale(uint32_t *pwNum, uint32_t *pwDen)
+{
+    *pwNum = s_wScaleNum;
+    *pwDen = s_wScaleDen;
+}
+
+static void host_flash_sim_busy(host_flash_sim_t *ptSim, uint64_t wNs)
+{
+    ptSim->tStat.wBusyNs += wNs;
+
+    if (ptSim->bPosted) {
+        /* the caller returns at once and polls host_flash_sim_busy_ns() */
+        uint64_t wNow = host_flash_sim_posted_ns();
+        uint64_t wReady = __atomic_load_n(&ptSim->wReadyNs, __ATOMIC_RELAXED);
+        /* other devices' busy times read it to count the overlap */
+        __atomic_store_n(&ptSim->wReadyNs, ((wReady > wNow) ? wReady : wNow) + wNs, __ATOMIC_RELAXED);
+        return;
+    }
+
+    if (s_tMode != HOST_FLASH_SIM_REALTIME || wNs == 0) {
+        s_wVirtualNs += wNs;
+        return;
+    }
+
+    uint64_t wDeadline = host_flash_sim_now_ns() + wNs;
+    uint64_t wPosted = 0;
+
+    /* posted devices, e.g. a SPI NOR erasing on its own, count as busy too */
+    for (uint32_t i = 0; i < HOST_FLASH_SIM_OPEN_MAX; i++) {
+        host_flash_sim_t *ptOther = s_ptOpened[i];
+        if (ptOther != NULL && ptOther != ptSim && ptOther->bPosted) {
+            uint64_t wLeft = host_flash_sim_busy_ns(ptOther);
+            wPosted = (wLeft > wPosted) ? ((wLeft < wNs) ? wLeft : wNs) : wPosted;
+        }
+    }
+    host_flash_sim_busy_count(1, wPosted);
+
+    if (wNs > 2 * s_wSpinNs) {
+        /* sleep the bulk of long operations, spin only for the tail */
+        struct timespec tSleep = {
+            .tv_sec  = (time_t)((wNs - s_wSpinNs) / 1000000000ull),
+            .tv_nsec = (long)((wNs - s_wSpinNs) % 1000000000ull),
+        };
+        nanosleep(&tSleep, NULL);
+    }
+
+    while (host_flash_sim_now_ns() < wDeadline);
+    host_flash_sim_busy_count(-1, 0);
+}
+
+/*
+ * Function: host_flash_sim_busy_ns
+ * Description: Time left until a device in posted mode finishes its last
+ *              program or erase.
+ * Parameters:
+ *   - ptSim: Simulated device.
+ * Returns: Remaining busy time in ns, 0 if the device is ready.
+ */
+uint64_t host_flash_sim_busy_ns(host_flash_sim_t *ptSim)
+{
+    uint64_t wNow = host_flash_sim_posted_ns();
+    uint64_t wReady = __atomic_load_n(&ptSim->wReadyNs, __ATOMIC_RELAXED);
+
+    return (wReady > wNow) ? wReady - wNow : 0;
+}
+
+/*
+ * Function: host_flash_sim_ms_to_ns
+ * Description: Converts a datasheet time to modelled busy time.
+ * Parameters:
+ *   - wMs: Time in ms, as in toErase or flash_erase_caps_t.
+ * Returns: Modelled time in ns under the current time scale.
+ */
+uint64_t host_flash_sim_ms_to_ns(unsigned long wMs)
+{
+    return (uint64_t)wMs * 1000000ull * s_wScaleNum / s_wScaleDen;
+}
+
+/*
+ * Function: host_flash_sim_sector
+ * Description: Locates the sector holding a device offset in sectors[].
+ * Parameters:
+ *   - ptSim: Simulated device.
+ *   - wOffset: Offset from DevAdr.
+ *   - pwStart: Receives the sector start offset.
+ *   - pwIndex: Receives the linear sector index.
+ * Returns: Sector size, 0 if the offset is outside the device.
+ */
+static uint32_t host_flash_sim_sector(host_flash_sim_t *ptSim, uint32_t wOffset,
+                                      uint32_t *pwStart, size_t *pwIndex)
+{
+    flash_dev_t const *ptDev = ptSim->ptFlashDev;
+    size_t wIndex = 0;
+
+    if (wOffset >= ptDev->szDev) {
+        return 0;
+    }
+
+    for (size_t i = 0; i < SECTOR_NUM && ptDev->sectors[i].szSector != 0xFFFFFFFF; i++) {
+        uint32_t wBase = ptDev->sectors[i].AddrSector;
+        uint32_t wSize = ptDev->sectors[i].szSector;
+        uint32_t wEnd  = ptDev->szDev;
+
+        if (i + 1 < SECTOR_NUM && ptDev->sectors[i + 1].szSector != 0xFFFFFFFF) {
+            wEnd = ptDev->sectors[i + 1].AddrSector;
+        }
+
+        if (wOffset < wEnd) {
+            uint32_t wNum = (wOffset - wBase) / wSize;
+            *pwStart = wBase + wNum * wSize;
+            *pwIndex = wIndex + wNum;
+            return wSize;
+        }
+
+        wIndex += (wEnd - wBase) / wSize;
+    }
+
+    return 0;
+}
+
+/*
+ * Function: host_flash_sim_open
+ * Description: Allocates the backing store of a simulated device. With an
+ *              image path the file is created/extended to szDev and mmap'd,
+ *              so the flash contents survive between runs.
+ * Parameters:
+ *   - ptSim: Simulated device.
+ *   - pchImage: Image file path, NULL for a RAM buffer.
+ * Returns: True on success.
+ */
+bool host_flash_sim_open(host_flash_sim_t *ptSim, const char *pchImage)
+{
+    flash_dev_t const *ptDev = ptSim->ptFlashDev;
+    uint32_t wStart;
+    size_t wLast;
+    bool bFresh = true;
+
+    host_flash_sim_close(ptSim);
+
+    if (pchImage != NULL) {
+        struct stat tStat;
+        ptSim->iFd = open(pchImage, O_RDWR | O_CREAT, 0644);
+        if (ptSim->iFd < 0) {
+            return false;
+        }
+        if (fstat(ptSim->iFd, &tStat) == 0 && (size_t)tStat.st_size >= ptDev->szDev) {
+            bFresh = false;
+        } else if (ftruncate(ptSim->iFd, ptDev->szDev) != 0) {
+            host_flash_sim_close(ptSim);
+            return false;
+        }
+        void *pMem = mmap(NULL, ptDev->szDev, PROT_READ | PROT_WRITE, MAP_SHARED, ptSim->iFd, 0);
+        if (pMem == MAP_FAILED) {
+            host_flash_sim_close(ptSim);
+            return false;
+        }
+        ptSim->pchMem = pMem;
+    } else {
+        ptSim->pchMem = malloc(ptDev->szDev);
+        if (ptSim->pchMem == NULL) {
+            return false;
+        }
+    }
+
+    if (bFresh) {
+        memset(ptSim->pchMem, ptDev->valEmpty, ptDev->szDev);
+    }
+
+    if (host_flash_sim_sector(ptSim, ptDev->szDev - 1, &wStart, &wLast) == 0) {
+        host_flash_sim_close(ptSim);
+        return false;
+    }
+    ptSim->wSectorNum = wLast + 1;
+    if (ptDev->DevType == EXTSPI && ptSim->wReadByteNs == 0) {
+        /* quad SPI at ~50MHz: command + address + dummy, then 25MB/s */
+        ptSim->wReadSetupNs = 1000;
+        ptSim->wReadByteNs = 40;
+    }
+    ptSim->pwWear = calloc(ptSim->wSectorNum, sizeof(uint32_t));
+    host_flash_sim_stat_reset(ptSim);
+    for (size_t i = 0; i < HOST_FLASH_SIM_OPEN_MAX; i++) {
+        if (s_ptOpened[i] == NULL) {
+            s_ptOpened[i] = ptSim;
+            break;
+        }
+    }
+
+    return ptSim->pwWear != NULL;
+}
+
+/*
+ * Function: host_flash_sim_close
+ * Description: Releases the backing store of a simulated device.
+ * Parameters:
+ *   - ptSim: Simulated device.
+ */
+void host_flash_sim_close(host_flash_sim_t *ptSim)
+{
+    for (size_t i = 0; i < HOST_FLASH_SIM_OPEN_MAX; i++) {
+        if (s_ptOpened[i] == ptSim) {
+            s_ptOpened[i] = NULL;
+        }
+    }
+    if (ptSim->pchMem != NULL) {
+        if (ptSim->iFd >= 0) {
+            munmap(ptSim->pchMem, ptSim->ptFlashDev->szDev);
+        } else {
+            free(ptSim->pchMem);
+        }
+    }
+    if (ptSim->iFd >= 0) {
+        close(ptSim->iFd);
+    }
+    free(ptSim->pwWear);
+    ptSim->pchMem = NULL;
+    ptSim->pwWear = NULL;
+    ptSim->iFd = -1;
+}
+
+/*
+ * Function: host_flash_sim_map
+ * Description: Memory map of the simulated devices, the host side
+ *              FLASH_BLOB_MAP_ADDR().
+ * Parameters:
+ *   - adr: Flash address.
+ * Returns: Pointer into the backing store, NULL if no open device holds adr.
+ */
+const uint8_t *host_flash_sim_map(uint32_t adr)
+{
+    for (size_t i = 0; i < HOST_FLASH_SIM_OPEN_MAX; i++) {
+        host_flash_sim_t *ptSim = s_ptOpened[i];
+        if (ptSim != NULL && adr - ptSim->ptFlashDev->DevAdr < ptSim->ptFlashDev->szDev) {
+            return ptSim->pchMem + (adr - ptSim->ptFlashDev->DevAdr);
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Function: host_flash_sim_stat_reset
+ * Description: Clears the operation statistics of a simulated device.
+ * Parameters:
+ *   - ptSim: Simulated device.
+ */
+void host_flash_sim_stat_reset(host_flash_sim_t *ptSim)
+{
+    memset(&ptSim->tStat, 0, sizeof(ptSim->tStat));
+}
+
+static bool host_flash_sim_ready(host_flash_sim_t *ptSim)
+{
+    if (ptSim->pchMem == NULL) {
+        return host_flash_sim_open(ptSim, NULL);
+    }
+    return true;
+}
+
+int32_t host_flash_sim_init(host_flash_sim_t *ptSim, uint32_t adr, uint32_t clk, uint32_t fnc)
+{
+    (void)adr; (void)clk; (void)fnc;
+    return host_flash_sim_ready(ptSim) ? 0 : 1;
+}
+
+int32_t host_flash_sim_uninit(host_flash_sim_t *ptSim, uint32_t fnc)
+{
+    (void)ptSim; (void)fnc;
+    return 0;
+}
+
+int32_t host_flash_sim_erase_chip(host_flash_sim_t *ptSim)
+{
+    flash_dev_t const *ptDev = ptSim->ptFlashDev;
+
+    if (!host_flash_sim_ready(ptSim)) {
+        return 1;
+    }
+
+    memset(ptSim->pchMem, ptDev->valEmpty, ptDev->szDev);
+    for (size_t i = 0; i < ptSim->wSectorNum; i++) {
+        ptSim->pwWear[i]++;
+    }
+    ptSim->tStat.wEraseCalls += ptSim->wSectorNum;
+    if (ptSim->ptErase != NULL && ptSim->ptErase->wChipTime != 0) {
+        host_flash_sim_busy(ptSim, host_flash_sim_ms_to_ns(ptSim->ptErase->wChipTime));
+    } else {
+        /* mass erase is modelled as a quarter of the sector by sector time */
+        host_flash_sim_busy(ptSim, host_flash_sim_ms_to_ns(ptDev->toErase) * ptSim->wSectorNum / 4);
+    }
+
+    return 0;
+}
+
+int32_t host_flash_sim_erase_sector(host_flash_sim_t *ptSim, uint32_t adr)
+{
+    flash_dev_t const *ptDev = ptSim->ptFlashDev;
+    uint32_t wStart, wSize;
+    size_t wIndex;
+
+    if (!host_flash_sim_ready(ptSim)) {
+        return 1;
+    }
+
+    wSize = host_flash_sim_sector(ptSim, adr - ptDev->DevAdr, &wStart, &wIndex);
+    if (wSize == 0 || wStart != adr - ptDev->DevAdr) {
+        /* not a sector start address */
+        ptSim->tStat.wViolations++;
+        return 1;
+    }
+
+    memset(ptSim->pchMem + wStart, ptDev->valEmpty, wSize);
+    ptSim->pwWear[wIndex]++;
+    ptSim->tStat.wEraseCalls++;
+    host_flash_sim_busy(ptSim, host_flash_sim_ms_to_ns(ptDev->toErase));
+
+    return 0;
+}
+
+int32_t host_flash_sim_erase_sectors(host_flash_sim_t *ptSim, uint32_t adr, uint32_t num)
+{
+    uint32_t wStart, wSize;
+    size_t wIndex;
+
+    /* a multi-sector erase costs the same as the single erases it replaces */
+    while (num-- > 0) {
+        if (host_flash_sim_erase_sector(ptSim, adr) != 0) {
+            return 1;
+        }
+        wSize = host_flash_sim_sector(ptSim, adr - ptSim->ptFlashDev->DevAdr, &wStart, &wIndex);
+        adr += wSize;
+    }
+
+    return 0;
+}
+
+int32_t host_flash_sim_erase_block(host_flash_sim_t *ptSim, uint32_t adr, uint32_t sz)
+{
+    flash_dev_t const *ptDev = ptSim->ptFlashDev;
+    uint32_t wOffset = adr - ptDev->DevAdr;
+    uint32_t wStart, wSize, wTime = 0;
+    size_t wIndex;
+
+    if (!host_flash_sim_ready(ptSim)) {
+        return 1;
+    }
+
+    for (int i = 0; ptSim->ptErase != NULL && i < FLASH_BLOB_ERASE_BLOCK_NUM; i++) {
+        if (ptSim->ptErase->wBlockSize[i] == sz) {
+            wTime = ptSim->ptErase->wBlockTime[i];
+        }
+    }
+    if (wTime == 0 || adr < ptDev->DevAdr || wOffset % sz != 0 || sz > ptDev->szDev - wOffset) {
+        /* unsupported block size, misaligned or outside the device */
+        ptSim->tStat.wViolations++;
+        return 1;
+    }
+
+    memset(ptSim->pchMem + wOffset, ptDev->valEmpty, sz);
+    for (uint32_t o = wOffset; o < wOffset + sz; o += wSize) {
+        wSize = host_flash_sim_sector(ptSim, o, &wStart, &wIndex);
+        ptSim->pwWear[wIndex]++;
+        ptSim->tStat.wEraseCalls++;
+    }
+    host_flash_sim_busy(ptSim, host_flash_sim_ms_to_ns(wTime));
+
+    return 0;
+}
+
+int32_t host_flash_sim_program(host_flash_sim_t *ptSim, uint32_t adr, uint32_t sz, uint8_t *buf)
+{
+    flash_dev_t const *ptDev = ptSim->ptFlashDev;
+    uint32_t wOffset = adr - ptDev->DevAdr;
+    int32_t nResult = 0;
+
+    if (!host_flash_sim_ready(ptSim)) {
+        return 1;
+    }
+
+    if (adr < ptDev->DevAdr || wOffset >= ptDev->szDev || sz > ptDev->szDev - wOffset ||
+        (sz != 0 && wOffset / ptDev->szPage != (wOffset + sz - 1) / ptDev->szPage)) {
+        /* outside the device or crossing a programming page */
+        ptSim->tStat.wViolations++;
+        return 1;
+    }
+
+    for (uint32_t i = 0; i < sz; i++) {
+        uint8_t chOld = ptSim->pchMem[wOffset + i];
+        if ((chOld & buf[i]) != buf[i]) {
+            /* NOR can only clear bits, the readback verify fails */
+            nResult = 1;
+        }
+        ptSim->pchMem[wOffset + i] = chOld & buf[i];
+    }
+
+    if (nResult != 0) {
+        ptSim->tStat.wViolations++;
+    }
+    ptSim->tStat.wProgCalls++;
+    ptSim->tStat.wProgBytes += sz;
+    host_flash_sim_busy(ptSim, host_flash_sim_ms_to_ns(ptDev->toProg) * sz / ptDev->szPage);
+
+    return nResult;
+}
+
+int32_t host_flash_sim_read(host_flash_sim_t *ptSim, uint32_t adr, uint32_t sz, uint8_t *buf)
+{
+    flash_dev_t const *ptDev = ptSim->ptFlashDev;
+    uint32_t wOffset = adr - ptDev->DevAdr;
+
+    if (!host_flash_sim_ready(ptSim)) {
+        return 1;
+    }
+
+    if (adr < ptDev->DevAdr || wOffset >= ptDev->szDev || sz > ptDev->szDev - wOffset) {
+        ptSim->tStat.wViolations++;
+        return 1;
+    }
+
+    memcpy(buf, ptSim->pchMem + wOffset, sz);
+    ptSim->tStat.wReadCalls++;
+    ptSim->tStat.wReadBytes += sz;
+    host_flash_sim_busy(ptSim, ptSim->wReadSetupNs + (uint64_t)ptSim->wReadByteNs * sz);
+
+    return 0;
+}
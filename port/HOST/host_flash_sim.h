@@ -0,0 +1,154 @@
+/****************************************************************************
+*  Copyright 2022 KK (https://github.com/WALI-KANG)                                    *
+*                                                                           *
+*  Licensed under the Apache License, Version 2.0 (the "License");          *
+*  you may not use this file except in compliance with the License.         *
+*  You may obtain a copy of the License at                                  *
+*                                                                           *
+*     http://www.apache.org/licenses/LICENSE-2.0                            *
+*                                                                           *
+*  Unless required by applicable law or agreed to in writing, software      *
+*  distributed under the License is distributed on an "AS IS" BASIS,        *
+*  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. *
+*  See the License for the specific language governing permissions and      *
+*  limitations under the License.                                           *
+*                                                                           *
+****************************************************************************/
+
+#ifndef HOST_FLASH_SIM_H
+#define HOST_FLASH_SIM_H
+#include "flash_blob.h"
+
+/*
+ * Host side NOR flash simulation.
+ *
+ * Every simulated device is backed by a RAM buffer (or an mmap'd image file)
+ * and behaves like real NOR flash: programming can only clear bits, erase
+ * fills the sector with valEmpty and the szPage / sectors[] geometry of the
+ * flash_dev_t is enforced. Program/erase latency is derived from toProg /
+ * toErase, either accumulated on a virtual clock or spent in real time.
+ */
+
+typedef enum {
+    HOST_FLASH_SIM_VIRTUAL = 0,     // accumulate modelled time only
+    HOST_FLASH_SIM_REALTIME,        // additionally busy-wait the modelled time
+} host_flash_sim_mode_t;
+
+/* Default tail of a REALTIME busy time that is spun, see host_flash_sim_set_spin() */
+#define HOST_FLASH_SIM_SPIN_NS      100000
+
+typedef struct {
+    uint64_t wProgCalls;            // Program() invocations
+    uint64_t wProgBytes;            // bytes passed to Program()
+    uint64_t wEraseCalls;           // sector erases (chip and block erase count each sector)
+    uint64_t wReadCalls;            // Read() invocations
+    uint64_t wReadBytes;            // bytes passed to Read()
+    uint64_t wViolations;           // rejected calls (0->1 bit, misalignment, range)
+    uint64_t wBusyNs;               // modelled busy time of the device
+} host_flash_sim_stat_t;
+
+typedef struct host_flash_sim_t {
+    flash_dev_t const  *ptFlashDev;
+    uint8_t            *pchMem;     // backing store, szDev bytes
+    int                 iFd;        // image file descriptor, -1 when RAM backed
+    uint32_t           *pwWear;     // erase count per sector
+    size_t              wSectorNum;
+    uint32_t            wReadSetupNs;   // per Read() command overhead
+    uint32_t            wReadByteNs;    // per byte transfer time of Read()
+    const flash_erase_caps_t *ptErase;  // block / chip erase timing, NULL for the defaults
+    bool                bPosted;    // busy time runs in the background, see host_flash_sim_busy_ns()
+    uint64_t            wReadyNs;   // simulated time the posted operations finish
+    host_flash_sim_stat_t tStat;
+} host_flash_sim_t;
+
+/*
+ * Defines a simulated device __NAME (a flash_blob_t) with the geometry
+ * __DEV. Each instance gets its own set of flash_ops_t trampolines, since
+ * the FLM style operations carry no context pointer. The _XIP variant has
+ * no Read op and is read through host_flash_sim_map(), like on-chip flash.
+ * __ERASE optionally names a flash_erase_caps_t whose EraseSectors /
+ * EraseBlock point at the __NAME##_erase_sectors / __NAME##_erase_block
+ * trampolines. The _BANKS variant is a memory mapped read-while-write part
+ * with banks of __BANK bytes. The _GEO variant is memory mapped and takes
+ * the flattened sector table __GEO, like the drivers of tools/flm2c.py.
+ * The _CACHED variant reads through the flash_cache_t __CACHE.
+ */
+#define HOST_FLASH_SIM_DEFINE(__NAME, __DEV)                                    \
+    HOST_FLASH_SIM_DEFINE_EX(__NAME, __DEV, __NAME##_read, NULL)
+#define HOST_FLASH_SIM_DEFINE_XIP(__NAME, __DEV)                                \
+    HOST_FLASH_SIM_DEFINE_EX(__NAME, __DEV, NULL, NULL)
+#define HOST_FLASH_SIM_DEFINE_BANKS(__NAME, __DEV, __BANK)                      \
+    HOST_FLASH_SIM_DEFINE_ALL(__NAME, __DEV, NULL, NULL, __BANK, NULL, NULL)
+#define HOST_FLASH_SIM_DEFINE_GEO(__NAME, __DEV, __ERASE, __GEO)                \
+    HOST_FLASH_SIM_DEFINE_ALL(__NAME, __DEV, NULL, __ERASE, 0, __GEO, NULL)
+#define HOST_FLASH_SIM_DEFINE_EX(__NAME, __DEV, __READ, __ERASE)                \
+    HOST_FLASH_SIM_DEFINE_ALL(__NAME, __DEV, __READ, __ERASE, 0, NULL, NULL)
+#define HOST_FLASH_SIM_DEFINE_CACHED(__NAME, __DEV, __CACHE)                    \
+    HOST_FLASH_SIM_DEFINE_ALL(__NAME, __DEV, __NAME##_read, NULL, 0, NULL, __CACHE)
+#define HOST_FLASH_SIM_DEFINE_ALL(__NAME, __DEV, __READ, __ERASE, __BANK, __GEO, __CACHE) \
+    host_flash_sim_t __NAME##_sim = {                                           \
+        .ptFlashDev = &(__DEV), .iFd = -1, .ptErase = (__ERASE)};               \
+    static int32_t __NAME##_init(uint32_t adr, uint32_t clk, uint32_t fnc)      \
+    {   return host_flash_sim_init(&__NAME##_sim, adr, clk, fnc);   }          \
+    static int32_t __NAME##_uninit(uint32_t fnc)                                \
+    {   return host_flash_sim_uninit(&__NAME##_sim, fnc);   }                  \
+    static int32_t __NAME##_erase_chip(void)                                    \
+    {   return host_flash_sim_erase_chip(&__NAME##_sim);   }                   \
+    static int32_t __NAME##_erase_sector(uint32_t adr)                          \
+    {   return host_flash_sim_erase_sector(&__NAME##_sim, adr);   }            \
+    __attribute__((unused))                                                     \
+    static int32_t __NAME##_erase_sectors(uint32_t adr, uint32_t num)           \
+    {   return host_flash_sim_erase_sectors(&__NAME##_sim, adr, num);   }      \
+    __attribute__((unused))                                                     \
+    static int32_t __NAME##_erase_block(uint32_t adr, uint32_t sz)              \
+    {   return host_flash_sim_erase_block(&__NAME##_sim, adr, sz);   }         \
+    static int32_t __NAME##_program(uint32_t adr, uint32_t sz, uint8_t *buf)    \
+    {   return host_flash_sim_program(&__NAME##_sim, adr, sz, buf);   }        \
+    __attribute__((unused))                                                     \
+    static int32_t __NAME##_read(uint32_t adr, uint32_t sz, uint8_t *buf)       \
+    {   return host_flash_sim_read(&__NAME##_sim, adr, sz, buf);   }           \
+    const flash_blob_t __NAME = {                                               \
+        .ptFlashDev = &(__DEV),                                                 \
+        .tFlashops.Init = __NAME##_init,                                        \
+        .tFlashops.UnInit = __NAME##_uninit,                                    \
+        .tFlashops.EraseChip = __NAME##_erase_chip,                             \
+        .tFlashops.EraseSector = __NAME##_erase_sector,                         \
+        .tFlashops.Program = __NAME##_program,                                  \
+        .tFlashops.Read = __READ,                                               \
+        .ptErase = (__ERASE),                                                   \
+        .wBankSize = (__BANK),                                                  \
+        .ptGeometry = (__GEO),                                                  \
+        .ptCache = (__CACHE),                                                   \
+    }
+
+extern void host_flash_sim_set_mode(host_flash_sim_mode_t tMode);
+extern host_flash_sim_mode_t host_flash_sim_get_mode(void);
+extern void host_flash_sim_set_spin(uint64_t wNs);
+extern void host_flash_sim_set_time_scale(uint32_t wNum, uint32_t wDen);
+extern void host_flash_sim_get_time_scale(uint32_t *pwNum, uint32_t *pwDen);
+extern uint64_t host_flash_sim_now_ns(void);
+extern uint64_t host_flash_sim_clock_ns(void);
+extern uint64_t host_flash_sim_virtual_ns(void);
+extern uint64_t host_flash_sim_ms_to_ns(unsigned long wMs);
+extern void host_flash_sim_idle(uint64_t wNs);
+extern void host_flash_sim_yield(void);
+extern void host_flash_sim_set_code_addr(uint32_t wAddr);
+extern uint32_t host_flash_sim_code_addr(void);
+extern uint32_t host_flash_sim_yields(uint32_t *pwMasked);
+extern uint64_t host_flash_sim_overlap_ns(uint64_t *pwBusy);
+
+extern bool host_flash_sim_open(host_flash_sim_t *ptSim, const char *pchImage);
+extern void host_flash_sim_close(host_flash_sim_t *ptSim);
+extern void host_flash_sim_stat_reset(host_flash_sim_t *ptSim);
+extern uint64_t host_flash_sim_busy_ns(host_flash_sim_t *ptSim);
+extern const uint8_t *host_flash_sim_map(uint32_t adr);
+
+extern int32_t host_flash_sim_init(host_flash_sim_t *ptSim, uint32_t adr, uint32_t clk, uint32_t fnc);
+extern int32_t host_flash_sim_uninit(host_flash_sim_t *ptSim, uint32_t fnc);
+extern int32_t host_flash_sim_erase_chip(host_flash_sim_t *ptSim);
+extern int32_t host_flash_sim_erase_sector(host_flash_sim_t *ptSim, uint32_t adr);
+extern int32_t host_flash_sim_erase_sectors(host_flash_sim_t *ptSim, uint32_t adr, uint32_t num);
+extern int32_t host_flash_sim_erase_block(host_flash_sim_t *ptSim, uint32_t adr, uint32_t sz);
+extern int32_t host_flash_sim_program(host_flash_sim_t *ptSim, uint32_t adr, uint32_t sz, uint8_t *buf);
+extern int32_t host_flash_sim_read(host_flash_sim_t *ptSim, uint32_t adr, uint32_t sz, uint8_t *buf);
+#endif
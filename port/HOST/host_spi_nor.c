@@ -0,0 +1,305 @@
+/****************************************************************************
+*  Copyright 2022 KK (https://github.com/WALI-KANG)                                    *
+*                                                                           *
+*  Licensed under the Apache License, Version 2.0 (the "License");          *
+*  you may not use this file except in compliance with the License.         *
+*  You may obtain a copy of the License at                                  *
+*                                                                           *
+*     http://www.apache.org/licenses/LICENSE-2.0                            *
+*                                                                           *
+*  Unless required by applicable law or agreed to in writing, software      *
+*  distributed under the License is distributed on an "AS IS" BASIS,        *
+*  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. *
+*  See the License for the specific language governing permissions and      *
+*  limitations under the License.                                           *
+*                                                                           *
+****************************************************************************/
+#include "host_spi_nor.h"
+
+/* block erase opcodes advertised for the block sizes of the array, in order */
+static const uint8_t c_chBlockCmd[] = {0x52, 0xD8};
+
+#define HOST_SPI_NOR_QER        5           // QE is SR2 bit 1, SR2 read with 0x35, written with 0x01
+#define HOST_SPI_NOR_READ_DUMMY 8
+
+static uint32_t host_spi_nor_log2(uint32_t wValue)
+{
+    uint32_t wExp = 0;
+
+    while ((1u << (wExp + 1)) <= wValue) {
+        wExp++;
+    }
+    return wExp;
+}
+
+/*
+ * Function: host_spi_nor_time_field
+ * Description: Encodes a typical time as SFDP count and units, rounding up.
+ * Parameters:
+ *   - wTime: Time in the unit of pwUnits.
+ *   - pwUnits: Ascending units.
+ *   - wUnitNum: Number of units.
+ * Returns: Count in bits 4:0, units in the bits above.
+ */
+static uint32_t host_spi_nor_time_field(uint32_t wTime, const uint32_t *pwUnits, uint32_t wUnitNum)
+{
+    for (uint32_t u = 0; u < wUnitNum; u++) {
+        uint32_t wCount = (wTime + pwUnits[u] - 1) / pwUnits[u];
+        if (wCount <= 32 || u == wUnitNum - 1) {
+            wCount = (wCount == 0) ? 1 : ((wCount > 32) ? 32 : wCount);
+            return (wCount - 1) | (u << 5);
+        }
+    }
+    return 0;
+}
+
+/*
+ * Function: host_spi_nor_sfdp_build
+ * Description: Generates a JESD216B SFDP header and basic flash parameter
+ *              table describing the memory array and its erase timing.
+ * Parameters:
+ *   - ptNor: Model.
+ */
+static void host_spi_nor_sfdp_build(host_spi_nor_t *ptNor)
+{
+    static const uint32_t c_wEraseUnits[] = {1, 16, 128, 1000};
+    static const uint32_t c_wChipUnits[] = {16, 256, 4000, 64000};
+    flash_dev_t const *ptDev = ptNor->ptSim->ptFlashDev;
+    const flash_erase_caps_t *ptCaps = ptNor->ptSim->ptErase;
+    uint32_t wDw[16] = {0};
+    uint32_t wSectorMs = (ptCaps != NULL && ptCaps->wSectorTime != 0) ? ptCaps->wSectorTime : ptDev->toErase;
+    uint32_t wProgUs = (ptDev->toProg * 1000 > 2048) ? 2048 : ptDev->toProg * 1000;
+
+    /*4kB erase, 1-1-2 and 1-1-4 fast read, 3 or 3/4 byte addresses*/
+    wDw[0] = 0xFF800000u | (1u << 22) | (1u << 16) | (0x20u << 8) | (1u << 2) | 0x01u;
+    if (ptDev->szDev > 0x1000000u) {
+        wDw[0] |= 1u << 17;
+    }
+    wDw[1] = ptDev->szDev * 8 - 1;
+    wDw[2] = (0x6Bu << 24) | ((uint32_t)HOST_SPI_NOR_READ_DUMMY << 16);
+    wDw[3] = (0x3Bu << 8) | HOST_SPI_NOR_READ_DUMMY;
+
+    /*erase type 1 is the sector, the following ones the blocks of the array*/
+    uint32_t wMul = (ptDev->toErase + 2 * wSectorMs - 1) / (2 * wSectorMs);
+    wMul = (wMul == 0) ? 1 : ((wMul > 16) ? 16 : wMul);
+    wDw[7] = (0x20u << 8) | host_spi_nor_log2(ptDev->sectors[0].szSector);
+    wDw[9] = (wMul - 1) | (host_spi_nor_time_field(wSectorMs, c_wEraseUnits, 4) << 4);
+    for (uint32_t i = 0; ptCaps != NULL && i < sizeof(c_chBlockCmd) && ptCaps->wBlockSize[i] != 0; i++) {
+        wDw[7 + (i + 1) / 2] |= (((uint32_t)c_chBlockCmd[i] << 8) | host_spi_nor_log2(ptCaps->wBlockSize[i]))
+                                << (((i + 1) & 1) * 16);
+        wDw[9] |= host_spi_nor_time_field(ptCaps->wBlockTime[i], c_wEraseUnits, 4) << (4 + (i + 1) * 7);
+    }
+
+    /*page program and chip erase*/
+    uint32_t wProgField = host_spi_nor_time_field(wProgUs, (const uint32_t[]){64}, 1);
+    wDw[10] = 1u | (host_spi_nor_log2(ptDev->szPage) << 4) | ((wProgField & 0x1F) << 8) | (1u << 13);
+    if (ptCaps != NULL && ptCaps->wChipTime != 0) {
+        wDw[10] |= host_spi_nor_time_field(ptCaps->wChipTime, c_wChipUnits, 4) << 24;
+    }
+    wDw[14] = (uint32_t)HOST_SPI_NOR_QER << 20;
+
+    memset(ptNor->chSfdp, 0xFF, sizeof(ptNor->chSfdp));
+    memcpy(ptNor->chSfdp, "SFDP", 4);
+    ptNor->chSfdp[4] = 0x06;                // JESD216B
+    ptNor->chSfdp[5] = 0x01;
+    ptNor->chSfdp[6] = 0x00;                // one parameter header
+    ptNor->chSfdp[8] = 0x00;                // basic flash parameter table
+    ptNor->chSfdp[9] = 0x06;
+    ptNor->chSfdp[10] = 0x01;
+    ptNor->chSfdp[11] = 16;                 // DWORDs
+    ptNor->chSfdp[12] = 16;                 // table pointer
+    ptNor->chSfdp[13] = 0;
+    ptNor->chSfdp[14] = 0;
+    ptNor->chSfdp[15] = 0xFF;
+    for (int i = 0; i < 16; i++) {
+        for (int b = 0; b < 4; b++) {
+            ptNor->chSfdp[16 + i * 4 + b] = (uint8_t)(wDw[i] >> (b * 8));
+        }
+    }
+}
+
+/*
+ * Function: host_spi_nor_open
+ * Description: Opens the memory array in posted mode and powers the model up.
+ * Parameters:
+ *   - ptNor: Model.
+ * Returns: True on success.
+ */
+bool host_spi_nor_open(host_spi_nor_t *ptNor)
+{
+    if (ptNor->ptSim->pchMem == NULL && !host_flash_sim_open(ptNor->ptSim, NULL)) {
+        return false;
+    }
+    ptNor->ptSim->bPosted = true;
+    ptNor->chSr1 = 0;
+    ptNor->chSr2 = 0;
+    ptNor->chAddrLen = 3;
+    memset(&ptNor->tStat, 0, sizeof(ptNor->tStat));
+    host_spi_nor_sfdp_build(ptNor);
+    return true;
+}
+
+static void host_spi_nor_reject(host_spi_nor_t *ptNor, const spi_nor_xfer_t *ptXfer)
+{
+    ptNor->tStat.wRejected++;
+    ptNor->ptSim->tStat.wViolations++;
+    if (ptXfer->pchRx != NULL) {
+        memset(ptXfer->pchRx, 0xFF, ptXfer->wLen);
+    }
+}
+
+/*
+ * Function: host_spi_nor_transfer
+ * Description: spi_nor_bus_t Transfer hook, executes one command.
+ * Parameters:
+ *   - pBus: The host_spi_nor_t.
+ *   - ptXfer: The command.
+ * Returns: 0, commands a part would not accept are counted as rejected.
+ */
+int32_t host_spi_nor_transfer(void *pBus, const spi_nor_xfer_t *ptXfer)
+{
+    host_spi_nor_t *ptNor = (host_spi_nor_t *)pBus;
+    host_flash_sim_t *ptSim = ptNor->ptSim;
+    flash_dev_t const *ptDev = ptSim->ptFlashDev;
+    uint8_t chLines = ptXfer->chLines ? ptXfer->chLines : 1;
+    uint32_t wAddr = ptXfer->wAddr & ((ptNor->chAddrLen == 4) ? 0xFFFFFFFFu : 0x00FFFFFFu);
+    bool bWel = (ptNor->chSr1 & SPI_NOR_SR_WEL) != 0;
+
+    if (ptSim->pchMem == NULL && !host_spi_nor_open(ptNor)) {
+        return 1;
+    }
+
+    /*opcode, address and dummy clocks on one line, data on chLines*/
+    uint64_t wClocks = 8 + ptXfer->chAddrLen * 8u + ptXfer->chDummy + (uint64_t)ptXfer->wLen * 8 / chLines;
+    uint64_t wNs = wClocks * 1000000000ull / ptNor->wClockHz;
+    host_flash_sim_idle(wNs);
+    ptNor->tStat.wBusNs += wNs;
+    ptNor->tStat.wCommands++;
+
+    if (ptXfer->chCmd == SPI_NOR_CMD_RDSR) {
+        ptNor->tStat.wStatusPolls++;
+        for (uint32_t i = 0; i < ptXfer->wLen; i++) {
+            ptXfer->pchRx[i] = ptNor->chSr1 | (host_flash_sim_busy_ns(ptSim) ? SPI_NOR_SR_WIP : 0);
+        }
+        return 0;
+    }
+    if (host_flash_sim_busy_ns(ptSim) != 0) {
+        /*only the status register answers while busy*/
+        host_spi_nor_reject(ptNor, ptXfer);
+        return 0;
+    }
+
+    switch (ptXfer->chCmd) {
+        case SPI_NOR_CMD_WREN:
+            ptNor->chSr1 |= SPI_NOR_SR_WEL;
+            return 0;
+        case 0x04:
+            ptNor->chSr1 &= (uint8_t)~SPI_NOR_SR_WEL;
+            return 0;
+        case SPI_NOR_CMD_RELEASE_PD:
+        case 0xB9:
+            return 0;
+        case SPI_NOR_CMD_EN4B:
+            ptNor->chAddrLen = 4;
+            return 0;
+        case 0xE9:
+            ptNor->chAddrLen = 3;
+            return 0;
+        case SPI_NOR_CMD_JEDEC_ID:
+            for (uint32_t i = 0; i < ptXfer->wLen; i++) {
+                ptXfer->pchRx[i] = (i < 3) ? ptNor->chJedecId[i] : 0xFF;
+            }
+            return 0;
+        case SPI_NOR_CMD_RDSR2:
+            for (uint32_t i = 0; i < ptXfer->wLen; i++) {
+                ptXfer->pchRx[i] = ptNor->chSr2;
+            }
+            return 0;
+        case SPI_NOR_CMD_WRSR:
+        case SPI_NOR_CMD_WRSR2:
+            if (!bWel || ptXfer->wLen == 0) {
+                break;
+            }
+            ptNor->tStat.wStatusWrites++;
+            if (ptXfer->chCmd == SPI_NOR_CMD_WRSR2) {
+                ptNor->chSr2 = ptXfer->pchTx[0];
+            } else if (ptXfer->wLen >= 2) {
+                ptNor->chSr2 = ptXfer->pchTx[1];
+            }
+            ptNor->chSr1 = (ptXfer->chCmd == SPI_NOR_CMD_WRSR) ? (ptXfer->pchTx[0] & 0xFC) : ptNor->chSr1;
+            ptNor->chSr1 &= (uint8_t)~SPI_NOR_SR_WEL;
+            return 0;
+        case SPI_NOR_CMD_SFDP:
+            if (ptXfer->chAddrLen != 3 || ptXfer->chDummy != 8 || chLines != 1) {
+                break;
+            }
+            for (uint32_t i = 0; i < ptXfer->wLen; i++) {
+                ptXfer->pchRx[i] = (wAddr + i < sizeof(ptNor->chSfdp)) ? ptNor->chSfdp[wAddr + i] : 0xFF;
+            }
+            return 0;
+        case SPI_NOR_CMD_READ:
+        case SPI_NOR_CMD_FAST_READ:
+        case 0x3B:
+        case 0x6B: {
+            uint8_t chWant = (ptXfer->chCmd == 0x6B) ? 4 : ((ptXfer->chCmd == 0x3B) ? 2 : 1);
+            uint8_t chDummy = (ptXfer->chCmd == SPI_NOR_CMD_READ) ? 0 : HOST_SPI_NOR_READ_DUMMY;
+            if (ptXfer->chAddrLen != ptNor->chAddrLen || chLines != chWant || ptXfer->chDummy != chDummy ||
+                (chWant == 4 && (ptNor->chSr2 & 0x02) == 0) ||
+                wAddr >= ptDev->szDev || ptXfer->wLen > ptDev->szDev - wAddr) {
+                break;
+            }
+            memcpy(ptXfer->pchRx, ptSim->pchMem + wAddr, ptXfer->wLen);
+            ptSim->tStat.wReadCalls++;
+            ptSim->tStat.wReadBytes += ptXfer->wLen;
+            return 0;
+        }
+        case SPI_NOR_CMD_PP:
+            if (!bWel || ptXfer->chAddrLen != ptNor->chAddrLen || chLines != 1) {
+                break;
+            }
+            ptNor->chSr1 &= (uint8_t)~SPI_NOR_SR_WEL;
+            /*a program the array rejects is counted there, the part gives no answer*/
+            host_flash_sim_program(ptSim, ptDev->DevAdr + wAddr, ptXfer->wLen, (uint8_t *)ptXfer->pchTx);
+            return 0;
+        case 0x20:
+            if (!bWel || ptXfer->chAddrLen != ptNor->chAddrLen) {
+                break;
+            }
+            ptNor->chSr1 &= (uint8_t)~SPI_NOR_SR_WEL;
+            host_flash_sim_erase_sector(ptSim, ptDev->DevAdr + wAddr);
+            return 0;
+        case SPI_NOR_CMD_CHIP_ERASE:
+        case 0x60:
+            if (!bWel) {
+                break;
+            }
+            ptNor->chSr1 &= (uint8_t)~SPI_NOR_SR_WEL;
+            host_flash_sim_erase_chip(ptSim);
+            return 0;
+        default:
+            for (uint32_t i = 0; i < sizeof(c_chBlockCmd) && ptSim->ptErase != NULL; i++) {
+                if (ptXfer->chCmd == c_chBlockCmd[i] && bWel && ptXfer->chAddrLen == ptNor->chAddrLen) {
+                    ptNor->chSr1 &= (uint8_t)~SPI_NOR_SR_WEL;
+                    host_flash_sim_erase_block(ptSim, ptDev->DevAdr + wAddr, ptSim->ptErase->wBlockSize[i]);
+                    return 0;
+                }
+            }
+            break;
+    }
+
+    host_spi_nor_reject(ptNor, ptXfer);
+    return 0;
+}
+
+/*
+ * Function: host_spi_nor_delay
+ * Description: spi_nor_bus_t Delay hook, lets simulated time pass.
+ * Parameters:
+ *   - pBus: The host_spi_nor_t.
+ *   - wUs: Microseconds.
+ */
+void host_spi_nor_delay(void *pBus, uint32_t wUs)
+{
+    (void)pBus;
+    host_flash_sim_idle((uint64_t)wUs * 1000);
+}
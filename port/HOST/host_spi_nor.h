@@ -0,0 +1,58 @@
+/****************************************************************************
+*  Copyright 2022 KK (https://github.com/WALI-KANG)                                    *
+*                                                                           *
+*  Licensed under the Apache License, Version 2.0 (the "License");          *
+*  you may not use this file except in compliance with the License.         *
+*  You may obtain a copy of the License at                                  *
+*                                                                           *
+*     http://www.apache.org/licenses/LICENSE-2.0                            *
+*                                                                           *
+*  Unless required by applicable law or agreed to in writing, software      *
+*  distributed under the License is distributed on an "AS IS" BASIS,        *
+*  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. *
+*  See the License for the specific language governing permissions and      *
+*  limitations under the License.                                           *
+*                                                                           *
+****************************************************************************/
+
+#ifndef HOST_SPI_NOR_H
+#define HOST_SPI_NOR_H
+#include "host_flash_sim.h"
+#include "SPI_NOR_FLASH_DRV.h"
+
+/*
+ * Host side model of a serial NOR part behind the spi_nor_bus_t interface.
+ *
+ * The model decodes opcodes instead of exposing flash_ops_t: status and
+ * write enable latch, JEDEC ID, an SFDP table generated from the geometry
+ * of the memory array, 1-1-1/1-1-2/1-1-4 fast reads, page program, 4kB /
+ * 32kB / 64kB / chip erase and 4 byte address mode. The memory array is a
+ * host_flash_sim_t in posted mode: a program or erase returns at once and
+ * the WIP bit stays set until the modelled busy time has passed. Every
+ * transfer spends its bus time (opcode, address and dummy clocks on one
+ * line, data on 1/2/4 lines) on the simulated clock.
+ */
+
+typedef struct {
+    uint64_t wCommands;             // chip select cycles
+    uint64_t wStatusPolls;          // status register reads
+    uint64_t wStatusWrites;         // non-volatile status register writes
+    uint64_t wBusNs;                // time spent transferring
+    uint64_t wRejected;             // commands a real part would ignore or garble
+} host_spi_nor_stat_t;
+
+typedef struct {
+    host_flash_sim_t   *ptSim;      // memory array, NOR rules and busy time
+    uint32_t            wClockHz;   // SCK frequency
+    uint8_t             chJedecId[3];
+    uint8_t             chSr1;      // WEL, WIP is derived from the array
+    uint8_t             chSr2;      // QE in bit 1
+    uint8_t             chAddrLen;  // 3, 4 after EN4B
+    uint8_t             chSfdp[16 + 16 * 4];    // header, one parameter header, 16 DWORD BFPT
+    host_spi_nor_stat_t tStat;
+} host_spi_nor_t;
+
+extern bool host_spi_nor_open(host_spi_nor_t *ptNor);
+extern int32_t host_spi_nor_transfer(void *pBus, const spi_nor_xfer_t *ptXfer);
+extern void host_spi_nor_delay(void *pBus, uint32_t wUs);
+#endif
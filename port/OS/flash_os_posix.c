@@ -0,0 +1,106 @@
+/****************************************************************************
+*  Copyright 2022 KK (https://github.com/WALI-KANG)                                    *
+*                                                                           *
+*  Licensed under the Apache License, Version 2.0 (the "License");          *
+*  you may not use this file except in compliance with the License.         *
+*  You may obtain a copy of the License at                                  *
+*                                                                           *
+*     http://www.apache.org/licenses/LICENSE-2.0                            *
+*                                                                           *
+*  Unless required by applicable law or agreed to in writing, software      *
+*  distributed under the License is distributed on an "AS IS" BASIS,        *
+*  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. *
+*  See the License for the specific language governing permissions and      *
+*  limitations under the License.                                           *
+*                                                                           *
+****************************************************************************/
+#include <errno.h>
+#include <unistd.h>
+#include "flash_lock.h"
+
+#if FLASH_BLOB_OS == FLASH_OS_POSIX
+
+/*
+ * Function: flash_os_mutex_init
+ * Description: Creates a mutex of the POSIX port of flash_lock.h, with
+ *              priority inheritance where the system supports it.
+ * Parameters:
+ *   - ptMutex: The mutex.
+ * Returns: True on success.
+ */
+bool flash_os_mutex_init(flash_os_mutex_t *ptMutex)
+{
+    pthread_mutexattr_t tAttr;
+    bool bResult;
+
+    if (pthread_mutexattr_init(&tAttr) != 0) {
+        return false;
+    }
+#if defined(_POSIX_THREAD_PRIO_INHERIT) && _POSIX_THREAD_PRIO_INHERIT > 0
+    pthread_mutexattr_setprotocol(&tAttr, PTHREAD_PRIO_INHERIT);
+#endif
+    bResult = (pthread_mutex_init(ptMutex, &tAttr) == 0);
+    pthread_mutexattr_destroy(&tAttr);
+
+    return bResult;
+}
+
+/*
+ * Function: flash_os_mutex_lock
+ * Description: Waits for the mutex, without timeout.
+ * Parameters:
+ *   - ptMutex: The mutex.
+ */
+void flash_os_mutex_lock(flash_os_mutex_t *ptMutex)
+{
+    pthread_mutex_lock(ptMutex);
+}
+
+/*
+ * Function: flash_os_mutex_unlock
+ * Description: Releases the mutex, called by the thread holding it.
+ * Parameters:
+ *   - ptMutex: The mutex.
+ */
+void flash_os_mutex_unlock(flash_os_mutex_t *ptMutex)
+{
+    pthread_mutex_unlock(ptMutex);
+}
+
+/*
+ * Function: flash_os_sem_init
+ * Description: Creates a semaphore of the POSIX port of flash_lock.h, an
+ *              unnamed semaphore shared by the threads of the process.
+ * Parameters:
+ *   - ptSem: The semaphore.
+ *   - wValue: Initial count.
+ * Returns: True on success.
+ */
+bool flash_os_sem_init(flash_os_sem_t *ptSem, uint32_t wValue)
+{
+    return sem_init(ptSem, 0, wValue) == 0;
+}
+
+/*
+ * Function: flash_os_sem_take
+ * Description: Waits for the semaphore, without timeout. Signals do not
+ *              cut the wait short.
+ * Parameters:
+ *   - ptSem: The semaphore.
+ */
+void flash_os_sem_take(flash_os_sem_t *ptSem)
+{
+    while (sem_wait(ptSem) != 0 && errno == EINTR);
+}
+
+/*
+ * Function: flash_os_sem_give
+ * Description: Releases the semaphore.
+ * Parameters:
+ *   - ptSem: The semaphore.
+ */
+void flash_os_sem_give(flash_os_sem_t *ptSem)
+{
+    sem_post(ptSem);
+}
+#endif
@@ -0,0 +1,90 @@
+/****************************************************************************
+*  Copyright 2022 KK (https://github.com/WALI-KANG)                                    *
+*                                                                           *
+*  Licensed under the Apache License, Version 2.0 (the "License");          *
+*  you may not use this file except in compliance with the License.         *
+*  You may obtain a copy of the License at                                  *
+*                                                                           *
+*     http://www.apache.org/licenses/LICENSE-2.0                            *
+*                                                                           *
+*  Unless required by applicable law or agreed to in writing, software      *
+*  distributed under the License is distributed on an "AS IS" BASIS,        *
+*  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. *
+*  See the License for the specific language governing permissions and      *
+*  limitations under the License.                                           *
+*                                                                           *
+****************************************************************************/
+#include "flash_lock.h"
+
+#if FLASH_BLOB_OS == FLASH_OS_RTTHREAD
+
+/*
+ * Function: flash_os_mutex_init
+ * Description: Creates a mutex of the RT-Thread port of flash_lock.h,
+ *              RT-Thread mutexes inherit the priority of their waiters.
+ * Parameters:
+ *   - ptMutex: The mutex.
+ * Returns: True on success.
+ */
+bool flash_os_mutex_init(flash_os_mutex_t *ptMutex)
+{
+    return rt_mutex_init(ptMutex, "flash", RT_IPC_FLAG_PRIO) == RT_EOK;
+}
+
+/*
+ * Function: flash_os_mutex_lock
+ * Description: Waits for the mutex, without timeout.
+ * Parameters:
+ *   - ptMutex: The mutex.
+ */
+void flash_os_mutex_lock(flash_os_mutex_t *ptMutex)
+{
+    rt_mutex_take(ptMutex, RT_WAITING_FOREVER);
+}
+
+/*
+ * Function: flash_os_mutex_unlock
+ * Description: Releases the mutex, called by the task holding it.
+ * Parameters:
+ *   - ptMutex: The mutex.
+ */
+void flash_os_mutex_unlock(flash_os_mutex_t *ptMutex)
+{
+    rt_mutex_release(ptMutex);
+}
+
+/*
+ * Function: flash_os_sem_init
+ * Description: Creates a semaphore of the RT-Thread port of flash_lock.h.
+ * Parameters:
+ *   - ptSem: The semaphore.
+ *   - wValue: Initial count.
+ * Returns: True on success.
+ */
+bool flash_os_sem_init(flash_os_sem_t *ptSem, uint32_t wValue)
+{
+    return rt_sem_init(ptSem, "flash", wValue, RT_IPC_FLAG_PRIO) == RT_EOK;
+}
+
+/*
+ * Function: flash_os_sem_take
+ * Description: Waits for the semaphore, without timeout.
+ * Parameters:
+ *   - ptSem: The semaphore.
+ */
+void flash_os_sem_take(flash_os_sem_t *ptSem)
+{
+    rt_sem_take(ptSem, RT_WAITING_FOREVER);
+}
+
+/*
+ * Function: flash_os_sem_give
+ * Description: Releases the semaphore.
+ * Parameters:
+ *   - ptSem: The semaphore.
+ */
+void flash_os_sem_give(flash_os_sem_t *ptSem)
+{
+    rt_sem_release(ptSem);
+}
+#endif
@@ -0,0 +1,483 @@
+/****************************************************************************
+*  Copyright 2022 KK (https://github.com/WALI-KANG)                                    *
+*                                                                           *
+*  Licensed under the Apache License, Version 2.0 (the "License");          *
+*  you may not use this file except in compliance with the License.         *
+*  You may obtain a copy of the License at                                  *
+*                                                                           *
+*     http://www.apache.org/licenses/LICENSE-2.0                            *
+*                                                                           *
+*  Unless required by applicable law or agreed to in writing, software      *
+*  distributed under the License is distributed on an "AS IS" BASIS,        *
+*  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. *
+*  See the License for the specific language governing permissions and      *
+*  limitations under the License.                                           *
+*                                                                           *
+****************************************************************************/
+#include <string.h>
+#include "SPI_NOR_FLASH_DRV.h"
+
+/* JESD216 basic flash parameter table, DWORDs counted from 1 */
+#define SFDP_DW(__N)                (wBfpt[(__N) - 1])
+#define SFDP_BFPT_MAX               16
+
+static int32_t spi_nor_xfer(spi_nor_t *ptNor, uint8_t chCmd, uint8_t chAddrLen, uint32_t wAddr, uint8_t chDummy,
+                            uint8_t chLines, const uint8_t *pchTx, uint8_t *pchRx, uint32_t wLen)
+{
+    spi_nor_xfer_t tXfer = {chCmd, chAddrLen, chDummy, chLines, wAddr, pchTx, pchRx, wLen};
+
+    return ptNor->ptBus->Transfer(ptNor->ptBus->pBus, &tXfer);
+}
+
+static int32_t spi_nor_cmd(spi_nor_t *ptNor, uint8_t chCmd)
+{
+    return spi_nor_xfer(ptNor, chCmd, 0, 0, 0, 1, NULL, NULL, 0);
+}
+
+static int32_t spi_nor_reg_read(spi_nor_t *ptNor, uint8_t chCmd, uint8_t *pchReg)
+{
+    return spi_nor_xfer(ptNor, chCmd, 0, 0, 0, 1, NULL, pchReg, 1);
+}
+
+static int32_t spi_nor_reg_write(spi_nor_t *ptNor, uint8_t chCmd, const uint8_t *pchReg, uint32_t wLen)
+{
+    if (spi_nor_cmd(ptNor, SPI_NOR_CMD_WREN) != 0) {
+        return 1;
+    }
+    return spi_nor_xfer(ptNor, chCmd, 0, 0, 0, 1, pchReg, NULL, wLen);
+}
+
+/*
+ * Function: spi_nor_wait
+ * Description: Polls the status register until the WIP bit clears. Without
+ *              a Delay hook every poll is counted as one microsecond.
+ * Parameters:
+ *   - ptNor: Device.
+ *   - dwTimeoutUs: Longest time the operation may take.
+ * Returns: 0 - OK, 1 - bus error or timeout.
+ */
+static int32_t spi_nor_wait(spi_nor_t *ptNor, uint64_t dwTimeoutUs)
+{
+    uint64_t dwWaited = 0;
+    uint8_t chStatus;
+
+    do {
+        if (spi_nor_reg_read(ptNor, SPI_NOR_CMD_RDSR, &chStatus) != 0) {
+            return 1;
+        }
+        ptNor->wPolls++;
+        if ((chStatus & SPI_NOR_SR_WIP) == 0) {
+            return 0;
+        }
+        if (ptNor->ptBus->Delay != NULL) {
+            ptNor->ptBus->Delay(ptNor->ptBus->pBus, SPI_NOR_POLL_US);
+            dwWaited += SPI_NOR_POLL_US;
+        } else {
+            dwWaited++;
+        }
+    } while (dwWaited <= dwTimeoutUs);
+
+    return 1;
+}
+
+/*
+ * Function: spi_nor_quad_enable
+ * Description: Sets the quad enable bit the way the SFDP QER field describes.
+ *              The bit is non-volatile, so it is only written if reading
+ *              it back shows it clear. QER 1 and 4 have no command to read
+ *              SR2 and are always written.
+ * Parameters:
+ *   - ptNor: Device.
+ *   - chQer: Quad enable requirement, BFPT DWORD 15 bits 22:20.
+ * Returns: True if the part is ready for 1-1-4 reads.
+ */
+static bool spi_nor_quad_enable(spi_nor_t *ptNor, uint8_t chQer)
+{
+    uint8_t chSr[2] = {0, 0};
+    int32_t nResult = 0;
+
+    switch (chQer) {
+        case 0:
+            /*no QE bit, or it cannot be cleared*/
+            return true;
+        case 1:
+        case 4:
+        case 5:
+            /*bit 1 of SR2, written together with SR1*/
+            nResult |= spi_nor_reg_read(ptNor, SPI_NOR_CMD_RDSR, &chSr[0]);
+            if (chQer == 5) {
+                nResult |= spi_nor_reg_read(ptNor, SPI_NOR_CMD_RDSR2, &chSr[1]);
+                if (nResult == 0 && (chSr[1] & 0x02) != 0) {
+                    return true;
+                }
+            }
+            chSr[1] |= 0x02;
+            nResult |= spi_nor_reg_write(ptNor, SPI_NOR_CMD_WRSR, chSr, 2);
+            break;
+        case 2:
+            /*bit 6 of SR1*/
+            nResult |= spi_nor_reg_read(ptNor, SPI_NOR_CMD_RDSR, &chSr[0]);
+            if (nResult == 0 && (chSr[0] & 0x40) != 0) {
+                return true;
+            }
+            chSr[0] |= 0x40;
+            nResult |= spi_nor_reg_write(ptNor, SPI_NOR_CMD_WRSR, chSr, 1);
+            break;
+        case 3:
+            /*bit 7 of SR2, own read and write opcodes*/
+            nResult |= spi_nor_reg_read(ptNor, SPI_NOR_CMD_RDSR2_ALT, &chSr[1]);
+            if (nResult == 0 && (chSr[1] & 0x80) != 0) {
+                return true;
+            }
+            chSr[1] |= 0x80;
+            nResult |= spi_nor_reg_write(ptNor, SPI_NOR_CMD_WRSR2_ALT, &chSr[1], 1);
+            break;
+        case 6:
+            /*bit 1 of SR2, own write opcode*/
+            nResult |= spi_nor_reg_read(ptNor, SPI_NOR_CMD_RDSR2, &chSr[1]);
+            if (nResult == 0 && (chSr[1] & 0x02) != 0) {
+                return true;
+            }
+            chSr[1] |= 0x02;
+            nResult |= spi_nor_reg_write(ptNor, SPI_NOR_CMD_WRSR2, &chSr[1], 1);
+            break;
+        default:
+            return false;
+    }
+
+    return nResult == 0 && spi_nor_wait(ptNor, (uint64_t)SPI_NOR_ERASE_TIMEOUT_MS * 1000) == 0;
+}
+
+/*
+ * Function: spi_nor_erase_time
+ * Description: Decodes a typical erase time of BFPT DWORD 10.
+ * Parameters:
+ *   - wField: The 7 bit field, count in bits 4:0 and units in bits 6:5.
+ * Returns: Typical time in ms.
+ */
+static uint32_t spi_nor_erase_time(uint32_t wField)
+{
+    static const uint16_t c_hwUnits[] = {1, 16, 128, 1000};
+
+    return ((wField & 0x1F) + 1) * c_hwUnits[(wField >> 5) & 3];
+}
+
+/*
+ * Function: spi_nor_probe
+ * Description: Identifies the part from its JEDEC ID and SFDP table and fills
+ *              in the geometry, erase types and timing of the device.
+ * Parameters:
+ *   - ptNor: Device defined by SPI_NOR_FLASH_DEFINE().
+ * Returns: True if the part has a usable SFDP basic flash parameter table.
+ */
+bool spi_nor_probe(spi_nor_t *ptNor)
+{
+    static const char c_chHex[] = "0123456789ABCDEF";
+    flash_dev_t *ptDev = &ptNor->tDev;
+    flash_erase_caps_t *ptErase = &ptNor->tErase;
+    uint32_t wBfpt[SFDP_BFPT_MAX] = {0};
+    uint8_t chHdr[16], chTable[SFDP_BFPT_MAX * 4];
+    uint32_t wSize[4], wTime[4];
+    uint8_t chCmd[4], chTypes = 0;
+
+    ptDev->szDev = 0;
+    spi_nor_cmd(ptNor, SPI_NOR_CMD_RELEASE_PD);
+    if (spi_nor_xfer(ptNor, SPI_NOR_CMD_JEDEC_ID, 0, 0, 0, 1, NULL, ptNor->chJedecId, 3) != 0 ||
+        spi_nor_xfer(ptNor, SPI_NOR_CMD_SFDP, 3, 0, 8, 1, NULL, chHdr, sizeof(chHdr)) != 0) {
+        return false;
+    }
+    /*the first parameter header is always the basic flash parameter table*/
+    uint32_t wDwords = chHdr[11];
+    uint32_t wTablePtr = chHdr[12] | ((uint32_t)chHdr[13] << 8) | ((uint32_t)chHdr[14] << 16);
+    if (memcmp(chHdr, "SFDP", 4) != 0 || chHdr[8] != 0x00 || chHdr[15] != 0xFF || wDwords < 9) {
+        return false;
+    }
+    wDwords = (wDwords > SFDP_BFPT_MAX) ? SFDP_BFPT_MAX : wDwords;
+    if (spi_nor_xfer(ptNor, SPI_NOR_CMD_SFDP, 3, wTablePtr, 8, 1, NULL, chTable, wDwords * 4) != 0) {
+        return false;
+    }
+    for (uint32_t i = 0; i < wDwords; i++) {
+        wBfpt[i] = chTable[i * 4] | ((uint32_t)chTable[i * 4 + 1] << 8) |
+                   ((uint32_t)chTable[i * 4 + 2] << 16) | ((uint32_t)chTable[i * 4 + 3] << 24);
+    }
+
+    /*density in bits, either N - 1 or 2^N*/
+    uint32_t wDensity = SFDP_DW(2) & 0x7FFFFFFFu;
+    uint64_t dwSize = ((uint64_t)wDensity + 1) / 8;
+    if (SFDP_DW(2) & 0x80000000u) {
+        dwSize = (wDensity >= 3 && wDensity < 35) ? 1ull << (wDensity - 3) : 0;
+    }
+    if (dwSize == 0 || dwSize - 1 > 0xFFFFFFFFu - ptDev->DevAdr) {
+        return false;
+    }
+
+    /*erase types, sorted by size*/
+    for (int i = 0; i < 4; i++) {
+        uint32_t wField = SFDP_DW(8 + i / 2) >> ((i & 1) * 16);
+        uint8_t chExp = (uint8_t)wField;
+        if (chExp == 0 || chExp > 31) {
+            continue;
+        }
+        uint8_t j = chTypes++;
+        for (; j > 0 && wSize[j - 1] > (1u << chExp); j--) {
+            wSize[j] = wSize[j - 1];
+            chCmd[j] = chCmd[j - 1];
+            wTime[j] = wTime[j - 1];
+        }
+        wSize[j] = 1u << chExp;
+        chCmd[j] = (uint8_t)(wField >> 8);
+        wTime[j] = (wDwords >= 11) ? spi_nor_erase_time(SFDP_DW(10) >> (4 + i * 7)) : 0;
+    }
+    if (chTypes == 0 || wSize[0] > dwSize) {
+        return false;
+    }
+
+    /*typical times and the multiplier to the maximum*/
+    uint32_t wEraseMul = 2 * ((SFDP_DW(10) & 0x0F) + 1);
+    uint32_t wPage = 256, wProgUs = 0, wChipMs = 0;
+    ptNor->wProgTimeoutUs = SPI_NOR_PROG_TIMEOUT_US;
+    if (wDwords >= 11) {
+        static const uint32_t c_wChipUnits[] = {16, 256, 4000, 64000};
+        wPage = 1u << ((SFDP_DW(11) >> 4) & 0x0F);
+        wProgUs = (((SFDP_DW(11) >> 8) & 0x1F) + 1) * ((SFDP_DW(11) & (1u << 13)) ? 64 : 8);
+        wChipMs = (((SFDP_DW(11) >> 24) & 0x1F) + 1) * c_wChipUnits[(SFDP_DW(11) >> 29) & 3];
+        ptNor->wProgTimeoutUs = wProgUs * 2 * ((SFDP_DW(11) & 0x0F) + 1);
+    }
+
+    /*4 byte addresses above 16MB, if the part can do them*/
+    ptNor->chAddrLen = 3;
+    if (dwSize > 0x1000000u) {
+        uint32_t wAddrMode = (SFDP_DW(1) >> 17) & 3;
+        if (wAddrMode == 0) {
+            return false;
+        }
+        ptNor->chAddrLen = 4;
+        if (wAddrMode == 1 && spi_nor_cmd(ptNor, SPI_NOR_CMD_EN4B) != 0) {
+            return false;
+        }
+    }
+
+    /*fastest read both the part and the wiring support*/
+    ptNor->chReadCmd = SPI_NOR_CMD_FAST_READ;
+    ptNor->chReadDummy = 8;
+    ptNor->chReadLines = 1;
+    if (ptNor->ptBus->chLines >= 2 && (SFDP_DW(1) & (1u << 16))) {
+        ptNor->chReadCmd = (uint8_t)(SFDP_DW(4) >> 8);
+        ptNor->chReadDummy = (uint8_t)((SFDP_DW(4) & 0x1F) + ((SFDP_DW(4) >> 5) & 7));
+        ptNor->chReadLines = 2;
+    }
+    if (ptNor->ptBus->chLines >= 4 && (SFDP_DW(1) & (1u << 22)) && wDwords >= 15 &&
+        spi_nor_quad_enable(ptNor, (uint8_t)((SFDP_DW(15) >> 20) & 7))) {
+        ptNor->chReadCmd = (uint8_t)(SFDP_DW(3) >> 24);
+        ptNor->chReadDummy = (uint8_t)(((SFDP_DW(3) >> 16) & 0x1F) + ((SFDP_DW(3) >> 21) & 7));
+        ptNor->chReadLines = 4;
+    }
+
+    /*the smallest erase type is the sector, the others are blocks*/
+    memset(ptErase->wBlockSize, 0, sizeof(ptErase->wBlockSize));
+    memset(ptErase->wBlockTime, 0, sizeof(ptErase->wBlockTime));
+    ptNor->chSectorCmd = chCmd[0];
+    for (uint8_t i = 1; i < chTypes && i <= FLASH_BLOB_ERASE_BLOCK_NUM; i++) {
+        ptErase->wBlockSize[i - 1] = wSize[i];
+        ptErase->wBlockTime[i - 1] = wTime[i];
+        ptNor->chBlockCmd[i - 1] = chCmd[i];
+        ptNor->wBlockTimeoutMs[i - 1] = wTime[i] ? wTime[i] * wEraseMul : SPI_NOR_ERASE_TIMEOUT_MS;
+    }
+    ptErase->EraseSectors = NULL;
+    ptErase->wSectorTime = wTime[0];
+    ptErase->wChipTime = wChipMs;
+    ptNor->wChipTimeoutMs = wChipMs ? wChipMs * wEraseMul
+                                    : (uint32_t)(dwSize / wSize[0]) * SPI_NOR_ERASE_TIMEOUT_MS;
+
+    memset(ptDev->DevName, 0, sizeof(ptDev->DevName));
+    memcpy(ptDev->DevName, "SPI NOR ", 8);
+    for (int i = 0; i < 3; i++) {
+        ptDev->DevName[8 + i * 2] = c_chHex[ptNor->chJedecId[i] >> 4];
+        ptDev->DevName[9 + i * 2] = c_chHex[ptNor->chJedecId[i] & 0x0F];
+    }
+    ptDev->Vers = FLASH_DRV_VERS;
+    ptDev->DevType = EXTSPI;
+    ptDev->szPage = wPage;
+    ptDev->Res = 0;
+    ptDev->valEmpty = 0xFF;
+    ptDev->toProg = (ptNor->wProgTimeoutUs + 999) / 1000;
+    ptDev->toErase = wTime[0] ? wTime[0] * wEraseMul : SPI_NOR_ERASE_TIMEOUT_MS;
+    ptDev->sectors[0].szSector = wSize[0];
+    ptDev->sectors[0].AddrSector = 0;
+    ptDev->sectors[1].szSector = 0xFFFFFFFF;
+    ptDev->sectors[1].AddrSector = 0xFFFFFFFF;
+    ptNor->wPolls = 0;
+    ptDev->szDev = (unsigned long)dwSize;
+
+    return true;
+}
+
+/*
+ *  Initialize Flash Programming Functions
+ *    Parameter:      adr:  Device Base Address
+ *                    clk:  Clock Frequency (Hz)
+ *                    fnc:  Function Code (1 - Erase, 2 - Program, 3 - Verify)
+ *    Return Value:   0 - OK,  1 - Failed
+ */
+int32_t spi_nor_init(spi_nor_t *ptNor, uint32_t adr, uint32_t clk, uint32_t fnc)
+{
+    (void)adr; (void)clk; (void)fnc;
+
+    if (ptNor->tDev.szDev == 0) {
+        /*not probed*/
+        return 1;
+    }
+    /*wake the part up, it may have lost the address mode in a reset*/
+    if (spi_nor_cmd(ptNor, SPI_NOR_CMD_RELEASE_PD) != 0 ||
+        (ptNor->chAddrLen == 4 && spi_nor_cmd(ptNor, SPI_NOR_CMD_EN4B) != 0)) {
+        return 1;
+    }
+    return 0;
+}
+
+/*
+ *  De-Initialize Flash Programming Functions
+ *    Parameter:      fnc:  Function Code (1 - Erase, 2 - Program, 3 - Verify)
+ *    Return Value:   0 - OK,  1 - Failed
+ */
+int32_t spi_nor_uninit(spi_nor_t *ptNor, uint32_t fnc)
+{
+    (void)ptNor; (void)fnc;
+    return 0;
+}
+
+/*
+ *  Erase complete Flash Memory
+ *    Return Value:   0 - OK,  1 - Failed
+ */
+int32_t spi_nor_erase_chip(spi_nor_t *ptNor)
+{
+    if (spi_nor_cmd(ptNor, SPI_NOR_CMD_WREN) != 0 || spi_nor_cmd(ptNor, SPI_NOR_CMD_CHIP_ERASE) != 0) {
+        return 1;
+    }
+    return spi_nor_wait(ptNor, (uint64_t)ptNor->wChipTimeoutMs * 1000);
+}
+
+/*
+ *  Erase Sector in Flash Memory
+ *    Parameter:      adr:  Sector Address
+ *    Return Value:   0 - OK,  1 - Failed
+ */
+int32_t spi_nor_erase_sector(spi_nor_t *ptNor, uint32_t adr)
+{
+    if (spi_nor_cmd(ptNor, SPI_NOR_CMD_WREN) != 0 ||
+        spi_nor_xfer(ptNor, ptNor->chSectorCmd, ptNor->chAddrLen, adr - ptNor->tDev.DevAdr, 0, 1,
+                     NULL, NULL, 0) != 0) {
+        return 1;
+    }
+    return spi_nor_wait(ptNor, (uint64_t)ptNor->tDev.toErase * 1000);
+}
+
+/*
+ *  Erase Block in Flash Memory
+ *    Parameter:      adr:  Block Address, aligned to sz
+ *                    sz:   Block Size, one of the SFDP erase types
+ *    Return Value:   0 - OK,  1 - Failed
+ */
+int32_t spi_nor_erase_block(spi_nor_t *ptNor, uint32_t adr, uint32_t sz)
+{
+    for (int i = 0; i < FLASH_BLOB_ERASE_BLOCK_NUM; i++) {
+        if (ptNor->tErase.wBlockSize[i] != sz || sz == 0) {
+            continue;
+        }
+        if (spi_nor_cmd(ptNor, SPI_NOR_CMD_WREN) != 0 ||
+            spi_nor_xfer(ptNor, ptNor->chBlockCmd[i], ptNor->chAddrLen, adr - ptNor->tDev.DevAdr, 0, 1,
+                         NULL, NULL, 0) != 0) {
+            return 1;
+        }
+        return spi_nor_wait(ptNor, (uint64_t)ptNor->wBlockTimeoutMs[i] * 1000);
+    }
+    return 1;
+}
+
+/*
+ *  Program Page in Flash Memory
+ *    Parameter:      adr:  Page Start Address
+ *                    sz:   Page Size
+ *                    buf:  Page Data
+ *    Return Value:   0 - OK,  1 - Failed
+ */
+int32_t spi_nor_program(spi_nor_t *ptNor, uint32_t adr, uint32_t sz, uint8_t *buf)
+{
+    uint32_t wOffset = adr - ptNor->tDev.DevAdr;
+
+    while (sz > 0) {
+        /*a page program wraps around inside the page, never cross it*/
+        uint32_t wChunk = ptNor->tDev.szPage - wOffset % ptNor->tDev.szPage;
+        wChunk = (wChunk < sz) ? wChunk : sz;
+        if (spi_nor_cmd(ptNor, SPI_NOR_CMD_WREN) != 0 ||
+            spi_nor_xfer(ptNor, SPI_NOR_CMD_PP, ptNor->chAddrLen, wOffset, 0, 1, buf, NULL, wChunk) != 0 ||
+            spi_nor_wait(ptNor, ptNor->wProgTimeoutUs) != 0) {
+            return 1;
+        }
+        wOffset += wChunk;
+        buf += wChunk;
+        sz -= wChunk;
+    }
+    return 0;
+}
+
+/*
+ *  Start programming a Page, the part stays busy after the return
+ *    Parameter:      adr:  Page Start Address
+ *                    sz:   Bytes within one page
+ *                    buf:  Page Data, sent before the return
+ *    Return Value:   0 - OK,  1 - Failed
+ */
+int32_t spi_nor_program_start(spi_nor_t *ptNor, uint32_t adr, uint32_t sz, uint8_t *buf)
+{
+    uint32_t wOffset = adr - ptNor->tDev.DevAdr;
+
+    if (sz == 0 || sz > ptNor->tDev.szPage - wOffset % ptNor->tDev.szPage) {
+        return 1;
+    }
+    ptNor->wProgWaitedUs = 0;
+    /*a DMA capable bus could return right after queueing the data phase*/
+    return spi_nor_cmd(ptNor, SPI_NOR_CMD_WREN) != 0 ||
+           spi_nor_xfer(ptNor, SPI_NOR_CMD_PP, ptNor->chAddrLen, wOffset, 0, 1, buf, NULL, sz) != 0;
+}
+
+/*
+ *  Check a Page Program started by spi_nor_program_start()
+ *    Return Value:   0 - Done,  1 - Failed,  FLASH_PROG_BUSY - Busy
+ */
+int32_t spi_nor_program_poll(spi_nor_t *ptNor)
+{
+    uint8_t chStatus;
+
+    if (spi_nor_reg_read(ptNor, SPI_NOR_CMD_RDSR, &chStatus) != 0) {
+        return 1;
+    }
+    ptNor->wPolls++;
+    if ((chStatus & SPI_NOR_SR_WIP) == 0) {
+        return 0;
+    }
+    if (ptNor->wProgWaitedUs > ptNor->wProgTimeoutUs) {
+        return 1;
+    }
+    if (ptNor->ptBus->Delay != NULL) {
+        ptNor->ptBus->Delay(ptNor->ptBus->pBus, SPI_NOR_POLL_US);
+        ptNor->wProgWaitedUs += SPI_NOR_POLL_US;
+    } else {
+        ptNor->wProgWaitedUs++;
+    }
+    return FLASH_PROG_BUSY;
+}
+
+/*
+ *  Read Data from Flash Memory
+ *    Parameter:      adr:  Start Address
+ *                    sz:   Number of Bytes
+ *                    buf:  Destination
+ *    Return Value:   0 - OK,  1 - Failed
+ */
+int32_t spi_nor_read(spi_nor_t *ptNor, uint32_t adr, uint32_t sz, uint8_t *buf)
+{
+    return spi_nor_xfer(ptNor, ptNor->chReadCmd, ptNor->chAddrLen, adr - ptNor->tDev.DevAdr,
+                        ptNor->chReadDummy, ptNor->chReadLines, NULL, buf, sz) != 0;
+}
@@ -0,0 +1,162 @@
+/****************************************************************************
+*  Copyright 2022 KK (https://github.com/WALI-KANG)                                    *
+*                                                                           *
+*  Licensed under the Apache License, Version 2.0 (the "License");          *
+*  you may not use this file except in compliance with the License.         *
+*  You may obtain a copy of the License at                                  *
+*                                                                           *
+*     http://www.apache.org/licenses/LICENSE-2.0                            *
+*                                                                           *
+*  Unless required by applicable law or agreed to in writing, software      *
+*  distributed under the License is distributed on an "AS IS" BASIS,        *
+*  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. *
+*  See the License for the specific language governing permissions and      *
+*  limitations under the License.                                           *
+*                                                                           *
+****************************************************************************/
+
+#ifndef SPI_NOR_FLASH_DRV_H
+#define SPI_NOR_FLASH_DRV_H
+#include "flash_blob.h"
+
+/*
+ * Generic serial NOR flash (EXTSPI) driver on top of a bus transfer hook.
+ *
+ * spi_nor_probe() reads the JEDEC ID and the SFDP basic flash parameter
+ * table and fills in the flash_dev_t (size, program page, 4kB sectors,
+ * timeouts) and the flash_erase_caps_t (32kB/64kB block erase and typical
+ * erase times, used by the erase planner). Reads use the fastest of
+ * 1-1-4, 1-1-2 and 1-1-1 fast read both the part and the wiring support.
+ * Program and erase commands wait by polling the WIP bit of the status
+ * register, never for a fixed time. The page program is also offered as
+ * ProgramStart/ProgramPoll, so the core can fill its next page buffer
+ * while the part is busy.
+ */
+
+/* Delay between two status polls when the bus has a Delay hook */
+#ifndef SPI_NOR_POLL_US
+    #define SPI_NOR_POLL_US         10
+#endif
+/* Timeouts used when the SFDP table carries no typical times (JESD216 rev 0) */
+#ifndef SPI_NOR_PROG_TIMEOUT_US
+    #define SPI_NOR_PROG_TIMEOUT_US 5000
+#endif
+#ifndef SPI_NOR_ERASE_TIMEOUT_MS
+    #define SPI_NOR_ERASE_TIMEOUT_MS 2000
+#endif
+
+#define SPI_NOR_CMD_WRSR            0x01
+#define SPI_NOR_CMD_PP              0x02
+#define SPI_NOR_CMD_READ            0x03
+#define SPI_NOR_CMD_RDSR            0x05
+#define SPI_NOR_CMD_WREN            0x06
+#define SPI_NOR_CMD_FAST_READ       0x0B
+#define SPI_NOR_CMD_WRSR2           0x31
+#define SPI_NOR_CMD_RDSR2           0x35
+#define SPI_NOR_CMD_RDSR2_ALT       0x3F
+#define SPI_NOR_CMD_WRSR2_ALT       0x3E
+#define SPI_NOR_CMD_SFDP            0x5A
+#define SPI_NOR_CMD_JEDEC_ID        0x9F
+#define SPI_NOR_CMD_RELEASE_PD      0xAB
+#define SPI_NOR_CMD_EN4B            0xB7
+#define SPI_NOR_CMD_CHIP_ERASE      0xC7
+
+#define SPI_NOR_SR_WIP              0x01
+#define SPI_NOR_SR_WEL              0x02
+
+/* One chip select cycle: opcode and address on one line, then the data phase */
+typedef struct {
+    uint8_t  chCmd;                 // opcode
+    uint8_t  chAddrLen;             // address bytes: 0, 3 or 4
+    uint8_t  chDummy;               // dummy clocks between address and data
+    uint8_t  chLines;               // data lines of the data phase: 1, 2 or 4
+    uint32_t wAddr;
+    const uint8_t *pchTx;           // data sent, NULL if none
+    uint8_t *pchRx;                 // data received, NULL if none
+    uint32_t wLen;                  // data phase bytes
+} spi_nor_xfer_t;
+
+typedef struct {
+    int32_t (*Transfer)(void *pBus, const spi_nor_xfer_t *ptXfer);  // 0 - OK
+    void (*Delay)(void *pBus, uint32_t wUs);                        // optional, between status polls
+    void *pBus;                     // passed to the hooks
+    uint8_t chLines;                // data lines wired to the part: 1, 2 or 4
+} spi_nor_bus_t;
+
+typedef struct {
+    spi_nor_bus_t const *ptBus;
+    flash_dev_t tDev;               // geometry, filled in by spi_nor_probe()
+    flash_erase_caps_t tErase;      // block erase and erase times, filled in by spi_nor_probe()
+    uint8_t  chJedecId[3];          // manufacturer, memory type, capacity
+    uint8_t  chAddrLen;             // 3, or 4 above 16MB
+    uint8_t  chSectorCmd;           // 4kB erase opcode
+    uint8_t  chBlockCmd[FLASH_BLOB_ERASE_BLOCK_NUM];    // opcodes of tErase.wBlockSize[]
+    uint8_t  chReadCmd;             // selected fast read
+    uint8_t  chReadDummy;
+    uint8_t  chReadLines;
+    uint32_t wProgTimeoutUs;
+    uint32_t wBlockTimeoutMs[FLASH_BLOB_ERASE_BLOCK_NUM];
+    uint32_t wChipTimeoutMs;
+    uint32_t wPolls;                // status reads since probe
+    uint32_t wProgWaitedUs;         // polled since the last spi_nor_program_start()
+} spi_nor_t;
+
+/*
+ * Defines a SPI NOR device __NAME (a flash_blob_t) at __BASE behind the bus
+ * __BUS. The device has no geometry until spi_nor_probe(&__NAME##_nor) has
+ * succeeded, which has to happen before the first target_flash_*() call
+ * (or be followed by flash_dev_index_build()).
+ */
+#define SPI_NOR_FLASH_DEFINE(__NAME, __BUS, __BASE)                             \
+    extern spi_nor_t __NAME##_nor;                                              \
+    static int32_t __NAME##_init(uint32_t adr, uint32_t clk, uint32_t fnc)      \
+    {   return spi_nor_init(&__NAME##_nor, adr, clk, fnc);   }                 \
+    static int32_t __NAME##_uninit(uint32_t fnc)                                \
+    {   return spi_nor_uninit(&__NAME##_nor, fnc);   }                         \
+    static int32_t __NAME##_erase_chip(void)                                    \
+    {   return spi_nor_erase_chip(&__NAME##_nor);   }                          \
+    static int32_t __NAME##_erase_sector(uint32_t adr)                          \
+    {   return spi_nor_erase_sector(&__NAME##_nor, adr);   }                   \
+    static int32_t __NAME##_erase_block(uint32_t adr, uint32_t sz)              \
+    {   return spi_nor_erase_block(&__NAME##_nor, adr, sz);   }                \
+    static int32_t __NAME##_program(uint32_t adr, uint32_t sz, uint8_t *buf)    \
+    {   return spi_nor_program(&__NAME##_nor, adr, sz, buf);   }               \
+    static int32_t __NAME##_read(uint32_t adr, uint32_t sz, uint8_t *buf)       \
+    {   return spi_nor_read(&__NAME##_nor, adr, sz, buf);   }                  \
+    static int32_t __NAME##_program_start(uint32_t adr, uint32_t sz, uint8_t *buf) \
+    {   return spi_nor_program_start(&__NAME##_nor, adr, sz, buf);   }         \
+    static int32_t __NAME##_program_poll(void)                                  \
+    {   return spi_nor_program_poll(&__NAME##_nor);   }                        \
+    static const flash_prog_async_t __NAME##_prog_async = {                     \
+        .ProgramStart = __NAME##_program_start,                                 \
+        .ProgramPoll = __NAME##_program_poll,                                   \
+    };                                                                          \
+    spi_nor_t __NAME##_nor = {                                                  \
+        .ptBus = &(__BUS),                                                      \
+        .tDev.DevAdr = (__BASE),                                                \
+        .tErase.EraseBlock = __NAME##_erase_block,                              \
+    };                                                                          \
+    const flash_blob_t __NAME = {                                               \
+        .ptFlashDev = &__NAME##_nor.tDev,                                       \
+        .tFlashops.Init = __NAME##_init,                                        \
+        .tFlashops.UnInit = __NAME##_uninit,                                    \
+        .tFlashops.EraseChip = __NAME##_erase_chip,                             \
+        .tFlashops.EraseSector = __NAME##_erase_sector,                         \
+        .tFlashops.Program = __NAME##_program,                                  \
+        .tFlashops.Read = __NAME##_read,                                        \
+        .ptErase = &__NAME##_nor.tErase,                                        \
+        .ptProgAsync = &__NAME##_prog_async,                                    \
+    }
+
+extern bool spi_nor_probe(spi_nor_t *ptNor);
+
+extern int32_t spi_nor_init(spi_nor_t *ptNor, uint32_t adr, uint32_t clk, uint32_t fnc);
+extern int32_t spi_nor_uninit(spi_nor_t *ptNor, uint32_t fnc);
+extern int32_t spi_nor_erase_chip(spi_nor_t *ptNor);
+extern int32_t spi_nor_erase_sector(spi_nor_t *ptNor, uint32_t adr);
+extern int32_t spi_nor_erase_block(spi_nor_t *ptNor, uint32_t adr, uint32_t sz);
+extern int32_t spi_nor_program(spi_nor_t *ptNor, uint32_t adr, uint32_t sz, uint8_t *buf);
+extern int32_t spi_nor_read(spi_nor_t *ptNor, uint32_t adr, uint32_t sz, uint8_t *buf);
+extern int32_t spi_nor_program_start(spi_nor_t *ptNor, uint32_t adr, uint32_t sz, uint8_t *buf);
+extern int32_t spi_nor_program_poll(spi_nor_t *ptNor);
+#endif
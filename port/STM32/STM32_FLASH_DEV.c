@@ -78,6 +78,7 @@ static struct FlashDevice const FlashDevice  =  {
    0x0800, 0x000000,           // Sector Size 2kB (512 Sectors)
    SECTOR_END
 };
+#define STM32_FLASH_BANK_SIZE   0x00080000  // Bank 2 at 0x08080000, read-while-write
 #endif
 
 #ifdef STM32F10x_CL
@@ -118,5 +119,6 @@ static struct FlashDevice const FlashDevice  =  {
    0x20000, 0x000000,          // Sector Size  128kB (16 Sectors)
    SECTOR_END
 };
+#define STM32_FLASH_BANK_SIZE   0x00100000  // Bank 2 at 0x08100000, read-while-write
 
 #endif
\ No newline at end of file
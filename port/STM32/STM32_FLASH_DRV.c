@@ -1,5 +1,9 @@
 #include "flash_blob.h"
 #include "STM32_FLASH_DEV.c"
+
+#ifndef STM32_FLASH_BANK_SIZE
+    #define STM32_FLASH_BANK_SIZE   0       // single bank part
+#endif
 /*
  *  Initialize Flash Programming Functions
  *    Parameter:      adr:  Device Base Address
@@ -37,7 +41,7 @@ static int32_t EraseChip(void)
     uint32_t PAGEError = 0;
     FLASH_EraseInitTypeDef EraseInitStruct;
     EraseInitStruct.TypeErase   = FLASH_TYPEERASE_MASSERASE;
-#if defined(FLASH_BANK2_END)
+#if defined(FLASH_BANK2_END) || defined(DUAL_BANK)
     EraseInitStruct.Banks       = FLASH_BANK_2;
     if (HAL_FLASHEx_Erase(&EraseInitStruct, &PAGEError) != HAL_OK)
     {
@@ -53,11 +57,12 @@ static int32_t EraseChip(void)
 }
 
 /*
- *  Erase Sector in Flash Memory
- *    Parameter:      adr:  Sector Address
+ *  Erase consecutive Sectors in Flash Memory
+ *    Parameter:      adr:  First Sector Address
+ *                    num:  Number of Sectors
  *    Return Value:   0 - OK,  1 - Failed
  */
-static int32_t EraseSector(uint32_t adr)
+static int32_t EraseSectors(uint32_t adr, uint32_t num)
 {
     int32_t result = 0;
     uint32_t PAGEError = 0;
@@ -68,7 +73,7 @@ static int32_t EraseSector(uint32_t adr)
     /* Fill EraseInit structure*/
     EraseInitStruct.TypeErase   = FLASH_TYPEERASE_PAGES;
     EraseInitStruct.PageAddress = adr;
-    EraseInitStruct.NbPages     = 1;
+    EraseInitStruct.NbPages     = num;
     if(adr > FLASH_BANK1_END){
         EraseInitStruct.Banks       = FLASH_BANK_2;
     }else{
@@ -81,18 +86,43 @@ static int32_t EraseSector(uint32_t adr)
     }
 #else
     EraseInitStruct.TypeErase   = FLASH_TYPEERASE_SECTORS;
-    EraseInitStruct.Sector = (adr - FLASH_BANK1_BASE) / FLASH_SECTOR_SIZE;;
-    EraseInitStruct.NbSectors   = 1;
-    EraseInitStruct.Banks       = FLASH_BANK_1;
     EraseInitStruct.VoltageRange  = FLASH_VOLTAGE_RANGE_3;
-    if (HAL_FLASHEx_Erase(&EraseInitStruct, &PAGEError) != HAL_OK)
-    {
-        result = 1;
+    while (num > 0 && result == 0) {
+        uint32_t bank_base = FLASH_BANK1_BASE;
+        EraseInitStruct.Banks       = FLASH_BANK_1;
+#if defined(DUAL_BANK)
+        /* sectors are numbered per bank, a run is split at the bank boundary */
+        if (adr >= FLASH_BANK2_BASE) {
+            bank_base = FLASH_BANK2_BASE;
+            EraseInitStruct.Banks   = FLASH_BANK_2;
+        }
+#endif
+        EraseInitStruct.Sector = (adr - bank_base) / FLASH_SECTOR_SIZE;
+        EraseInitStruct.NbSectors   = FLASH_SECTOR_TOTAL - EraseInitStruct.Sector;
+        if (EraseInitStruct.NbSectors > num) {
+            EraseInitStruct.NbSectors = num;
+        }
+        if (HAL_FLASHEx_Erase(&EraseInitStruct, &PAGEError) != HAL_OK)
+        {
+            result = 1;
+        }
+        adr += EraseInitStruct.NbSectors * FLASH_SECTOR_SIZE;
+        num -= EraseInitStruct.NbSectors;
     }
 #endif
     return result;
 }
 
+/*
+ *  Erase Sector in Flash Memory
+ *    Parameter:      adr:  Sector Address
+ *    Return Value:   0 - OK,  1 - Failed
+ */
+static int32_t EraseSector(uint32_t adr)
+{
+    return EraseSectors(adr, 1);
+}
+
 /*
  *  Program Page in Flash Memory
  *    Parameter:      adr:  Page Start Address
@@ -106,7 +136,8 @@ static int32_t ProgramPage(uint32_t addr, uint32_t sz, uint8_t* buf)
 	uint32_t write_granularity = FLASH_NB_32BITWORD_IN_FLASHWORD * 4;
     uint32_t write_size = write_granularity;
     uint32_t end_addr   = addr + sz - 1,write_addr;
-	uint8_t write_buffer[32] = {0};
+	uint8_t write_buffer[32];
+	memset(write_buffer, 0xFF, sizeof(write_buffer));   /* pad with erased value, leaves the tail untouched */
 	write_addr = (uint32_t)buf;
 	__HAL_FLASH_CLEAR_FLAG(FLASH_FLAG_EOP | FLASH_FLAG_OPERR | FLASH_FLAG_WRPERR);
     while (addr < end_addr) {
@@ -119,15 +150,8 @@ static int32_t ProgramPage(uint32_t addr, uint32_t sz, uint8_t* buf)
             }
             write_addr = (uint32_t)((uint32_t *)write_buffer);
         }
+        /* readback is done by flash_blob, see target_flash_verify_policy() */
         if (HAL_FLASH_Program(FLASH_TYPEPROGRAM_FLASHWORD, addr, write_addr) == HAL_OK) {
-		   for(uint8_t i = 0; i < write_size; i++)
-            {
-                if (*(uint8_t *)(addr + i) != *(uint8_t *)(write_addr + i))
-                {
-                result = 1;
-                break;
-                }
-            }
             addr += write_granularity;
             write_addr  += write_granularity;
         } else {
@@ -138,6 +162,18 @@ static int32_t ProgramPage(uint32_t addr, uint32_t sz, uint8_t* buf)
     return result;
 }
 
+/*
+ *  HAL_FLASHEx_Erase() takes a page/sector count, so runs of sectors can be
+ *  erased in one call. A run takes as long as its single erases and only
+ *  stretches the IRQ-masked window, so wRunSectorTime stays 0 and the planner
+ *  keeps erasing sector by sector. wChipTime stays 0 until the mass erase
+ *  time of the part is filled in, which keeps the planner from choosing
+ *  EraseChip.
+ */
+static const flash_erase_caps_t FlashErase = {
+    .EraseSectors = EraseSectors,
+};
+
 const  flash_blob_t  onchip_flash_device = {
     .tFlashops.Init = Init,  
     .tFlashops.UnInit = UnInit,  
@@ -146,5 +182,8 @@ const  flash_blob_t  onchip_flash_device = {
     .tFlashops.Program = ProgramPage,  
     .tFlashops.Read = NULL,
     .ptFlashDev = &FlashDevice,
+    .wWriteGranularity = FLASH_NB_32BITWORD_IN_FLASHWORD * 4,
+    .ptErase = &FlashErase,
+    .wBankSize = STM32_FLASH_BANK_SIZE,
 };
 
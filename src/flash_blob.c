@@ -16,204 +16,3538 @@
 ****************************************************************************/
 #include "flash_blob.h"
 #include "flash_blob_cfg.h"
+#include "flash_lock.h"
+
+#if FLASH_BLOB_OS != FLASH_OS_NONE && FLASH_BLOB_USE_PARALLEL != ENABLED
+    #error "FLASH_BLOB_OS locks devices one by one, FLASH_BLOB_USE_PARALLEL must be enabled for per-device scratch buffers"
+#endif
+
+/*
+ * FLASH_BLOB_YIELD() runs between two critical sections with IRQs enabled,
+ * e.g. to kick a watchdog or yield to other tasks. It must not call the
+ * target_flash_* API. FLASH_BLOB_GET_TICK() returns a free running 32-bit
+ * tick used to measure how long IRQs stay masked.
+ */
+#ifndef FLASH_BLOB_YIELD
+    #define FLASH_BLOB_YIELD()
+#endif
+#if !defined(FLASH_BLOB_GET_TICK) && defined(USE_PERF_COUNTER) && USE_PERF_COUNTER == ENABLED
+    #define FLASH_BLOB_GET_TICK()       ((uint32_t)get_system_ticks())
+#endif
+/*
+ * FLASH_BLOB_MAP_ADDR() converts an address of a memory mapped device
+ * (tFlashops.Read == NULL) into a CPU pointer.
+ */
+#ifndef FLASH_BLOB_MAP_ADDR
+    #define FLASH_BLOB_MAP_ADDR(__ADDR)     ((const uint8_t *)(uintptr_t)(__ADDR))
+#endif
+/*
+ * FLASH_BLOB_CODE_ADDR() is an address in the flash the CPU executes code
+ * and takes vectors from while flash_blob runs. On devices with banks
+ * (flash_blob_t::wBankSize) only steps on the bank holding it mask IRQs,
+ * and requests for the other banks go first.
+ */
+#ifndef FLASH_BLOB_CODE_ADDR
+    #define FLASH_BLOB_CODE_ADDR()      ((uint32_t)(uintptr_t)&flash_dev_find)
+#endif
+/*
+ * FLASH_BLOB_DEV_LOCK(__ID)/FLASH_BLOB_DEV_UNLOCK(__ID) serialise the access
+ * to the device flash_dev_id() == __ID, so tasks using different devices
+ * run in parallel. FLASH_BLOB_DEV_RDLOCK(__ID)/FLASH_BLOB_DEV_RDUNLOCK(__ID)
+ * are taken instead by reads of memory mapped devices, which may overlap
+ * each other but no other access to the device. FLASH_BLOB_LOCK()/
+ * FLASH_BLOB_UNLOCK() guard what all devices share: the address index, the
+ * statistics and the trace; it is only ever taken inside a device lock,
+ * never the other way round.
+ * FLASH_BLOB_DEV_NOTIFY(__ID) runs after a request was queued for a
+ * device, e.g. to wake the task calling target_flash_poll_dev() for it.
+ * None of the locks is taken twice by one task.
+ * With FLASH_BLOB_OS set they default to the flash_rwlock_t of flash_lock.h,
+ * one per device and one shared.
+ */
+#if FLASH_BLOB_OS != FLASH_OS_NONE
+    #ifndef FLASH_BLOB_DEV_LOCK
+        #define FLASH_BLOB_DEV_LOCK(__ID)       flash_rwlock_write(&s_tDevCtx[__ID].tLock)
+        #define FLASH_BLOB_DEV_UNLOCK(__ID)     flash_rwlock_write_release(&s_tDevCtx[__ID].tLock)
+    #endif
+    #ifndef FLASH_BLOB_DEV_RDLOCK
+        #define FLASH_BLOB_DEV_RDLOCK(__ID)     flash_rwlock_read(&s_tDevCtx[__ID].tLock)
+        #define FLASH_BLOB_DEV_RDUNLOCK(__ID)   flash_rwlock_read_release(&s_tDevCtx[__ID].tLock)
+    #endif
+    #ifndef FLASH_BLOB_LOCK
+        #define FLASH_BLOB_LOCK()               flash_rwlock_write(&s_tLock)
+        #define FLASH_BLOB_UNLOCK()             flash_rwlock_write_release(&s_tLock)
+    #endif
+#endif
+#ifndef FLASH_BLOB_DEV_LOCK
+    #define FLASH_BLOB_DEV_LOCK(__ID)
+    #define FLASH_BLOB_DEV_UNLOCK(__ID)
+#endif
+#ifndef FLASH_BLOB_DEV_RDLOCK
+    #define FLASH_BLOB_DEV_RDLOCK(__ID)     FLASH_BLOB_DEV_LOCK(__ID)
+    #define FLASH_BLOB_DEV_RDUNLOCK(__ID)   FLASH_BLOB_DEV_UNLOCK(__ID)
+#endif
+#ifndef FLASH_BLOB_LOCK
+    #define FLASH_BLOB_LOCK()
+    #define FLASH_BLOB_UNLOCK()
+#endif
+#ifndef FLASH_BLOB_DEV_NOTIFY
+    #define FLASH_BLOB_DEV_NOTIFY(__ID)
+#endif
+/*
+ * FLASH_BLOB_BARRIER() makes the stores before it visible to other CPUs,
+ * tasks and IRQs before the stores after it, e.g. the index before the
+ * flag announcing it.
+ */
+#ifndef FLASH_BLOB_BARRIER
+    #if defined(__GNUC__)
+        #define FLASH_BLOB_BARRIER()    __sync_synchronize()
+    #else
+        #define FLASH_BLOB_BARRIER()    __DMB()
+    #endif
+#endif
+#if FLASH_BLOB_USE_PROG_PIPELINE == ENABLED && FLASH_BLOB_USE_PAGE_BUF != ENABLED
+    #error "FLASH_BLOB_USE_PROG_PIPELINE needs FLASH_BLOB_USE_PAGE_BUF"
+#endif
 /* Array containing flash devices and their configurations */
 static const flash_blob_t * const flash_table[] = FLASH_DEV_TABLE;
 
-/* Length of the flash_table array */
-static const size_t flash_table_len = sizeof(flash_table) / sizeof(flash_table[0]);
+/* Length of the flash_table array */
+static const size_t flash_table_len = sizeof(flash_table) / sizeof(flash_table[0]);
+
+/* Capacity of the address range index */
+#ifndef FLASH_DEV_MAX_NUM
+    #define FLASH_DEV_MAX_NUM   (sizeof(flash_table) / sizeof(flash_table[0]) + FLASH_DEV_REG_NUM)
+#endif
+
+#if FLASH_DEV_REG_NUM > 0
+/* Devices added by flash_dev_register(), their context slots follow FLASH_DEV_TABLE */
+static uint16_t s_hwDevRegNum = 0;
+#endif
+
+#define FLASH_DIFF_WORDS    (FLASH_BLOB_DIFF_CHUNK_SIZE / 4)
+
+/* Page buffers per device: one, or a ping-pong pair for the program pipeline */
+#if FLASH_BLOB_USE_PROG_PIPELINE == ENABLED
+    #define FLASH_BUF_NUM   2
+#else
+    #define FLASH_BUF_NUM   1
+#endif
+
+/* Working buffers of the operations that need one, see FLASH_DEV_SCRATCH() */
+typedef struct {
+    uint8_t  chCheck[FLASH_BLOB_ATOM_MAX_SIZE];     // readback of the program verify
+#if FLASH_BLOB_USE_DIFF_WRITE == ENABLED
+    uint32_t wDiffCur[FLASH_DIFF_WORDS];    // flash contents of the current chunk
+    uint32_t wDiffNew[FLASH_DIFF_WORDS];    // target contents of the current chunk
+#endif
+#if FLASH_BLOB_USE_PAGE_BUF != ENABLED
+    uint8_t  chWord[64];            // flash word straddling two writev segments
+    uint32_t wWordAddr;
+    uint32_t wWordFill;
+#endif
+} flash_scratch_t;
+
+/* Runtime state kept for every indexed device */
+typedef struct {
+    const flash_blob_t *ptBlob;
+    const flash_geometry_t *ptGeo;  // flash_blob_t::ptGeometry, or tGeometry
+    uint32_t wGranularity;          // write granularity, power of two
+    flash_geometry_t tGeometry;     // flattened sectors[] of devices without a prebuilt table
+#if FLASH_BLOB_USE_PAGE_BUF == ENABLED
+    uint32_t wBufUnit;              // min(szPage, FLASH_BLOB_PAGE_BUF_SIZE), divides szPage
+    uint32_t wBufAddr;              // address of the buffered unit
+    uint32_t wDirtyLo;              // dirty span [wDirtyLo, wDirtyHi) within the unit,
+    uint32_t wDirtyHi;              // empty when equal
+    uint8_t *pchBuf;                // buffer being filled, one of chBuf[]
+    uint8_t  chBuf[FLASH_BUF_NUM][FLASH_BLOB_PAGE_BUF_SIZE];
+#endif
+#if FLASH_BLOB_USE_PROG_PIPELINE == ENABLED
+    uint8_t *pchPipe;               // the other chBuf[], programming in the background
+    uint32_t wPipeAddr;             // address of its unit
+    uint32_t wPipeLo;               // its dirty span, like wDirtyLo/wDirtyHi,
+    uint32_t wPipeHi;               // nothing in flight when equal
+    uint32_t wPipeStart;            // tick of ProgramStart
+    bool     bPipeFailed;           // a background program failed, not reported yet
+#endif
+#if FLASH_BLOB_USE_DIFF_WRITE == ENABLED
+    flash_diff_stat_t tDiffStat;
+#endif
+#if FLASH_BLOB_USE_STAT == ENABLED
+    flash_dev_stat_t tStat;
+#endif
+#if FLASH_BLOB_USE_DIGEST == ENABLED
+    flash_digest_t tDigest;         // data accepted by write/writev since reset
+#endif
+    uint8_t  chVerify;              // flash_verify_t
+    flash_req_t *ptReqHead;         // FIFO of pending asynchronous requests
+    flash_req_t *ptReqTail;
+    bool     bMaskIrq;              // steps run with IRQs masked, see flash_irq_mask_t
+#if defined(FLASH_BLOB_GET_TICK)
+    uint32_t wIrqCall;              // longest IRQ-masked window of the current call, under FLASH_BLOB_LOCK
+#endif
+    uint32_t wBankReads[FLASH_BLOB_BANK_MAX];   // reads per bank, a hint only, updated without lock
+    uint32_t wBankSeen[FLASH_BLOB_BANK_MAX];    // wBankReads when the scheduler last looked
+#if FLASH_BLOB_USE_PARALLEL == ENABLED
+    flash_scratch_t tScratch;
+#endif
+#if FLASH_BLOB_OS != FLASH_OS_NONE
+    flash_rwlock_t tLock;           // kept over index rebuilds
+#endif
+} flash_dev_ctx_t;
+
+static flash_dev_ctx_t s_tDevCtx[FLASH_DEV_MAX_NUM];
+#if FLASH_BLOB_OS != FLASH_OS_NONE
+static flash_rwlock_t s_tLock;
+#endif
+
+/* The value passed to the device lock hooks */
+#define FLASH_DEV_ID(__CTX)     ((int32_t)((__CTX) - s_tDevCtx))
+
+/* Only tasks holding different device locks use scratch buffers concurrently */
+#if FLASH_BLOB_USE_PARALLEL == ENABLED
+    #define FLASH_DEV_SCRATCH(__CTX)    (&(__CTX)->tScratch)
+#else
+static flash_scratch_t s_tScratch;
+    #define FLASH_DEV_SCRATCH(__CTX)    (&s_tScratch)
+#endif
+
+#if defined(FLASH_BLOB_GET_TICK)
+static flash_irq_stat_t s_tIrqStat;
+#endif
+
+/*
+ * Function: flash_atom_enter
+ * Description: Masks IRQs for one step if the device needs it.
+ * Parameters:
+ *   - bMask: flash_dev_ctx_t::bMaskIrq of the device.
+ * Returns: PRIMASK before the step.
+ */
+static inline uint32_t flash_atom_enter(bool bMask)
+{
+    uint32_t wPrimask = __get_PRIMASK();
+
+    if (bMask) {
+        __disable_irq();
+    }
+    return wPrimask;
+}
+
+/*
+ * Function: flash_atom_leave
+ * Description: Restores IRQs after a step, accounts the window if they were
+ *              masked and runs the yield hook.
+ * Parameters:
+ *   - ptCtx: Device context.
+ *   - wStart: Tick taken before the step.
+ *   - wPrimask: Value returned by flash_atom_enter().
+ *   - bMask: flash_dev_ctx_t::bMaskIrq of the device.
+ */
+static void flash_atom_leave(flash_dev_ctx_t *ptCtx, uint32_t wStart, uint32_t wPrimask, bool bMask)
+{
+    if (!bMask) {
+        FLASH_BLOB_YIELD();
+        return;
+    }
+    __set_PRIMASK(wPrimask);
+#if defined(FLASH_BLOB_GET_TICK)
+    uint32_t wWindow = FLASH_BLOB_GET_TICK() - wStart;
+
+    FLASH_BLOB_LOCK();
+    s_tIrqStat.wWindows++;
+    if (wWindow > ptCtx->wIrqCall) {
+        ptCtx->wIrqCall = wWindow;
+    }
+    /*calls on other devices keep their own maximum, the last one to mask IRQs is reported*/
+    s_tIrqStat.wLastCall = ptCtx->wIrqCall;
+    if (wWindow > s_tIrqStat.wMax) {
+        s_tIrqStat.wMax = wWindow;
+    }
+    FLASH_BLOB_UNLOCK();
+#else
+    (void)ptCtx;
+    (void)wStart;
+#endif
+    FLASH_BLOB_YIELD();
+}
+
+/*
+ * Function: flash_atom_call
+ * Description: Starts the per call IRQ window measurement of an API call.
+ * Parameters:
+ *   - ptCtx: Device context of the call.
+ */
+static inline void flash_atom_call(flash_dev_ctx_t *ptCtx)
+{
+#if defined(FLASH_BLOB_GET_TICK)
+    FLASH_BLOB_LOCK();
+    ptCtx->wIrqCall = 0;
+    FLASH_BLOB_UNLOCK();
+#else
+    (void)ptCtx;
+#endif
+}
+
+#if defined(FLASH_BLOB_GET_TICK)
+    #define FLASH_ATOM_TICK()   FLASH_BLOB_GET_TICK()
+#else
+    #define FLASH_ATOM_TICK()   0
+#endif
+
+/* One erase/program/read step of a range of a device, IRQs masked only if the range needs it */
+#define flash_atom_code(__CTX, __ADDR, __SIZE)                                          \
+            for (uint32_t SAFE_NAME(mask) = flash_dev_irq_masked((__CTX), (__ADDR), (__SIZE)), \
+                          SAFE_NAME(tick) = FLASH_ATOM_TICK(),                          \
+                          SAFE_NAME(primask) = flash_atom_enter(SAFE_NAME(mask)),       \
+                          *SAFE_NAME(once) = NULL;                                      \
+                 SAFE_NAME(once)++ == NULL;                                             \
+                 flash_atom_leave((__CTX), SAFE_NAME(tick), SAFE_NAME(primask), SAFE_NAME(mask)))
+
+/*
+ * Short updates of state the device and shared locks already cover. Without
+ * an OS lock IRQs are masked instead, as the bare metal port always did.
+ */
+#if FLASH_BLOB_OS != FLASH_OS_NONE
+    #define flash_guard_code()                                                          \
+            for (uint32_t *SAFE_NAME(guard) = NULL; SAFE_NAME(guard)++ == NULL;)
+#else
+    #define flash_guard_code()      safe_atom_code()
+#endif
+
+/*
+ * Address range index, kept sorted by start address. Starts are stored in
+ * their own array so the binary search walks a dense block of words.
+ */
+static uint32_t s_wDevStart[FLASH_DEV_MAX_NUM];
+static uint32_t s_wDevLast[FLASH_DEV_MAX_NUM];   // DevAdr + szDev - 1, inclusive to allow ranges ending at 4GB
+static flash_dev_ctx_t *s_ptDevIndex[FLASH_DEV_MAX_NUM];
+static uint16_t s_hwDevNum = 0;
+#if FLASH_BLOB_USE_PARALLEL != ENABLED
+static volatile uint16_t s_hwLastHit = 0;
+#endif
+static volatile bool s_bIndexReady = false;     // set once, after the index is complete
+static bool s_bIndexResult = false;             // every device of FLASH_DEV_TABLE was indexed
+
+/*
+ * Function: flash_dev_sector_map_build
+ * Description: Flattens the sectors[] list of a device into regions with
+ *              cumulative sector indexes. A table prebuilt for the device
+ *              is taken as is.
+ * Parameters:
+ *   - ptCtx: Device context, ptBlob must be set.
+ * Returns: True if the sector list describes the whole device consistently.
+ */
+static bool flash_dev_sector_map_build(flash_dev_ctx_t *ptCtx)
+{
+    flash_dev_t const *ptDev = ptCtx->ptBlob->ptFlashDev;
+    uint32_t wFirst = 0;
+    uint8_t chNum = 0;
+
+    if (ptCtx->ptBlob->ptGeometry != NULL) {
+        ptCtx->ptGeo = ptCtx->ptBlob->ptGeometry;
+        return ptCtx->ptGeo->chRegionNum != 0 && ptCtx->ptGeo->chRegionNum <= SECTOR_NUM;
+    }
+
+    while (chNum < SECTOR_NUM && ptDev->sectors[chNum].szSector != 0xFFFFFFFF) {
+        chNum++;
+    }
+
+    if (chNum == 0 || ptDev->sectors[0].AddrSector != 0) {
+        return false;
+    }
+
+    for (uint8_t i = 0; i < chNum; i++) {
+        flash_region_t *ptRegion = &ptCtx->tGeometry.tRegion[i];
+        uint32_t wEnd = (i + 1 < chNum) ? ptDev->sectors[i + 1].AddrSector : ptDev->szDev;
+
+        ptRegion->wOffset = ptDev->sectors[i].AddrSector;
+        ptRegion->wSize = ptDev->sectors[i].szSector;
+        ptRegion->wFirst = wFirst;
+        ptRegion->chShift = 0;
+
+        if (ptRegion->wSize == 0 || wEnd <= ptRegion->wOffset ||
+            (wEnd - ptRegion->wOffset) % ptRegion->wSize != 0) {
+            return false;
+        }
+        if ((ptRegion->wSize & (ptRegion->wSize - 1)) == 0) {
+            while ((1ul << ptRegion->chShift) < ptRegion->wSize) {
+                ptRegion->chShift++;
+            }
+        }
+
+        wFirst += (wEnd - ptRegion->wOffset) / ptRegion->wSize;
+    }
+
+    ptCtx->tGeometry.chRegionNum = chNum;
+    ptCtx->tGeometry.wSectorNum = wFirst;
+    ptCtx->ptGeo = &ptCtx->tGeometry;
+
+    return true;
+}
+
+/*
+ * Function: flash_dev_region_find
+ * Description: Finds the region holding a device offset (O(log regions)).
+ * Parameters:
+ *   - ptCtx: Device context.
+ *   - wOffset: Offset from DevAdr, must be below szDev.
+ * Returns: Pointer to the region.
+ */
+static const flash_region_t *flash_dev_region_find(const flash_dev_ctx_t *ptCtx, uint32_t wOffset)
+{
+    uint8_t chLow = 0, chHigh = ptCtx->ptGeo->chRegionNum - 1;
+
+    while (chLow < chHigh) {
+        uint8_t chMid = (chLow + chHigh + 1) >> 1;
+        if (ptCtx->ptGeo->tRegion[chMid].wOffset <= wOffset) {
+            chLow = chMid;
+        } else {
+            chHigh = chMid - 1;
+        }
+    }
+
+    return &ptCtx->ptGeo->tRegion[chLow];
+}
+
+/*
+ * Function: flash_dev_sector_of
+ * Description: Maps a device offset to its sector.
+ * Parameters:
+ *   - ptCtx: Device context.
+ *   - wOffset: Offset from DevAdr, must be below szDev.
+ *   - ptSector: Receives the sector start address, size and index.
+ */
+static void flash_dev_sector_of(const flash_dev_ctx_t *ptCtx, uint32_t wOffset, flash_sector_t *ptSector)
+{
+    const flash_region_t *ptRegion = flash_dev_region_find(ptCtx, wOffset);
+    uint32_t wNum = (ptRegion->chShift != 0) ? (wOffset - ptRegion->wOffset) >> ptRegion->chShift
+                                             : (wOffset - ptRegion->wOffset) / ptRegion->wSize;
+
+    ptSector->wIndex = ptRegion->wFirst + wNum;
+    ptSector->wAddr = ptCtx->ptBlob->ptFlashDev->DevAdr + ptRegion->wOffset + wNum * ptRegion->wSize;
+    ptSector->wSize = ptRegion->wSize;
+}
+
+/*
+ * Function: flash_dev_bank_mask
+ * Description: Gets the banks a range of a device touches.
+ * Parameters:
+ *   - ptCtx: Device context.
+ *   - addr, size: The range, within the device.
+ * Returns: Bit n set for bank n, bit 0 for a device without banks.
+ */
+static uint8_t flash_dev_bank_mask(const flash_dev_ctx_t *ptCtx, uint32_t addr, size_t size)
+{
+    uint32_t wBankSize = ptCtx->ptBlob->wBankSize;
+    uint32_t wOffset = addr - ptCtx->ptBlob->ptFlashDev->DevAdr;
+    uint32_t wFirst, wLast;
+
+    if (wBankSize == 0) {
+        return 1;
+    }
+    wFirst = wOffset / wBankSize;
+    wLast = (wOffset + (size ? size - 1 : 0)) / wBankSize;
+    wFirst = (wFirst < FLASH_BLOB_BANK_MAX) ? wFirst : FLASH_BLOB_BANK_MAX - 1;
+    wLast = (wLast < FLASH_BLOB_BANK_MAX) ? wLast : FLASH_BLOB_BANK_MAX - 1;
+
+    return (uint8_t)((2u << wLast) - (1u << wFirst));
+}
+
+/*
+ * Function: flash_dev_code_mask
+ * Description: Gets the bank of a device holding FLASH_BLOB_CODE_ADDR().
+ * Parameters:
+ *   - ptCtx: Device context.
+ * Returns: Bank mask as flash_dev_bank_mask(), 0 if the code runs elsewhere.
+ */
+static uint8_t flash_dev_code_mask(const flash_dev_ctx_t *ptCtx)
+{
+    uint32_t wCode = FLASH_BLOB_CODE_ADDR();
+
+    if (wCode - ptCtx->ptBlob->ptFlashDev->DevAdr >= ptCtx->ptBlob->ptFlashDev->szDev) {
+        return 0;
+    }
+    return flash_dev_bank_mask(ptCtx, wCode, 1);
+}
+
+/*
+ * Function: flash_dev_irq_masked
+ * Description: Tells if erasing, programming or reading a range masks IRQs:
+ *              the device needs it (flash_irq_mask_t) and, if it has banks,
+ *              the range shares a bank with the running code. The CPU keeps
+ *              fetching from the other banks of a read-while-write part.
+ * Parameters:
+ *   - ptCtx: Device context.
+ *   - addr, size: The range.
+ * Returns: True if IRQs are masked.
+ */
+static bool flash_dev_irq_masked(const flash_dev_ctx_t *ptCtx, uint32_t addr, size_t size)
+{
+    if (!ptCtx->bMaskIrq) {
+        return false;
+    }
+    return ptCtx->ptBlob->wBankSize == 0 ||
+           (flash_dev_bank_mask(ptCtx, addr, size) & flash_dev_code_mask(ptCtx)) != 0;
+}
+
+/*
+ * Function: flash_dev_bank_read
+ * Description: Notes a read for the scheduler. Concurrent readers may lose
+ *              a count, it only matters whether the count changed.
+ * Parameters:
+ *   - ptCtx: Device context.
+ *   - addr, size: The range read.
+ */
+static inline void flash_dev_bank_read(flash_dev_ctx_t *ptCtx, uint32_t addr, size_t size)
+{
+    uint8_t chMask = flash_dev_bank_mask(ptCtx, addr, size);
+
+    for (uint32_t i = 0; i < FLASH_BLOB_BANK_MAX; i++) {
+        if (chMask & (1u << i)) {
+            ptCtx->wBankReads[i]++;
+        }
+    }
+}
+
+/*
+ * Function: flash_dev_ctx_setup
+ * Description: Initialises the runtime context of a device before it is
+ *              indexed.
+ * Parameters:
+ *   - ptCtx: Unused context slot, ptBlob must be set.
+ * Returns: False if the sector list, write granularity or banks of the
+ *          device are inconsistent or its lock cannot be created.
+ */
+static bool flash_dev_ctx_setup(flash_dev_ctx_t *ptCtx)
+{
+    const flash_blob_t *ptBlob = ptCtx->ptBlob;
+    uint32_t wSize = ptBlob->ptFlashDev->szDev;
+
+    if (!flash_dev_sector_map_build(ptCtx)) {
+        /*sectors[] does not describe the device*/
+        return false;
+    }
+
+    ptCtx->wGranularity = ptBlob->wWriteGranularity ? ptBlob->wWriteGranularity : 4;
+    if ((ptCtx->wGranularity & (ptCtx->wGranularity - 1)) != 0 ||
+        ptBlob->ptFlashDev->szPage == 0 || ptBlob->ptFlashDev->szPage % ptCtx->wGranularity != 0) {
+        /*granularity must be a power of two dividing the page*/
+        return false;
+    }
+    if (ptBlob->wBankSize != 0 && wSize % ptBlob->wBankSize != 0) {
+        /*banks must split the device evenly*/
+        return false;
+    }
+    ptCtx->chVerify = FLASH_BLOB_VERIFY_POLICY;
+    ptCtx->bMaskIrq = (ptBlob->chIrqMask == FLASH_IRQ_MASK_ALWAYS) ||
+                      (ptBlob->chIrqMask == FLASH_IRQ_MASK_AUTO && ptBlob->ptFlashDev->DevType == ONCHIP);
+#if FLASH_BLOB_OS != FLASH_OS_NONE
+    if (!flash_rwlock_init(&ptCtx->tLock)) {
+        return false;
+    }
+#endif
+#if FLASH_BLOB_USE_DIGEST == ENABLED
+    flash_digest_init(&ptCtx->tDigest);
+#endif
+#if FLASH_BLOB_USE_PAGE_BUF == ENABLED
+    ptCtx->wBufUnit = FLASH_BLOB_PAGE_BUF_SIZE;
+    while (ptCtx->wBufUnit > ptCtx->wGranularity && ptBlob->ptFlashDev->szPage % ptCtx->wBufUnit != 0) {
+        ptCtx->wBufUnit >>= 1;
+    }
+    if (ptCtx->wBufUnit > ptBlob->ptFlashDev->szPage) {
+        ptCtx->wBufUnit = ptBlob->ptFlashDev->szPage;
+    }
+    if (ptBlob->ptFlashDev->szPage % ptCtx->wBufUnit != 0 || ptCtx->wBufUnit % ptCtx->wGranularity != 0) {
+        return false;
+    }
+    ptCtx->wDirtyLo = ptCtx->wDirtyHi = 0;
+    ptCtx->pchBuf = ptCtx->chBuf[0];
+    memset(ptCtx->chBuf, ptBlob->ptFlashDev->valEmpty, sizeof(ptCtx->chBuf));
+#endif
+#if FLASH_BLOB_USE_PROG_PIPELINE == ENABLED
+    ptCtx->pchPipe = ptCtx->chBuf[1];
+    ptCtx->wPipeLo = ptCtx->wPipeHi = 0;
+    ptCtx->bPipeFailed = false;
+#endif
+
+    return true;
+}
+
+/*
+ * Function: flash_dev_index_insert
+ * Description: Sets up the context slot of a device and inserts the device
+ *              into the sorted address range index. Contexts of devices
+ *              indexed before are left as they are.
+ * Parameters:
+ *   - ptBlob: Flash device to insert.
+ *   - ptCtx: Its context slot, which fixes its flash_dev_id().
+ * Returns: True if inserted, false if the range is empty, overlaps an
+ *          indexed device, has an invalid sector list or the index is full.
+ */
+static bool flash_dev_index_insert(const flash_blob_t *ptBlob, flash_dev_ctx_t *ptCtx)
+{
+    uint32_t wStart = ptBlob->ptFlashDev->DevAdr;
+    uint32_t wSize = ptBlob->ptFlashDev->szDev;
+    uint16_t hwPos = s_hwDevNum;
+
+    if (wSize == 0 || wStart + (wSize - 1) < wStart || s_hwDevNum >= FLASH_DEV_MAX_NUM) {
+        return false;
+    }
+
+    while (hwPos > 0 && s_wDevStart[hwPos - 1] > wStart) {
+        hwPos--;
+    }
+
+    if ((hwPos > 0 && s_wDevLast[hwPos - 1] >= wStart) ||
+        (hwPos < s_hwDevNum && s_wDevStart[hwPos] <= wStart + (wSize - 1))) {
+        /*device address ranges must not overlap*/
+        return false;
+    }
+
+    ptCtx->ptBlob = ptBlob;
+    if (!flash_dev_ctx_setup(ptCtx)) {
+        ptCtx->ptBlob = NULL;
+        return false;
+    }
+
+    /*a reader may only see the new device once it is complete*/
+#if FLASH_BLOB_USE_PARALLEL != ENABLED
+    s_hwLastHit = 0;
+#endif
+    FLASH_BLOB_BARRIER();
+    for (uint16_t i = s_hwDevNum; i > hwPos; i--) {
+        s_wDevStart[i] = s_wDevStart[i - 1];
+        s_wDevLast[i] = s_wDevLast[i - 1];
+        s_ptDevIndex[i] = s_ptDevIndex[i - 1];
+    }
+    s_wDevStart[hwPos] = wStart;
+    s_wDevLast[hwPos] = wStart + (wSize - 1);
+    s_ptDevIndex[hwPos] = ptCtx;
+    s_hwDevNum++;
+
+    return true;
+}
+
+/*
+ * Function: flash_dev_index_fill
+ * Description: Inserts the devices of FLASH_DEV_TABLE not indexed yet, each
+ *              with the context slot of its table position. Devices indexed
+ *              before are not touched. The caller holds FLASH_BLOB_LOCK().
+ */
+static void flash_dev_index_fill(void)
+{
+    s_bIndexResult = true;
+    for (uint16_t i = 0; i < flash_table_len; i++) {
+        if (s_tDevCtx[i].ptBlob == NULL && !flash_dev_index_insert(flash_table[i], &s_tDevCtx[i])) {
+            s_bIndexResult = false;
+        }
+    }
+    FLASH_BLOB_BARRIER();
+    s_bIndexReady = true;
+}
+
+/*
+ * Function: flash_dev_index_build
+ * Description: Builds the sorted address range index from FLASH_DEV_TABLE.
+ *              Called lazily on first lookup, may be called at start-up to
+ *              validate the table. Later calls only add the devices
+ *              rejected before, e.g. a SPI NOR device probed since, and
+ *              leave indexed devices, their page buffers and locks alone.
+ *              With FLASH_BLOB_OS set it also
+ *              creates the locks, so call it once before the tasks using
+ *              the API are started. Call it before an IRQ handler uses
+ *              the API, the first lookup takes FLASH_BLOB_LOCK().
+ * Returns: True if every device was indexed, false if a device was rejected
+ *          because its range is empty, overlaps a previous entry or its
+ *          sectors[] list is inconsistent or its lock cannot be created.
+ */
+bool flash_dev_index_build(void)
+{
+    bool bResult;
+
+#if FLASH_BLOB_OS != FLASH_OS_NONE
+    if (!flash_rwlock_init(&s_tLock)) {
+        return false;
+    }
+#endif
+    FLASH_BLOB_LOCK();
+    flash_dev_index_fill();
+    bResult = s_bIndexResult;
+    FLASH_BLOB_UNLOCK();
+
+    return bResult;
+}
+
+/*
+ * Function: flash_dev_register
+ * Description: Adds a device at runtime, e.g. one loaded by flash_flm_load().
+ *              It is appended to the index with the context slot after
+ *              FLASH_DEV_TABLE and the devices registered before, the
+ *              devices in use are not touched. The index entries move, so
+ *              lookups must not run meanwhile: do not call it while other
+ *              tasks or IRQs use the target_flash_* API.
+ * Parameters:
+ *   - ptFlashDevice: Device to add, must stay valid until reset.
+ * Returns: True if added, false if FLASH_DEV_REG_NUM devices were added
+ *          already or the index rejects the device, e.g. since its range
+ *          overlaps an indexed device.
+ */
+bool flash_dev_register(const flash_blob_t *ptFlashDevice)
+{
+    bool bResult = false;
+
+#if FLASH_DEV_REG_NUM > 0
+    if (ptFlashDevice == NULL || ptFlashDevice->ptFlashDev == NULL) {
+        return false;
+    }
+#if FLASH_BLOB_OS != FLASH_OS_NONE
+    if (!flash_rwlock_init(&s_tLock)) {
+        return false;
+    }
+#endif
+    FLASH_BLOB_LOCK();
+    if (!s_bIndexReady) {
+        flash_dev_index_fill();
+    }
+    if (s_hwDevRegNum < FLASH_DEV_REG_NUM &&
+        flash_dev_index_insert(ptFlashDevice, &s_tDevCtx[flash_table_len + s_hwDevRegNum])) {
+        s_hwDevRegNum++;
+        bResult = true;
+    }
+    FLASH_BLOB_UNLOCK();
+#else
+    (void)ptFlashDevice;
+#endif
+
+    return bResult;
+}
+
+/*
+ * Function: flash_dev_ctx_find
+ * Description: Finds the runtime context of the device holding an address.
+ *              The last hit is checked first, otherwise the sorted index is
+ *              binary searched. With FLASH_BLOB_USE_PARALLEL the device
+ *              workers run concurrently on different devices, the last
+ *              hit would be shared and keep missing, so only the search
+ *              is used.
+ * Parameters:
+ *   - addr: Flash memory address to find.
+ * Returns: Pointer to the device context if found, NULL otherwise.
+ */
+static flash_dev_ctx_t *flash_dev_ctx_find(uint32_t addr)
+{
+#if FLASH_BLOB_USE_PARALLEL != ENABLED
+    uint16_t hwHit = s_hwLastHit;
+#else
+    uint16_t hwHit;
+#endif
+    uint16_t hwNum;
+    const uint32_t *pwBase = s_wDevStart;
+
+    if (!s_bIndexReady) {
+#if FLASH_BLOB_OS != FLASH_OS_NONE
+        if (!flash_rwlock_init(&s_tLock)) {
+            return NULL;
+        }
+#endif
+        FLASH_BLOB_LOCK();
+        if (!s_bIndexReady) {
+            flash_dev_index_fill();
+        }
+        FLASH_BLOB_UNLOCK();
+    }
+
+#if FLASH_BLOB_USE_PARALLEL != ENABLED
+    if (hwHit < s_hwDevNum && addr >= s_wDevStart[hwHit] && addr <= s_wDevLast[hwHit]) {
+        return s_ptDevIndex[hwHit];
+    }
+#endif
+
+    if (s_hwDevNum == 0 || addr < s_wDevStart[0]) {
+        return NULL;
+    }
+
+    /* branch free search for the last entry whose start is not above addr */
+    hwNum = s_hwDevNum;
+    while (hwNum > 1) {
+        uint16_t hwHalf = hwNum >> 1;
+        pwBase = (pwBase[hwHalf] <= addr) ? pwBase + hwHalf : pwBase;
+        hwNum -= hwHalf;
+    }
+
+    hwHit = (uint16_t)(pwBase - s_wDevStart);
+    if (addr > s_wDevLast[hwHit]) {
+        return NULL;
+    }
+
+#if FLASH_BLOB_USE_PARALLEL != ENABLED
+    s_hwLastHit = hwHit;
+#endif
+    return s_ptDevIndex[hwHit];
+}
+
+/*
+ * Function: flash_dev_find
+ * Description: Finds the flash device based on the specified address.
+ * Parameters:
+ *   - addr: Flash memory address to find.
+ * Returns: Pointer to the flash_blob_t structure if found, NULL otherwise.
+ */
+const flash_blob_t *flash_dev_find(uint32_t addr)
+{
+    flash_dev_ctx_t *ptCtx = flash_dev_ctx_find(addr);
+
+    return (ptCtx != NULL) ? ptCtx->ptBlob : NULL;
+}
+
+/*
+ * Function: flash_dev_id
+ * Description: Gets the number of a device as passed to the lock hooks and
+ *              stored in flash_trace_t::chDev: its position in FLASH_DEV_TABLE,
+ *              registered devices follow in the order of flash_dev_register().
+ * Parameters:
+ *   - addr: Any address of the device.
+ * Returns: Device number, -1 if no device holds addr.
+ */
+int32_t flash_dev_id(uint32_t addr)
+{
+    flash_dev_ctx_t *ptCtx = flash_dev_ctx_find(addr);
+
+    return (ptCtx != NULL) ? FLASH_DEV_ID(ptCtx) : -1;
+}
+
+/*
+ * Function: target_flash_sector_info
+ * Description: Looks up the sector holding an address.
+ * Parameters:
+ *   - addr: Flash memory address.
+ *   - ptSector: Receives the sector start address, size and index.
+ * Returns: True if addr belongs to a registered device.
+ */
+bool target_flash_sector_info(uint32_t addr, flash_sector_t *ptSector)
+{
+    flash_dev_ctx_t *ptCtx = flash_dev_ctx_find(addr);
+
+    if (ptCtx == NULL || ptSector == NULL) {
+        return false;
+    }
+
+    flash_dev_sector_of(ptCtx, addr - ptCtx->ptBlob->ptFlashDev->DevAdr, ptSector);
+    return true;
+}
+
+/*
+ * Function: target_flash_sector_at
+ * Description: Looks up a sector by its index within a device.
+ * Parameters:
+ *   - addr: Any address of the device.
+ *   - wIndex: Linear sector index, 0 is the sector at DevAdr.
+ *   - ptSector: Receives the sector start address, size and index.
+ * Returns: True if the device exists and has a sector wIndex.
+ */
+bool target_flash_sector_at(uint32_t addr, uint32_t wIndex, flash_sector_t *ptSector)
+{
+    flash_dev_ctx_t *ptCtx = flash_dev_ctx_find(addr);
+    uint8_t chRegion;
+
+    if (ptCtx == NULL || ptSector == NULL || wIndex >= ptCtx->ptGeo->wSectorNum) {
+        return false;
+    }
+
+    const flash_region_t *ptRegion = ptCtx->ptGeo->tRegion;
+
+    for (chRegion = ptCtx->ptGeo->chRegionNum - 1; ptRegion[chRegion].wFirst > wIndex; chRegion--);
+
+    ptSector->wIndex = wIndex;
+    ptSector->wSize = ptRegion[chRegion].wSize;
+    ptSector->wAddr = ptCtx->ptBlob->ptFlashDev->DevAdr + ptRegion[chRegion].wOffset +
+                      (wIndex - ptRegion[chRegion].wFirst) * ptSector->wSize;
+    return true;
+}
+
+/*
+ * Function: target_flash_bank_info
+ * Description: Gets the bank holding an address and whether erasing or
+ *              programming it stalls the CPU. Such operations, and every
+ *              ISR left enabled while they run, must execute from RAM; the
+ *              other banks of a read-while-write part are updated while the
+ *              application keeps running from flash. A device without banks
+ *              is one bank.
+ * Parameters:
+ *   - addr: Any address of the bank.
+ *   - ptBank: Receives the bank.
+ * Returns: True if a device holds addr.
+ */
+bool target_flash_bank_info(uint32_t addr, flash_bank_t *ptBank)
+{
+    flash_dev_ctx_t *ptCtx = flash_dev_ctx_find(addr);
+
+    if (ptCtx == NULL) {
+        return false;
+    }
+
+    uint32_t wDevAdr = ptCtx->ptBlob->ptFlashDev->DevAdr;
+    uint32_t wBankSize = ptCtx->ptBlob->wBankSize ? ptCtx->ptBlob->wBankSize : ptCtx->ptBlob->ptFlashDev->szDev;
+    uint32_t wIndex = (addr - wDevAdr) / wBankSize;
+
+    ptBank->wAddr = wDevAdr + wIndex * wBankSize;
+    ptBank->wSize = wBankSize;
+    ptBank->chIndex = (uint8_t)wIndex;
+    ptBank->bCode = (FLASH_BLOB_CODE_ADDR() - ptBank->wAddr) < wBankSize;
+    ptBank->bStall = flash_dev_irq_masked(ptCtx, ptBank->wAddr, wBankSize);
+
+    return true;
+}
+#if FLASH_BLOB_USE_STAT == ENABLED || FLASH_BLOB_USE_TRACE == ENABLED
+#if FLASH_BLOB_USE_TRACE == ENABLED
+static flash_trace_t s_tTrace[FLASH_BLOB_TRACE_DEPTH];
+static uint32_t s_wTraceHead = 0;       // next entry to write
+static uint32_t s_wTraceTail = 0;       // oldest entry not read yet
+static uint32_t s_wTraceLost = 0;       // entries overwritten before they were read
+#endif
+
+/*
+ * Function: flash_op_record
+ * Description: Accounts one operation in the device counters and the trace.
+ * Parameters:
+ *   - ptCtx: Device context.
+ *   - chOp: flash_op_t.
+ *   - addr, size: Range of the operation.
+ *   - wStart: Tick taken before the operation.
+ *   - bFailed: The operation reported an error.
+ */
+static void flash_op_record(flash_dev_ctx_t *ptCtx, uint8_t chOp, uint32_t addr, size_t size,
+                            uint32_t wStart, bool bFailed)
+{
+    uint32_t wTicks = FLASH_ATOM_TICK() - wStart;
+
+#if FLASH_BLOB_USE_STAT == ENABLED
+    flash_op_stat_t *ptOp = &ptCtx->tStat.tOp[chOp];
+    uint32_t wBucket = 0;
+
+    /*readers of a memory mapped device record at the same time*/
+    FLASH_BLOB_LOCK();
+    ptOp->wCalls++;
+    ptOp->wFailures += bFailed;
+    ptOp->dwBytes += size;
+    ptOp->dwTicks += wTicks;
+    if (wTicks > ptOp->wMaxTicks) {
+        ptOp->wMaxTicks = wTicks;
+    }
+    while (wBucket < FLASH_BLOB_STAT_HIST_NUM - 1 && (wTicks >> wBucket) != 0) {
+        wBucket++;
+    }
+    ptOp->wHist[wBucket]++;
+
+    if (chOp == FLASH_OP_ERASE) {
+        /*block and chip erases wear every sector they cover*/
+        flash_sector_t tSector;
+        uint32_t wOffset = addr - ptCtx->ptBlob->ptFlashDev->DevAdr;
+        do {
+            flash_dev_sector_of(ptCtx, wOffset, &tSector);
+            ptCtx->tStat.wSectorErases[(tSector.wIndex < FLASH_BLOB_STAT_SECTOR_NUM)
+                                       ? tSector.wIndex : FLASH_BLOB_STAT_SECTOR_NUM - 1]++;
+            wOffset += tSector.wSize;
+        } while (wOffset < addr - ptCtx->ptBlob->ptFlashDev->DevAdr + size);
+    }
+    FLASH_BLOB_UNLOCK();
+#endif
+#if FLASH_BLOB_USE_TRACE == ENABLED
+    FLASH_BLOB_LOCK();
+    flash_guard_code(){
+        flash_trace_t *ptTrace = &s_tTrace[s_wTraceHead % FLASH_BLOB_TRACE_DEPTH];
+        ptTrace->wStart = wStart;
+        ptTrace->wTicks = wTicks;
+        ptTrace->wAddr = addr;
+        ptTrace->wSize = size;
+        ptTrace->chDev = (uint8_t)FLASH_DEV_ID(ptCtx);
+        ptTrace->chOp = chOp;
+        ptTrace->chFailed = bFailed;
+        s_wTraceHead++;
+        if (s_wTraceHead - s_wTraceTail > FLASH_BLOB_TRACE_DEPTH) {
+            s_wTraceTail++;
+            s_wTraceLost++;
+        }
+    }
+    FLASH_BLOB_UNLOCK();
+#endif
+}
+
+    #define FLASH_OP_START()                            FLASH_ATOM_TICK()
+    #define FLASH_OP_RECORD(__CTX, __OP, __ADDR, __SIZE, __START, __FAILED)    \
+            flash_op_record((__CTX), (__OP), (__ADDR), (__SIZE), (__START), (__FAILED))
+#else
+    #define FLASH_OP_START()                            0
+    #define FLASH_OP_RECORD(__CTX, __OP, __ADDR, __SIZE, __START, __FAILED)
+#endif
+
+#if FLASH_BLOB_USE_READ_CACHE == ENABLED
+/*
+ * Function: flash_cache_update
+ * Description: Keeps the read cache of a device in step with a change of
+ *              the flash: programmed bytes are merged into the lines they
+ *              fall into the way the cells take them (bits only move away
+ *              from valEmpty), anything else drops the lines.
+ * Parameters:
+ *   - ptCtx: Device context.
+ *   - addr, size: The range changed.
+ *   - buf: Data programmed, NULL for an erase or a failed program.
+ */
+static void flash_cache_update(flash_dev_ctx_t *ptCtx, uint32_t addr, const uint8_t *buf, size_t size)
+{
+    flash_cache_t *ptCache = ptCtx->ptBlob->ptCache;
+    uint8_t chEmpty = ptCtx->ptBlob->ptFlashDev->valEmpty;
+    uint32_t wLineSize;
+
+    if (ptCache == NULL || ptCtx->ptBlob->tFlashops.Read == NULL) {
+        return;
+    }
+    if (chEmpty != 0xFF && chEmpty != 0x00) {
+        buf = NULL;
+    }
+    wLineSize = ptCache->hwLineSize;
+
+    for (uint32_t i = 0; i < (uint32_t)ptCache->hwSets * ptCache->chWays; i++) {
+        uint32_t wLine = ptCache->ptWay[i].wLine & ~1u;
+
+        if (ptCache->ptWay[i].wLine == 0 || wLine >= addr + size || wLine + wLineSize <= addr) {
+            continue;
+        }
+        if (buf == NULL) {
+            ptCache->ptWay[i].wLine = 0;
+            ptCache->tStat.wInvalidated++;
+            continue;
+        }
+
+        uint32_t wLo = (addr > wLine) ? addr : wLine;
+        uint32_t wHi = (addr + size < wLine + wLineSize) ? addr + size : wLine + wLineSize;
+        uint8_t *pchLine = &ptCache->pchData[i * wLineSize];
+
+        for (uint32_t a = wLo; a < wHi; a++) {
+            if (chEmpty == 0xFF) {
+                pchLine[a - wLine] &= buf[a - addr];
+            } else {
+                pchLine[a - wLine] |= buf[a - addr];
+            }
+        }
+    }
+}
+#else
+    #define flash_cache_update(__CTX, __ADDR, __BUF, __SIZE)
+#endif
+
+/*
+ * Function: flash_dev_erase_step
+ * Description: Runs one planned erase operation in its own critical section.
+ * Parameters:
+ *   - ptCtx: Device context.
+ *   - ptStep: The operation.
+ * Returns: True on success.
+ */
+static bool flash_dev_erase_step(flash_dev_ctx_t *ptCtx, const flash_erase_step_t *ptStep)
+{
+    const flash_blob_t *ptFlashDevice = ptCtx->ptBlob;
+    const flash_erase_caps_t *ptCaps = ptFlashDevice->ptErase;
+    int32_t nResult = -1;
+    flash_sector_t tSector;
+
+    flash_dev_sector_of(ptCtx, ptStep->wAddr - ptFlashDevice->ptFlashDev->DevAdr, &tSector);
+    uint32_t wStart = FLASH_OP_START();
+    flash_atom_code(ptCtx, ptStep->wAddr, ptStep->wSize){
+        switch (ptStep->chKind) {
+            case FLASH_ERASE_CHIP:
+                nResult = ptFlashDevice->tFlashops.EraseChip();
+                break;
+            case FLASH_ERASE_BLOCK:
+                nResult = ptCaps->EraseBlock(ptStep->wAddr, ptStep->wSize);
+                break;
+            case FLASH_ERASE_SECTORS:
+                nResult = ptCaps->EraseSectors(ptStep->wAddr, ptStep->wSize / tSector.wSize);
+                break;
+            default:
+                nResult = ptFlashDevice->tFlashops.EraseSector(ptStep->wAddr);
+                break;
+        }
+    }
+    FLASH_OP_RECORD(ptCtx, FLASH_OP_ERASE, ptStep->wAddr, ptStep->wSize, wStart, nResult != 0);
+    (void)wStart;
+    flash_cache_update(ptCtx, ptStep->wAddr, NULL, ptStep->wSize);
+
+    return 0 == nResult;
+}
+
+#if FLASH_BLOB_USE_DIFF_WRITE == ENABLED
+/*
+ * Function: flash_dev_erase_sector
+ * Description: Erases one sector in its own critical section.
+ * Parameters:
+ *   - ptCtx: Device context.
+ *   - ptSector: The sector.
+ * Returns: True on success.
+ */
+static bool flash_dev_erase_sector(flash_dev_ctx_t *ptCtx, const flash_sector_t *ptSector)
+{
+    flash_erase_step_t tStep = {ptSector->wAddr, ptSector->wSize, 0, FLASH_ERASE_SECTOR};
+
+    if (ptCtx->ptBlob->tFlashops.EraseSector == NULL) {
+        return false;
+    }
+    return flash_dev_erase_step(ptCtx, &tStep);
+}
+#endif
+
+/*
+ * Function: flash_erase_block_fit
+ * Description: Finds the largest block erase worth using at an offset: the
+ *              block is aligned, ends before wEnd, covers sectors of one
+ *              size and is faster than erasing it with smaller blocks or
+ *              sector by sector.
+ * Parameters:
+ *   - ptCtx: Device context.
+ *   - wOffset: Offset from DevAdr, sector aligned.
+ *   - wEnd: End offset of the range to erase.
+ *   - wSectorTime: Modelled time of a sector erase.
+ * Returns: Index into wBlockSize[], -1 if no block fits.
+ */
+static int flash_erase_block_fit(flash_dev_ctx_t *ptCtx, uint32_t wOffset, uint32_t wEnd, uint32_t wSectorTime)
+{
+    const flash_erase_caps_t *ptCaps = ptCtx->ptBlob->ptErase;
+    uint32_t wCover[FLASH_BLOB_ERASE_BLOCK_NUM];
+    flash_sector_t tFirst, tLast;
+    int iFit = -1;
+
+    if (ptCaps->EraseBlock == NULL) {
+        return -1;
+    }
+
+    flash_dev_sector_of(ptCtx, wOffset, &tFirst);
+    for (int i = 0; i < FLASH_BLOB_ERASE_BLOCK_NUM && ptCaps->wBlockSize[i] != 0; i++) {
+        uint32_t wSize = ptCaps->wBlockSize[i];
+        /*cheapest way to erase the same bytes without this block size*/
+        uint32_t wSmaller = (i == 0) ? (wSize / tFirst.wSize) * wSectorTime
+                                     : (wSize / ptCaps->wBlockSize[i - 1]) * wCover[i - 1];
+
+        wCover[i] = (ptCaps->wBlockTime[i] < wSmaller) ? ptCaps->wBlockTime[i] : wSmaller;
+        if (wOffset % wSize != 0 || wEnd - wOffset < wSize || ptCaps->wBlockTime[i] >= wSmaller) {
+            continue;
+        }
+        flash_dev_sector_of(ptCtx, wOffset + wSize - 1, &tLast);
+        if (tLast.wSize == tFirst.wSize && tLast.wIndex - tFirst.wIndex + 1 == wSize / tFirst.wSize) {
+            iFit = i;
+        }
+    }
+
+    return iFit;
+}
+
+/*
+ * Function: flash_erase_plan_next
+ * Description: Chooses the operation erasing the start of [wOffset, wEnd):
+ *              the chip if the range is the whole device and that is
+ *              faster, else the largest block worth using, else a run of
+ *              up to FLASH_BLOB_ERASE_RUN_MAX sectors if runs are faster,
+ *              else one sector. Where IRQs are masked for the operation
+ *              nothing that takes longer than one sector erase is chosen.
+ * Parameters:
+ *   - ptCtx: Device context.
+ *   - wOffset: Offset from DevAdr, sector aligned.
+ *   - wEnd: End offset of the range, sector aligned.
+ *   - bChip: Consider a chip erase.
+ *   - ptStep: Receives the operation.
+ */
+static void flash_erase_plan_next(flash_dev_ctx_t *ptCtx, uint32_t wOffset, uint32_t wEnd, bool bChip,
+                                  flash_erase_step_t *ptStep)
+{
+    const flash_blob_t *ptBlob = ptCtx->ptBlob;
+    const flash_erase_caps_t *ptCaps = ptBlob->ptErase;
+    uint32_t wSectorTime = (ptCaps != NULL && ptCaps->wSectorTime != 0) ? ptCaps->wSectorTime
+                                                                          : ptBlob->ptFlashDev->toErase;
+    uint32_t wDevAdr = ptBlob->ptFlashDev->DevAdr;
+    flash_sector_t tSector;
+
+    flash_dev_sector_of(ptCtx, wOffset, &tSector);
+    ptStep->wAddr = tSector.wAddr;
+    ptStep->wSize = tSector.wSize;
+    ptStep->wTime = wSectorTime;
+    ptStep->chKind = FLASH_ERASE_SECTOR;
+    if (ptCaps == NULL) {
+        return;
+    }
+
+    if (bChip && wOffset == 0 && wEnd == ptBlob->ptFlashDev->szDev && ptCaps->wChipTime != 0 &&
+        ptBlob->tFlashops.EraseChip != NULL &&
+        (ptCaps->wChipTime <= wSectorTime || !flash_dev_irq_masked(ptCtx, wDevAdr, wEnd))) {
+        flash_erase_step_t tStep;
+        uint32_t wTime = 0;
+
+        for (uint32_t o = 0; o < wEnd && wTime <= ptCaps->wChipTime; o += tStep.wSize) {
+            flash_erase_plan_next(ptCtx, o, wEnd, false, &tStep);
+            wTime += tStep.wTime;
+        }
+        if (wTime > ptCaps->wChipTime) {
+            ptStep->wAddr = wDevAdr;
+            ptStep->wSize = ptBlob->ptFlashDev->szDev;
+            ptStep->wTime = ptCaps->wChipTime;
+            ptStep->chKind = FLASH_ERASE_CHIP;
+            return;
+        }
+    }
+
+    int iBlock = flash_erase_block_fit(ptCtx, wOffset, wEnd, wSectorTime);
+    if (iBlock >= 0 && (ptCaps->wBlockTime[iBlock] <= wSectorTime ||
+                        !flash_dev_irq_masked(ptCtx, wDevAdr + wOffset, ptCaps->wBlockSize[iBlock]))) {
+        ptStep->wSize = ptCaps->wBlockSize[iBlock];
+        ptStep->wTime = ptCaps->wBlockTime[iBlock];
+        ptStep->chKind = FLASH_ERASE_BLOCK;
+        return;
+    }
+
+    uint32_t wRunTime = ptCaps->wRunSectorTime;
+    if (ptCaps->EraseSectors != NULL && wRunTime != 0 && wRunTime < wSectorTime) {
+        uint32_t wNum = 1;
+        flash_sector_t tNext;
+
+        /*stop where a block erase can take over or the masked window would exceed one sector erase*/
+        for (uint32_t o = wOffset + tSector.wSize; wNum < FLASH_BLOB_ERASE_RUN_MAX && o < wEnd; o += tSector.wSize) {
+            flash_dev_sector_of(ptCtx, o, &tNext);
+            if (tNext.wSize != tSector.wSize || flash_erase_block_fit(ptCtx, o, wEnd, wSectorTime) >= 0 ||
+                ((wNum + 1) * wRunTime > wSectorTime &&
+                 flash_dev_irq_masked(ptCtx, wDevAdr + wOffset, (wNum + 1) * tSector.wSize))) {
+                break;
+            }
+            wNum++;
+        }
+        if (wNum > 1) {
+            ptStep->wSize = wNum * tSector.wSize;
+            ptStep->wTime = wNum * wRunTime;
+            ptStep->chKind = FLASH_ERASE_SECTORS;
+        }
+    }
+}
+
+/*
+ * Function: target_flash_erase_plan
+ * Description: Shows how target_flash_erase() would erase [addr, addr + size)
+ *              and what it costs in the erase time model of the device.
+ * Parameters:
+ *   - addr: Flash memory address to start erasing.
+ *   - size: Number of bytes to erase.
+ *   - ptSteps: Receives up to wMax operations, may be NULL.
+ *   - wMax: Capacity of ptSteps.
+ *   - pwTime: Optional, receives the total modelled time in ms.
+ * Returns: Number of operations, 0 if the range is invalid.
+ */
+uint32_t target_flash_erase_plan(uint32_t addr, size_t size, flash_erase_step_t *ptSteps, uint32_t wMax,
+                                 uint32_t *pwTime)
+{
+    flash_dev_ctx_t *ptCtx = flash_dev_ctx_find(addr);
+    flash_sector_t tFirst, tLast;
+    uint32_t wNum = 0, wTime = 0;
+
+    if (ptCtx == NULL) {
+        return 0;
+    }
+    uint32_t wOffset = addr - ptCtx->ptBlob->ptFlashDev->DevAdr;
+    if (size == 0 || size > ptCtx->ptBlob->ptFlashDev->szDev - wOffset) {
+        return 0;
+    }
+
+    flash_dev_sector_of(ptCtx, wOffset, &tFirst);
+    flash_dev_sector_of(ptCtx, wOffset + size - 1, &tLast);
+    uint32_t wEnd = tLast.wAddr + tLast.wSize - ptCtx->ptBlob->ptFlashDev->DevAdr;
+    for (uint32_t o = tFirst.wAddr - ptCtx->ptBlob->ptFlashDev->DevAdr; o < wEnd; wNum++) {
+        flash_erase_step_t tStep;
+        flash_erase_plan_next(ptCtx, o, wEnd, true, &tStep);
+        if (ptSteps != NULL && wNum < wMax) {
+            ptSteps[wNum] = tStep;
+        }
+        wTime += tStep.wTime;
+        o += tStep.wSize;
+    }
+
+    if (pwTime != NULL) {
+        *pwTime = wTime;
+    }
+    return wNum;
+}
+
+/*
+ * Function: flash_map_copy
+ * Description: Copies from memory mapped flash a word at a time, four words
+ *              per iteration so the bus can burst.
+ * Parameters:
+ *   - buf: Destination.
+ *   - pchSrc: Mapped source.
+ *   - size: Number of bytes.
+ */
+static void flash_map_copy(uint8_t *buf, const uint8_t *pchSrc, size_t size)
+{
+    while (size > 0 && ((uintptr_t)pchSrc & 3) != 0) {
+        *buf++ = *pchSrc++;
+        size--;
+    }
+
+    if (((uintptr_t)buf & 3) == 0) {
+        uint32_t *pwDst = (uint32_t *)buf;
+        const volatile uint32_t *pwSrc = (const volatile uint32_t *)pchSrc;
+
+        for (; size >= 16; size -= 16) {
+            uint32_t w0 = pwSrc[0], w1 = pwSrc[1], w2 = pwSrc[2], w3 = pwSrc[3];
+            pwDst[0] = w0;
+            pwDst[1] = w1;
+            pwDst[2] = w2;
+            pwDst[3] = w3;
+            pwDst += 4;
+            pwSrc += 4;
+        }
+        for (; size >= 4; size -= 4) {
+            *pwDst++ = *pwSrc++;
+        }
+        buf = (uint8_t *)pwDst;
+        pchSrc = (const uint8_t *)pwSrc;
+    } else {
+        /*misaligned destination, let the C library shift the words*/
+        memcpy(buf, pchSrc, size & ~(size_t)3);
+        buf += size & ~(size_t)3;
+        pchSrc += size & ~(size_t)3;
+        size &= 3;
+    }
+
+    while (size--) {
+        *buf++ = *pchSrc++;
+    }
+}
+
+/*
+ * Function: flash_dev_read
+ * Description: Reads a range through the Read op, FLASH_BLOB_ATOM_MAX_SIZE
+ *              bytes per critical section. Memory mapped devices are copied
+ *              in one go with IRQs enabled: no flash algorithm runs and a
+ *              bus read cannot leave the device in an unknown state.
+ * Parameters:
+ *   - ptCtx: Device context.
+ *   - addr: Flash memory address.
+ *   - buf: Destination.
+ *   - size: Number of bytes.
+ * Returns: True on success.
+ */
+static bool flash_dev_read(flash_dev_ctx_t *ptCtx, uint32_t addr, uint8_t *buf, size_t size)
+{
+    const flash_blob_t *ptFlashDevice = ptCtx->ptBlob;
+    bool bResult = true;
+
+    if (ptFlashDevice->tFlashops.Read == NULL) {
+        const uint8_t *pchSrc = FLASH_BLOB_MAP_ADDR(addr);
+        uint32_t wStart = FLASH_OP_START();
+
+        if (pchSrc != NULL) {
+            flash_map_copy(buf, pchSrc, size);
+        }
+        FLASH_OP_RECORD(ptCtx, FLASH_OP_READ, addr, size, wStart, pchSrc == NULL);
+        (void)wStart;
+        return pchSrc != NULL;
+    }
+
+    while (size > 0 && bResult) {
+        size_t wChunk = (size > FLASH_BLOB_ATOM_MAX_SIZE) ? FLASH_BLOB_ATOM_MAX_SIZE : size;
+        uint32_t wStart = FLASH_OP_START();
+
+        flash_atom_code(ptCtx, addr, wChunk){
+            /*Read Failed*/
+            bResult = (0 == ptFlashDevice->tFlashops.Read(addr, wChunk, buf));
+        }
+        FLASH_OP_RECORD(ptCtx, FLASH_OP_READ, addr, wChunk, wStart, !bResult);
+        (void)wStart;
+        addr += wChunk;
+        buf += wChunk;
+        size -= wChunk;
+    }
+
+    return bResult;
+}
+
+#if FLASH_BLOB_USE_READ_CACHE == ENABLED
+/*
+ * Function: flash_cache_find
+ * Description: Looks a line up in the read cache.
+ * Parameters:
+ *   - ptCache: The cache.
+ *   - wLine: Line address.
+ * Returns: Index into ptWay[], -1 if the line is not cached.
+ */
+static int32_t flash_cache_find(const flash_cache_t *ptCache, uint32_t wLine)
+{
+    uint32_t wSet = (wLine / ptCache->hwLineSize) & (ptCache->hwSets - 1);
+
+    for (uint32_t i = wSet; i < (uint32_t)ptCache->hwSets * ptCache->chWays; i += ptCache->hwSets) {
+        if (ptCache->ptWay[i].wLine == (wLine | 1)) {
+            return (int32_t)i;
+        }
+    }
+    return -1;
+}
+
+/*
+ * Function: flash_cache_fill
+ * Description: Reads a missing line into the way of its set used least
+ *              recently. A miss on the line a sequential read needs next
+ *              also reads the line after it, into the same way of the next
+ *              set, so both come with one Read call.
+ * Parameters:
+ *   - ptCtx: Device context.
+ *   - wLine: Line address.
+ * Returns: Index into ptWay[] of the line, -1 if Read failed.
+ */
+static int32_t flash_cache_fill(flash_dev_ctx_t *ptCtx, uint32_t wLine)
+{
+    flash_cache_t *ptCache = ptCtx->ptBlob->ptCache;
+    const flash_dev_t *ptDev = ptCtx->ptBlob->ptFlashDev;
+    uint32_t wLineSize = ptCache->hwLineSize;
+    uint32_t wSet = (wLine / wLineSize) & (ptCache->hwSets - 1);
+    uint32_t wVictim = wSet;
+    uint32_t wSize = wLineSize;
+
+    /*an empty way, else the one unused for the longest time*/
+    for (uint32_t i = wSet; i < (uint32_t)ptCache->hwSets * ptCache->chWays; i += ptCache->hwSets) {
+        if (ptCache->ptWay[i].wLine == 0) {
+            wVictim = i;
+            break;
+        }
+        if (ptCache->wClock - ptCache->ptWay[i].wUsed > ptCache->wClock - ptCache->ptWay[wVictim].wUsed) {
+            wVictim = i;
+        }
+    }
+
+    bool bNext = (wLine == ptCache->wNext) && (wSet + 1 < ptCache->hwSets) &&
+                 (wLine - ptDev->DevAdr + 2 * wLineSize <= ptDev->szDev) &&
+                 flash_cache_find(ptCache, wLine + wLineSize) < 0;
+    if (bNext) {
+        wSize += wLineSize;
+        ptCache->ptWay[wVictim + 1].wLine = 0;
+    }
+    ptCache->ptWay[wVictim].wLine = 0;
+    if (!flash_dev_read(ptCtx, wLine, &ptCache->pchData[wVictim * wLineSize], wSize)) {
+        return -1;
+    }
+    ptCache->ptWay[wVictim].wLine = wLine | 1;
+    ptCache->tStat.wMisses++;
+    if (bNext) {
+        ptCache->ptWay[wVictim + 1].wLine = (wLine + wLineSize) | 1;
+        ptCache->ptWay[wVictim + 1].wUsed = ptCache->wClock;
+        ptCache->tStat.wPrefetches++;
+    }
+
+    return (int32_t)wVictim;
+}
+
+/*
+ * Function: flash_cache_read
+ * Description: Reads a range through the read cache of the device, if it
+ *              has one and is not memory mapped.
+ * Parameters:
+ *   - ptCtx: Device context.
+ *   - addr: Flash memory address.
+ *   - buf: Receives the data.
+ *   - size: Number of bytes.
+ * Returns: True on success.
+ */
+static bool flash_cache_read(flash_dev_ctx_t *ptCtx, uint32_t addr, uint8_t *buf, size_t size)
+{
+    flash_cache_t *ptCache = ptCtx->ptBlob->ptCache;
+
+    if (ptCache == NULL || ptCtx->ptBlob->tFlashops.Read == NULL) {
+        return flash_dev_read(ptCtx, addr, buf, size);
+    }
+    if (size >= FLASH_BLOB_CACHE_BYPASS_SIZE) {
+        /*bulk reads would only push the hot lines out*/
+        ptCache->tStat.wBypassed++;
+        return flash_dev_read(ptCtx, addr, buf, size);
+    }
+
+    uint32_t wLineSize = ptCache->hwLineSize;
+
+    while (size > 0) {
+        uint32_t wLine = addr & ~(wLineSize - 1);
+        size_t wChunk = wLine + wLineSize - addr;
+        int32_t nWay = flash_cache_find(ptCache, wLine);
+
+        if (wChunk > size) {
+            wChunk = size;
+        }
+        if (nWay >= 0) {
+            ptCache->tStat.wHits++;
+        } else if ((nWay = flash_cache_fill(ptCtx, wLine)) < 0) {
+            return false;
+        }
+        ptCache->ptWay[nWay].wUsed = ++ptCache->wClock;
+        memcpy(buf, &ptCache->pchData[(uint32_t)nWay * wLineSize + (addr - wLine)], wChunk);
+        ptCache->wNext = wLine + wLineSize;
+        addr += wChunk;
+        buf += wChunk;
+        size -= wChunk;
+    }
+
+    return true;
+}
+#else
+    #define flash_cache_read(__CTX, __ADDR, __BUF, __SIZE)  flash_dev_read((__CTX), (__ADDR), (__BUF), (__SIZE))
+#endif
+
+/*
+ * Function: flash_dev_verify_span
+ * Description: Compares programmed flash with the data given to Program.
+ *              Only bits Program had to change are checked, bytes equal to
+ *              valEmpty (padding) may hold older data.
+ * Parameters:
+ *   - ptCtx: Device context.
+ *   - addr: Flash memory address.
+ *   - buf: Data passed to Program.
+ *   - size: Number of bytes.
+ * Returns: True if the flash holds the data.
+ */
+static bool flash_dev_verify_span(flash_dev_ctx_t *ptCtx, uint32_t addr, const uint8_t *buf, size_t size)
+{
+    uint8_t *pchCheck = FLASH_DEV_SCRATCH(ptCtx)->chCheck;
+    uint8_t chEmpty = ptCtx->ptBlob->ptFlashDev->valEmpty;
+
+    while (size > 0) {
+        size_t wChunk = (size > FLASH_BLOB_ATOM_MAX_SIZE) ? FLASH_BLOB_ATOM_MAX_SIZE : size;
+        const uint8_t *pchFlash = pchCheck;
+
+        if (ptCtx->ptBlob->tFlashops.Read == NULL) {
+            pchFlash = FLASH_BLOB_MAP_ADDR(addr);
+            if (pchFlash == NULL) {
+                return false;
+            }
+        } else if (!flash_dev_read(ptCtx, addr, pchCheck, wChunk)) {
+            return false;
+        }
+        for (size_t i = 0; i < wChunk; i++) {
+            if (((pchFlash[i] ^ buf[i]) & (buf[i] ^ chEmpty)) != 0) {
+                return false;
+            }
+        }
+        addr += wChunk;
+        buf += wChunk;
+        size -= wChunk;
+    }
+
+    return true;
+}
+
+/*
+ * Function: flash_dev_verify
+ * Description: Reads back a programmed piece as the verify policy of the
+ *              device asks for.
+ * Parameters:
+ *   - ptCtx: Device context.
+ *   - addr: Flash memory address.
+ *   - buf: Data passed to Program.
+ *   - size: Number of bytes.
+ * Returns: True if the check passed or is off.
+ */
+static bool flash_dev_verify(flash_dev_ctx_t *ptCtx, uint32_t addr, const uint8_t *buf, size_t size)
+{
+    uint32_t wUnit = ptCtx->wGranularity;
+
+    switch (ptCtx->chVerify) {
+        case FLASH_VERIFY_OFF:
+            return true;
+        case FLASH_VERIFY_SAMPLED:
+            if (size > 2 * wUnit) {
+                return flash_dev_verify_span(ptCtx, addr, buf, wUnit) &&
+                       flash_dev_verify_span(ptCtx, addr + size - wUnit, buf + size - wUnit, wUnit);
+            }
+            return flash_dev_verify_span(ptCtx, addr, buf, size);
+        default:
+            return flash_dev_verify_span(ptCtx, addr, buf, size);
+    }
+}
+
+/*
+ * Function: flash_dev_pipe_usable
+ * Description: Tells whether a page buffer flush of a range may run in the
+ *              background. Steps that mask IRQs never do: the CPU could not
+ *              fetch from the device while it programs anyway.
+ * Parameters:
+ *   - ptCtx: Device context.
+ *   - addr: Start of the range.
+ *   - size: Number of bytes.
+ * Returns: True if the device has ProgramStart/ProgramPoll to use.
+ */
+static inline bool flash_dev_pipe_usable(const flash_dev_ctx_t *ptCtx, uint32_t addr, size_t size)
+{
+#if FLASH_BLOB_USE_PROG_PIPELINE == ENABLED
+    return ptCtx->ptBlob->ptProgAsync != NULL && !flash_dev_irq_masked(ptCtx, addr, size);
+#else
+    (void)ptCtx; (void)addr; (void)size;
+    return false;
+#endif
+}
+
+#if FLASH_BLOB_USE_PROG_PIPELINE == ENABLED
+/*
+ * Function: flash_dev_pipe_wait
+ * Description: Waits for the background program of a device, verifies it
+ *              and hands its page buffer back. A failure is kept in
+ *              bPipeFailed until flash_dev_pipe_check() reports it.
+ * Parameters:
+ *   - ptCtx: Device context.
+ */
+static void flash_dev_pipe_wait(flash_dev_ctx_t *ptCtx)
+{
+    uint32_t wGranularity = ptCtx->wGranularity;
+    uint32_t wLo = ptCtx->wPipeLo & ~(wGranularity - 1);
+    uint32_t wHi = (ptCtx->wPipeHi + wGranularity - 1) & ~(wGranularity - 1);
+    int32_t nResult;
+
+    if (ptCtx->wPipeLo == ptCtx->wPipeHi) {
+        return;
+    }
+
+    while ((nResult = ptCtx->ptBlob->ptProgAsync->ProgramPoll()) == FLASH_PROG_BUSY) {
+        FLASH_BLOB_YIELD();
+    }
+    ptCtx->wPipeLo = ptCtx->wPipeHi = 0;
+    FLASH_OP_RECORD(ptCtx, FLASH_OP_PROGRAM, ptCtx->wPipeAddr + wLo, wHi - wLo, ptCtx->wPipeStart, nResult != 0);
+
+    if (0 != nResult || !flash_dev_verify(ptCtx, ptCtx->wPipeAddr + wLo, &ptCtx->pchPipe[wLo], wHi - wLo)) {
+        ptCtx->bPipeFailed = true;
+        flash_cache_update(ptCtx, ptCtx->wPipeAddr + wLo, NULL, wHi - wLo);
+    }
+    memset(&ptCtx->pchPipe[wLo], ptCtx->ptBlob->ptFlashDev->valEmpty, wHi - wLo);
+}
+
+/*
+ * Function: flash_dev_pipe_check
+ * Description: Waits for the background program of a device and reports
+ *              whether every background program since the last check
+ *              succeeded.
+ * Parameters:
+ *   - ptCtx: Device context.
+ * Returns: True on success or if nothing was programmed in the background.
+ */
+static bool flash_dev_pipe_check(flash_dev_ctx_t *ptCtx)
+{
+    bool bFailed;
+
+    flash_dev_pipe_wait(ptCtx);
+    bFailed = ptCtx->bPipeFailed;
+    ptCtx->bPipeFailed = false;
+
+    return !bFailed;
+}
+
+/*
+ * Function: flash_dev_pipe_start
+ * Description: Programs the dirty span of the page buffer in the background
+ *              and swaps the buffers, so the caller fills one while the
+ *              device programs the other. The previous background program
+ *              is waited for first.
+ * Parameters:
+ *   - ptCtx: Device context.
+ *   - wLo, wHi: Span to program within the unit, widened to the write
+ *               granularity.
+ * Returns: False if the previous program or this start failed.
+ */
+static bool flash_dev_pipe_start(flash_dev_ctx_t *ptCtx, uint32_t wLo, uint32_t wHi)
+{
+    uint8_t *pchFill = ptCtx->pchBuf;
+    bool bResult = flash_dev_pipe_check(ptCtx);
+    int32_t nResult = 1;
+
+    ptCtx->wPipeStart = FLASH_OP_START();
+    flash_atom_code(ptCtx, ptCtx->wBufAddr + wLo, wHi - wLo){
+        nResult = ptCtx->ptBlob->ptProgAsync->ProgramStart(ptCtx->wBufAddr + wLo, wHi - wLo, &pchFill[wLo]);
+    }
+    if (0 != nResult) {
+        FLASH_OP_RECORD(ptCtx, FLASH_OP_PROGRAM, ptCtx->wBufAddr + wLo, wHi - wLo, ptCtx->wPipeStart, true);
+        flash_cache_update(ptCtx, ptCtx->wBufAddr + wLo, NULL, wHi - wLo);
+        memset(&pchFill[wLo], ptCtx->ptBlob->ptFlashDev->valEmpty, wHi - wLo);
+        ptCtx->wDirtyLo = ptCtx->wDirtyHi = 0;
+        return false;
+    }
+
+    /*reads wait for the program, the cache may show its result already*/
+    flash_cache_update(ptCtx, ptCtx->wBufAddr + wLo, &pchFill[wLo], wHi - wLo);
+    /*the buffer handed back by the wait is clean, fill it next*/
+    ptCtx->pchBuf = ptCtx->pchPipe;
+    ptCtx->pchPipe = pchFill;
+    ptCtx->wPipeAddr = ptCtx->wBufAddr;
+    ptCtx->wPipeLo = ptCtx->wDirtyLo;
+    ptCtx->wPipeHi = ptCtx->wDirtyHi;
+    ptCtx->wDirtyLo = ptCtx->wDirtyHi = 0;
+
+    return bResult;
+}
+#else
+    #define flash_dev_pipe_wait(__CTX)
+    #define flash_dev_pipe_check(__CTX)     true
+#endif
+
+/*
+ * Function: flash_dev_program
+ * Description: Programs a range directly, split at programming page boundaries
+ *              and FLASH_BLOB_ATOM_MAX_SIZE, each piece in its own critical
+ *              section.
+ * Parameters:
+ *   - ptCtx: Device context.
+ *   - addr: Flash memory address, aligned to the write granularity.
+ *   - buf: Data to program.
+ *   - size: Number of bytes.
+ * Returns: True on success.
+ */
+static bool flash_dev_program(flash_dev_ctx_t *ptCtx, uint32_t addr, const uint8_t *buf, size_t size)
+{
+    const flash_blob_t *ptFlashDevice = ptCtx->ptBlob;
+    uint32_t wPage = ptFlashDevice->ptFlashDev->szPage;
+    uint32_t wBudget = FLASH_BLOB_ATOM_MAX_SIZE & ~(ptCtx->wGranularity - 1);
+    int32_t nResult = 0;
+
+    if (ptFlashDevice->tFlashops.Program == NULL || !flash_dev_pipe_check(ptCtx)) {
+        return false;
+    }
+    if (wBudget == 0) {
+        wBudget = ptCtx->wGranularity;
+    }
+
+    while (size > 0) {
+        /*never cross a programming page boundary, nor exceed the IRQ budget*/
+        size_t wChunk = wPage - (addr % wPage);
+        if (wChunk > wBudget) {
+            wChunk = wBudget;
+        }
+        if (wChunk > size) {
+            wChunk = size;
+        }
+        uint32_t wStart = FLASH_OP_START();
+        flash_atom_code(ptCtx, addr, wChunk){
+            nResult = ptFlashDevice->tFlashops.Program(addr, wChunk, (uint8_t *)buf);
+        }
+        FLASH_OP_RECORD(ptCtx, FLASH_OP_PROGRAM, addr, wChunk, wStart, nResult != 0);
+        (void)wStart;
+        if (0 != nResult || !flash_dev_verify(ptCtx, addr, buf, wChunk)) {
+            /*Programming Failed*/
+            flash_cache_update(ptCtx, addr, NULL, wChunk);
+            return false;
+        }
+        flash_cache_update(ptCtx, addr, buf, wChunk);
+        addr += wChunk;
+        buf += wChunk;
+        size -= wChunk;
+    }
+
+    return true;
+}
+
+#if FLASH_BLOB_USE_PAGE_BUF == ENABLED
+/*
+ * Function: flash_dev_buf_flush
+ * Description: Programs the dirty span of the page buffer, widened to the
+ *              write granularity. The widening bytes are valEmpty and leave
+ *              the flash untouched. Devices with ProgramStart/ProgramPoll
+ *              program it in the background, see flash_dev_pipe_start().
+ * Parameters:
+ *   - ptCtx: Device context.
+ * Returns: True on success or if nothing was buffered.
+ */
+static bool flash_dev_buf_flush(flash_dev_ctx_t *ptCtx)
+{
+    uint32_t wLo = ptCtx->wDirtyLo & ~(ptCtx->wGranularity - 1);
+    uint32_t wHi = (ptCtx->wDirtyHi + ptCtx->wGranularity - 1) & ~(ptCtx->wGranularity - 1);
+    bool bResult = true;
+
+    if (ptCtx->wDirtyLo == ptCtx->wDirtyHi) {
+        return true;
+    }
+#if FLASH_BLOB_USE_PROG_PIPELINE == ENABLED
+    if (flash_dev_pipe_usable(ptCtx, ptCtx->wBufAddr + wLo, wHi - wLo)) {
+        return flash_dev_pipe_start(ptCtx, wLo, wHi);
+    }
+#endif
+
+    bResult = flash_dev_program(ptCtx, ptCtx->wBufAddr + wLo, &ptCtx->pchBuf[wLo], wHi - wLo);
+
+    memset(&ptCtx->pchBuf[wLo], ptCtx->ptBlob->ptFlashDev->valEmpty, wHi - wLo);
+    ptCtx->wDirtyLo = ptCtx->wDirtyHi = 0;
+
+    return bResult;
+}
+
+/*
+ * Function: flash_dev_buf_write
+ * Description: Accumulates a write in the page buffer. Only contiguous or
+ *              overlapping writes within one buffer unit are merged; a full
+ *              unit is programmed as soon as it is complete, and whole
+ *              aligned units bypass the buffer unless they are programmed
+ *              in the background.
+ * Parameters:
+ *   - ptCtx: Device context.
+ *   - addr: Flash memory address, any alignment.
+ *   - buf: Data to write.
+ *   - size: Number of bytes.
+ * Returns: True on success.
+ */
+static bool flash_dev_buf_write(flash_dev_ctx_t *ptCtx, uint32_t addr, const uint8_t *buf, size_t size)
+{
+    uint32_t wUnit = ptCtx->wBufUnit;
+
+    while (size > 0) {
+        uint32_t wBase = addr - (addr % wUnit);
+        uint32_t wLo = addr - wBase;
+        uint32_t wHi = (size < wUnit - wLo) ? wLo + (uint32_t)size : wUnit;
+        bool bEmpty = (ptCtx->wDirtyLo == ptCtx->wDirtyHi);
+
+        if (!bEmpty && (ptCtx->wBufAddr != wBase || wLo > ptCtx->wDirtyHi || wHi < ptCtx->wDirtyLo)) {
+            if (!flash_dev_buf_flush(ptCtx)) {
+                return false;
+            }
+            bEmpty = true;
+        }
+
+        if (bEmpty && wLo == 0 && wHi == wUnit && !flash_dev_pipe_usable(ptCtx, wBase, wUnit)) {
+            /*a whole unit goes straight from the caller's buffer*/
+            if (!flash_dev_program(ptCtx, wBase, buf, wUnit)) {
+                return false;
+            }
+        } else {
+            if (bEmpty) {
+                ptCtx->wBufAddr = wBase;
+                ptCtx->wDirtyLo = wLo;
+                ptCtx->wDirtyHi = wHi;
+            } else {
+                ptCtx->wDirtyLo = (wLo < ptCtx->wDirtyLo) ? wLo : ptCtx->wDirtyLo;
+                ptCtx->wDirtyHi = (wHi > ptCtx->wDirtyHi) ? wHi : ptCtx->wDirtyHi;
+            }
+            memcpy(&ptCtx->pchBuf[wLo], buf, wHi - wLo);
+
+            if (ptCtx->wDirtyLo == 0 && ptCtx->wDirtyHi == wUnit && !flash_dev_buf_flush(ptCtx)) {
+                return false;
+            }
+        }
+
+        addr += wHi - wLo;
+        buf += wHi - wLo;
+        size -= wHi - wLo;
+    }
+
+    return true;
+}
+
+/*
+ * Function: flash_buf_overlay_span
+ * Description: Copies the dirty span of one page buffer over read data.
+ * Parameters:
+ *   - wUnit: Address of the buffered unit.
+ *   - wDirtyLo, wDirtyHi: Dirty span within the unit.
+ *   - pchUnit: The buffer.
+ *   - addr: Address the data was read from.
+ *   - buf: Read data.
+ *   - size: Number of bytes.
+ */
+static void flash_buf_overlay_span(uint32_t wUnit, uint32_t wDirtyLo, uint32_t wDirtyHi, const uint8_t *pchUnit,
+                                   uint32_t addr, uint8_t *buf, size_t size)
+{
+    uint32_t wLo = wUnit + wDirtyLo;
+    uint32_t wHi = wUnit + wDirtyHi;
+
+    if (wDirtyLo == wDirtyHi || wHi <= addr || wLo - addr >= size) {
+        return;
+    }
+
+    if (wLo < addr) {
+        wLo = addr;
+    }
+    if (wHi - addr > size) {
+        wHi = addr + size;
+    }
+    memcpy(buf + (wLo - addr), &pchUnit[wLo - wUnit], wHi - wLo);
+}
+
+/*
+ * Function: flash_dev_buf_overlay
+ * Description: Copies buffered, not yet programmed bytes over read data.
+ * Parameters:
+ *   - ptCtx: Device context.
+ *   - addr: Address the data was read from.
+ *   - buf: Read data.
+ *   - size: Number of bytes.
+ */
+static void flash_dev_buf_overlay(flash_dev_ctx_t *ptCtx, uint32_t addr, uint8_t *buf, size_t size)
+{
+#if FLASH_BLOB_USE_PROG_PIPELINE == ENABLED
+    /*the unit in flight is older than the one being filled*/
+    flash_buf_overlay_span(ptCtx->wPipeAddr, ptCtx->wPipeLo, ptCtx->wPipeHi, ptCtx->pchPipe, addr, buf, size);
+#endif
+    flash_buf_overlay_span(ptCtx->wBufAddr, ptCtx->wDirtyLo, ptCtx->wDirtyHi, ptCtx->pchBuf, addr, buf, size);
+}
+
+/*
+ * Function: flash_dev_buf_discard
+ * Description: Drops buffered data that falls into an erased range.
+ * Parameters:
+ *   - ptCtx: Device context.
+ *   - addr: Start of the erased range.
+ *   - size: Size of the erased range.
+ */
+static void flash_dev_buf_discard(flash_dev_ctx_t *ptCtx, uint32_t addr, size_t size)
+{
+    if (ptCtx->wDirtyLo != ptCtx->wDirtyHi && ptCtx->wBufAddr - addr < size) {
+        memset(ptCtx->pchBuf, ptCtx->ptBlob->ptFlashDev->valEmpty, ptCtx->wBufUnit);
+        ptCtx->wDirtyLo = ptCtx->wDirtyHi = 0;
+    }
+}
+#endif
+
+/*
+ * Function: flash_req_submit
+ * Description: Fills in a request and appends it to the queue of its device.
+ *              The caller holds the device lock.
+ * Parameters:
+ *   - ptCtx: Device context.
+ *   - ptReq: Request, must not be pending.
+ *   - chOp: flash_req_op_t.
+ *   - addr, buf, size: Range and data of the request.
+ *   - fnDone, pTarget: Completion callback and its user data.
+ * Returns: True if queued, false if the request is still pending.
+ */
+static bool flash_req_submit(flash_dev_ctx_t *ptCtx, flash_req_t *ptReq, uint8_t chOp, uint32_t addr,
+                             const uint8_t *buf, size_t size, flash_req_cb_t *fnDone, void *pTarget)
+{
+    bool bResult = false;
+
+    flash_guard_code(){
+        if (ptReq->chStatus != FLASH_REQ_PENDING) {
+            ptReq->ptNext = NULL;
+            ptReq->fnDone = fnDone;
+            ptReq->pTarget = pTarget;
+            ptReq->pchBuf = buf;
+            ptReq->wAddr = addr;
+            ptReq->wSize = size;
+            ptReq->wDone = 0;
+            ptReq->chOp = chOp;
+            ptReq->bIdle = false;
+            ptReq->chStatus = FLASH_REQ_PENDING;
+            if (ptCtx->ptReqTail != NULL) {
+                ptCtx->ptReqTail->ptNext = ptReq;
+            } else {
+                ptCtx->ptReqHead = ptReq;
+            }
+            ptCtx->ptReqTail = ptReq;
+            bResult = true;
+        }
+    }
+    return bResult;
+}
+
+/*
+ * Function: flash_dev_idle_unlink
+ * Description: Takes the background requests out of the queue of a device,
+ *              between two steps. The caller holds the device lock and
+ *              passes the result to flash_req_cancelled() after unlocking.
+ * Parameters:
+ *   - ptCtx: Device context.
+ * Returns: The removed requests chained by ptNext, NULL if there were none.
+ */
+static flash_req_t *flash_dev_idle_unlink(flash_dev_ctx_t *ptCtx)
+{
+    flash_req_t *ptIdle = NULL, **pptIdleTail = &ptIdle;
+
+    flash_guard_code(){
+        flash_req_t **pptLink = &ptCtx->ptReqHead;
+
+        ptCtx->ptReqTail = NULL;
+        while (*pptLink != NULL) {
+            flash_req_t *ptReq = *pptLink;
+            if (ptReq->bIdle) {
+                *pptLink = ptReq->ptNext;
+                ptReq->ptNext = NULL;
+                *pptIdleTail = ptReq;
+                pptIdleTail = &ptReq->ptNext;
+            } else {
+                ptCtx->ptReqTail = ptReq;
+                pptLink = &ptReq->ptNext;
+            }
+        }
+    }
+    return ptIdle;
+}
+
+/*
+ * Function: flash_req_cancelled
+ * Description: Completes requests taken out by flash_dev_idle_unlink() as
+ *              cancelled and runs their callbacks, without the lock.
+ * Parameters:
+ *   - ptReq: First request of the chain, may be NULL.
+ */
+static void flash_req_cancelled(flash_req_t *ptReq)
+{
+    while (ptReq != NULL) {
+        flash_req_t *ptNext = ptReq->ptNext;
+        flash_req_cb_t *fnDone = ptReq->fnDone;
+        ptReq->chStatus = FLASH_REQ_CANCELLED;
+        if (fnDone != NULL) {
+            fnDone(ptReq);
+        }
+        ptReq = ptNext;
+    }
+}
+
+/*
+ * Function: flash_req_step
+ * Description: Advances the request at the head of the queue of a device by
+ *              one planned erase operation or up to the next programming
+ *              page boundary. The caller holds the device lock.
+ * Parameters:
+ *   - ptCtx: Device context.
+ *   - ptReq: Request to advance.
+ * Returns: True on success.
+ */
+static bool flash_req_step(flash_dev_ctx_t *ptCtx, flash_req_t *ptReq)
+{
+    const flash_blob_t *ptFlashDevice = ptCtx->ptBlob;
+    uint32_t wAddr = ptReq->wAddr + ptReq->wDone;
+
+    if (ptReq->chOp == FLASH_REQ_ERASE) {
+        flash_sector_t tSector;
+
+#if FLASH_BLOB_USE_PAGE_BUF == ENABLED
+        if (ptReq->wDone == 0) {
+            flash_dev_buf_discard(ptCtx, ptReq->wAddr, ptReq->wSize);
+        }
+#endif
+        /*a failed background program is still reported by the next write or sync*/
+        flash_dev_pipe_wait(ptCtx);
+        flash_erase_step_t tStep;
+        uint32_t wDevAdr = ptFlashDevice->ptFlashDev->DevAdr;
+
+        /*background erases go sector by sector, so a foreground request waits for one sector at most*/
+        flash_dev_sector_of(ptCtx, (ptReq->bIdle ? wAddr : ptReq->wAddr + ptReq->wSize - 1) - wDevAdr, &tSector);
+        flash_erase_plan_next(ptCtx, wAddr - wDevAdr, tSector.wAddr + tSector.wSize - wDevAdr, !ptReq->bIdle, &tStep);
+        if (!flash_dev_erase_step(ptCtx, &tStep)) {
+            /*erase Failed*/
+            return false;
+        }
+        ptReq->wDone += tStep.wSize;
+    } else {
+        uint32_t wPage = ptFlashDevice->ptFlashDev->szPage;
+        size_t wChunk = wPage - (wAddr % wPage);
+
+        if (wChunk > ptReq->wSize - ptReq->wDone) {
+            wChunk = ptReq->wSize - ptReq->wDone;
+        }
+#if FLASH_BLOB_USE_PAGE_BUF == ENABLED
+        if (!flash_dev_buf_write(ptCtx, wAddr, ptReq->pchBuf + ptReq->wDone, wChunk)) {
+            return false;
+        }
+#else
+        if (!flash_dev_program(ptCtx, wAddr, ptReq->pchBuf + ptReq->wDone, wChunk)) {
+            return false;
+        }
+#endif
+        ptReq->wDone += wChunk;
+    }
+
+    return true;
+}
+
+/*
+ * Function: flash_dev_req_pick
+ * Description: Chooses the request a device works on next. On a device with
+ *              banks that is the oldest request whose remaining range avoids
+ *              the bank holding the running code, the banks read since the
+ *              last step and the banks of older requests, which keeps the
+ *              order within a bank. Otherwise it is the oldest request.
+ *              The caller holds the device lock.
+ * Parameters:
+ *   - ptCtx: Device context.
+ *   - pptPrev: Receives the request queued before it, NULL for the head.
+ * Returns: The request, NULL if none is pending.
+ */
+static flash_req_t *flash_dev_req_pick(flash_dev_ctx_t *ptCtx, flash_req_t **pptPrev)
+{
+    flash_req_t *ptPrev = NULL;
+    uint8_t chBusy, chOlder = 0;
+
+    *pptPrev = NULL;
+    if (ptCtx->ptBlob->wBankSize == 0 || ptCtx->ptReqHead == NULL) {
+        return ptCtx->ptReqHead;
+    }
+
+    chBusy = flash_dev_code_mask(ptCtx);
+    for (uint32_t i = 0; i < FLASH_BLOB_BANK_MAX; i++) {
+        if (ptCtx->wBankReads[i] != ptCtx->wBankSeen[i]) {
+            ptCtx->wBankSeen[i] = ptCtx->wBankReads[i];
+            chBusy |= 1u << i;
+        }
+    }
+
+    for (flash_req_t *ptReq = ptCtx->ptReqHead; ptReq != NULL; ptPrev = ptReq, ptReq = ptReq->ptNext) {
+        uint8_t chMask = flash_dev_bank_mask(ptCtx, ptReq->wAddr + ptReq->wDone, ptReq->wSize - ptReq->wDone);
+        if ((chMask & (chBusy | chOlder)) == 0) {
+            *pptPrev = ptPrev;
+            return ptReq;
+        }
+        chOlder |= chMask;
+    }
+
+    /*every bank with work is busy, the oldest request goes on anyway*/
+    return ptCtx->ptReqHead;
+}
+
+/*
+ * Function: flash_dev_poll
+ * Description: Advances the next pending request of one device, see
+ *              flash_dev_req_pick(), by one step under the device lock.
+ *              Once the request is finished it leaves the queue, its status
+ *              is written last under the lock, and its callback runs
+ *              without the lock. A request without callback may be gone
+ *              as soon as the status is written.
+ * Parameters:
+ *   - ptCtx: Device context.
+ * Returns: True if requests of the device are still pending.
+ */
+static bool flash_dev_poll(flash_dev_ctx_t *ptCtx)
+{
+    flash_req_t *ptReq, *ptPrev;
+    flash_req_cb_t *fnDone = NULL;
+    bool bResult = true, bPending;
+
+    FLASH_BLOB_DEV_LOCK(FLASH_DEV_ID(ptCtx));
+    ptReq = flash_dev_req_pick(ptCtx, &ptPrev);
+    if (ptReq != NULL) {
+        bResult = flash_req_step(ptCtx, ptReq);
+        if (!bResult || ptReq->wDone >= ptReq->wSize) {
+            flash_guard_code(){
+                if (ptPrev != NULL) {
+                    ptPrev->ptNext = ptReq->ptNext;
+                } else {
+                    ptCtx->ptReqHead = ptReq->ptNext;
+                }
+                if (ptCtx->ptReqTail == ptReq) {
+                    ptCtx->ptReqTail = ptPrev;
+                }
+            }
+            fnDone = ptReq->fnDone;
+            /*the waiter of a request on its stack may return right after this*/
+            ptReq->chStatus = bResult ? FLASH_REQ_DONE : FLASH_REQ_FAILED;
+        }
+    }
+    bPending = (ptCtx->ptReqHead != NULL);
+    FLASH_BLOB_DEV_UNLOCK(FLASH_DEV_ID(ptCtx));
+    /*tasks waiting for the device get in before the next step takes the lock again*/
+    FLASH_BLOB_YIELD();
+
+    if (fnDone != NULL) {
+        /*a request with a callback stays with the library until the callback returns*/
+        fnDone(ptReq);
+    }
+
+    return bPending;
+}
+
+/*
+ * Function: target_flash_poll
+ * Description: Cooperative state machine of the asynchronous API. Every
+ *              call advances the oldest pending request of each device by
+ *              one step: one planned erase operation or up to one page.
+ *              A finished request is removed from its queue and its
+ *              callback runs. The callback may submit new requests.
+ * Returns: True if requests are still pending.
+ */
+bool target_flash_poll(void)
+{
+    bool bPending = false;
+
+    for (uint16_t i = 0; i < s_hwDevNum; i++) {
+        if (s_ptDevIndex[i]->ptReqHead != NULL) {
+            bPending |= flash_dev_poll(s_ptDevIndex[i]);
+        }
+    }
+
+    return bPending;
+}
+
+/*
+ * Function: target_flash_poll_dev
+ * Description: target_flash_poll() for one device, e.g. the loop of a
+ *              worker task per device woken by FLASH_BLOB_DEV_NOTIFY(), so
+ *              that requests for different devices progress in parallel.
+ * Parameters:
+ *   - addr: Any address of the device.
+ * Returns: True if requests of the device are still pending.
+ */
+bool target_flash_poll_dev(uint32_t addr)
+{
+    flash_dev_ctx_t *ptCtx = flash_dev_ctx_find(addr);
+
+    return (ptCtx != NULL) && flash_dev_poll(ptCtx);
+}
+
+/*
+ * Function: flash_dev_drain
+ * Description: Completes every request queued for a device.
+ * Parameters:
+ *   - ptCtx: Device context.
+ */
+static void flash_dev_drain(flash_dev_ctx_t *ptCtx)
+{
+    flash_req_t *ptIdle;
+
+    FLASH_BLOB_DEV_LOCK(FLASH_DEV_ID(ptCtx));
+    ptIdle = flash_dev_idle_unlink(ptCtx);
+    FLASH_BLOB_DEV_UNLOCK(FLASH_DEV_ID(ptCtx));
+    flash_req_cancelled(ptIdle);
+
+    while (flash_dev_poll(ptCtx));
+}
+
+/*
+ * Function: flash_req_wait
+ * Description: Polls the device of a request until the request has completed.
+ * Parameters:
+ *   - ptCtx: Device context.
+ *   - ptReq: Submitted request.
+ */
+static void flash_req_wait(flash_dev_ctx_t *ptCtx, flash_req_t *ptReq)
+{
+    while (ptReq->chStatus == FLASH_REQ_PENDING) {
+        flash_dev_poll(ptCtx);
+    }
+}
+
+/*
+ * Function: flash_dev_sector_span
+ * Description: Widens a range to the sectors it touches.
+ * Parameters:
+ *   - ptCtx: Device context.
+ *   - wOffset: Start offset from DevAdr, size bytes from it are in the device.
+ *   - size: Number of bytes, not 0.
+ *   - pwAddr: Receives the start address of the first sector.
+ * Returns: Bytes from there to the end of the last sector.
+ */
+static size_t flash_dev_sector_span(flash_dev_ctx_t *ptCtx, uint32_t wOffset, size_t size, uint32_t *pwAddr)
+{
+    flash_sector_t tFirst, tLast;
+
+    flash_dev_sector_of(ptCtx, wOffset, &tFirst);
+    flash_dev_sector_of(ptCtx, wOffset + (uint32_t)(size - 1), &tLast);
+    *pwAddr = tFirst.wAddr;
+
+    return tLast.wAddr + tLast.wSize - tFirst.wAddr;
+}
+
+/*
+ * Function: target_flash_erase_async
+ * Description: Queues an erase of every sector touched by [addr, addr + size).
+ *              The request covers whole sectors: ptReq->wAddr and wSize
+ *              hold the widened range, ptReq->wDone counts the erased bytes.
+ * Parameters:
+ *   - ptReq: Caller owned request, untouched until completion.
+ *   - addr: Flash memory address to start erasing.
+ *   - size: Number of bytes to erase.
+ *   - fnDone: Optional completion callback.
+ *   - pTarget: User data for the callback.
+ * Returns: True if queued.
+ */
+bool target_flash_erase_async(flash_req_t *ptReq, uint32_t addr, size_t size,
+                              flash_req_cb_t *fnDone, void *pTarget)
+{
+    flash_dev_ctx_t *ptCtx = flash_dev_ctx_find(addr);
+    uint32_t wStart;
+    bool bResult;
+
+    if(ptReq == NULL || ptCtx == NULL || ptCtx->ptBlob->tFlashops.EraseSector == NULL) {
+        return false;
+    }
+
+    uint32_t wOffset = addr - ptCtx->ptBlob->ptFlashDev->DevAdr;
+    if (size == 0 || size > ptCtx->ptBlob->ptFlashDev->szDev - wOffset) {
+        /*erase outrange flash size */
+        return false;
+    }
+
+    /*the request covers whole sectors, so does the buffered data it drops*/
+    size = flash_dev_sector_span(ptCtx, wOffset, size, &wStart);
+
+    FLASH_BLOB_DEV_LOCK(FLASH_DEV_ID(ptCtx));
+    flash_req_t *ptIdle = flash_dev_idle_unlink(ptCtx);
+    bResult = flash_req_submit(ptCtx, ptReq, FLASH_REQ_ERASE, wStart, NULL, size, fnDone, pTarget);
+    FLASH_BLOB_DEV_UNLOCK(FLASH_DEV_ID(ptCtx));
+    flash_req_cancelled(ptIdle);
+    if (bResult) {
+        FLASH_BLOB_DEV_NOTIFY(FLASH_DEV_ID(ptCtx));
+    }
+
+    return bResult;
+}
+
+/*
+ * Function: target_flash_erase_idle
+ * Description: Queues a background erase, e.g. to prepare sectors while the
+ *              application is idle. It is only accepted while no other
+ *              request is queued for the device, and the next foreground
+ *              request, blocking call or target_flash_sync() of the device
+ *              cancels it between two erase steps: a foreground operation
+ *              waits for one erase step at most. ptReq->wDone tells how far
+ *              a cancelled request got.
+ * Parameters:
+ *   - ptReq: Caller owned request, untouched until completion.
+ *   - addr: Flash memory address to start erasing.
+ *   - size: Number of bytes to erase.
+ *   - fnDone: Optional completion callback, also called on cancellation.
+ *   - pTarget: User data for the callback.
+ * Returns: True if queued, false if the device has foreground work queued.
+ */
+bool target_flash_erase_idle(flash_req_t *ptReq, uint32_t addr, size_t size,
+                             flash_req_cb_t *fnDone, void *pTarget)
+{
+    flash_dev_ctx_t *ptCtx = flash_dev_ctx_find(addr);
+    uint32_t wStart;
+    bool bResult = false;
+
+    if(ptReq == NULL || ptCtx == NULL || ptCtx->ptBlob->tFlashops.EraseSector == NULL) {
+        return false;
+    }
+
+    uint32_t wOffset = addr - ptCtx->ptBlob->ptFlashDev->DevAdr;
+    if (size == 0 || size > ptCtx->ptBlob->ptFlashDev->szDev - wOffset) {
+        /*erase outrange flash size */
+        return false;
+    }
+
+    size = flash_dev_sector_span(ptCtx, wOffset, size, &wStart);
+
+    FLASH_BLOB_DEV_LOCK(FLASH_DEV_ID(ptCtx));
+    if (ptCtx->ptReqTail == NULL || ptCtx->ptReqTail->bIdle) {
+        /*foreground requests are never queued behind background ones*/
+        bResult = flash_req_submit(ptCtx, ptReq, FLASH_REQ_ERASE, wStart, NULL, size, fnDone, pTarget);
+        if (bResult) {
+            ptReq->bIdle = true;
+        }
+    }
+    FLASH_BLOB_DEV_UNLOCK(FLASH_DEV_ID(ptCtx));
+    if (bResult) {
+        FLASH_BLOB_DEV_NOTIFY(FLASH_DEV_ID(ptCtx));
+    }
+
+    return bResult;
+}
+
+/*
+ * Function: target_flash_write_async
+ * Description: Queues a write. The data is programmed page by page from
+ *              buf, which must stay valid until the request completed.
+ * Parameters:
+ *   - ptReq: Caller owned request, untouched until completion.
+ *   - addr: Flash memory address to start writing.
+ *   - buf: Pointer to the data to be written.
+ *   - size: Number of bytes to write.
+ *   - fnDone: Optional completion callback.
+ *   - pTarget: User data for the callback.
+ * Returns: True if queued.
+ */
+bool target_flash_write_async(flash_req_t *ptReq, uint32_t addr, const uint8_t *buf, size_t size,
+                              flash_req_cb_t *fnDone, void *pTarget)
+{
+    flash_dev_ctx_t *ptCtx = flash_dev_ctx_find(addr);
+    bool bResult;
+
+    if(ptReq == NULL || ptCtx == NULL || size == 0) {
+        return false;
+    }
+
+    if (size > ptCtx->ptBlob->ptFlashDev->szDev - (addr - ptCtx->ptBlob->ptFlashDev->DevAdr)) {
+        /*write outrange flash size*/
+        return false;
+    }
+
+#if FLASH_BLOB_USE_PAGE_BUF != ENABLED
+    if (addr % ptCtx->wGranularity != 0) {
+        /*addr must be aligned to the write granularity*/
+        return false;
+    }
+#endif
+
+    FLASH_BLOB_DEV_LOCK(FLASH_DEV_ID(ptCtx));
+    flash_req_t *ptIdle = flash_dev_idle_unlink(ptCtx);
+    bResult = flash_req_submit(ptCtx, ptReq, FLASH_REQ_WRITE, addr, buf, size, fnDone, pTarget);
+#if FLASH_BLOB_USE_DIGEST == ENABLED
+    if (bResult) {
+        flash_digest_update(&ptCtx->tDigest, buf, size);
+    }
+#endif
+    FLASH_BLOB_DEV_UNLOCK(FLASH_DEV_ID(ptCtx));
+    flash_req_cancelled(ptIdle);
+    if (bResult) {
+        FLASH_BLOB_DEV_NOTIFY(FLASH_DEV_ID(ptCtx));
+    }
+
+    return bResult;
+}
+
+/*
+ * Function: flash_session_erased
+ * Description: Completion callback of the erase-ahead request.
+ * Parameters:
+ *   - ptReq: The finished erase request.
+ */
+static void flash_session_erased(flash_req_t *ptReq)
+{
+    flash_session_t *ptSession = (flash_session_t *)ptReq->pTarget;
+
+    if (ptReq->chStatus == FLASH_REQ_DONE) {
+        ptSession->wErased = ptReq->wAddr + ptReq->wDone;
+    }
+}
+
+/*
+ * Function: flash_session_erase_next
+ * Description: Queues the erase of the sector at the high-water mark, unless
+ *              one is already in flight or the session range is covered.
+ * Parameters:
+ *   - ptSession: Open session.
+ * Returns: True if an erase is in flight afterwards.
+ */
+static bool flash_session_erase_next(flash_session_t *ptSession)
+{
+    if (ptSession->tErase.chStatus == FLASH_REQ_PENDING) {
+        return true;
+    }
+    if (ptSession->wErased - ptSession->wBase >= ptSession->wLimit - ptSession->wBase) {
+        return false;
+    }
+    return target_flash_erase_async(&ptSession->tErase, ptSession->wErased, 1,
+                                    flash_session_erased, ptSession);
+}
+
+/*
+ * Function: target_flash_session_open
+ * Description: Opens a streaming write session over [addr, addr + size).
+ *              Nothing is erased up front; the first sector is queued for
+ *              erase right away and every later sector one sector ahead of
+ *              the cursor, so that erasing overlaps with receiving the data
+ *              as long as the application calls target_flash_poll() while
+ *              it waits for the link.
+ * Parameters:
+ *   - ptSession: Session object owned by the caller.
+ *   - addr: Start address, must be sector aligned.
+ *   - size: Size of the session range.
+ * Returns: True on success.
+ */
+bool target_flash_session_open(flash_session_t *ptSession, uint32_t addr, size_t size)
+{
+    flash_sector_t tSector;
+    const flash_blob_t *ptFlashDevice = flash_dev_find(addr);
+
+    if (ptSession == NULL || ptFlashDevice == NULL || size == 0 ||
+        size > ptFlashDevice->ptFlashDev->szDev - (addr - ptFlashDevice->ptFlashDev->DevAdr) ||
+        !target_flash_sector_info(addr, &tSector) || tSector.wAddr != addr) {
+        return false;
+    }
+
+    memset(ptSession, 0, sizeof(*ptSession));
+    ptSession->wBase = addr;
+    ptSession->wLimit = addr + size;
+    ptSession->wCursor = addr;
+    ptSession->wErased = addr;
+#if FLASH_BLOB_USE_DIGEST == ENABLED
+    flash_digest_init(&ptSession->tDigest);
+#endif
+    flash_session_erase_next(ptSession);
+
+    return true;
+}
+
+/*
+ * Function: target_flash_session_append
+ * Description: Writes data at the session cursor. Waits for the sectors it
+ *              needs to be erased, then queues the erase of the next sector
+ *              once the cursor has entered the last erased one.
+ * Parameters:
+ *   - ptSession: Open session.
+ *   - buf: Data, may be reused once the call returns.
+ *   - size: Number of bytes.
+ * Returns: Number of bytes written, 0 on failure.
+ */
+int32_t target_flash_session_append(flash_session_t *ptSession, const uint8_t *buf, size_t size)
+{
+    flash_sector_t tSector;
+
+    if (ptSession == NULL || size == 0 || size > ptSession->wLimit - ptSession->wCursor) {
+        return 0;
+    }
+
+    flash_dev_ctx_t *ptCtx = flash_dev_ctx_find(ptSession->wBase);
+
+    /*catch up with the cursor, normally the erase-ahead is already done*/
+    while (ptSession->wErased - ptSession->wBase < ptSession->wCursor + size - ptSession->wBase) {
+        if (!flash_session_erase_next(ptSession)) {
+            return 0;
+        }
+        flash_req_wait(ptCtx, &ptSession->tErase);
+        if (ptSession->tErase.chStatus != FLASH_REQ_DONE) {
+            return 0;
+        }
+    }
+
+    if (target_flash_write(ptSession->wCursor, buf, size) != (int32_t)size) {
+        return 0;
+    }
+    ptSession->wCursor += size;
+#if FLASH_BLOB_USE_DIGEST == ENABLED
+    flash_digest_update(&ptSession->tDigest, buf, size);
+#endif
+
+    /*keep one sector erased ahead of the cursor*/
+    if (target_flash_sector_info(ptSession->wCursor, &tSector) &&
+        ptSession->wErased - ptSession->wBase <= tSector.wAddr + tSector.wSize - ptSession->wBase) {
+        flash_session_erase_next(ptSession);
+    }
+
+    return size;
+}
+
+/*
+ * Function: target_flash_session_close
+ * Description: Waits for an erase-ahead still in flight and programs data
+ *              left in the page buffer.
+ * Parameters:
+ *   - ptSession: Open session.
+ * Returns: True on success.
+ */
+bool target_flash_session_close(flash_session_t *ptSession)
+{
+    flash_dev_ctx_t *ptCtx;
+
+    if (ptSession == NULL || (ptCtx = flash_dev_ctx_find(ptSession->wBase)) == NULL) {
+        return false;
+    }
+    flash_req_wait(ptCtx, &ptSession->tErase);
+    return target_flash_sync(ptSession->wBase);
+}
+
+/*
+ * Function: target_flash_init
+ * Description: Initializes the flash memory based on the specified address.
+ * Parameters:
+ *   - addr: Flash memory address to initialize.
+ * Returns: True if initialization is successful, false otherwise.
+ */
+bool target_flash_init(uint32_t addr)
+{
+    if (addr % 4 != 0) {
+        /*flash addr must be 4-byte alignment*/
+        return false;
+    }
+
+    flash_dev_ctx_t *ptCtx = flash_dev_ctx_find(addr);
+
+    if(ptCtx != NULL) {
+        FLASH_BLOB_DEV_LOCK(FLASH_DEV_ID(ptCtx));
+        ptCtx->ptBlob->tFlashops.Init(addr, 0, 0);
+        /*the device may have been changed behind our back while it was not in use*/
+        flash_cache_update(ptCtx, ptCtx->ptBlob->ptFlashDev->DevAdr, NULL, ptCtx->ptBlob->ptFlashDev->szDev);
+        FLASH_BLOB_DEV_UNLOCK(FLASH_DEV_ID(ptCtx));
+        return true;
+    }
+
+    return false;
+}
+/*
+ * Function: target_flash_uninit
+ * Description: Flushes buffered writes and uninitializes the flash memory
+ *              based on the specified address.
+ * Parameters:
+ *   - addr: Flash memory address to uninitialize.
+ * Returns: True if uninitialization is successful, false otherwise.
+ */
+bool target_flash_uninit(uint32_t addr)
+{
+    flash_dev_ctx_t *ptCtx = flash_dev_ctx_find(addr);
+    bool bResult = true;
+
+    if(ptCtx != NULL) {
+        bResult = target_flash_sync(addr);
+        FLASH_BLOB_DEV_LOCK(FLASH_DEV_ID(ptCtx));
+        ptCtx->ptBlob->tFlashops.UnInit(addr);
+        FLASH_BLOB_DEV_UNLOCK(FLASH_DEV_ID(ptCtx));
+    }
+
+    return bResult;
+}
+
+/*
+ * Function: target_flash_sync
+ * Description: Completes the requests queued for a device, programs any
+ *              data still held in its page buffer and waits for the
+ *              background program. Reports a failed background program
+ *              no write has reported yet.
+ * Parameters:
+ *   - addr: Any address of the device.
+ * Returns: True on success or if nothing was buffered.
+ */
+bool target_flash_sync(uint32_t addr)
+{
+    flash_dev_ctx_t *ptCtx = flash_dev_ctx_find(addr);
+    bool bResult = true;
+
+    if (ptCtx == NULL) {
+        return false;
+    }
+    flash_atom_call(ptCtx);
+    /*queued writes may still add to the page buffer*/
+    flash_dev_drain(ptCtx);
+#if FLASH_BLOB_USE_PAGE_BUF == ENABLED
+    FLASH_BLOB_DEV_LOCK(FLASH_DEV_ID(ptCtx));
+    bResult = flash_dev_buf_flush(ptCtx);
+    bResult = flash_dev_pipe_check(ptCtx) && bResult;
+    FLASH_BLOB_DEV_UNLOCK(FLASH_DEV_ID(ptCtx));
+#endif
+    return bResult;
+}
+
+/*
+ * Function: target_flash_write
+ * Description: Writes data to the flash memory, blocking wrapper around
+ *              target_flash_write_async(). Requests queued before
+ *              for the device are completed first. With the page buffer enabled any alignment
+ *              is accepted and the tail of a write may stay buffered until
+ *              the next write leaves its page, target_flash_sync() or
+ *              target_flash_uninit().
+ * Parameters:
+ *   - addr: Flash memory address to start writing.
+ *   - buf: Pointer to the data to be written.
+ *   - size: Number of bytes to write.
+ * Returns: Number of bytes actually written.
+ */
+int target_flash_write(uint32_t addr, const uint8_t *buf, size_t size)
+{
+    flash_dev_ctx_t *ptCtx = flash_dev_ctx_find(addr);
+    flash_req_t tReq = {0};
+
+    if (ptCtx == NULL) {
+        return 0;
+    }
+    flash_atom_call(ptCtx);
+    if (!target_flash_write_async(&tReq, addr, buf, size, NULL, NULL)) {
+        return 0;
+    }
+    flash_req_wait(ptCtx, &tReq);
+
+    return (tReq.chStatus == FLASH_REQ_DONE) ? size : 0;
+}
+
+#if FLASH_BLOB_USE_PAGE_BUF != ENABLED
+/*
+ * Function: flash_writev_stage
+ * Description: Collects the few bytes of a flash word that is split between
+ *              two segments. The word is programmed once it is complete.
+ * Parameters:
+ *   - ptCtx: Device context.
+ *   - addr: Address of the bytes.
+ *   - buf: The bytes.
+ *   - size: Number of bytes, never crossing a word boundary.
+ * Returns: True on success.
+ */
+static bool flash_writev_stage(flash_dev_ctx_t *ptCtx, uint32_t addr, const uint8_t *buf, size_t size)
+{
+    flash_scratch_t *ptScratch = FLASH_DEV_SCRATCH(ptCtx);
+    uint32_t wWord = addr & ~(ptCtx->wGranularity - 1);
+
+    if (ptScratch->wWordFill == 0) {
+        memset(ptScratch->chWord, ptCtx->ptBlob->ptFlashDev->valEmpty, ptCtx->wGranularity);
+        ptScratch->wWordAddr = wWord;
+    }
+    memcpy(&ptScratch->chWord[addr - wWord], buf, size);
+    ptScratch->wWordFill = addr + size - wWord;
+
+    if (ptScratch->wWordFill == ptCtx->wGranularity) {
+        ptScratch->wWordFill = 0;
+        return flash_dev_program(ptCtx, ptScratch->wWordAddr, ptScratch->chWord, ptCtx->wGranularity);
+    }
+    return true;
+}
+#endif
+
+/*
+ * Function: flash_dev_writev
+ * Description: Programs the segments of target_flash_writev(), the caller
+ *              holds the device lock. With the page buffer the segments
+ *              fill it like one contiguous write, so only whole units and
+ *              the final tail are programmed.
+ * Parameters:
+ *   - ptCtx: Device context.
+ *   - addr: Flash memory address to start writing.
+ *   - ptVec: Segments, programmed in order.
+ *   - wCount: Number of segments.
+ * Returns: True on success.
+ */
+static bool flash_dev_writev(flash_dev_ctx_t *ptCtx, uint32_t addr, const flash_iovec_t *ptVec, uint32_t wCount)
+{
+#if FLASH_BLOB_USE_PAGE_BUF == ENABLED
+    for (uint32_t i = 0; i < wCount; i++) {
+#if FLASH_BLOB_USE_DIGEST == ENABLED
+        flash_digest_update(&ptCtx->tDigest, ptVec[i].pBase, ptVec[i].wLen);
+#endif
+        /*whole units still bypass the buffer, a unit split between segments is merged*/
+        if (!flash_dev_buf_write(ptCtx, addr, (const uint8_t *)ptVec[i].pBase, ptVec[i].wLen)) {
+            return false;
+        }
+        addr += ptVec[i].wLen;
+    }
+
+    return true;
+#else
+    uint32_t wWord = ptCtx->wGranularity;
+    flash_scratch_t *ptScratch = FLASH_DEV_SCRATCH(ptCtx);
+
+    ptScratch->wWordFill = 0;
+
+    for (uint32_t i = 0; i < wCount; i++) {
+        const uint8_t *pchSrc = (const uint8_t *)ptVec[i].pBase;
+        size_t wLen = ptVec[i].wLen;
+
+#if FLASH_BLOB_USE_DIGEST == ENABLED
+        flash_digest_update(&ptCtx->tDigest, pchSrc, wLen);
+#endif
+
+        /*complete a word started by the previous segment*/
+        size_t wHead = (wWord - (addr & (wWord - 1))) & (wWord - 1);
+        if (wHead > wLen) {
+            wHead = wLen;
+        }
+        if (wHead != 0 && !flash_writev_stage(ptCtx, addr, pchSrc, wHead)) {
+            return false;
+        }
+        addr += wHead;
+        pchSrc += wHead;
+        wLen -= wHead;
+
+        /*whole words straight from the segment*/
+        size_t wRun = wLen & ~(size_t)(wWord - 1);
+        if (wRun != 0 && !flash_dev_program(ptCtx, addr, pchSrc, wRun)) {
+            return false;
+        }
+        addr += wRun;
+        pchSrc += wRun;
+        wLen -= wRun;
+
+        /*start the word the next segment completes*/
+        if (wLen != 0 && !flash_writev_stage(ptCtx, addr, pchSrc, wLen)) {
+            return false;
+        }
+        addr += wLen;
+    }
+
+    if (ptScratch->wWordFill != 0) {
+        ptScratch->wWordFill = 0;
+        if (!flash_dev_program(ptCtx, ptScratch->wWordAddr, ptScratch->chWord, wWord)) {
+            return false;
+        }
+    }
+
+    return true;
+#endif
+}
+
+/*
+ * Function: target_flash_writev
+ * Description: Writes a list of segments to a contiguous flash range
+ *              without staging them in one buffer. With the page buffer
+ *              the segments are gathered there page by page and a trailing
+ *              partial page stays buffered as with target_flash_write().
+ *              Without it every aligned run of flash words is programmed
+ *              straight from its segment, only the words split by a
+ *              segment boundary are copied and the last one is padded with
+ *              valEmpty.
+ * Parameters:
+ *   - addr: Flash memory address to start writing.
+ *   - ptVec: Segments, programmed in order.
+ *   - wCount: Number of segments.
+ * Returns: Number of bytes actually written.
+ */
+int32_t target_flash_writev(uint32_t addr, const flash_iovec_t *ptVec, uint32_t wCount)
+{
+    flash_dev_ctx_t *ptCtx = flash_dev_ctx_find(addr);
+    size_t wTotal = 0;
+    bool bResult;
+
+    if(ptCtx == NULL || ptVec == NULL) {
+        return 0;
+    }
+    for (uint32_t i = 0; i < wCount; i++) {
+        wTotal += ptVec[i].wLen;
+    }
+    if (wTotal == 0 || wTotal > ptCtx->ptBlob->ptFlashDev->szDev - (addr - ptCtx->ptBlob->ptFlashDev->DevAdr)) {
+        /*write outrange flash size*/
+        return 0;
+    }
+
+#if FLASH_BLOB_USE_PAGE_BUF != ENABLED
+    if (ptCtx->wGranularity > sizeof(FLASH_DEV_SCRATCH(ptCtx)->chWord) || addr % ptCtx->wGranularity != 0) {
+        return 0;
+    }
+#endif
+
+    flash_atom_call(ptCtx);
+    /*keep the order with queued requests*/
+    flash_dev_drain(ptCtx);
+
+    FLASH_BLOB_DEV_LOCK(FLASH_DEV_ID(ptCtx));
+    bResult = flash_dev_writev(ptCtx, addr, ptVec, wCount);
+    FLASH_BLOB_DEV_UNLOCK(FLASH_DEV_ID(ptCtx));
+
+    return bResult ? wTotal : 0;
+}
+
+/*
+ * Function: target_flash_read
+ * Description: Reads data from the flash memory, including data still held
+ *              in the page buffer. Queued asynchronous requests are not
+ *              waited for.
+ * Parameters:
+ *   - addr: Flash memory address to start reading.
+ *   - buf: Pointer to store the read data.
+ *   - size: Number of bytes to read.
+ * Returns: Number of bytes actually read.
+ */
+int target_flash_read(uint32_t addr, uint8_t *buf, size_t size)
+{
+    flash_dev_ctx_t *ptCtx = flash_dev_ctx_find(addr);
+
+    if(ptCtx == NULL) {
+        return 0;
+    }
+
+    if ((addr - ptCtx->ptBlob->ptFlashDev->DevAdr + size) > ptCtx->ptBlob->ptFlashDev->szDev) {
+        /*read outrange flash size*/
+        return 0;
+    }
+
+    /*bus reads of a memory mapped device overlap, the Read op of a flash algorithm may not*/
+    bool bShared = (ptCtx->ptBlob->tFlashops.Read == NULL);
+
+    flash_atom_call(ptCtx);
+    if (bShared) {
+        FLASH_BLOB_DEV_RDLOCK(FLASH_DEV_ID(ptCtx));
+    } else {
+        FLASH_BLOB_DEV_LOCK(FLASH_DEV_ID(ptCtx));
+        /*the device answers no Read while it programs, bus reads see the buffer overlay*/
+        flash_dev_pipe_wait(ptCtx);
+    }
+    flash_dev_bank_read(ptCtx, addr, size);
+    if (!flash_cache_read(ptCtx, addr, buf, size)) {
+        size = 0;
+    }
+
+#if FLASH_BLOB_USE_PAGE_BUF == ENABLED
+    if (size != 0) {
+        flash_dev_buf_overlay(ptCtx, addr, buf, size);
+    }
+#endif
+    if (bShared) {
+        FLASH_BLOB_DEV_RDUNLOCK(FLASH_DEV_ID(ptCtx));
+    } else {
+        FLASH_BLOB_DEV_UNLOCK(FLASH_DEV_ID(ptCtx));
+    }
+
+    return size;
+}
 
 /*
- * Function: flash_dev_find
- * Description: Finds the flash device based on the specified address.
+ * Function: target_flash_map
+ * Description: Gives direct read access to a memory mapped device, so data
+ *              can be parsed in place instead of copied. Queued requests
+ *              and the page buffer are flushed first; data written later
+ *              shows up once it has been programmed.
  * Parameters:
- *   - addr: Flash memory address to find.
- * Returns: Pointer to the flash_blob_t structure if found, NULL otherwise.
+ *   - addr: Flash memory address.
+ *   - size: Number of bytes the caller is going to access.
+ * Returns: CPU pointer to addr, NULL if the range is not memory mapped.
  */
-static const flash_blob_t *  flash_dev_find(uint32_t addr)
+const uint8_t *target_flash_map(uint32_t addr, size_t size)
 {
-    for (uint16_t i = 0; i < flash_table_len; i++) {
-        if(addr >= flash_table[i]->ptFlashDev->DevAdr &&
-           addr < flash_table[i]->ptFlashDev->DevAdr + flash_table[i]->ptFlashDev->szDev) {
-            return flash_table[i];
+    flash_dev_ctx_t *ptCtx = flash_dev_ctx_find(addr);
+
+    if (ptCtx == NULL || ptCtx->ptBlob->tFlashops.Read != NULL ||
+        (addr - ptCtx->ptBlob->ptFlashDev->DevAdr + size) > ptCtx->ptBlob->ptFlashDev->szDev) {
+        return NULL;
+    }
+    if (!target_flash_sync(addr)) {
+        return NULL;
+    }
+    flash_dev_bank_read(ptCtx, addr, size);
+
+    return FLASH_BLOB_MAP_ADDR(addr);
+}
+
+/*
+ * Function: target_flash_checksum
+ * Description: CRC32 of a flash range, including data still held in the
+ *              page buffer. Memory mapped devices are hashed in place.
+ * Parameters:
+ *   - addr: Flash memory address.
+ *   - size: Number of bytes.
+ * Returns: flash_crc32() of the range, 0 if it cannot be read.
+ */
+uint32_t target_flash_checksum(uint32_t addr, size_t size)
+{
+    const uint8_t *pchImage = target_flash_map(addr, size);
+    uint8_t chBuf[FLASH_BLOB_ATOM_MAX_SIZE];
+    uint32_t wCrc = 0;
+
+    if (pchImage != NULL) {
+        return flash_crc32(0, pchImage, size);
+    }
+
+    while (size > 0) {
+        size_t wChunk = (size > sizeof(chBuf)) ? sizeof(chBuf) : size;
+        if (target_flash_read(addr, chBuf, wChunk) != (int32_t)wChunk) {
+            return 0;
         }
+        wCrc = flash_crc32(wCrc, chBuf, wChunk);
+        addr += wChunk;
+        size -= wChunk;
     }
 
-    return NULL;
+    return wCrc;
 }
+
 /*
- * Function: target_flash_init
- * Description: Initializes the flash memory based on the specified address.
+ * Function: target_flash_digest
+ * Description: Gets the running digest of the data accepted by
+ *              target_flash_write*() and target_flash_writev() of a
+ *              device, in call order. Reset it before writing an image and
+ *              compare afterwards instead of reading the image back.
  * Parameters:
- *   - addr: Flash memory address to initialize.
- * Returns: True if initialization is successful, false otherwise.
+ *   - addr: Any address of the device.
+ *   - ptDigest: Receives the digest, may be NULL.
+ *   - bReset: Restart the digest after reading it.
+ * Returns: True if the device exists and FLASH_BLOB_USE_DIGEST is enabled.
  */
-bool target_flash_init(uint32_t addr)
+bool target_flash_digest(uint32_t addr, flash_digest_t *ptDigest, bool bReset)
 {
-    if (addr % 4 != 0) {
-        /*flash addr must be 4-byte alignment*/
+#if FLASH_BLOB_USE_DIGEST == ENABLED
+    flash_dev_ctx_t *ptCtx = flash_dev_ctx_find(addr);
+
+    if (ptCtx == NULL) {
         return false;
     }
+    FLASH_BLOB_DEV_LOCK(FLASH_DEV_ID(ptCtx));
+    if (ptDigest != NULL) {
+        *ptDigest = ptCtx->tDigest;
+    }
+    if (bReset) {
+        flash_digest_init(&ptCtx->tDigest);
+    }
+    FLASH_BLOB_DEV_UNLOCK(FLASH_DEV_ID(ptCtx));
+    return true;
+#else
+    (void)addr;
+    (void)ptDigest;
+    (void)bReset;
+    return false;
+#endif
+}
 
-    const flash_blob_t *ptFlashDevice = flash_dev_find(addr);
+/*
+ * Function: target_flash_verify_policy
+ * Description: Selects how a device checks programmed data, replacing the
+ *              readback loops of the Program ops. The default is
+ *              FLASH_BLOB_VERIFY_POLICY.
+ * Parameters:
+ *   - addr: Any address of the device.
+ *   - tPolicy: FLASH_VERIFY_OFF, FLASH_VERIFY_SAMPLED or FLASH_VERIFY_FULL.
+ * Returns: True on success.
+ */
+bool target_flash_verify_policy(uint32_t addr, flash_verify_t tPolicy)
+{
+    flash_dev_ctx_t *ptCtx = flash_dev_ctx_find(addr);
 
-    if(ptFlashDevice != NULL) {
-        ptFlashDevice->tFlashops.Init(addr, 0, 0);
-        return true;
+    if (ptCtx == NULL || tPolicy > FLASH_VERIFY_FULL) {
+        return false;
+    }
+    ptCtx->chVerify = (uint8_t)tPolicy;
+    return true;
+}
+
+/*
+ * Function: target_flash_erase_ex
+ * Description: Erases every sector touched by [addr, addr + size), blocking
+ *              wrapper around target_flash_erase_async(). The range is
+ *              explicitly widened to sector boundaries.
+ * Parameters:
+ *   - addr: Flash memory address to start erasing.
+ *   - size: Number of bytes to erase.
+ *   - ptErased: Optional, receives the sector aligned range actually erased.
+ * Returns: Number of bytes actually erased, counted from the aligned start.
+ */
+int32_t target_flash_erase_ex(uint32_t addr, size_t size, flash_range_t *ptErased)
+{
+    flash_dev_ctx_t *ptCtx = flash_dev_ctx_find(addr);
+    flash_req_t tReq = {0};
+
+    if (ptErased != NULL) {
+        ptErased->wAddr = addr;
+        ptErased->wSize = 0;
     }
 
+    if (ptCtx == NULL) {
+        return 0;
+    }
+    flash_atom_call(ptCtx);
+    if (!target_flash_erase_async(&tReq, addr, size, NULL, NULL)) {
+        return 0;
+    }
+    flash_req_wait(ptCtx, &tReq);
+
+    if (ptErased != NULL) {
+        ptErased->wAddr = tReq.wAddr;
+        ptErased->wSize = tReq.wDone;
+    }
+    return tReq.wDone;
+}
+
+/*
+ * Function: target_flash_erase
+ * Description: Erases a specified portion of the flash memory, widened to
+ *              sector boundaries.
+ * Parameters:
+ *   - addr: Flash memory address to start erasing.
+ *   - size: Number of bytes to erase.
+ * Returns: Number of bytes actually erased.
+ */
+int target_flash_erase(uint32_t addr, size_t size)
+{
+    return target_flash_erase_ex(addr, size, NULL);
+}
+
+/*
+ * Function: target_flash_stat
+ * Description: Reads the operation counters of a device. Only available
+ *              with FLASH_BLOB_USE_STAT, latencies need FLASH_BLOB_GET_TICK().
+ * Parameters:
+ *   - addr: Any address of the device.
+ *   - ptStat: Optional, receives the counters.
+ *   - bReset: Clear the counters after reading.
+ * Returns: True if the device exists and statistics are enabled.
+ */
+bool target_flash_stat(uint32_t addr, flash_dev_stat_t *ptStat, bool bReset)
+{
+#if FLASH_BLOB_USE_STAT == ENABLED
+    flash_dev_ctx_t *ptCtx = flash_dev_ctx_find(addr);
+
+    if (ptCtx == NULL) {
+        return false;
+    }
+    FLASH_BLOB_DEV_LOCK(FLASH_DEV_ID(ptCtx));
+    FLASH_BLOB_LOCK();
+    flash_guard_code(){
+        if (ptStat != NULL) {
+            *ptStat = ptCtx->tStat;
+        }
+        if (bReset) {
+            memset(&ptCtx->tStat, 0, sizeof(ptCtx->tStat));
+        }
+    }
+    FLASH_BLOB_UNLOCK();
+    FLASH_BLOB_DEV_UNLOCK(FLASH_DEV_ID(ptCtx));
+    return true;
+#else
+    (void)addr;
+    (void)ptStat;
+    (void)bReset;
     return false;
+#endif
 }
+
 /*
- * Function: target_flash_uninit
- * Description: Uninitializes the flash memory based on the specified address.
+ * Function: target_flash_trace_read
+ * Description: Takes the oldest entries out of the operation trace. Only
+ *              available with FLASH_BLOB_USE_TRACE.
  * Parameters:
- *   - addr: Flash memory address to uninitialize.
- * Returns: True if uninitialization is successful, false otherwise.
+ *   - ptTrace: Receives up to wMax entries, oldest first.
+ *   - wMax: Capacity of ptTrace.
+ *   - pwLost: Optional, receives and clears the number of entries
+ *             overwritten before they were read.
+ * Returns: Number of entries copied.
  */
-bool target_flash_uninit(uint32_t addr)
+uint32_t target_flash_trace_read(flash_trace_t *ptTrace, uint32_t wMax, uint32_t *pwLost)
 {
-    const flash_blob_t *ptFlashDevice = flash_dev_find(addr);
+    uint32_t wNum = 0;
 
-    if(ptFlashDevice != NULL) {
-        ptFlashDevice->tFlashops.UnInit(addr);
-        return true;
+#if FLASH_BLOB_USE_TRACE == ENABLED
+    FLASH_BLOB_LOCK();
+    flash_guard_code(){
+        while (wNum < wMax && s_wTraceTail != s_wTraceHead) {
+            ptTrace[wNum++] = s_tTrace[s_wTraceTail++ % FLASH_BLOB_TRACE_DEPTH];
+        }
+        if (pwLost != NULL) {
+            *pwLost = s_wTraceLost;
+            s_wTraceLost = 0;
+        }
+    }
+    FLASH_BLOB_UNLOCK();
+#else
+    (void)ptTrace;
+    (void)wMax;
+    if (pwLost != NULL) {
+        *pwLost = 0;
     }
+#endif
+    return wNum;
+}
 
-    return true;
+/*
+ * Function: target_flash_irq_stat
+ * Description: Reads the IRQ-masked window statistics. All values stay 0
+ *              unless FLASH_BLOB_GET_TICK() is available.
+ * Parameters:
+ *   - ptStat: Optional, receives the statistics.
+ *   - bReset: Clear the statistics after reading.
+ */
+void target_flash_irq_stat(flash_irq_stat_t *ptStat, bool bReset)
+{
+#if defined(FLASH_BLOB_GET_TICK)
+    FLASH_BLOB_LOCK();
+    if (ptStat != NULL) {
+        *ptStat = s_tIrqStat;
+    }
+    if (bReset) {
+        memset(&s_tIrqStat, 0, sizeof(s_tIrqStat));
+    }
+    FLASH_BLOB_UNLOCK();
+#else
+    (void)bReset;
+    if (ptStat != NULL) {
+        memset(ptStat, 0, sizeof(*ptStat));
+    }
+#endif
 }
+
+#if FLASH_BLOB_USE_DIFF_WRITE == ENABLED
 /*
- * Function: target_flash_write
- * Description: Writes data to the flash memory.
+ * Function: flash_diff_equal
+ * Description: Word-wide comparison, written without early exit so that
+ *              the compiler can vectorize it.
  * Parameters:
- *   - addr: Flash memory address to start writing.
- *   - buf: Pointer to the data to be written.
- *   - size: Number of bytes to write.
- * Returns: Number of bytes actually written.
+ *   - pwCur: Current contents.
+ *   - pwNew: Target contents.
+ *   - wWords: Number of words.
+ * Returns: True if both are identical.
  */
-int target_flash_write(uint32_t addr, const uint8_t *buf, size_t size)
+static bool flash_diff_equal(const uint32_t *pwCur, const uint32_t *pwNew, uint32_t wWords)
 {
-    const flash_blob_t *ptFlashDevice = flash_dev_find(addr);
+    uint32_t wDiff = 0;
 
-    safe_atom_code(){
-        if(ptFlashDevice != NULL) {
-            if (addr % 4 != 0) {
-                /*addr must be 4-byte alignment*/
-				size = 0;
-                continue;
-            }
+    for (uint32_t i = 0; i < wWords; i++) {
+        wDiff |= pwCur[i] ^ pwNew[i];
+    }
+    return wDiff == 0;
+}
 
-            if ((addr - ptFlashDevice->ptFlashDev->DevAdr + size) > ptFlashDevice->ptFlashDev->szDev) {
-                /*write outrange flash size*/
-				size = 0;
-                continue;
-            }
+/*
+ * Function: flash_diff_need_erase
+ * Description: Checks whether reaching the target contents needs a bit to
+ *              go back to its erased state, which programming cannot do.
+ * Parameters:
+ *   - pwCur: Current contents.
+ *   - pwNew: Target contents.
+ *   - wWords: Number of words.
+ *   - wEmpty: valEmpty replicated to a word.
+ * Returns: True if the sector has to be erased.
+ */
+static bool flash_diff_need_erase(const uint32_t *pwCur, const uint32_t *pwNew, uint32_t wWords, uint32_t wEmpty)
+{
+    /*flip into a domain where erased bits are 1 and programming clears them*/
+    uint32_t wFlip = ~wEmpty;
+    uint32_t wSet = 0;
 
-            if(ptFlashDevice->tFlashops.Program) {
-                if( 0 != ptFlashDevice->tFlashops.Program(addr, size, (uint8_t *)buf)) {
-                    /*Programming Failed*/
-					size = 0;
-                    continue;
-                }
-            } else {
-				size = 0;
-                continue;
+    for (uint32_t i = 0; i < wWords; i++) {
+        wSet |= (pwNew[i] ^ wFlip) & ~(pwCur[i] ^ wFlip);
+    }
+    return wSet != 0;
+}
+
+/*
+ * Function: flash_diff_load
+ * Description: Loads one chunk: wDiffCur receives the flash contents (or
+ *              the erased value), wDiffNew the same with the part of the
+ *              request that falls into the chunk applied.
+ * Parameters:
+ *   - ptCtx: Device context.
+ *   - wChunk: Chunk address.
+ *   - wLen: Chunk length, multiple of 4.
+ *   - addr, buf, size: The update request.
+ *   - bErased: The chunk was just erased, skip reading it.
+ * Returns: True on success.
+ */
+static bool flash_diff_load(flash_dev_ctx_t *ptCtx, uint32_t wChunk, uint32_t wLen,
+                            uint32_t addr, const uint8_t *buf, size_t size, bool bErased)
+{
+    uint32_t wLo = (addr > wChunk) ? addr : wChunk;
+    uint32_t wHi = (addr + size < wChunk + wLen) ? addr + size : wChunk + wLen;
+    flash_scratch_t *ptScratch = FLASH_DEV_SCRATCH(ptCtx);
+    bool bResult = true;
+
+    if (bErased) {
+        memset(ptScratch->wDiffCur, ptCtx->ptBlob->ptFlashDev->valEmpty, wLen);
+    } else {
+        bResult = flash_dev_read(ptCtx, wChunk, (uint8_t *)ptScratch->wDiffCur, wLen);
+    }
+    memcpy(ptScratch->wDiffNew, ptScratch->wDiffCur, wLen);
+    memcpy((uint8_t *)ptScratch->wDiffNew + (wLo - wChunk), buf + (wLo - addr), wHi - wLo);
+
+    return bResult;
+}
+
+/*
+ * Function: flash_diff_program
+ * Description: Programs the runs of write units in which wDiffNew differs
+ *              from wDiffCur. After an erase wDiffCur holds valEmpty, so
+ *              erased runs of the source are skipped as well.
+ * Parameters:
+ *   - ptCtx: Device context.
+ *   - wChunk: Chunk address.
+ *   - wLen: Chunk length, multiple of wUnit.
+ *   - wUnit: Write unit, max(granularity, 4).
+ * Returns: Number of bytes programmed, -1 on failure.
+ */
+static int32_t flash_diff_program(flash_dev_ctx_t *ptCtx, uint32_t wChunk, uint32_t wLen, uint32_t wUnit)
+{
+    flash_scratch_t *ptScratch = FLASH_DEV_SCRATCH(ptCtx);
+    uint32_t wWords = wUnit / 4;
+    uint32_t wStart = 0;
+    int32_t nProgrammed = 0;
+    bool bRun = false;
+
+    for (uint32_t wOff = 0; wOff <= wLen; wOff += wUnit) {
+        bool bDiff = (wOff < wLen) &&
+                     !flash_diff_equal(&ptScratch->wDiffCur[wOff / 4], &ptScratch->wDiffNew[wOff / 4], wWords);
+        if (bDiff && !bRun) {
+            wStart = wOff;
+            bRun = true;
+        } else if (!bDiff && bRun) {
+            if (!flash_dev_program(ptCtx, wChunk + wStart,
+                                   (const uint8_t *)ptScratch->wDiffNew + wStart, wOff - wStart)) {
+                return -1;
             }
+            nProgrammed += wOff - wStart;
+            bRun = false;
         }
     }
-    return size;
+
+    return nProgrammed;
 }
 
 /*
- * Function: target_flash_read
- * Description: Reads data from the flash memory.
+ * Function: flash_diff_classify
+ * Description: Compares the part [wPos, wHi) of one sector with the request.
  * Parameters:
- *   - addr: Flash memory address to start reading.
- *   - buf: Pointer to store the read data.
- *   - size: Number of bytes to read.
- * Returns: Number of bytes actually read.
+ *   - ptCtx: Device context.
+ *   - wPos, wHi: Range within the sector, aligned to the write unit.
+ *   - addr, buf, size: The update request.
+ *   - wEmpty: valEmpty replicated to a word.
+ *   - pbEqual: Receives whether the flash holds the data already.
+ *   - pbErase: Receives whether the sector has to be erased.
+ * Returns: True on success.
  */
-int target_flash_read(uint32_t addr, uint8_t *buf, size_t size)
+static bool flash_diff_classify(flash_dev_ctx_t *ptCtx, uint32_t wPos, uint32_t wHi,
+                                uint32_t addr, const uint8_t *buf, size_t size, uint32_t wEmpty,
+                                bool *pbEqual, bool *pbErase)
 {
-    const flash_blob_t *ptFlashDevice = flash_dev_find(addr);
+    flash_scratch_t *ptScratch = FLASH_DEV_SCRATCH(ptCtx);
 
-    safe_atom_code(){
-        if(ptFlashDevice != NULL) {
-            if (addr % 4 != 0) {
-                /*addr must be 4-byte alignment*/
-			    size = 0;
-                continue;
-            }
+    *pbEqual = true;
+    *pbErase = false;
+    for (uint32_t wChunk = wPos; wChunk < wHi && !*pbErase; wChunk += FLASH_BLOB_DIFF_CHUNK_SIZE) {
+        uint32_t wLen = (wHi - wChunk < FLASH_BLOB_DIFF_CHUNK_SIZE) ? wHi - wChunk : FLASH_BLOB_DIFF_CHUNK_SIZE;
+        if (!flash_diff_load(ptCtx, wChunk, wLen, addr, buf, size, false)) {
+            return false;
+        }
+        if (!flash_diff_equal(ptScratch->wDiffCur, ptScratch->wDiffNew, wLen / 4)) {
+            *pbEqual = false;
+            *pbErase = flash_diff_need_erase(ptScratch->wDiffCur, ptScratch->wDiffNew, wLen / 4, wEmpty);
+        }
+    }
+    return true;
+}
+
+/*
+ * Function: flash_diff_blank
+ * Description: Checks whether a range holds valEmpty only.
+ * Parameters:
+ *   - ptCtx: Device context.
+ *   - wFrom, wTo: The range, may be empty.
+ * Returns: True if the range is blank, false if not or it cannot be read.
+ */
+static bool flash_diff_blank(flash_dev_ctx_t *ptCtx, uint32_t wFrom, uint32_t wTo)
+{
+    uint8_t *pchCur = (uint8_t *)FLASH_DEV_SCRATCH(ptCtx)->wDiffCur;
+    uint8_t chEmpty = ptCtx->ptBlob->ptFlashDev->valEmpty;
 
-            if ((addr - ptFlashDevice->ptFlashDev->DevAdr + size) > ptFlashDevice->ptFlashDev->szDev) {
-                /*read outrange flash size*/
-			    size = 0;
-                continue;
+    while (wFrom < wTo) {
+        uint32_t wLen = (wTo - wFrom < FLASH_BLOB_DIFF_CHUNK_SIZE) ? wTo - wFrom : FLASH_BLOB_DIFF_CHUNK_SIZE;
+        if (!flash_dev_read(ptCtx, wFrom, pchCur, wLen)) {
+            return false;
+        }
+        for (uint32_t i = 0; i < wLen; i++) {
+            if (pchCur[i] != chEmpty) {
+                return false;
             }
+        }
+        wFrom += wLen;
+    }
+    return true;
+}
+
+/*
+ * Function: flash_diff_keeps
+ * Description: Checks that updating the sector holding wAt does not lose
+ *              data: the sector needs no erase, or it holds nothing but
+ *              valEmpty outside the request.
+ * Parameters:
+ *   - ptCtx: Device context.
+ *   - wAt: Address of the first or last sector of the request.
+ *   - addr, buf, size: The update request.
+ *   - wUnit: Write unit, max(granularity, 4).
+ *   - wEmpty: valEmpty replicated to a word.
+ * Returns: True if the sector can be updated.
+ */
+static bool flash_diff_keeps(flash_dev_ctx_t *ptCtx, uint32_t wAt, uint32_t addr, const uint8_t *buf,
+                             size_t size, uint32_t wUnit, uint32_t wEmpty)
+{
+    flash_sector_t tSector;
+    uint32_t wEnd = addr + size;
+    bool bEqual, bErase;
+
+    flash_dev_sector_of(ptCtx, wAt - ptCtx->ptBlob->ptFlashDev->DevAdr, &tSector);
+    uint32_t wSectorEnd = tSector.wAddr + tSector.wSize;
+    uint32_t wLo = (addr > tSector.wAddr) ? addr : tSector.wAddr;
+    uint32_t wHi = (wEnd - tSector.wAddr < tSector.wSize) ? wEnd : wSectorEnd;
+
+    if (flash_diff_blank(ptCtx, tSector.wAddr, wLo) && flash_diff_blank(ptCtx, wHi, wSectorEnd)) {
+        return true;
+    }
+    wLo &= ~(wUnit - 1);
+    wHi = (wHi + wUnit - 1) & ~(wUnit - 1);
+
+    return flash_diff_classify(ptCtx, wLo, wHi, addr, buf, size, wEmpty, &bEqual, &bErase) && !bErase;
+}
+
+/*
+ * Function: flash_dev_update
+ * Description: Compares and rewrites the sectors of target_flash_update(),
+ *              the caller holds the device lock.
+ * Parameters:
+ *   - ptCtx: Device context.
+ *   - addr: Flash memory address to start writing.
+ *   - buf: Pointer to the data to be written.
+ *   - size: Number of bytes to write.
+ *   - wUnit: Write unit, max(granularity, 4).
+ * Returns: True on success.
+ */
+static bool flash_dev_update(flash_dev_ctx_t *ptCtx, uint32_t addr, const uint8_t *buf, size_t size, uint32_t wUnit)
+{
+    const flash_blob_t *ptFlashDevice = ptCtx->ptBlob;
+    flash_diff_stat_t *ptStat = &ptCtx->tDiffStat;
+    uint32_t wEmpty = ptFlashDevice->ptFlashDev->valEmpty * 0x01010101u;
+    uint32_t wProgrammed = 0;
+    flash_sector_t tSector;
+
+#if FLASH_BLOB_USE_PAGE_BUF == ENABLED
+    /*the comparison reads what is in the flash, nothing may be in flight*/
+    if (!flash_dev_buf_flush(ptCtx) || !flash_dev_pipe_check(ptCtx)) {
+        return false;
+    }
+#endif
+
+    /*an erase of the first or last sector must not take data outside the range along, refuse up front*/
+    if (!flash_diff_keeps(ptCtx, addr, addr, buf, size, wUnit, wEmpty) ||
+        !flash_diff_keeps(ptCtx, addr + size - 1, addr, buf, size, wUnit, wEmpty)) {
+        return false;
+    }
 
-            if(ptFlashDevice->tFlashops.Read) {
-                if( 0 != ptFlashDevice->tFlashops.Read(addr, size, (uint8_t *)buf)) {
-                    /*Read Failed*/
-					size = 0;
-                    continue;
+    uint32_t wPos = addr & ~(wUnit - 1);
+    uint32_t wEnd = (uint32_t)((addr + size + wUnit - 1) & ~(wUnit - 1));
+    while (wPos != wEnd) {
+        flash_dev_sector_of(ptCtx, wPos - ptFlashDevice->ptFlashDev->DevAdr, &tSector);
+        uint32_t wHi = (wEnd - tSector.wAddr < tSector.wSize) ? wEnd : tSector.wAddr + tSector.wSize;
+        bool bEqual, bErase;
+
+        /*pass 1, classify the sector*/
+        if (!flash_diff_classify(ptCtx, wPos, wHi, addr, buf, size, wEmpty, &bEqual, &bErase)) {
+            return false;
+        }
+
+        if (bEqual) {
+            ptStat->wSectorsSkipped++;
+        } else {
+            if (bErase) {
+                if (!flash_dev_erase_sector(ptCtx, &tSector)) {
+                    /*erase Failed*/
+                    return false;
                 }
+                ptStat->wErases++;
+                /*the part of the sector before the request is erased as well*/
+                wPos = tSector.wAddr;
             } else {
-                for (uint16_t i = 0; i < size; i++, buf++, addr++) {
-                    *buf = *(uint8_t *) addr;
+                ptStat->wErasesAvoided++;
+            }
+
+            /*pass 2, program what differs*/
+            for (uint32_t wChunk = wPos; wChunk < wHi; wChunk += FLASH_BLOB_DIFF_CHUNK_SIZE) {
+                uint32_t wLen = (wHi - wChunk < FLASH_BLOB_DIFF_CHUNK_SIZE) ? wHi - wChunk : FLASH_BLOB_DIFF_CHUNK_SIZE;
+                if (!flash_diff_load(ptCtx, wChunk, wLen, addr, buf, size, bErase)) {
+                    return false;
+                }
+                int32_t nProgrammed = flash_diff_program(ptCtx, wChunk, wLen, wUnit);
+                if (nProgrammed < 0) {
+                    return false;
                 }
+                wProgrammed += nProgrammed;
             }
         }
+
+        wPos = wHi;
     }
 
-    return size;
+    ptStat->wBytesProgrammed += wProgrammed;
+    ptStat->wBytesSkipped += (size > wProgrammed) ? size - wProgrammed : 0;
+
+    return true;
 }
 
 /*
- * Function: target_flash_erase
- * Description: Erases a specified portion of the flash memory.
+ * Function: target_flash_update
+ * Description: Writes data only where the flash does not already hold it.
+ *              Each sector touched by the range is compared first; a sector
+ *              that matches is skipped, a sector that only needs bits
+ *              programmed is patched without erase, otherwise the sector is
+ *              erased and everything but runs of valEmpty is programmed.
+ *              An erase covers the whole sector, so if the first or last
+ *              sector needs one while it holds data outside
+ *              [addr, addr + size), the call is refused before anything is
+ *              written: update such data along with the rest of its sector.
  * Parameters:
- *   - addr: Flash memory address to start erasing.
- *   - size: Number of bytes to erase.
- * Returns: Number of bytes actually erased.
+ *   - addr: Flash memory address to start writing.
+ *   - buf: Pointer to the data to be written.
+ *   - size: Number of bytes to write.
+ * Returns: Number of bytes written, 0 on failure.
  */
-int target_flash_erase(uint32_t addr, size_t size)
+int32_t target_flash_update(uint32_t addr, const uint8_t *buf, size_t size)
 {
-    size_t wSector = 0;
-    size_t wEraseSize = 0;
-    const flash_blob_t *ptFlashDevice = flash_dev_find(addr);
-    if(ptFlashDevice != NULL) {
-		safe_atom_code(){
-			if (size > ptFlashDevice->ptFlashDev->szDev) {
-				/*erase outrange flash size */
-				wEraseSize = 0;
-				continue;
-			}
-
-			while(wEraseSize < size) {
-				if(ptFlashDevice->tFlashops.EraseSector) {
-					if(0 != ptFlashDevice->tFlashops.EraseSector(addr)) {
-						/*erase Failed*/
-						break;
-					}
-				} else {
-					break;
-				}
-
-				for(wSector = 0; wSector < SECTOR_NUM; wSector++) {
-					if(ptFlashDevice->ptFlashDev->sectors[wSector + 1].szSector == 0XFFFFFFFF )
-						break;
-
-					if(((addr - ptFlashDevice->ptFlashDev->DevAdr) < ptFlashDevice->ptFlashDev->sectors[wSector + 1].AddrSector) &&
-					   ((addr - ptFlashDevice->ptFlashDev->DevAdr) >= ptFlashDevice->ptFlashDev->sectors[wSector].AddrSector) )
-						break;
-				}
-
-				addr += ptFlashDevice->ptFlashDev->sectors[wSector].szSector;
-				wEraseSize += ptFlashDevice->ptFlashDev->sectors[wSector].szSector;
-			}
-	    }
-        return wEraseSize;
+    flash_dev_ctx_t *ptCtx = flash_dev_ctx_find(addr);
+    bool bResult;
+
+    if(ptCtx == NULL) {
+        return 0;
     }
 
+    uint32_t wUnit = (ptCtx->wGranularity > 4) ? ptCtx->wGranularity : 4;
+
+    if (size == 0 || size > ptCtx->ptBlob->ptFlashDev->szDev - (addr - ptCtx->ptBlob->ptFlashDev->DevAdr)
+        || FLASH_BLOB_DIFF_CHUNK_SIZE % wUnit != 0) {
+        return 0;
+    }
+
+    flash_atom_call(ptCtx);
+    /*compare against the result of everything queued before*/
+    flash_dev_drain(ptCtx);
+
+    FLASH_BLOB_DEV_LOCK(FLASH_DEV_ID(ptCtx));
+    bResult = flash_dev_update(ptCtx, addr, buf, size, wUnit);
+    FLASH_BLOB_DEV_UNLOCK(FLASH_DEV_ID(ptCtx));
+
+    return bResult ? size : 0;
+}
+
+/*
+ * Function: target_flash_diff_stat
+ * Description: Reads the target_flash_update() counters of a device.
+ * Parameters:
+ *   - addr: Any address of the device.
+ *   - ptStat: Optional, receives the counters.
+ *   - bReset: Clear the counters after reading.
+ * Returns: True if the device exists.
+ */
+bool target_flash_diff_stat(uint32_t addr, flash_diff_stat_t *ptStat, bool bReset)
+{
+    flash_dev_ctx_t *ptCtx = flash_dev_ctx_find(addr);
+
+    if (ptCtx == NULL) {
+        return false;
+    }
+    FLASH_BLOB_DEV_LOCK(FLASH_DEV_ID(ptCtx));
+    if (ptStat != NULL) {
+        *ptStat = ptCtx->tDiffStat;
+    }
+    if (bReset) {
+        memset(&ptCtx->tDiffStat, 0, sizeof(ptCtx->tDiffStat));
+    }
+    FLASH_BLOB_DEV_UNLOCK(FLASH_DEV_ID(ptCtx));
+    return true;
+}
+#else
+int32_t target_flash_update(uint32_t addr, const uint8_t *buf, size_t size)
+{
+    (void)addr;
+    (void)buf;
+    (void)size;
     return 0;
 }
 
+bool target_flash_diff_stat(uint32_t addr, flash_diff_stat_t *ptStat, bool bReset)
+{
+    (void)addr;
+    (void)bReset;
+    if (ptStat != NULL) {
+        memset(ptStat, 0, sizeof(*ptStat));
+    }
+    return false;
+}
+#endif
+
+#if FLASH_BLOB_USE_READ_CACHE == ENABLED
+/*
+ * Function: target_flash_cache_stat
+ * Description: Reads the read cache counters of a device.
+ * Parameters:
+ *   - addr: Any address of the device.
+ *   - ptStat: Optional, receives the counters.
+ *   - bReset: Clear the counters after reading.
+ * Returns: True if the device reads through a cache.
+ */
+bool target_flash_cache_stat(uint32_t addr, flash_cache_stat_t *ptStat, bool bReset)
+{
+    flash_dev_ctx_t *ptCtx = flash_dev_ctx_find(addr);
+    flash_cache_t *ptCache;
+
+    if (ptCtx == NULL || (ptCache = ptCtx->ptBlob->ptCache) == NULL || ptCtx->ptBlob->tFlashops.Read == NULL) {
+        if (ptStat != NULL) {
+            memset(ptStat, 0, sizeof(*ptStat));
+        }
+        return false;
+    }
+    FLASH_BLOB_DEV_LOCK(FLASH_DEV_ID(ptCtx));
+    if (ptStat != NULL) {
+        *ptStat = ptCache->tStat;
+    }
+    if (bReset) {
+        memset(&ptCache->tStat, 0, sizeof(ptCache->tStat));
+    }
+    FLASH_BLOB_DEV_UNLOCK(FLASH_DEV_ID(ptCtx));
+    return true;
+}
+#else
+bool target_flash_cache_stat(uint32_t addr, flash_cache_stat_t *ptStat, bool bReset)
+{
+    (void)addr;
+    (void)bReset;
+    if (ptStat != NULL) {
+        memset(ptStat, 0, sizeof(*ptStat));
+    }
+    return false;
+}
+#endif
@@ -0,0 +1,519 @@
+/****************************************************************************
+*  Copyright 2022 KK (https://github.com/WALI-KANG)                                    *
+*                                                                           *
+*  Licensed under the Apache License, Version 2.0 (the "License");          *
+*  you may not use this file except in compliance with the License.         *
+*  You may obtain a copy of the License at                                  *
+*                                                                           *
+*     http://www.apache.org/licenses/LICENSE-2.0                            *
+*                                                                           *
+*  Unless required by applicable law or agreed to in writing, software      *
+*  distributed under the License is distributed on an "AS IS" BASIS,        *
+*  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. *
+*  See the License for the specific language governing permissions and      *
+*  limitations under the License.                                           *
+*                                                                           *
+****************************************************************************/
+#include "flash_blob_cfg.h"
+#include "flash_flm.h"
+
+#if FLASH_FLM_SLOT_NUM < 1 || FLASH_FLM_SLOT_NUM > 4
+    #error "FLASH_FLM_SLOT_NUM must be 1 to 4"
+#endif
+
+#define FLASH_FLM_EHDR_SIZE     52
+#define FLASH_FLM_SHDR_SIZE     40
+#define FLASH_FLM_SYM_SIZE      16
+#define FLASH_FLM_SHT_SYMTAB    2
+#define FLASH_FLM_SHT_NOBITS    8
+#define FLASH_FLM_EM_ARM        40
+#define FLASH_FLM_STB_GLOBAL    1
+
+/* FlashDevice of the FLM: DevName is 128 characters there, the sectors follow the fixed part */
+#define FLASH_FLM_NAME_SIZE     128
+#define FLASH_FLM_DEV_SIZE      (2 + FLASH_FLM_NAME_SIZE + 2 + 7 * 4)
+#define FLASH_FLM_SECTOR_MAX    512
+
+/* Where the image is read from */
+typedef struct {
+    const uint8_t *pchBuf;          // image in memory, NULL to read it from flash
+    uint32_t wAddr;                 // flash address of the image
+    size_t wSize;
+} flash_flm_image_t;
+
+/* One section of interest */
+typedef struct {
+    uint32_t wIndex;
+    uint32_t wType;
+    uint32_t wAddr;
+    uint32_t wOffset;
+    uint32_t wSize;
+    uint32_t wLink;
+} flash_flm_section_t;
+
+enum {
+    FLASH_FLM_PRG_CODE = 0,
+    FLASH_FLM_PRG_DATA,
+    FLASH_FLM_DEV_DSCR,
+    FLASH_FLM_SYMTAB,
+    FLASH_FLM_STRTAB,               // found through the sh_link of .symtab
+    FLASH_FLM_SECTION_NUM,
+};
+
+static const char *const c_pchSections[FLASH_FLM_STRTAB] = {"PrgCode", "PrgData", "DevDscr", ".symtab"};
+static const char *const c_pchEntries[FLASH_FLM_ENTRY_NUM] = {
+    "Init", "UnInit", "EraseChip", "EraseSector", "ProgramPage",
+};
+
+/* Algorithms bound to the trampolines of each slot */
+static flash_flm_t *s_ptSlot[FLASH_FLM_SLOT_NUM];
+
+/*
+ * Function: flash_flm_read
+ * Description: Reads a part of the image.
+ * Parameters:
+ *   - ptImage: The image.
+ *   - wOffset: Offset in the image.
+ *   - pBuf: Receives the bytes.
+ *   - wSize: Number of bytes.
+ * Returns: False if the part is outside the image or cannot be read.
+ */
+static bool flash_flm_read(const flash_flm_image_t *ptImage, uint32_t wOffset, void *pBuf, size_t wSize)
+{
+    if (wOffset > ptImage->wSize || wSize > ptImage->wSize - wOffset) {
+        return false;
+    }
+    if (wSize == 0) {
+        return true;
+    }
+    if (ptImage->pchBuf != NULL) {
+        memcpy(pBuf, ptImage->pchBuf + wOffset, wSize);
+        return true;
+    }
+    return target_flash_read(ptImage->wAddr + wOffset, (uint8_t *)pBuf, wSize) == (int32_t)wSize;
+}
+
+static inline uint16_t flash_flm_le16(const uint8_t *pchBuf)
+{
+    return (uint16_t)(pchBuf[0] | (pchBuf[1] << 8));
+}
+
+static inline uint32_t flash_flm_le32(const uint8_t *pchBuf)
+{
+    return (uint32_t)pchBuf[0] | ((uint32_t)pchBuf[1] << 8) | ((uint32_t)pchBuf[2] << 16) |
+           ((uint32_t)pchBuf[3] << 24);
+}
+
+/*
+ * Function: flash_flm_name_is
+ * Description: Compares a string of a string table with a name.
+ * Parameters:
+ *   - ptImage: The image.
+ *   - ptStrtab: The string table.
+ *   - wName: Offset of the string in the table.
+ *   - pchName: Name to compare with, at most 15 characters.
+ * Returns: True if the string is the name.
+ */
+static bool flash_flm_name_is(const flash_flm_image_t *ptImage, const flash_flm_section_t *ptStrtab,
+                              uint32_t wName, const char *pchName)
+{
+    char chBuf[16];
+    size_t wLen = strlen(pchName) + 1;
+
+    if (wName >= ptStrtab->wSize || wLen > ptStrtab->wSize - wName ||
+        !flash_flm_read(ptImage, ptStrtab->wOffset + wName, chBuf, wLen)) {
+        return false;
+    }
+    return memcmp(chBuf, pchName, wLen) == 0;
+}
+
+/*
+ * Function: flash_flm_sections
+ * Description: Checks the ELF header and finds the sections of an FLM.
+ * Parameters:
+ *   - ptImage: The image.
+ *   - ptSection: Receives FLASH_FLM_SECTION_NUM sections.
+ * Returns: FLASH_FLM_OK or the reason the image is refused.
+ */
+static flash_flm_err_t flash_flm_sections(const flash_flm_image_t *ptImage, flash_flm_section_t *ptSection)
+{
+    uint8_t chBuf[FLASH_FLM_EHDR_SIZE];
+    flash_flm_section_t tShstr = {0};
+    uint32_t wShoff, wShnum, wShstrndx;
+
+    if (!flash_flm_read(ptImage, 0, chBuf, FLASH_FLM_EHDR_SIZE)) {
+        return FLASH_FLM_ERR_READ;
+    }
+    if (memcmp(chBuf, "\x7f" "ELF", 4) != 0 || chBuf[4] != 1 || chBuf[5] != 1 ||
+        flash_flm_le16(&chBuf[18]) != FLASH_FLM_EM_ARM || flash_flm_le16(&chBuf[46]) != FLASH_FLM_SHDR_SIZE) {
+        /*32-bit, little endian, ARM*/
+        return FLASH_FLM_ERR_ELF;
+    }
+    wShoff = flash_flm_le32(&chBuf[32]);
+    wShnum = flash_flm_le16(&chBuf[48]);
+    wShstrndx = flash_flm_le16(&chBuf[50]);
+    if (wShstrndx >= wShnum) {
+        return FLASH_FLM_ERR_ELF;
+    }
+    if (wShoff > ptImage->wSize || wShnum * FLASH_FLM_SHDR_SIZE > ptImage->wSize - wShoff) {
+        return FLASH_FLM_ERR_READ;
+    }
+
+    memset(ptSection, 0, sizeof(flash_flm_section_t) * FLASH_FLM_SECTION_NUM);
+    for (uint32_t i = 0; i <= wShnum; i++) {
+        /*the section names first, then every section*/
+        uint32_t wIndex = (i == 0) ? wShstrndx : i - 1;
+        flash_flm_section_t tSection;
+        uint32_t wName;
+
+        if (!flash_flm_read(ptImage, wShoff + wIndex * FLASH_FLM_SHDR_SIZE, chBuf, FLASH_FLM_SHDR_SIZE)) {
+            return FLASH_FLM_ERR_READ;
+        }
+        wName = flash_flm_le32(&chBuf[0]);
+        tSection.wIndex = wIndex;
+        tSection.wType = flash_flm_le32(&chBuf[4]);
+        tSection.wAddr = flash_flm_le32(&chBuf[12]);
+        tSection.wOffset = flash_flm_le32(&chBuf[16]);
+        tSection.wSize = flash_flm_le32(&chBuf[20]);
+        tSection.wLink = flash_flm_le32(&chBuf[24]);
+        if (tSection.wType != FLASH_FLM_SHT_NOBITS &&
+            (tSection.wOffset > ptImage->wSize || tSection.wSize > ptImage->wSize - tSection.wOffset)) {
+            /*contents outside the image, offsets below need not care about wrapping*/
+            return FLASH_FLM_ERR_READ;
+        }
+        if (i == 0) {
+            tShstr = tSection;
+            continue;
+        }
+        for (uint8_t s = 0; s < FLASH_FLM_STRTAB; s++) {
+            if (ptSection[s].wSize == 0 && flash_flm_name_is(ptImage, &tShstr, wName, c_pchSections[s])) {
+                ptSection[s] = tSection;
+            }
+        }
+    }
+
+    if (ptSection[FLASH_FLM_SYMTAB].wType != FLASH_FLM_SHT_SYMTAB ||
+        ptSection[FLASH_FLM_SYMTAB].wLink >= wShnum ||
+        !flash_flm_read(ptImage, wShoff + ptSection[FLASH_FLM_SYMTAB].wLink * FLASH_FLM_SHDR_SIZE,
+                        chBuf, FLASH_FLM_SHDR_SIZE)) {
+        return FLASH_FLM_ERR_SYMBOL;
+    }
+    ptSection[FLASH_FLM_STRTAB].wOffset = flash_flm_le32(&chBuf[16]);
+    ptSection[FLASH_FLM_STRTAB].wSize = flash_flm_le32(&chBuf[20]);
+    if (ptSection[FLASH_FLM_STRTAB].wOffset > ptImage->wSize ||
+        ptSection[FLASH_FLM_STRTAB].wSize > ptImage->wSize - ptSection[FLASH_FLM_STRTAB].wOffset) {
+        return FLASH_FLM_ERR_READ;
+    }
+
+    if (ptSection[FLASH_FLM_PRG_CODE].wSize == 0 || ptSection[FLASH_FLM_PRG_CODE].wAddr != 0 ||
+        ptSection[FLASH_FLM_PRG_DATA].wSize == 0 || ptSection[FLASH_FLM_DEV_DSCR].wSize == 0 ||
+        ptSection[FLASH_FLM_PRG_DATA].wAddr < ptSection[FLASH_FLM_PRG_CODE].wSize ||
+        (ptSection[FLASH_FLM_PRG_DATA].wAddr & 3) != 0) {
+        /*PrgCode at 0, PrgData word aligned after it*/
+        return FLASH_FLM_ERR_SECTION;
+    }
+
+    return FLASH_FLM_OK;
+}
+
+/*
+ * Function: flash_flm_entries
+ * Description: Looks up the entry points in the symbol table.
+ * Parameters:
+ *   - ptImage: The image.
+ *   - ptSection: Sections found by flash_flm_sections().
+ *   - pwOffset: Receives FLASH_FLM_ENTRY_NUM offsets in PrgCode, Thumb bit
+ *     set, 0 for a missing one.
+ * Returns: FLASH_FLM_OK or FLASH_FLM_ERR_SYMBOL.
+ */
+static flash_flm_err_t flash_flm_entries(const flash_flm_image_t *ptImage, const flash_flm_section_t *ptSection,
+                                         uint32_t *pwOffset)
+{
+    const flash_flm_section_t *ptSymtab = &ptSection[FLASH_FLM_SYMTAB];
+    uint8_t chSym[FLASH_FLM_SYM_SIZE];
+
+    memset(pwOffset, 0, sizeof(uint32_t) * FLASH_FLM_ENTRY_NUM);
+    for (uint32_t wOffset = 0; wOffset + FLASH_FLM_SYM_SIZE <= ptSymtab->wSize; wOffset += FLASH_FLM_SYM_SIZE) {
+        if (!flash_flm_read(ptImage, ptSymtab->wOffset + wOffset, chSym, FLASH_FLM_SYM_SIZE)) {
+            return FLASH_FLM_ERR_READ;
+        }
+        uint32_t wName = flash_flm_le32(&chSym[0]);
+        uint32_t wValue = flash_flm_le32(&chSym[4]);
+
+        if ((chSym[12] >> 4) != FLASH_FLM_STB_GLOBAL || wName == 0) {
+            continue;
+        }
+        for (uint8_t e = 0; e < FLASH_FLM_ENTRY_NUM; e++) {
+            if (pwOffset[e] != 0 || !flash_flm_name_is(ptImage, &ptSection[FLASH_FLM_STRTAB], wName, c_pchEntries[e])) {
+                continue;
+            }
+            if (flash_flm_le16(&chSym[14]) != ptSection[FLASH_FLM_PRG_CODE].wIndex || (wValue & 1) == 0 ||
+                wValue >= ptSection[FLASH_FLM_PRG_CODE].wSize) {
+                /*Thumb code in PrgCode*/
+                return FLASH_FLM_ERR_SYMBOL;
+            }
+            pwOffset[e] = wValue;
+        }
+    }
+
+    for (uint8_t e = 0; e < FLASH_FLM_ENTRY_NUM; e++) {
+        if (pwOffset[e] == 0 && e != FLASH_FLM_ERASE_CHIP) {
+            return FLASH_FLM_ERR_SYMBOL;
+        }
+    }
+    return FLASH_FLM_OK;
+}
+
+/*
+ * Function: flash_flm_dev
+ * Description: Converts the FlashDevice description into a flash_dev_t.
+ * Parameters:
+ *   - ptImage: The image.
+ *   - ptDscr: The DevDscr section.
+ *   - ptDev: Receives the description.
+ * Returns: FLASH_FLM_OK, FLASH_FLM_ERR_READ or FLASH_FLM_ERR_DEVDSCR.
+ */
+static flash_flm_err_t flash_flm_dev(const flash_flm_image_t *ptImage, const flash_flm_section_t *ptDscr,
+                                     flash_dev_t *ptDev)
+{
+    uint8_t chBuf[FLASH_FLM_DEV_SIZE];
+    const uint8_t *pchField = &chBuf[2 + FLASH_FLM_NAME_SIZE];
+    uint32_t wNum;
+
+    if (ptDscr->wSize < FLASH_FLM_DEV_SIZE + 8 || !flash_flm_read(ptImage, ptDscr->wOffset, chBuf, sizeof(chBuf))) {
+        return (ptDscr->wSize < FLASH_FLM_DEV_SIZE + 8) ? FLASH_FLM_ERR_DEVDSCR : FLASH_FLM_ERR_READ;
+    }
+
+    memset(ptDev, 0, sizeof(flash_dev_t));
+    ptDev->Vers = flash_flm_le16(&chBuf[0]);
+    memcpy(ptDev->DevName, &chBuf[2], sizeof(ptDev->DevName) - 1);
+    ptDev->DevType = flash_flm_le16(&pchField[0]);
+    ptDev->DevAdr = flash_flm_le32(&pchField[2]);
+    ptDev->szDev = flash_flm_le32(&pchField[6]);
+    ptDev->szPage = flash_flm_le32(&pchField[10]);
+    ptDev->Res = flash_flm_le32(&pchField[14]);
+    ptDev->valEmpty = pchField[18];
+    ptDev->toProg = flash_flm_le32(&pchField[22]);
+    ptDev->toErase = flash_flm_le32(&pchField[26]);
+
+    if (ptDev->DevType > EXTSPI || ptDev->szDev == 0 || ptDev->szPage == 0 ||
+        (uint32_t)ptDev->DevAdr + ((uint32_t)ptDev->szDev - 1) < (uint32_t)ptDev->DevAdr) {
+        return FLASH_FLM_ERR_DEVDSCR;
+    }
+
+    for (wNum = 0; wNum < FLASH_FLM_SECTOR_MAX; wNum++) {
+        uint8_t chSector[8];
+        uint32_t wOffset = FLASH_FLM_DEV_SIZE + wNum * 8;
+
+        if (wOffset + 8 > ptDscr->wSize) {
+            /*the list must end inside the section*/
+            return FLASH_FLM_ERR_DEVDSCR;
+        }
+        if (!flash_flm_read(ptImage, ptDscr->wOffset + wOffset, chSector, sizeof(chSector))) {
+            return FLASH_FLM_ERR_READ;
+        }
+        uint32_t wSize = flash_flm_le32(&chSector[0]);
+        uint32_t wAddr = flash_flm_le32(&chSector[4]);
+        if (wSize == 0xFFFFFFFF) {
+            break;
+        }
+        if (wNum >= SECTOR_NUM - 1 || wSize == 0 || wAddr >= ptDev->szDev ||
+            (wNum == 0 && wAddr != 0) || (wNum > 0 && wAddr <= ptDev->sectors[wNum - 1].AddrSector)) {
+            /*ascending from offset 0, room for SECTOR_END*/
+            return FLASH_FLM_ERR_DEVDSCR;
+        }
+        ptDev->sectors[wNum].szSector = wSize;
+        ptDev->sectors[wNum].AddrSector = wAddr;
+    }
+    if (wNum == 0 || wNum == FLASH_FLM_SECTOR_MAX) {
+        return FLASH_FLM_ERR_DEVDSCR;
+    }
+    for (; wNum < SECTOR_NUM; wNum++) {
+        ptDev->sectors[wNum].szSector = 0xFFFFFFFF;
+        ptDev->sectors[wNum].AddrSector = 0xFFFFFFFF;
+    }
+
+    return FLASH_FLM_OK;
+}
+
+/*
+ * Function: flash_flm_entry
+ * Description: Runs an entry point of the algorithm bound to a slot.
+ * Parameters:
+ *   - chSlot: The slot.
+ *   - chEntry: flash_flm_entry_t.
+ *   - wArg0, wArg1, wArg2: Arguments.
+ * Returns: The return value of the algorithm, 0 - OK.
+ */
+static int32_t flash_flm_entry(uint8_t chSlot, uint8_t chEntry, uintptr_t wArg0, uintptr_t wArg1, uintptr_t wArg2)
+{
+    flash_flm_t *ptFlm = s_ptSlot[chSlot];
+
+    return flash_flm_call(ptFlm->wEntry[chEntry], ptFlm->pStaticBase, wArg0, wArg1, wArg2);
+}
+
+#define FLASH_FLM_SLOT_DEFINE(__N)                                                      \
+    static int32_t flash_flm_init##__N(uint32_t adr, uint32_t clk, uint32_t fnc)        \
+    {   return flash_flm_entry(__N, FLASH_FLM_INIT, adr, clk, fnc);   }                 \
+    static int32_t flash_flm_uninit##__N(uint32_t fnc)                                  \
+    {   return flash_flm_entry(__N, FLASH_FLM_UNINIT, fnc, 0, 0);   }                   \
+    static int32_t flash_flm_erase_chip##__N(void)                                      \
+    {   return flash_flm_entry(__N, FLASH_FLM_ERASE_CHIP, 0, 0, 0);   }                 \
+    static int32_t flash_flm_erase_sector##__N(uint32_t adr)                            \
+    {   return flash_flm_entry(__N, FLASH_FLM_ERASE_SECTOR, adr, 0, 0);   }             \
+    static int32_t flash_flm_program##__N(uint32_t adr, uint32_t sz, uint8_t *buf)      \
+    {   return flash_flm_entry(__N, FLASH_FLM_PROGRAM_PAGE, adr, sz, (uintptr_t)buf);   }
+
+#define FLASH_FLM_SLOT_OPS(__N)                                                         \
+    {flash_flm_init##__N, flash_flm_uninit##__N, flash_flm_erase_chip##__N,            \
+     flash_flm_erase_sector##__N, flash_flm_program##__N, NULL}
+
+FLASH_FLM_SLOT_DEFINE(0)
+#if FLASH_FLM_SLOT_NUM > 1
+FLASH_FLM_SLOT_DEFINE(1)
+#endif
+#if FLASH_FLM_SLOT_NUM > 2
+FLASH_FLM_SLOT_DEFINE(2)
+#endif
+#if FLASH_FLM_SLOT_NUM > 3
+FLASH_FLM_SLOT_DEFINE(3)
+#endif
+
+/* Trampolines of each slot, Read stays NULL: FLM devices are read memory mapped */
+static const flash_ops_t c_tSlotOps[FLASH_FLM_SLOT_NUM] = {
+    FLASH_FLM_SLOT_OPS(0),
+#if FLASH_FLM_SLOT_NUM > 1
+    FLASH_FLM_SLOT_OPS(1),
+#endif
+#if FLASH_FLM_SLOT_NUM > 2
+    FLASH_FLM_SLOT_OPS(2),
+#endif
+#if FLASH_FLM_SLOT_NUM > 3
+    FLASH_FLM_SLOT_OPS(3),
+#endif
+};
+
+/*
+ * Function: flash_flm_load_image
+ * Description: Loads an FLM image, see flash_flm_load().
+ * Parameters:
+ *   - ptFlm: Receives the algorithm.
+ *   - ptImage: The image.
+ *   - pExec: Execution region, word aligned.
+ *   - wExecSize: Size of the region.
+ * Returns: FLASH_FLM_OK or the reason the image is refused.
+ */
+static flash_flm_err_t flash_flm_load_image(flash_flm_t *ptFlm, const flash_flm_image_t *ptImage, void *pExec,
+                                            size_t wExecSize)
+{
+    flash_flm_section_t tSection[FLASH_FLM_SECTION_NUM];
+    const flash_flm_section_t *ptCode = &tSection[FLASH_FLM_PRG_CODE];
+    const flash_flm_section_t *ptData = &tSection[FLASH_FLM_PRG_DATA];
+    uint32_t wOffset[FLASH_FLM_ENTRY_NUM];
+    uint8_t *pchExec = (uint8_t *)pExec;
+    flash_flm_err_t tErr;
+    uint8_t chSlot;
+
+    for (chSlot = 0; chSlot < FLASH_FLM_SLOT_NUM; chSlot++) {
+        if (s_ptSlot[chSlot] == ptFlm) {
+            /*loaded and registered already*/
+            return FLASH_FLM_ERR_SLOT;
+        }
+    }
+
+    if ((tErr = flash_flm_sections(ptImage, tSection)) != FLASH_FLM_OK ||
+        (tErr = flash_flm_entries(ptImage, tSection, wOffset)) != FLASH_FLM_OK ||
+        (tErr = flash_flm_dev(ptImage, &tSection[FLASH_FLM_DEV_DSCR], &ptFlm->tDev)) != FLASH_FLM_OK) {
+        return tErr;
+    }
+
+    ptFlm->wExecUsed = ((size_t)ptData->wAddr + ptData->wSize + 3) & ~(size_t)3;
+    if (pchExec == NULL || ((uintptr_t)pchExec & 3) != 0 || ptData->wSize > wExecSize ||
+        ptFlm->wExecUsed > wExecSize) {
+        return FLASH_FLM_ERR_EXEC;
+    }
+
+    for (chSlot = 0; chSlot < FLASH_FLM_SLOT_NUM && s_ptSlot[chSlot] != NULL; chSlot++);
+    if (chSlot == FLASH_FLM_SLOT_NUM) {
+        return FLASH_FLM_ERR_SLOT;
+    }
+
+    /*PrgCode, the gap up to PrgData and a zero initialised PrgData are cleared first*/
+    memset(pchExec, 0, ptFlm->wExecUsed);
+    if (!flash_flm_read(ptImage, ptCode->wOffset, pchExec, ptCode->wSize) ||
+        (ptData->wType != FLASH_FLM_SHT_NOBITS &&
+         !flash_flm_read(ptImage, ptData->wOffset, pchExec + ptData->wAddr, ptData->wSize))) {
+        return FLASH_FLM_ERR_READ;
+    }
+    FLASH_FLM_CODE_SYNC(pchExec, ptFlm->wExecUsed);
+
+    for (uint8_t e = 0; e < FLASH_FLM_ENTRY_NUM; e++) {
+        ptFlm->wEntry[e] = (wOffset[e] != 0) ? (uintptr_t)pchExec + wOffset[e] : 0;
+    }
+    ptFlm->pStaticBase = pchExec + ptData->wAddr;
+
+    memset(&ptFlm->tBlob, 0, sizeof(ptFlm->tBlob));
+    ptFlm->tBlob.ptFlashDev = &ptFlm->tDev;
+    ptFlm->tBlob.tFlashops = c_tSlotOps[chSlot];
+    if (ptFlm->wEntry[FLASH_FLM_ERASE_CHIP] == 0) {
+        ptFlm->tBlob.tFlashops.EraseChip = NULL;
+    }
+
+    s_ptSlot[chSlot] = ptFlm;
+    if (!flash_dev_register(&ptFlm->tBlob)) {
+        s_ptSlot[chSlot] = NULL;
+        return FLASH_FLM_ERR_REGISTER;
+    }
+
+    return FLASH_FLM_OK;
+}
+
+/*
+ * Function: flash_flm_load
+ * Description: Loads an FLM image from memory: checks the ELF headers,
+ *              the entry points and DevDscr, copies PrgCode/PrgData into
+ *              the execution region and registers the device. Nothing is
+ *              registered if it fails.
+ * Parameters:
+ *   - ptFlm: Receives the algorithm, must stay valid until reset.
+ *   - pImage: The FLM file.
+ *   - wSize: Size of the file.
+ *   - pExec: Execution region, word aligned. It must be executable RAM
+ *     and stay reserved for the algorithm.
+ *   - wExecSize: Size of the region, at least PrgCode plus PrgData.
+ * Returns: FLASH_FLM_OK or the reason the image is refused.
+ */
+flash_flm_err_t flash_flm_load(flash_flm_t *ptFlm, const void *pImage, size_t wSize, void *pExec,
+                               size_t wExecSize)
+{
+    flash_flm_image_t tImage = {.pchBuf = (const uint8_t *)pImage, .wSize = wSize};
+
+    if (ptFlm == NULL || pImage == NULL) {
+        return FLASH_FLM_ERR_READ;
+    }
+    return flash_flm_load_image(ptFlm, &tImage, pExec, wExecSize);
+}
+
+/*
+ * Function: flash_flm_load_from
+ * Description: Loads an FLM image stored in a flash partition, as
+ *              flash_flm_load(). The image is read piecewise through
+ *              target_flash_read(), so it need not be memory mapped.
+ * Parameters:
+ *   - ptFlm: Receives the algorithm, must stay valid until reset.
+ *   - addr: Flash address of the FLM file.
+ *   - wSize: Size of the file.
+ *   - pExec: Execution region, as for flash_flm_load().
+ *   - wExecSize: Size of the region.
+ * Returns: FLASH_FLM_OK or the reason the image is refused.
+ */
+flash_flm_err_t flash_flm_load_from(flash_flm_t *ptFlm, uint32_t addr, size_t wSize, void *pExec,
+                                    size_t wExecSize)
+{
+    flash_flm_image_t tImage = {.pchBuf = NULL, .wAddr = addr, .wSize = wSize};
+
+    if (ptFlm == NULL) {
+        return FLASH_FLM_ERR_READ;
+    }
+    return flash_flm_load_image(ptFlm, &tImage, pExec, wExecSize);
+}
@@ -0,0 +1,570 @@
+/****************************************************************************
+*  Copyright 2022 KK (https://github.com/WALI-KANG)                                    *
+*                                                                           *
+*  Licensed under the Apache License, Version 2.0 (the "License");          *
+*  you may not use this file except in compliance with the License.         *
+*  You may obtain a copy of the License at                                  *
+*                                                                           *
+*     http://www.apache.org/licenses/LICENSE-2.0                            *
+*                                                                           *
+*  Unless required by applicable law or agreed to in writing, software      *
+*  distributed under the License is distributed on an "AS IS" BASIS,        *
+*  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. *
+*  See the License for the specific language governing permissions and      *
+*  limitations under the License.                                           *
+*                                                                           *
+****************************************************************************/
+#include "flash_kv.h"
+
+#define FLASH_KV_ADDR_NONE      0xFFFFFFFFu     // slot never used, ends a probe sequence
+#define FLASH_KV_ADDR_DELETED   0xFFFFFFFEu     // slot of a deleted key, probing continues
+#define FLASH_KV_SEG_MAGIC      0x31564B46u     // "FKV1"
+#define FLASH_KV_SEG_COMPACTED  0x504D4F43u     // "COMP", compaction into the segment finished
+#define FLASH_KV_REC_VALID      0x5A
+#define FLASH_KV_REC_DELETED    0x3C
+
+/* Start of every segment, followed by one write unit for the compaction marker
+ * and the records, all aligned to the write granularity */
+typedef struct {
+    uint32_t wMagic;
+    uint32_t wSeq;                  // increases by one for every segment opened
+} flash_kv_seg_hdr_t;
+
+typedef struct {
+    uint8_t  chState;               // FLASH_KV_REC_VALID or FLASH_KV_REC_DELETED
+    uint8_t  chKeyLen;
+    uint16_t hwValLen;
+    uint32_t wCrc;                  // CRC32 of the fields above, the key and the value
+} flash_kv_rec_hdr_t;
+
+/* record being read or written, the store is not reentrant */
+static uint8_t s_chRec[sizeof(flash_kv_rec_hdr_t) + FLASH_KV_KEY_MAX + FLASH_KV_VALUE_MAX];
+
+static uint32_t flash_kv_align(const flash_kv_t *ptKv, uint32_t wSize)
+{
+    return (wSize + ptKv->wUnit - 1) & ~(ptKv->wUnit - 1);
+}
+
+static uint32_t flash_kv_seg_addr(const flash_kv_t *ptKv, uint16_t hwSeg)
+{
+    return ptKv->wBase + (uint32_t)hwSeg * ptKv->wSegSize;
+}
+
+static uint32_t flash_kv_seg_data(const flash_kv_t *ptKv, uint16_t hwSeg)
+{
+    return flash_kv_seg_addr(ptKv, hwSeg) + flash_kv_align(ptKv, sizeof(flash_kv_seg_hdr_t)) +
+           flash_kv_align(ptKv, sizeof(uint32_t));
+}
+
+static uint32_t flash_kv_hash(const uint8_t *pchKey, size_t wLen)
+{
+    uint32_t wHash = 2166136261u;
+
+    while (wLen--) {
+        wHash = (wHash ^ *pchKey++) * 16777619u;
+    }
+    return wHash;
+}
+
+static bool flash_kv_is_empty(const flash_kv_t *ptKv, const uint8_t *pchData, size_t wLen)
+{
+    while (wLen--) {
+        if (*pchData++ != ptKv->chEmpty) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * Function: flash_kv_load
+ * Description: Reads the record at addr into s_chRec.
+ * Parameters:
+ *   - ptKv: Store.
+ *   - addr: Record address.
+ *   - wLimit: End of the segment.
+ *   - pbIntact: Receives whether the CRC matched.
+ * Returns: Aligned record length, 0 at the end of the log, -1 if the data
+ *          at addr is not a record.
+ */
+static int32_t flash_kv_load(flash_kv_t *ptKv, uint32_t addr, uint32_t wLimit, bool *pbIntact)
+{
+    flash_kv_rec_hdr_t *ptHdr = (flash_kv_rec_hdr_t *)s_chRec;
+
+    if (wLimit - addr < sizeof(flash_kv_rec_hdr_t)) {
+        return 0;
+    }
+    if (target_flash_read(addr, s_chRec, sizeof(flash_kv_rec_hdr_t)) != sizeof(flash_kv_rec_hdr_t)) {
+        return -1;
+    }
+    if (flash_kv_is_empty(ptKv, s_chRec, sizeof(flash_kv_rec_hdr_t))) {
+        return 0;
+    }
+
+    uint32_t wLen = sizeof(flash_kv_rec_hdr_t) + ptHdr->chKeyLen + ptHdr->hwValLen;
+    if ((ptHdr->chState != FLASH_KV_REC_VALID && ptHdr->chState != FLASH_KV_REC_DELETED) ||
+        ptHdr->chKeyLen == 0 || ptHdr->chKeyLen > FLASH_KV_KEY_MAX ||
+        ptHdr->hwValLen > FLASH_KV_VALUE_MAX || flash_kv_align(ptKv, wLen) > wLimit - addr) {
+        return -1;
+    }
+    if (target_flash_read(addr + sizeof(flash_kv_rec_hdr_t), s_chRec + sizeof(flash_kv_rec_hdr_t),
+                          wLen - sizeof(flash_kv_rec_hdr_t)) != (int32_t)(wLen - sizeof(flash_kv_rec_hdr_t))) {
+        return -1;
+    }
+
+    uint32_t wCrc = flash_crc32(0, s_chRec, offsetof(flash_kv_rec_hdr_t, wCrc));
+    *pbIntact = (flash_crc32(wCrc, s_chRec + sizeof(flash_kv_rec_hdr_t), wLen - sizeof(flash_kv_rec_hdr_t))
+                 == ptHdr->wCrc);
+
+    return flash_kv_align(ptKv, wLen);
+}
+
+/*
+ * Function: flash_kv_lookup
+ * Description: Finds the index slot of a key by linear probing. Slots whose
+ *              hash matches are confirmed by reading the key of the record.
+ * Parameters:
+ *   - ptKv: Store.
+ *   - pchKey, wKeyLen: The key.
+ *   - wHash: flash_kv_hash() of the key.
+ *   - bInsert: Return a free slot if the key is not indexed.
+ * Returns: The slot, NULL if not found (or no free slot when inserting).
+ */
+static flash_kv_slot_t *flash_kv_lookup(flash_kv_t *ptKv, const uint8_t *pchKey, size_t wKeyLen,
+                                        uint32_t wHash, bool bInsert)
+{
+    uint8_t chKey[sizeof(flash_kv_rec_hdr_t) + FLASH_KV_KEY_MAX];
+    flash_kv_slot_t *ptReuse = NULL;
+
+    for (uint32_t i = 0; i < FLASH_KV_INDEX_NUM; i++) {
+        flash_kv_slot_t *ptSlot = &ptKv->tIndex[(wHash + i) & (FLASH_KV_INDEX_NUM - 1)];
+
+        if (ptSlot->wAddr == FLASH_KV_ADDR_NONE) {
+            return (ptReuse != NULL) ? ptReuse : (bInsert ? ptSlot : NULL);
+        }
+        if (ptSlot->wAddr == FLASH_KV_ADDR_DELETED) {
+            if (bInsert && ptReuse == NULL) {
+                ptReuse = ptSlot;
+            }
+            continue;
+        }
+        if (ptSlot->wHash == wHash &&
+            target_flash_read(ptSlot->wAddr, chKey, sizeof(flash_kv_rec_hdr_t) + wKeyLen)
+                == (int32_t)(sizeof(flash_kv_rec_hdr_t) + wKeyLen) &&
+            ((flash_kv_rec_hdr_t *)chKey)->chKeyLen == wKeyLen &&
+            memcmp(chKey + sizeof(flash_kv_rec_hdr_t), pchKey, wKeyLen) == 0) {
+            return ptSlot;
+        }
+    }
+
+    return ptReuse;
+}
+
+/*
+ * Function: flash_kv_index
+ * Description: Applies a record found at mount or copied by GC to the index.
+ * Parameters:
+ *   - ptKv: Store.
+ *   - addr: Record address, the record is in s_chRec.
+ * Returns: False if the index is full.
+ */
+static bool flash_kv_index(flash_kv_t *ptKv, uint32_t addr)
+{
+    flash_kv_rec_hdr_t *ptHdr = (flash_kv_rec_hdr_t *)s_chRec;
+    const uint8_t *pchKey = s_chRec + sizeof(flash_kv_rec_hdr_t);
+    uint32_t wHash = flash_kv_hash(pchKey, ptHdr->chKeyLen);
+    flash_kv_slot_t *ptSlot = flash_kv_lookup(ptKv, pchKey, ptHdr->chKeyLen, wHash,
+                                              ptHdr->chState == FLASH_KV_REC_VALID);
+
+    if (ptHdr->chState == FLASH_KV_REC_DELETED) {
+        if (ptSlot != NULL) {
+            ptSlot->wAddr = FLASH_KV_ADDR_DELETED;
+            ptKv->hwKeys--;
+        }
+        return true;
+    }
+    if (ptSlot == NULL) {
+        return false;
+    }
+    if (ptSlot->wAddr == FLASH_KV_ADDR_NONE || ptSlot->wAddr == FLASH_KV_ADDR_DELETED) {
+        ptKv->hwKeys++;
+    }
+    ptSlot->wHash = wHash;
+    ptSlot->wAddr = addr;
+    return true;
+}
+
+/*
+ * Function: flash_kv_seg_open
+ * Description: Starts a new head segment, which must be erased.
+ * Parameters:
+ *   - ptKv: Store.
+ *   - hwSeg: Segment index.
+ * Returns: True on success.
+ */
+static bool flash_kv_seg_open(flash_kv_t *ptKv, uint16_t hwSeg)
+{
+    flash_kv_seg_hdr_t tHdr = {FLASH_KV_SEG_MAGIC, ptKv->wSeq + 1};
+    uint32_t wAddr = flash_kv_seg_addr(ptKv, hwSeg);
+
+    if (target_flash_write(wAddr, (const uint8_t *)&tHdr, sizeof(tHdr)) != sizeof(tHdr) ||
+        !target_flash_sync(wAddr)) {
+        return false;
+    }
+    ptKv->hwHead = hwSeg;
+    ptKv->wSeq++;
+    ptKv->wWrite = flash_kv_seg_data(ptKv, hwSeg);
+    return true;
+}
+
+/*
+ * Function: flash_kv_seg_mark
+ * Description: Marks the head segment as the complete copy of a compaction,
+ *              so a reset while the source is erased does not roll it back.
+ * Parameters:
+ *   - ptKv: Store.
+ * Returns: True on success.
+ */
+static bool flash_kv_seg_mark(flash_kv_t *ptKv)
+{
+    uint32_t wAddr = flash_kv_seg_addr(ptKv, ptKv->hwHead) + flash_kv_align(ptKv, sizeof(flash_kv_seg_hdr_t));
+    uint32_t wMark = FLASH_KV_SEG_COMPACTED;
+    uint32_t wLen = flash_kv_align(ptKv, sizeof(wMark));
+
+    memset(s_chRec, ptKv->chEmpty, wLen);
+    memcpy(s_chRec, &wMark, sizeof(wMark));
+    return target_flash_write(wAddr, s_chRec, wLen) == (int32_t)wLen && target_flash_sync(wAddr);
+}
+
+static bool flash_kv_seg_erase(flash_kv_t *ptKv, uint16_t hwSeg)
+{
+    ptKv->wErases++;
+    return target_flash_erase(flash_kv_seg_addr(ptKv, hwSeg), ptKv->wSegSize) == (int32_t)ptKv->wSegSize;
+}
+
+/*
+ * Function: flash_kv_gc
+ * Description: Copies the live records of the oldest segment into the only
+ *              erased segment, which becomes the head, marks the copy
+ *              complete, then erases the oldest segment. Tombstones are dropped: every older record
+ *              of their key is in the same segment.
+ * Parameters:
+ *   - ptKv: Store.
+ * Returns: True on success.
+ */
+static bool flash_kv_gc(flash_kv_t *ptKv)
+{
+    uint16_t hwOld = ptKv->hwTail;
+    uint32_t wAddr = flash_kv_seg_data(ptKv, hwOld);
+    uint32_t wLimit = flash_kv_seg_addr(ptKv, hwOld) + ptKv->wSegSize;
+    int32_t nLen;
+    bool bIntact;
+
+    if (!flash_kv_seg_open(ptKv, (ptKv->hwHead + 1) % ptKv->hwSegNum)) {
+        return false;
+    }
+
+    while ((nLen = flash_kv_load(ptKv, wAddr, wLimit, &bIntact)) > 0) {
+        flash_kv_rec_hdr_t *ptHdr = (flash_kv_rec_hdr_t *)s_chRec;
+        const uint8_t *pchKey = s_chRec + sizeof(flash_kv_rec_hdr_t);
+
+        if (bIntact && ptHdr->chState == FLASH_KV_REC_VALID) {
+            flash_kv_slot_t *ptSlot = flash_kv_lookup(ptKv, pchKey, ptHdr->chKeyLen,
+                                                      flash_kv_hash(pchKey, ptHdr->chKeyLen), false);
+            if (ptSlot != NULL && ptSlot->wAddr == wAddr) {
+                /*still the latest record of its key*/
+                size_t wLen = sizeof(flash_kv_rec_hdr_t) + ptHdr->chKeyLen + ptHdr->hwValLen;
+                if (target_flash_write(ptKv->wWrite, s_chRec, wLen) != (int32_t)wLen) {
+                    return false;
+                }
+                ptSlot->wAddr = ptKv->wWrite;
+                ptKv->wWrite += nLen;
+            }
+        }
+        wAddr += nLen;
+    }
+
+    if (!target_flash_sync(ptKv->wBase) || !flash_kv_seg_mark(ptKv) || !flash_kv_seg_erase(ptKv, hwOld)) {
+        return false;
+    }
+    ptKv->hwTail = (hwOld + 1) % ptKv->hwSegNum;
+    ptKv->wGcRuns++;
+    return true;
+}
+
+/*
+ * Function: flash_kv_reserve
+ * Description: Makes room for a record in the head segment. A new segment
+ *              is opened while at least two are erased, otherwise the
+ *              oldest one is compacted.
+ * Parameters:
+ *   - ptKv: Store.
+ *   - wLen: Aligned record length.
+ * Returns: False if the store is full.
+ */
+static bool flash_kv_reserve(flash_kv_t *ptKv, uint32_t wLen)
+{
+    for (uint16_t i = 0; i <= ptKv->hwSegNum; i++) {
+        uint32_t wEnd = flash_kv_seg_addr(ptKv, ptKv->hwHead) + ptKv->wSegSize;
+        uint16_t hwUsed = (ptKv->hwHead + ptKv->hwSegNum - ptKv->hwTail) % ptKv->hwSegNum + 1;
+
+        if (wEnd - ptKv->wWrite >= wLen) {
+            return true;
+        }
+        if (ptKv->hwSegNum - hwUsed >= 2) {
+            if (!flash_kv_seg_open(ptKv, (ptKv->hwHead + 1) % ptKv->hwSegNum)) {
+                return false;
+            }
+        } else if (!flash_kv_gc(ptKv)) {
+            return false;
+        }
+    }
+    return false;
+}
+
+/*
+ * Function: flash_kv_append
+ * Description: Appends a record and programs it right away.
+ * Parameters:
+ *   - ptKv: Store.
+ *   - chState: FLASH_KV_REC_VALID or FLASH_KV_REC_DELETED.
+ *   - pchKey, wKeyLen: The key.
+ *   - pValue, wSize: The value.
+ * Returns: Address of the record, FLASH_KV_ADDR_NONE on failure.
+ */
+static uint32_t flash_kv_append(flash_kv_t *ptKv, uint8_t chState, const char *pchKey, size_t wKeyLen,
+                                const void *pValue, size_t wSize)
+{
+    flash_kv_rec_hdr_t *ptHdr = (flash_kv_rec_hdr_t *)s_chRec;
+    size_t wLen = sizeof(flash_kv_rec_hdr_t) + wKeyLen + wSize;
+    uint32_t wAddr;
+
+    if (!flash_kv_reserve(ptKv, flash_kv_align(ptKv, wLen))) {
+        return FLASH_KV_ADDR_NONE;
+    }
+
+    ptHdr->chState = chState;
+    ptHdr->chKeyLen = (uint8_t)wKeyLen;
+    ptHdr->hwValLen = (uint16_t)wSize;
+    memcpy(s_chRec + sizeof(flash_kv_rec_hdr_t), pchKey, wKeyLen);
+    if (wSize != 0) {
+        memcpy(s_chRec + sizeof(flash_kv_rec_hdr_t) + wKeyLen, pValue, wSize);
+    }
+    ptHdr->wCrc = flash_crc32(flash_crc32(0, s_chRec, offsetof(flash_kv_rec_hdr_t, wCrc)),
+                               s_chRec + sizeof(flash_kv_rec_hdr_t), wKeyLen + wSize);
+
+    wAddr = ptKv->wWrite;
+    if (target_flash_write(wAddr, s_chRec, wLen) != (int32_t)wLen || !target_flash_sync(wAddr)) {
+        /*the space is lost, the next mount skips the torn record*/
+        ptKv->wWrite += flash_kv_align(ptKv, wLen);
+        return FLASH_KV_ADDR_NONE;
+    }
+    ptKv->wWrite += flash_kv_align(ptKv, wLen);
+    return wAddr;
+}
+
+/*
+ * Function: flash_kv_mount
+ * Description: Attaches a store to [addr, addr + size) and builds the RAM
+ *              index with one scan. An empty or foreign range is formatted.
+ *              A compaction interrupted by a reset is rolled back, or
+ *              finished if only the erase of its source was cut short.
+ * Parameters:
+ *   - ptKv: Store object owned by the caller.
+ *   - addr: Start of the range, sector aligned.
+ *   - size: Size of the range, at least two sectors of equal size.
+ * Returns: True on success.
+ */
+bool flash_kv_mount(flash_kv_t *ptKv, uint32_t addr, size_t size)
+{
+    const flash_blob_t *ptBlob = flash_dev_find(addr);
+    flash_sector_t tSector, tLast;
+    flash_kv_seg_hdr_t tHdr;
+    uint16_t hwUsed = 0;
+
+    if (ptKv == NULL || ptBlob == NULL || !target_flash_sector_info(addr, &tSector) ||
+        tSector.wAddr != addr || size < 2 * tSector.wSize || size % tSector.wSize != 0 ||
+        !target_flash_sector_info(addr + size - 1, &tLast) || tLast.wSize != tSector.wSize ||
+        tLast.wIndex - tSector.wIndex + 1 != size / tSector.wSize) {
+        return false;
+    }
+
+    memset(ptKv, 0, sizeof(*ptKv));
+    for (uint32_t i = 0; i < FLASH_KV_INDEX_NUM; i++) {
+        ptKv->tIndex[i].wAddr = FLASH_KV_ADDR_NONE;
+    }
+    ptKv->wBase = addr;
+    ptKv->wSegSize = tSector.wSize;
+    ptKv->hwSegNum = size / tSector.wSize;
+    ptKv->wUnit = ptBlob->wWriteGranularity ? ptBlob->wWriteGranularity : 4;
+    ptKv->chEmpty = ptBlob->ptFlashDev->valEmpty;
+
+    /*classify the segments, the used ones form a run of sequence numbers*/
+    for (uint16_t i = 0; i < ptKv->hwSegNum; i++) {
+        if (target_flash_read(flash_kv_seg_addr(ptKv, i), (uint8_t *)&tHdr, sizeof(tHdr)) != sizeof(tHdr)) {
+            return false;
+        }
+        if (tHdr.wMagic == FLASH_KV_SEG_MAGIC) {
+            if (hwUsed == 0 || (int32_t)(tHdr.wSeq - ptKv->wSeq) > 0) {
+                ptKv->hwHead = i;
+                ptKv->wSeq = tHdr.wSeq;
+            }
+            hwUsed++;
+        } else if (!flash_kv_is_empty(ptKv, (const uint8_t *)&tHdr, sizeof(tHdr)) && !flash_kv_seg_erase(ptKv, i)) {
+            return false;
+        }
+    }
+
+    if (hwUsed == 0) {
+        ptKv->wSeq = 0;
+        return flash_kv_seg_open(ptKv, 0);
+    }
+    if (hwUsed == ptKv->hwSegNum) {
+        /*no erased segment left: a compaction into the head was cut short*/
+        uint32_t wMark;
+
+        if (target_flash_read(flash_kv_seg_addr(ptKv, ptKv->hwHead) + flash_kv_align(ptKv, sizeof(tHdr)),
+                              (uint8_t *)&wMark, sizeof(wMark)) != sizeof(wMark)) {
+            return false;
+        }
+        if (wMark == FLASH_KV_SEG_COMPACTED) {
+            /*the copy is complete, only the oldest segment was not erased yet*/
+            if (!flash_kv_seg_erase(ptKv, (ptKv->hwHead + 1) % ptKv->hwSegNum)) {
+                return false;
+            }
+        } else {
+            if (!flash_kv_seg_erase(ptKv, ptKv->hwHead)) {
+                return false;
+            }
+            ptKv->hwHead = (ptKv->hwHead + ptKv->hwSegNum - 1) % ptKv->hwSegNum;
+            ptKv->wSeq--;
+        }
+        hwUsed--;
+    }
+    ptKv->hwTail = (ptKv->hwHead + ptKv->hwSegNum - hwUsed + 1) % ptKv->hwSegNum;
+
+    /*replay oldest to newest, later records win*/
+    for (uint16_t k = 0; k < hwUsed; k++) {
+        uint16_t hwSeg = (ptKv->hwTail + k) % ptKv->hwSegNum;
+        uint32_t wAddr = flash_kv_seg_data(ptKv, hwSeg);
+        uint32_t wLimit = flash_kv_seg_addr(ptKv, hwSeg) + ptKv->wSegSize;
+        int32_t nLen;
+        bool bIntact;
+
+        while ((nLen = flash_kv_load(ptKv, wAddr, wLimit, &bIntact)) > 0) {
+            if (bIntact && !flash_kv_index(ptKv, wAddr)) {
+                return false;
+            }
+            wAddr += nLen;
+        }
+        if (hwSeg == ptKv->hwHead) {
+            /*unreadable data ends the head, appends continue in the next segment*/
+            ptKv->wWrite = (nLen < 0) ? wLimit : wAddr;
+        }
+    }
+
+    return true;
+}
+
+/*
+ * Function: flash_kv_get
+ * Description: Reads the value of a key, located through the RAM index.
+ * Parameters:
+ *   - ptKv: Mounted store.
+ *   - pchKey: Zero terminated key.
+ *   - pBuf: Receives up to wSize bytes of the value.
+ *   - wSize: Size of pBuf.
+ * Returns: Length of the stored value, -1 if the key does not exist.
+ */
+int32_t flash_kv_get(flash_kv_t *ptKv, const char *pchKey, void *pBuf, size_t wSize)
+{
+    size_t wKeyLen = strlen(pchKey);
+    flash_kv_rec_hdr_t *ptHdr = (flash_kv_rec_hdr_t *)s_chRec;
+    bool bIntact = false;
+
+    if (wKeyLen == 0 || wKeyLen > FLASH_KV_KEY_MAX) {
+        return -1;
+    }
+
+    flash_kv_slot_t *ptSlot = flash_kv_lookup(ptKv, (const uint8_t *)pchKey, wKeyLen,
+                                              flash_kv_hash((const uint8_t *)pchKey, wKeyLen), false);
+    if (ptSlot == NULL ||
+        flash_kv_load(ptKv, ptSlot->wAddr, ptSlot->wAddr + ptKv->wSegSize, &bIntact) <= 0 || !bIntact) {
+        return -1;
+    }
+
+    memcpy(pBuf, s_chRec + sizeof(flash_kv_rec_hdr_t) + wKeyLen, (wSize < ptHdr->hwValLen) ? wSize : ptHdr->hwValLen);
+    return ptHdr->hwValLen;
+}
+
+/*
+ * Function: flash_kv_set
+ * Description: Stores a value; costs one record append, no erase unless
+ *              the store has to be compacted.
+ * Parameters:
+ *   - ptKv: Mounted store.
+ *   - pchKey: Zero terminated key, at most FLASH_KV_KEY_MAX bytes.
+ *   - pValue: The value.
+ *   - wSize: Value length, at most FLASH_KV_VALUE_MAX bytes.
+ * Returns: True on success.
+ */
+bool flash_kv_set(flash_kv_t *ptKv, const char *pchKey, const void *pValue, size_t wSize)
+{
+    size_t wKeyLen = strlen(pchKey);
+
+    if (wKeyLen == 0 || wKeyLen > FLASH_KV_KEY_MAX || wSize > FLASH_KV_VALUE_MAX) {
+        return false;
+    }
+
+    uint32_t wHash = flash_kv_hash((const uint8_t *)pchKey, wKeyLen);
+    if (flash_kv_lookup(ptKv, (const uint8_t *)pchKey, wKeyLen, wHash, true) == NULL) {
+        /*index full*/
+        return false;
+    }
+
+    uint32_t wAddr = flash_kv_append(ptKv, FLASH_KV_REC_VALID, pchKey, wKeyLen, pValue, wSize);
+    if (wAddr == FLASH_KV_ADDR_NONE) {
+        return false;
+    }
+
+    /*compaction may have moved records, look the slot up again*/
+    flash_kv_slot_t *ptSlot = flash_kv_lookup(ptKv, (const uint8_t *)pchKey, wKeyLen, wHash, true);
+    if (ptSlot->wAddr == FLASH_KV_ADDR_NONE || ptSlot->wAddr == FLASH_KV_ADDR_DELETED) {
+        ptKv->hwKeys++;
+    }
+    ptSlot->wHash = wHash;
+    ptSlot->wAddr = wAddr;
+    return true;
+}
+
+/*
+ * Function: flash_kv_delete
+ * Description: Removes a key by appending a tombstone record.
+ * Parameters:
+ *   - ptKv: Mounted store.
+ *   - pchKey: Zero terminated key.
+ * Returns: True if the key does not exist afterwards.
+ */
+bool flash_kv_delete(flash_kv_t *ptKv, const char *pchKey)
+{
+    size_t wKeyLen = strlen(pchKey);
+
+    if (wKeyLen == 0 || wKeyLen > FLASH_KV_KEY_MAX) {
+        return false;
+    }
+
+    uint32_t wHash = flash_kv_hash((const uint8_t *)pchKey, wKeyLen);
+    if (flash_kv_lookup(ptKv, (const uint8_t *)pchKey, wKeyLen, wHash, false) == NULL) {
+        return true;
+    }
+    if (flash_kv_append(ptKv, FLASH_KV_REC_DELETED, pchKey, wKeyLen, NULL, 0) == FLASH_KV_ADDR_NONE) {
+        return false;
+    }
+
+    flash_kv_slot_t *ptSlot = flash_kv_lookup(ptKv, (const uint8_t *)pchKey, wKeyLen, wHash, false);
+    if (ptSlot != NULL) {
+        ptSlot->wAddr = FLASH_KV_ADDR_DELETED;
+        ptKv->hwKeys--;
+    }
+    return true;
+}
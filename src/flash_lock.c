@@ -0,0 +1,109 @@
+/****************************************************************************
+*  Copyright 2022 KK (https://github.com/WALI-KANG)                                    *
+*                                                                           *
+*  Licensed under the Apache License, Version 2.0 (the "License");          *
+*  you may not use this file except in compliance with the License.         *
+*  You may obtain a copy of the License at                                  *
+*                                                                           *
+*     http://www.apache.org/licenses/LICENSE-2.0                            *
+*                                                                           *
+*  Unless required by applicable law or agreed to in writing, software      *
+*  distributed under the License is distributed on an "AS IS" BASIS,        *
+*  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. *
+*  See the License for the specific language governing permissions and      *
+*  limitations under the License.                                           *
+*                                                                           *
+****************************************************************************/
+#include "flash_lock.h"
+
+#if FLASH_BLOB_OS != FLASH_OS_NONE
+
+/*
+ * Function: flash_rwlock_init
+ * Description: Creates the mutexes and the semaphore of a lock. Does
+ *              nothing if the lock is initialised already, so it must not
+ *              race with its own first call, e.g. run it before the tasks
+ *              are started.
+ * Parameters:
+ *   - ptLock: The lock.
+ * Returns: True if the lock can be used.
+ */
+bool flash_rwlock_init(flash_rwlock_t *ptLock)
+{
+    if (ptLock->bReady) {
+        return true;
+    }
+    ptLock->hwReaders = 0;
+    ptLock->bDrain = false;
+    ptLock->bReady = flash_os_mutex_init(&ptLock->tGate) &&
+                     flash_os_mutex_init(&ptLock->tCount) &&
+                     flash_os_sem_init(&ptLock->tDrained, 0);
+
+    return ptLock->bReady;
+}
+
+/*
+ * Function: flash_rwlock_read
+ * Description: Takes the lock shared with other readers. Waits while a
+ *              writer holds the lock or waits for it.
+ * Parameters:
+ *   - ptLock: The lock.
+ */
+void flash_rwlock_read(flash_rwlock_t *ptLock)
+{
+    flash_os_mutex_lock(&ptLock->tGate);
+    flash_os_mutex_lock(&ptLock->tCount);
+    ptLock->hwReaders++;
+    flash_os_mutex_unlock(&ptLock->tCount);
+    flash_os_mutex_unlock(&ptLock->tGate);
+}
+
+/*
+ * Function: flash_rwlock_read_release
+ * Description: Releases a lock taken by flash_rwlock_read().
+ * Parameters:
+ *   - ptLock: The lock.
+ */
+void flash_rwlock_read_release(flash_rwlock_t *ptLock)
+{
+    flash_os_mutex_lock(&ptLock->tCount);
+    if (--ptLock->hwReaders == 0 && ptLock->bDrain) {
+        /*the writer holding the gate waits for the last reader*/
+        ptLock->bDrain = false;
+        flash_os_sem_give(&ptLock->tDrained);
+    }
+    flash_os_mutex_unlock(&ptLock->tCount);
+}
+
+/*
+ * Function: flash_rwlock_write
+ * Description: Takes the lock exclusively. Readers arriving meanwhile wait
+ *              until the writer has released it.
+ * Parameters:
+ *   - ptLock: The lock.
+ */
+void flash_rwlock_write(flash_rwlock_t *ptLock)
+{
+    bool bWait;
+
+    flash_os_mutex_lock(&ptLock->tGate);
+    flash_os_mutex_lock(&ptLock->tCount);
+    bWait = (ptLock->hwReaders != 0);
+    ptLock->bDrain = bWait;
+    flash_os_mutex_unlock(&ptLock->tCount);
+    if (bWait) {
+        flash_os_sem_take(&ptLock->tDrained);
+    }
+}
+
+/*
+ * Function: flash_rwlock_write_release
+ * Description: Releases a lock taken by flash_rwlock_write().
+ * Parameters:
+ *   - ptLock: The lock.
+ */
+void flash_rwlock_write_release(flash_rwlock_t *ptLock)
+{
+    flash_os_mutex_unlock(&ptLock->tGate);
+}
+#endif
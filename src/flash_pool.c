@@ -0,0 +1,353 @@
+/****************************************************************************
+*  Copyright 2022 KK (https://github.com/WALI-KANG)                                    *
+*                                                                           *
+*  Licensed under the Apache License, Version 2.0 (the "License");          *
+*  you may not use this file except in compliance with the License.         *
+*  You may obtain a copy of the License at                                  *
+*                                                                           *
+*     http://www.apache.org/licenses/LICENSE-2.0                            *
+*                                                                           *
+*  Unless required by applicable law or agreed to in writing, software      *
+*  distributed under the License is distributed on an "AS IS" BASIS,        *
+*  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. *
+*  See the License for the specific language governing permissions and      *
+*  limitations under the License.                                           *
+*                                                                           *
+****************************************************************************/
+#include "flash_pool.h"
+
+#define FLASH_POOL_CHECK_SIZE   64      // bytes read per step of a blank check
+
+/*
+ * Function: flash_pool_erased
+ * Description: Completion callback of the background erase, runs in
+ *              whatever context polled the device. Only a sector still
+ *              marked as erasing changes: flash_pool_take() may have taken
+ *              it meanwhile.
+ * Parameters:
+ *   - ptReq: The finished or cancelled request.
+ */
+static void flash_pool_erased(flash_req_t *ptReq)
+{
+    flash_pool_t *ptPool = (flash_pool_t *)ptReq->pTarget;
+    uint8_t *pchState = &ptPool->chState[ptPool->hwErasing];
+
+    safe_atom_code(){
+        if (*pchState == FLASH_POOL_ERASING) {
+            *pchState = (ptReq->chStatus == FLASH_REQ_DONE) ? FLASH_POOL_READY : FLASH_POOL_DIRTY;
+        }
+    }
+    if (ptReq->chStatus == FLASH_REQ_DONE) {
+        ptPool->tStat.wErased++;
+    } else if (ptReq->chStatus == FLASH_REQ_CANCELLED) {
+        ptPool->tStat.wCancelled++;
+    }
+    /*tReq and hwErasing may be reused from now on*/
+    ptPool->bBusy = false;
+}
+
+static bool flash_pool_sector(const flash_pool_t *ptPool, uint16_t hwSector, flash_sector_t *ptSector)
+{
+    return target_flash_sector_at(ptPool->wAddr, ptPool->wFirst + hwSector, ptSector);
+}
+
+/*
+ * Function: flash_pool_index
+ * Description: Finds the pool sector holding an address.
+ * Parameters:
+ *   - ptPool: Pool.
+ *   - addr: Any address of the sector.
+ * Returns: Sector number within the pool, -1 if addr is outside.
+ */
+static int32_t flash_pool_index(const flash_pool_t *ptPool, uint32_t addr)
+{
+    flash_sector_t tSector;
+
+    if (addr - ptPool->wAddr >= ptPool->wSize || !target_flash_sector_info(addr, &tSector)) {
+        return -1;
+    }
+    return (int32_t)(tSector.wIndex - ptPool->wFirst);
+}
+
+/*
+ * Function: flash_pool_depth
+ * Description: Counts the erased sectors from the next one to hand out up
+ *              to the first one the writer still owns.
+ * Parameters:
+ *   - ptPool: Pool.
+ *   - phwNext: Receives the first sector in that run which is neither
+ *              erased nor being erased, hwSectors if there is none.
+ * Returns: The pool depth.
+ */
+static uint16_t flash_pool_depth(const flash_pool_t *ptPool, uint16_t *phwNext)
+{
+    uint16_t hwDepth = 0;
+
+    *phwNext = ptPool->hwSectors;
+    for (uint16_t i = 0; i < ptPool->hwSectors; i++) {
+        uint16_t hwSector = (ptPool->hwNext + i) % ptPool->hwSectors;
+        uint8_t chState = ptPool->chState[hwSector];
+
+        if (chState == FLASH_POOL_OWNED) {
+            break;
+        }
+        if (chState == FLASH_POOL_READY) {
+            hwDepth++;
+        } else if (*phwNext == ptPool->hwSectors && chState != FLASH_POOL_ERASING) {
+            *phwNext = hwSector;
+        }
+    }
+    return hwDepth;
+}
+
+/*
+ * Function: flash_pool_is_blank
+ * Description: Checks whether a piece of a sector reads as erased, in place
+ *              for memory mapped devices.
+ * Parameters:
+ *   - addr: Start of the piece.
+ *   - size: Bytes, at most FLASH_POOL_CHECK_SIZE.
+ *   - chEmpty: valEmpty of the device.
+ * Returns: True if every byte is chEmpty.
+ */
+static bool flash_pool_is_blank(uint32_t addr, uint32_t size, uint8_t chEmpty)
+{
+    const uint8_t *pchData = target_flash_map(addr, size);
+    uint8_t chBuf[FLASH_POOL_CHECK_SIZE];
+
+    if (pchData == NULL) {
+        if (target_flash_read(addr, chBuf, size) != (int32_t)size) {
+            return false;
+        }
+        pchData = chBuf;
+    }
+    for (uint32_t i = 0; i < size; i++) {
+        if (pchData[i] != chEmpty) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * Function: flash_pool_init
+ * Description: Sets up a pool over [addr, addr + size). The state of the
+ *              sectors is unknown: flash_pool_idle() blank checks them
+ *              before erasing. Sectors holding data to keep are marked
+ *              with flash_pool_claim() before the first flash_pool_idle().
+ * Parameters:
+ *   - ptPool: Pool owned by the caller.
+ *   - addr: Region start, sector aligned.
+ *   - size: Region size, whole sectors, at most FLASH_POOL_SECTOR_MAX.
+ *   - hwTarget: Erased sectors to keep ready.
+ * Returns: True on success.
+ */
+bool flash_pool_init(flash_pool_t *ptPool, uint32_t addr, size_t size, uint16_t hwTarget)
+{
+    flash_sector_t tFirst, tLast;
+
+    if (ptPool == NULL || size == 0 || !target_flash_sector_info(addr, &tFirst) || tFirst.wAddr != addr ||
+        !target_flash_sector_info(addr + size - 1, &tLast) || tLast.wAddr + tLast.wSize != addr + size ||
+        tLast.wIndex - tFirst.wIndex + 1 > FLASH_POOL_SECTOR_MAX || flash_dev_find(addr) != flash_dev_find(tLast.wAddr)) {
+        return false;
+    }
+
+    memset(ptPool, 0, sizeof(*ptPool));
+    ptPool->wAddr = addr;
+    ptPool->wSize = size;
+    ptPool->wFirst = tFirst.wIndex;
+    ptPool->hwSectors = tLast.wIndex - tFirst.wIndex + 1;
+    ptPool->hwTarget = (hwTarget < ptPool->hwSectors) ? hwTarget : ptPool->hwSectors;
+    ptPool->tStat.hwMinDepth = 0xFFFF;
+    return true;
+}
+
+/*
+ * Function: flash_pool_claim
+ * Description: Marks a sector as owned by the writer, e.g. one of a log
+ *              found at startup. flash_pool_take() continues after the
+ *              sector claimed last.
+ * Parameters:
+ *   - ptPool: Pool.
+ *   - addr: Any address of the sector.
+ * Returns: True if the sector is in the pool and not being erased.
+ */
+bool flash_pool_claim(flash_pool_t *ptPool, uint32_t addr)
+{
+    int32_t nSector = flash_pool_index(ptPool, addr);
+    bool bResult = false;
+
+    if (nSector < 0) {
+        return false;
+    }
+    FLASH_POOL_LOCK(ptPool);
+    if (ptPool->chState[nSector] != FLASH_POOL_ERASING) {
+        ptPool->chState[nSector] = FLASH_POOL_OWNED;
+        ptPool->hwNext = (nSector + 1) % ptPool->hwSectors;
+        bResult = true;
+    }
+    FLASH_POOL_UNLOCK(ptPool);
+    return bResult;
+}
+
+/*
+ * Function: flash_pool_take
+ * Description: Hands the next sector in ring order to the writer, erased.
+ *              A sector that is not erased yet is a miss: it is erased
+ *              right away, cancelling a background erase of it.
+ * Parameters:
+ *   - ptPool: Pool.
+ *   - ptSector: Receives the sector.
+ * Returns: False if the writer owns every sector, or the erase failed.
+ */
+bool flash_pool_take(flash_pool_t *ptPool, flash_sector_t *ptSector)
+{
+    uint16_t hwSector, hwDirty;
+    bool bReady = false, bResult = false;
+
+    FLASH_POOL_LOCK(ptPool);
+    hwSector = ptPool->hwNext;
+    uint16_t hwDepth = flash_pool_depth(ptPool, &hwDirty);
+    if (hwDepth < ptPool->tStat.hwMinDepth) {
+        ptPool->tStat.hwMinDepth = hwDepth;
+    }
+
+    if (ptPool->chState[hwSector] != FLASH_POOL_OWNED && flash_pool_sector(ptPool, hwSector, ptSector)) {
+        safe_atom_code(){
+            bReady = (ptPool->chState[hwSector] == FLASH_POOL_READY);
+            ptPool->chState[hwSector] = FLASH_POOL_OWNED;
+        }
+        if (!bReady) {
+            ptPool->tStat.wMisses++;
+            if (target_flash_erase(ptSector->wAddr, ptSector->wSize) < (int32_t)ptSector->wSize) {
+                ptPool->chState[hwSector] = FLASH_POOL_DIRTY;
+                FLASH_POOL_UNLOCK(ptPool);
+                return false;
+            }
+        }
+        ptPool->hwNext = (hwSector + 1) % ptPool->hwSectors;
+        ptPool->tStat.wTaken++;
+        bResult = true;
+    }
+    FLASH_POOL_UNLOCK(ptPool);
+
+    return bResult;
+}
+
+/*
+ * Function: flash_pool_release
+ * Description: Gives a sector back once its data is no longer needed, it
+ *              is erased in the background when its turn comes.
+ * Parameters:
+ *   - ptPool: Pool.
+ *   - addr: Any address of the sector.
+ * Returns: True if the writer owned the sector.
+ */
+bool flash_pool_release(flash_pool_t *ptPool, uint32_t addr)
+{
+    int32_t nSector = flash_pool_index(ptPool, addr);
+    bool bResult = false;
+
+    if (nSector < 0) {
+        return false;
+    }
+    FLASH_POOL_LOCK(ptPool);
+    if (ptPool->chState[nSector] == FLASH_POOL_OWNED) {
+        ptPool->chState[nSector] = FLASH_POOL_DIRTY;
+        bResult = true;
+    }
+    FLASH_POOL_UNLOCK(ptPool);
+    return bResult;
+}
+
+/*
+ * Function: flash_pool_idle
+ * Description: Does one step of background work, for an idle hook or a
+ *              low priority task: queues the erase of a sector, runs one
+ *              erase step, or blank checks the next FLASH_POOL_CHECK_SIZE
+ *              bytes of a sector never looked at, so every step is short
+ *              but the one erasing. Sectors are prepared in the order they
+ *              are handed out, until hwTarget are ready. Nothing is queued
+ *              while the device has foreground requests.
+ * Parameters:
+ *   - ptPool: Pool.
+ * Returns: True if there is more to do, false once the pool is full or
+ *          nothing can be prepared right now.
+ */
+bool flash_pool_idle(flash_pool_t *ptPool)
+{
+    flash_sector_t tSector;
+    uint16_t hwSector;
+    bool bMore = false;
+
+    FLASH_POOL_LOCK(ptPool);
+    if (ptPool->bBusy) {
+        /*a device worker may be running it already, polling here does no harm*/
+        target_flash_poll_dev(ptPool->wAddr);
+        FLASH_POOL_UNLOCK(ptPool);
+        return true;
+    }
+
+    if (flash_pool_depth(ptPool, &hwSector) < ptPool->hwTarget && hwSector < ptPool->hwSectors &&
+        flash_pool_sector(ptPool, hwSector, &tSector)) {
+        if (ptPool->hwChecking != hwSector) {
+            ptPool->hwChecking = hwSector;
+            ptPool->wChecked = 0;
+        }
+        uint32_t wChunk = tSector.wSize - ptPool->wChecked;
+        if (wChunk > FLASH_POOL_CHECK_SIZE) {
+            wChunk = FLASH_POOL_CHECK_SIZE;
+        }
+
+        if (ptPool->chState[hwSector] == FLASH_POOL_UNKNOWN &&
+            flash_pool_is_blank(tSector.wAddr + ptPool->wChecked, wChunk,
+                                flash_dev_find(ptPool->wAddr)->ptFlashDev->valEmpty)) {
+            /*the rest of the sector is checked by the next calls*/
+            ptPool->wChecked += wChunk;
+            if (ptPool->wChecked == tSector.wSize) {
+                ptPool->chState[hwSector] = FLASH_POOL_READY;
+                ptPool->tStat.wBlank++;
+            }
+            bMore = true;
+        } else {
+            ptPool->chState[hwSector] = FLASH_POOL_ERASING;
+            ptPool->hwErasing = hwSector;
+            ptPool->bBusy = true;
+            if (target_flash_erase_idle(&ptPool->tReq, tSector.wAddr, tSector.wSize, flash_pool_erased, ptPool)) {
+                /*a device worker starts it now, otherwise the next call does*/
+                bMore = true;
+            } else {
+                /*the device is busy with foreground work*/
+                ptPool->bBusy = false;
+                ptPool->chState[hwSector] = FLASH_POOL_DIRTY;
+            }
+        }
+    }
+    FLASH_POOL_UNLOCK(ptPool);
+
+    return bMore;
+}
+
+/*
+ * Function: flash_pool_stat
+ * Description: Gets the counters of a pool and its current depth.
+ * Parameters:
+ *   - ptPool: Pool.
+ *   - ptStat: Receives the counters, may be NULL.
+ *   - bReset: Clear the counters afterwards.
+ */
+void flash_pool_stat(flash_pool_t *ptPool, flash_pool_stat_t *ptStat, bool bReset)
+{
+    uint16_t hwNext;
+
+    FLASH_POOL_LOCK(ptPool);
+    ptPool->tStat.hwDepth = flash_pool_depth(ptPool, &hwNext);
+    if (ptStat != NULL) {
+        *ptStat = ptPool->tStat;
+    }
+    if (bReset) {
+        memset(&ptPool->tStat, 0, sizeof(ptPool->tStat));
+        ptPool->tStat.hwMinDepth = 0xFFFF;
+    }
+    FLASH_POOL_UNLOCK(ptPool);
+}
@@ -0,0 +1,577 @@
+/****************************************************************************
+*  Copyright 2022 KK (https://github.com/WALI-KANG)                                    *
+*                                                                           *
+*  Licensed under the Apache License, Version 2.0 (the "License");          *
+*  you may not use this file except in compliance with the License.         *
+*  You may obtain a copy of the License at                                  *
+*                                                                           *
+*     http://www.apache.org/licenses/LICENSE-2.0                            *
+*                                                                           *
+*  Unless required by applicable law or agreed to in writing, software      *
+*  distributed under the License is distributed on an "AS IS" BASIS,        *
+*  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. *
+*  See the License for the specific language governing permissions and      *
+*  limitations under the License.                                           *
+*                                                                           *
+****************************************************************************/
+#include "flash_slot.h"
+
+/* What a status record says about chSlot */
+enum {
+    FLASH_SLOT_REC_ERASED = 1,      // the slot holds no image, an update into it started
+    FLASH_SLOT_REC_READY,           // the slot holds an image of wSize bytes with CRC32 wCrc
+    FLASH_SLOT_REC_TRIAL,           // boot the slot on trial, wSize trial boots so far
+    FLASH_SLOT_REC_BOOT,            // the active slot was booted on trial once more
+    FLASH_SLOT_REC_CONFIRM,         // the active slot passed its trial
+    FLASH_SLOT_REC_SELECT,          // boot the slot, confirmed: rollback and compaction
+};
+
+typedef struct {
+    uint32_t wSeq;                  // increases by one for every record, across both log sectors
+    uint8_t  chOp;
+    uint8_t  chSlot;
+    uint16_t hwCheck;               // low half of the CRC32 of the other fields
+    uint32_t wSize;
+    uint32_t wCrc;
+} flash_slot_rec_t;
+
+static uint32_t flash_slot_log_addr(const flash_slot_t *ptSlot, uint8_t chLog)
+{
+    return ptSlot->ptCfg->wLogAddr + chLog * ptSlot->wSector;
+}
+
+static uint16_t flash_slot_rec_check(const flash_slot_rec_t *ptRec)
+{
+    uint32_t wCrc = flash_crc32(0, ptRec, offsetof(flash_slot_rec_t, hwCheck));
+
+    return (uint16_t)flash_crc32(wCrc, &ptRec->wSize, sizeof(*ptRec) - offsetof(flash_slot_rec_t, wSize));
+}
+
+/*
+ * Function: flash_slot_apply
+ * Description: Applies a record to the state in RAM.
+ * Parameters:
+ *   - ptSlot: Slot manager.
+ *   - ptRec: An intact record.
+ * Returns: None.
+ */
+static void flash_slot_apply(flash_slot_t *ptSlot, const flash_slot_rec_t *ptRec)
+{
+    flash_slot_image_t *ptImage = &ptSlot->tImage[ptRec->chSlot];
+
+    switch (ptRec->chOp) {
+        case FLASH_SLOT_REC_ERASED:
+            ptImage->wSize = 0;
+            ptImage->wCrc = 0;
+            break;
+        case FLASH_SLOT_REC_READY:
+            ptImage->wSize = ptRec->wSize;
+            ptImage->wCrc = ptRec->wCrc;
+            break;
+        case FLASH_SLOT_REC_TRIAL:
+            ptSlot->chActive = ptRec->chSlot;
+            ptSlot->bTrial = true;
+            ptSlot->chBoots = (uint8_t)ptRec->wSize;
+            break;
+        case FLASH_SLOT_REC_BOOT:
+            if (ptSlot->bTrial && ptSlot->chBoots < 0xFF) {
+                ptSlot->chBoots++;
+            }
+            break;
+        case FLASH_SLOT_REC_CONFIRM:
+            ptSlot->bTrial = false;
+            break;
+        case FLASH_SLOT_REC_SELECT:
+            ptSlot->chActive = ptRec->chSlot;
+            ptSlot->bTrial = false;
+            ptSlot->chBoots = 0;
+            break;
+        default:
+            break;
+    }
+}
+
+/*
+ * Function: flash_slot_load
+ * Description: Reads the record at addr.
+ * Parameters:
+ *   - ptSlot: Slot manager.
+ *   - addr: Record address.
+ *   - ptRec: Receives the record.
+ * Returns: 1 - intact record, 0 - never written, -1 - torn or unreadable.
+ */
+static int32_t flash_slot_load(const flash_slot_t *ptSlot, uint32_t addr, flash_slot_rec_t *ptRec)
+{
+    const uint8_t *pchRec = (const uint8_t *)ptRec;
+    bool bEmpty = true;
+
+    if (target_flash_read(addr, (uint8_t *)ptRec, sizeof(*ptRec)) != sizeof(*ptRec)) {
+        return -1;
+    }
+    for (uint32_t i = 0; i < sizeof(*ptRec); i++) {
+        if (pchRec[i] != ptSlot->chEmpty) {
+            bEmpty = false;
+            break;
+        }
+    }
+    if (bEmpty) {
+        return 0;
+    }
+    if (ptRec->chOp < FLASH_SLOT_REC_ERASED || ptRec->chOp > FLASH_SLOT_REC_SELECT ||
+        ptRec->chSlot >= FLASH_SLOT_NUM || ptRec->hwCheck != flash_slot_rec_check(ptRec)) {
+        return -1;
+    }
+    return 1;
+}
+
+/*
+ * Function: flash_slot_scan
+ * Description: Walks the records of a log sector up to the first one never
+ *              written; torn records are skipped.
+ * Parameters:
+ *   - ptSlot: Slot manager.
+ *   - chLog: Log sector, 0 or 1.
+ *   - bApply: Apply the intact records and track the sequence number.
+ *   - pwFirst: Receives the sequence number of the first intact record.
+ * Returns: Number of records written, intact or not, -1 if none is intact.
+ */
+static int32_t flash_slot_scan(flash_slot_t *ptSlot, uint8_t chLog, bool bApply, uint32_t *pwFirst)
+{
+    uint32_t wAddr = flash_slot_log_addr(ptSlot, chLog);
+    uint32_t wLimit = wAddr + ptSlot->wSector;
+    flash_slot_rec_t tRec;
+    int32_t nRecs = 0;
+    bool bIntact = false;
+    int32_t nState;
+
+    for (; wLimit - wAddr >= ptSlot->wRecSize; wAddr += ptSlot->wRecSize) {
+        nState = flash_slot_load(ptSlot, wAddr, &tRec);
+        if (nState == 0) {
+            break;
+        }
+        nRecs++;
+        if (nState < 0) {
+            continue;
+        }
+        if (!bIntact) {
+            *pwFirst = tRec.wSeq;
+            bIntact = true;
+        }
+        if (bApply) {
+            flash_slot_apply(ptSlot, &tRec);
+            ptSlot->wSeq = tRec.wSeq + 1;
+        }
+    }
+    if (bApply) {
+        ptSlot->wWrite = wAddr;
+    }
+
+    return bIntact ? nRecs : (nRecs ? -1 : 0);
+}
+
+static bool flash_slot_log_erase(flash_slot_t *ptSlot, uint8_t chLog)
+{
+    ptSlot->wLogErases++;
+    return target_flash_erase(flash_slot_log_addr(ptSlot, chLog), ptSlot->wSector) == (int32_t)ptSlot->wSector;
+}
+
+/*
+ * Function: flash_slot_put
+ * Description: Programs a record at the write pointer and applies it. The
+ *              record is complete or torn after a reset, never half applied.
+ * Parameters:
+ *   - ptSlot: Slot manager, room for the record is reserved.
+ *   - chOp, chSlot, wSize, wCrc: The record.
+ * Returns: True on success.
+ */
+static bool flash_slot_put(flash_slot_t *ptSlot, uint8_t chOp, uint8_t chSlot, uint32_t wSize, uint32_t wCrc)
+{
+    flash_slot_rec_t tRec = {ptSlot->wSeq, chOp, chSlot, 0, wSize, wCrc};
+    uint32_t wAddr = ptSlot->wWrite;
+
+    tRec.hwCheck = flash_slot_rec_check(&tRec);
+
+    /*the space is taken even if programming fails, the next mount skips a torn record*/
+    ptSlot->wWrite += ptSlot->wRecSize;
+    ptSlot->wLogBytes += ptSlot->wRecSize;
+    if (target_flash_write(wAddr, (const uint8_t *)&tRec, sizeof(tRec)) != sizeof(tRec) ||
+        !target_flash_sync(wAddr)) {
+        return false;
+    }
+    ptSlot->wSeq++;
+    flash_slot_apply(ptSlot, &tRec);
+    return true;
+}
+
+/*
+ * Function: flash_slot_compact
+ * Description: Restates the state in at most three records in the other
+ *              log sector, then erases the current one. Every record of
+ *              the snapshot repeats a fact of the state, so replaying the
+ *              old sector followed by a cut short snapshot gives the same
+ *              state and mount simply compacts again.
+ * Parameters:
+ *   - ptSlot: Slot manager.
+ * Returns: True on success.
+ */
+static bool flash_slot_compact(flash_slot_t *ptSlot)
+{
+    uint8_t chOld = ptSlot->chLog;
+    uint8_t chNew = chOld ^ 1;
+
+    if (!flash_slot_log_erase(ptSlot, chNew)) {
+        return false;
+    }
+    ptSlot->chLog = chNew;
+    ptSlot->wWrite = flash_slot_log_addr(ptSlot, chNew);
+
+    for (uint8_t i = 0; i < FLASH_SLOT_NUM; i++) {
+        const flash_slot_image_t *ptImage = &ptSlot->tImage[i];
+        if (!flash_slot_put(ptSlot, ptImage->wSize ? FLASH_SLOT_REC_READY : FLASH_SLOT_REC_ERASED, i,
+                            ptImage->wSize, ptImage->wCrc)) {
+            return false;
+        }
+    }
+    if (ptSlot->chActive != FLASH_SLOT_NONE &&
+        !flash_slot_put(ptSlot, ptSlot->bTrial ? FLASH_SLOT_REC_TRIAL : FLASH_SLOT_REC_SELECT,
+                        ptSlot->chActive, ptSlot->bTrial ? ptSlot->chBoots : 0, 0)) {
+        return false;
+    }
+
+    return flash_slot_log_erase(ptSlot, chOld);
+}
+
+/*
+ * Function: flash_slot_append
+ * Description: Appends a record, compacting the log first when the
+ *              current sector is full.
+ * Parameters:
+ *   - ptSlot: Slot manager.
+ *   - chOp, chSlot, wSize, wCrc: The record.
+ * Returns: True on success.
+ */
+static bool flash_slot_append(flash_slot_t *ptSlot, uint8_t chOp, uint8_t chSlot, uint32_t wSize, uint32_t wCrc)
+{
+    uint32_t wEnd = flash_slot_log_addr(ptSlot, ptSlot->chLog) + ptSlot->wSector;
+
+    if (wEnd - ptSlot->wWrite < ptSlot->wRecSize && !flash_slot_compact(ptSlot)) {
+        return false;
+    }
+    return flash_slot_put(ptSlot, chOp, chSlot, wSize, wCrc);
+}
+
+/*
+ * Function: flash_slot_select
+ * Description: Makes a slot the confirmed active one and points the boot
+ *              bank at it on dual-bank parts.
+ * Parameters:
+ *   - ptSlot: Slot manager.
+ *   - chSlot: Slot holding a valid image.
+ * Returns: True on success.
+ */
+static bool flash_slot_select(flash_slot_t *ptSlot, uint8_t chSlot)
+{
+    if (!flash_slot_append(ptSlot, FLASH_SLOT_REC_SELECT, chSlot, 0, 0)) {
+        return false;
+    }
+    return ptSlot->ptCfg->SwapBanks == NULL || ptSlot->ptCfg->SwapBanks(chSlot);
+}
+
+/*
+ * Function: flash_slot_range_ok
+ * Description: Checks that [addr, addr + size) starts and ends on sector
+ *              boundaries of one device.
+ * Parameters:
+ *   - addr, size: The range.
+ * Returns: True if it does.
+ */
+static bool flash_slot_range_ok(uint32_t addr, uint32_t size)
+{
+    flash_sector_t tFirst, tLast;
+
+    return size != 0 && target_flash_sector_info(addr, &tFirst) && tFirst.wAddr == addr &&
+           target_flash_sector_info(addr + size - 1, &tLast) && tLast.wAddr + tLast.wSize == addr + size &&
+           flash_dev_find(addr) == flash_dev_find(addr + size - 1);
+}
+
+static bool flash_slot_overlap(uint32_t wAddr0, uint32_t wSize0, uint32_t wAddr1, uint32_t wSize1)
+{
+    return wAddr0 < wAddr1 + wSize1 && wAddr1 < wAddr0 + wSize0;
+}
+
+/*
+ * Function: flash_slot_mount
+ * Description: Attaches the slot manager to its slots and status log and
+ *              replays the log. An empty log means no slot was activated
+ *              yet; a compaction interrupted by a reset is redone.
+ * Parameters:
+ *   - ptSlot: Slot manager owned by the caller.
+ *   - ptCfg: Slots and log, kept by the caller as long as ptSlot is used.
+ * Returns: True on success.
+ */
+bool flash_slot_mount(flash_slot_t *ptSlot, const flash_slot_cfg_t *ptCfg)
+{
+    const flash_blob_t *ptBlob;
+    flash_sector_t tSector, tNext;
+    uint32_t wFirst[2] = {0, 0};
+    int32_t nRecs[2];
+
+    if (ptSlot == NULL || ptCfg == NULL || (ptBlob = flash_dev_find(ptCfg->wLogAddr)) == NULL ||
+        !target_flash_sector_info(ptCfg->wLogAddr, &tSector) || tSector.wAddr != ptCfg->wLogAddr ||
+        !target_flash_sector_info(ptCfg->wLogAddr + tSector.wSize, &tNext) || tNext.wSize != tSector.wSize ||
+        flash_dev_find(tNext.wAddr) != ptBlob) {
+        return false;
+    }
+    for (uint8_t i = 0; i < FLASH_SLOT_NUM; i++) {
+        const flash_slot_desc_t *ptDesc = &ptCfg->tSlot[i];
+        if (!flash_slot_range_ok(ptDesc->wAddr, ptDesc->wSize) ||
+            flash_slot_overlap(ptDesc->wAddr, ptDesc->wSize, ptCfg->wLogAddr, 2 * tSector.wSize)) {
+            return false;
+        }
+    }
+    if (flash_slot_overlap(ptCfg->tSlot[0].wAddr, ptCfg->tSlot[0].wSize,
+                           ptCfg->tSlot[1].wAddr, ptCfg->tSlot[1].wSize)) {
+        return false;
+    }
+
+    uint32_t wUnit = ptBlob->wWriteGranularity ? ptBlob->wWriteGranularity : 4;
+
+    memset(ptSlot, 0, sizeof(*ptSlot));
+    ptSlot->ptCfg = ptCfg;
+    ptSlot->chActive = FLASH_SLOT_NONE;
+    ptSlot->chUpdate = FLASH_SLOT_NONE;
+    ptSlot->chEmpty = ptBlob->ptFlashDev->valEmpty;
+    ptSlot->wSector = tSector.wSize;
+    ptSlot->wRecSize = (sizeof(flash_slot_rec_t) + wUnit - 1) & ~(wUnit - 1);
+
+    /*a sector holding nothing intact is erased, the other one has the log*/
+    for (uint8_t i = 0; i < 2; i++) {
+        nRecs[i] = flash_slot_scan(ptSlot, i, false, &wFirst[i]);
+        if (nRecs[i] < 0) {
+            if (!flash_slot_log_erase(ptSlot, i)) {
+                return false;
+            }
+            nRecs[i] = 0;
+        }
+    }
+
+    if (nRecs[0] > 0 && nRecs[1] > 0) {
+        /*both used: a compaction was cut short, replay the old sector first and compact again*/
+        uint8_t chOld = ((int32_t)(wFirst[1] - wFirst[0]) > 0) ? 0 : 1;
+
+        flash_slot_scan(ptSlot, chOld, true, &wFirst[chOld]);
+        flash_slot_scan(ptSlot, chOld ^ 1, true, &wFirst[chOld ^ 1]);
+        ptSlot->chLog = chOld;
+        return flash_slot_compact(ptSlot);
+    }
+
+    ptSlot->chLog = (nRecs[1] > 0) ? 1 : 0;
+    flash_slot_scan(ptSlot, ptSlot->chLog, true, &wFirst[ptSlot->chLog]);
+    return true;
+}
+
+/*
+ * Function: flash_slot_addr
+ * Description: Gets the address a slot is mapped at right now, which on a
+ *              dual-bank part depends on the bank booted.
+ * Parameters:
+ *   - ptSlot: Mounted slot manager.
+ *   - chSlot: Slot, 0 or 1.
+ * Returns: Start address of the slot.
+ */
+uint32_t flash_slot_addr(const flash_slot_t *ptSlot, uint8_t chSlot)
+{
+    const flash_slot_cfg_t *ptCfg = ptSlot->ptCfg;
+    uint8_t chMapped = (ptCfg->MappedSlot != NULL) ? ptCfg->MappedSlot() : 0;
+
+    return ptCfg->tSlot[(chSlot ^ chMapped) & 1].wAddr;
+}
+
+/*
+ * Function: flash_slot_validate
+ * Description: Checks a slot against the size and CRC32 recorded when its
+ *              image was finished.
+ * Parameters:
+ *   - ptSlot: Mounted slot manager.
+ *   - chSlot: Slot, 0 or 1.
+ * Returns: True if the slot holds the complete image.
+ */
+bool flash_slot_validate(flash_slot_t *ptSlot, uint8_t chSlot)
+{
+    const flash_slot_image_t *ptImage;
+
+    if (chSlot >= FLASH_SLOT_NUM) {
+        return false;
+    }
+    ptImage = &ptSlot->tImage[chSlot];
+    return ptImage->wSize != 0 && target_flash_checksum(flash_slot_addr(ptSlot, chSlot), ptImage->wSize) == ptImage->wCrc;
+}
+
+/*
+ * Function: flash_slot_boot
+ * Description: Picks the slot to start, for the boot loader. A slot on
+ *              trial is counted and given up after FLASH_SLOT_TRIAL_BOOTS
+ *              boots without flash_slot_confirm(); a corrupted image is
+ *              given up right away. Either way the other slot is selected.
+ * Parameters:
+ *   - ptSlot: Mounted slot manager.
+ * Returns: Slot to start, FLASH_SLOT_NONE if no slot holds a bootable image.
+ */
+uint8_t flash_slot_boot(flash_slot_t *ptSlot)
+{
+    uint8_t chActive = ptSlot->chActive;
+    bool bGiveUp;
+
+    if (chActive == FLASH_SLOT_NONE) {
+        return FLASH_SLOT_NONE;
+    }
+
+#if FLASH_SLOT_BOOT_VERIFY == ENABLED
+    bGiveUp = !flash_slot_validate(ptSlot, chActive);
+#else
+    bGiveUp = false;
+#endif
+    if (!bGiveUp && ptSlot->bTrial) {
+        if (ptSlot->chBoots < FLASH_SLOT_TRIAL_BOOTS) {
+            /*count the boot before starting the image, a hang counts as well*/
+            flash_slot_append(ptSlot, FLASH_SLOT_REC_BOOT, chActive, 0, 0);
+            return chActive;
+        }
+        bGiveUp = true;
+    }
+    if (!bGiveUp) {
+        return chActive;
+    }
+
+    if (flash_slot_validate(ptSlot, chActive ^ 1) && flash_slot_select(ptSlot, chActive ^ 1)) {
+        return chActive ^ 1;
+    }
+#if FLASH_SLOT_BOOT_VERIFY == ENABLED
+    /*nothing to fall back to: keep trying a trial image, never start a corrupted one*/
+    return flash_slot_validate(ptSlot, chActive) ? chActive : FLASH_SLOT_NONE;
+#else
+    return chActive;
+#endif
+}
+
+/*
+ * Function: flash_slot_update_begin
+ * Description: Invalidates the inactive slot for an update. The image is
+ *              then written with target_flash_session_*(), flash_unpack_*()
+ *              or target_flash_write() and finished by
+ *              flash_slot_update_end(). Refused while the active slot is
+ *              on trial, since the inactive slot is its fallback.
+ * Parameters:
+ *   - ptSlot: Mounted slot manager.
+ * Returns: Address of the slot to write, FLASH_SLOT_ADDR_NONE on failure.
+ */
+uint32_t flash_slot_update_begin(flash_slot_t *ptSlot)
+{
+    uint8_t chSlot = (ptSlot->chActive == FLASH_SLOT_NONE) ? 0 : ptSlot->chActive ^ 1;
+
+    if (ptSlot->bTrial) {
+        return FLASH_SLOT_ADDR_NONE;
+    }
+    if (ptSlot->tImage[chSlot].wSize != 0 && !flash_slot_append(ptSlot, FLASH_SLOT_REC_ERASED, chSlot, 0, 0)) {
+        return FLASH_SLOT_ADDR_NONE;
+    }
+    ptSlot->chUpdate = chSlot;
+    return flash_slot_addr(ptSlot, chSlot);
+}
+
+/*
+ * Function: flash_slot_update_end
+ * Description: Records the size and CRC32 of the image written since
+ *              flash_slot_update_begin(), computed from the flash.
+ * Parameters:
+ *   - ptSlot: Mounted slot manager.
+ *   - wSize: Image size.
+ *   - pwCrc: Expected CRC32, e.g. from the update manifest, NULL to skip the check.
+ * Returns: True if the image was recorded.
+ */
+bool flash_slot_update_end(flash_slot_t *ptSlot, size_t wSize, const uint32_t *pwCrc)
+{
+    uint8_t chSlot = ptSlot->chUpdate;
+
+    if (chSlot == FLASH_SLOT_NONE || wSize == 0 || wSize > ptSlot->ptCfg->tSlot[chSlot].wSize) {
+        return false;
+    }
+
+    uint32_t wCrc = target_flash_checksum(flash_slot_addr(ptSlot, chSlot), wSize);
+    if (pwCrc != NULL && *pwCrc != wCrc) {
+        return false;
+    }
+    if (!flash_slot_append(ptSlot, FLASH_SLOT_REC_READY, chSlot, wSize, wCrc)) {
+        return false;
+    }
+    ptSlot->chUpdate = FLASH_SLOT_NONE;
+    return true;
+}
+
+/*
+ * Function: flash_slot_activate
+ * Description: Boots a validated slot from the next reset on, on trial
+ *              until flash_slot_confirm(). Costs one record, on dual-bank
+ *              parts plus the bank swap option; the image is not copied.
+ * Parameters:
+ *   - ptSlot: Mounted slot manager.
+ *   - chSlot: Slot holding a finished image.
+ * Returns: True on success.
+ */
+bool flash_slot_activate(flash_slot_t *ptSlot, uint8_t chSlot)
+{
+    uint8_t chPrev = ptSlot->chActive;
+
+    if (chSlot >= FLASH_SLOT_NUM || chSlot == ptSlot->chUpdate || (ptSlot->bTrial && chSlot != chPrev)) {
+        return false;
+    }
+    if (chSlot == chPrev) {
+        return true;
+    }
+    if (!flash_slot_validate(ptSlot, chSlot) || !flash_slot_append(ptSlot, FLASH_SLOT_REC_TRIAL, chSlot, 0, 0)) {
+        return false;
+    }
+    if (ptSlot->ptCfg->SwapBanks != NULL && !ptSlot->ptCfg->SwapBanks(chSlot)) {
+        /*the boot bank did not change, neither does the log*/
+        if (chPrev != FLASH_SLOT_NONE) {
+            flash_slot_append(ptSlot, FLASH_SLOT_REC_SELECT, chPrev, 0, 0);
+        }
+        return false;
+    }
+    return true;
+}
+
+/*
+ * Function: flash_slot_confirm
+ * Description: Ends the trial of the active slot, called by the new image
+ *              once it works. Costs one record.
+ * Parameters:
+ *   - ptSlot: Mounted slot manager.
+ * Returns: True if the active slot is confirmed.
+ */
+bool flash_slot_confirm(flash_slot_t *ptSlot)
+{
+    if (ptSlot->chActive == FLASH_SLOT_NONE) {
+        return false;
+    }
+    return !ptSlot->bTrial || flash_slot_append(ptSlot, FLASH_SLOT_REC_CONFIRM, ptSlot->chActive, 0, 0);
+}
+
+/*
+ * Function: flash_slot_rollback
+ * Description: Goes back to the image in the other slot, confirmed. Costs
+ *              one record, the same as activating.
+ * Parameters:
+ *   - ptSlot: Mounted slot manager.
+ * Returns: True on success, false if the other slot holds no valid image.
+ */
+bool flash_slot_rollback(flash_slot_t *ptSlot)
+{
+    uint8_t chActive = ptSlot->chActive;
+
+    if (chActive == FLASH_SLOT_NONE || (chActive ^ 1) == ptSlot->chUpdate ||
+        !flash_slot_validate(ptSlot, chActive ^ 1)) {
+        return false;
+    }
+    return flash_slot_select(ptSlot, chActive ^ 1);
+}
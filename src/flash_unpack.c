@@ -0,0 +1,226 @@
+/****************************************************************************
+*  Copyright 2022 KK (https://github.com/WALI-KANG)                                    *
+*                                                                           *
+*  Licensed under the Apache License, Version 2.0 (the "License");          *
+*  you may not use this file except in compliance with the License.         *
+*  You may obtain a copy of the License at                                  *
+*                                                                           *
+*     http://www.apache.org/licenses/LICENSE-2.0                            *
+*                                                                           *
+*  Unless required by applicable law or agreed to in writing, software      *
+*  distributed under the License is distributed on an "AS IS" BASIS,        *
+*  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. *
+*  See the License for the specific language governing permissions and      *
+*  limitations under the License.                                           *
+*                                                                           *
+****************************************************************************/
+#include "flash_unpack.h"
+
+#define FLASH_UNPACK_WINDOW_SIZE    (1u << FLASH_UNPACK_WINDOW_BITS)
+
+enum {
+    FLASH_UNPACK_TAG = 0,           // 1: literal follows, 0: back-reference follows
+    FLASH_UNPACK_LITERAL,
+    FLASH_UNPACK_INDEX,
+    FLASH_UNPACK_COUNT,
+    FLASH_UNPACK_COPY,
+    FLASH_UNPACK_FAILED,
+};
+
+/*
+ * Function: flash_unpack_bits
+ * Description: Takes the next chNum bits of the input, MSB first.
+ * Parameters:
+ *   - ptUnpack: Decoder.
+ *   - ppchIn: Input cursor, advanced by the bytes pulled in.
+ *   - pchEnd: End of the input.
+ *   - chNum: Number of bits, at most 16.
+ *   - phwValue: Receives the bits.
+ * Returns: False if the input ran out, the bits seen so far are kept.
+ */
+static bool flash_unpack_bits(flash_unpack_t *ptUnpack, const uint8_t **ppchIn, const uint8_t *pchEnd,
+                              uint8_t chNum, uint16_t *phwValue)
+{
+    while (ptUnpack->chBitNum < chNum) {
+        if (*ppchIn == pchEnd) {
+            return false;
+        }
+        ptUnpack->wBits = (ptUnpack->wBits << 8) | *(*ppchIn)++;
+        ptUnpack->chBitNum += 8;
+    }
+    ptUnpack->chBitNum -= chNum;
+    *phwValue = (uint16_t)((ptUnpack->wBits >> ptUnpack->chBitNum) & ((1u << chNum) - 1));
+    return true;
+}
+
+/*
+ * Function: flash_unpack_flush
+ * Description: Appends the decoded bytes still held only in the ring to the
+ *              session, in at most two contiguous runs.
+ * Parameters:
+ *   - ptUnpack: Decoder.
+ * Returns: True on success.
+ */
+static bool flash_unpack_flush(flash_unpack_t *ptUnpack)
+{
+    while (ptUnpack->hwPending > 0) {
+        uint16_t hwStart = (ptUnpack->hwHead - ptUnpack->hwPending) & (FLASH_UNPACK_WINDOW_SIZE - 1);
+        uint16_t hwLen = ptUnpack->hwPending;
+
+        if (hwStart + hwLen > FLASH_UNPACK_WINDOW_SIZE) {
+            hwLen = FLASH_UNPACK_WINDOW_SIZE - hwStart;
+        }
+        if (target_flash_session_append(&ptUnpack->tSession, &ptUnpack->chWindow[hwStart], hwLen) != hwLen) {
+            return false;
+        }
+        ptUnpack->hwPending -= hwLen;
+    }
+    return true;
+}
+
+static bool flash_unpack_emit(flash_unpack_t *ptUnpack, uint8_t chByte)
+{
+    if (ptUnpack->hwPending == FLASH_UNPACK_WINDOW_SIZE && !flash_unpack_flush(ptUnpack)) {
+        return false;
+    }
+    ptUnpack->chWindow[ptUnpack->hwHead] = chByte;
+    ptUnpack->hwHead = (ptUnpack->hwHead + 1) & (FLASH_UNPACK_WINDOW_SIZE - 1);
+    ptUnpack->hwPending++;
+    ptUnpack->wOut++;
+    return true;
+}
+
+/*
+ * Function: flash_unpack_step
+ * Description: Advances the decoder by one state.
+ * Parameters:
+ *   - ptUnpack: Decoder.
+ *   - ppchIn: Input cursor.
+ *   - pchEnd: End of the input.
+ * Returns: False once more input is needed or decoding failed.
+ */
+static bool flash_unpack_step(flash_unpack_t *ptUnpack, const uint8_t **ppchIn, const uint8_t *pchEnd)
+{
+    uint16_t hwValue;
+
+    switch (ptUnpack->chState) {
+        case FLASH_UNPACK_TAG:
+            if (!flash_unpack_bits(ptUnpack, ppchIn, pchEnd, 1, &hwValue)) {
+                return false;
+            }
+            ptUnpack->chState = hwValue ? FLASH_UNPACK_LITERAL : FLASH_UNPACK_INDEX;
+            return true;
+
+        case FLASH_UNPACK_LITERAL:
+            if (!flash_unpack_bits(ptUnpack, ppchIn, pchEnd, 8, &hwValue)) {
+                return false;
+            }
+            ptUnpack->chState = flash_unpack_emit(ptUnpack, (uint8_t)hwValue) ? FLASH_UNPACK_TAG : FLASH_UNPACK_FAILED;
+            return true;
+
+        case FLASH_UNPACK_INDEX:
+            if (!flash_unpack_bits(ptUnpack, ppchIn, pchEnd, FLASH_UNPACK_WINDOW_BITS, &ptUnpack->hwIndex)) {
+                return false;
+            }
+            ptUnpack->chState = FLASH_UNPACK_COUNT;
+            return true;
+
+        case FLASH_UNPACK_COUNT:
+            if (!flash_unpack_bits(ptUnpack, ppchIn, pchEnd, FLASH_UNPACK_LOOKAHEAD_BITS, &hwValue)) {
+                return false;
+            }
+            ptUnpack->hwCount = hwValue + 1;
+            ptUnpack->chState = FLASH_UNPACK_COPY;
+            return true;
+
+        case FLASH_UNPACK_COPY:
+            while (ptUnpack->hwCount > 0) {
+                uint8_t chByte = ptUnpack->chWindow[(ptUnpack->hwHead - ptUnpack->hwIndex - 1) &
+                                                    (FLASH_UNPACK_WINDOW_SIZE - 1)];
+                if (!flash_unpack_emit(ptUnpack, chByte)) {
+                    ptUnpack->chState = FLASH_UNPACK_FAILED;
+                    return false;
+                }
+                ptUnpack->hwCount--;
+            }
+            ptUnpack->chState = FLASH_UNPACK_TAG;
+            return true;
+
+        default:
+            return false;
+    }
+}
+
+/*
+ * Function: flash_unpack_open
+ * Description: Starts decoding into [addr, addr + size), erasing ahead of
+ *              the output like target_flash_session_open().
+ * Parameters:
+ *   - ptUnpack: Decoder object owned by the caller.
+ *   - addr: Start address, must be sector aligned.
+ *   - size: Room for the decoded image.
+ * Returns: True on success.
+ */
+bool flash_unpack_open(flash_unpack_t *ptUnpack, uint32_t addr, size_t size)
+{
+    if (ptUnpack == NULL) {
+        return false;
+    }
+    memset(ptUnpack, 0, sizeof(*ptUnpack));
+    return target_flash_session_open(&ptUnpack->tSession, addr, size);
+}
+
+/*
+ * Function: flash_unpack_feed
+ * Description: Decodes the next piece of the compressed stream. Pieces may
+ *              split symbols anywhere; the decoded bytes are appended to
+ *              the session before the call returns.
+ * Parameters:
+ *   - ptUnpack: Open decoder.
+ *   - buf: Compressed data, may be reused once the call returns.
+ *   - size: Number of bytes.
+ * Returns: Number of decoded bytes, -1 on failure (output beyond the
+ *          range or a flash error).
+ */
+int32_t flash_unpack_feed(flash_unpack_t *ptUnpack, const uint8_t *buf, size_t size)
+{
+    const uint8_t *pchIn = buf;
+    uint32_t wOut;
+
+    if (ptUnpack == NULL || (buf == NULL && size != 0)) {
+        return -1;
+    }
+
+    wOut = ptUnpack->wOut;
+    while (flash_unpack_step(ptUnpack, &pchIn, buf + size));
+
+    if (ptUnpack->chState == FLASH_UNPACK_FAILED || !flash_unpack_flush(ptUnpack)) {
+        ptUnpack->chState = FLASH_UNPACK_FAILED;
+        return -1;
+    }
+    return ptUnpack->wOut - wOut;
+}
+
+/*
+ * Function: flash_unpack_close
+ * Description: Ends the stream and closes the session. Up to seven zero
+ *              bits of padding after the last symbol are ignored.
+ * Parameters:
+ *   - ptUnpack: Open decoder.
+ * Returns: True if the stream ended on a symbol boundary and all data was
+ *          programmed. tSession.wCursor is the end of the image,
+ *          tSession.tDigest its digest.
+ */
+bool flash_unpack_close(flash_unpack_t *ptUnpack)
+{
+    bool bResult;
+
+    if (ptUnpack == NULL) {
+        return false;
+    }
+    /*the padding can only be read as the start of a back-reference index*/
+    bResult = (ptUnpack->chState == FLASH_UNPACK_TAG || ptUnpack->chState == FLASH_UNPACK_INDEX) &&
+              ptUnpack->chBitNum < 8 && (ptUnpack->wBits & ((1u << ptUnpack->chBitNum) - 1)) == 0;
+    bResult = flash_unpack_flush(ptUnpack) && bResult;
+    return target_flash_session_close(&ptUnpack->tSession) && bResult;
+}
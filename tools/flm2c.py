@@ -0,0 +1,368 @@
+#!/usr/bin/env python3
+#
+# Copyright 2022 KK (https://github.com/WALI-KANG)
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#    http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#
+"""Converts Keil FLM flash algorithms into flash_blob drivers.
+
+Each FLM becomes one C file <ident>.c holding PrgCode/PrgData as a word
+array, the FlashDevice description as a flash_dev_t, the flattened sector
+table as a flash_geometry_t and a const flash_blob_t named
+<ident>_flash_device, ready to be listed in FLASH_DEV_TABLE. <ident> is the
+FLM file name in lower case; FLMs of the same name get _2, _3, ... so that
+neither their files nor their symbols clash. The entry points run through
+flash_flm_call() of inc/flash_flm.h.
+
+    flm2c.py STM32F4xx_1024.FLM
+    flm2c.py -o drivers ~/.cache/arm/packs/Keil/STM32F4xx_DFP/2.17.1/CMSIS/Flash
+    flm2c.py -o drivers Keil.STM32F4xx_DFP.2.17.1.pack
+
+Directories are searched recursively, packs (zip files) are read from their
+Flash folders. Several inputs also produce flash_flm_devices.h with the
+extern declarations and the address ranges of all devices.
+"""
+
+import argparse
+import os
+import re
+import struct
+import sys
+import zipfile
+
+SECTOR_NUM = 16             # flash_dev_t::sectors[] of inc/flash_blob.h, SECTOR_END included
+DEV_NAME_LEN = 32           # flash_dev_t::DevName of inc/flash_blob.h
+FLM_NAME_LEN = 128          # FlashDevice::DevName of the FLM
+FLM_SECTOR_MAX = 512        # FlashDevice::sectors[] of the FLM
+
+DEV_TYPES = {0: "UNKNOWN", 1: "ONCHIP", 2: "EXT8BIT", 3: "EXT16BIT", 4: "EXT32BIT", 5: "EXTSPI"}
+
+# FLM entry point, flash_ops_t member, mandatory
+ENTRIES = (
+    ("Init", "Init", True),
+    ("UnInit", "UnInit", True),
+    ("EraseChip", "EraseChip", False),
+    ("EraseSector", "EraseSector", True),
+    ("ProgramPage", "Program", True),
+)
+
+
+class FlmError(Exception):
+    pass
+
+
+class Flm:
+    """The parts of an FLM file a driver is built from."""
+
+    def __init__(self, name, data):
+        self.name = name
+        self.sections = {}
+        self.symbols = {}
+        self._parse_elf(data)
+        self._parse_dev()
+        self._build_geometry()
+
+    def _parse_elf(self, data):
+        if len(data) < 52 or data[:4] != b"\x7fELF":
+            raise FlmError("not an ELF file")
+        if data[4] != 1 or data[5] != 1:
+            raise FlmError("not a 32-bit little endian ELF file")
+        (e_type, e_machine, _, _, _, e_shoff, _, _, _, _,
+         e_shentsize, e_shnum, e_shstrndx) = struct.unpack_from("<HHIIIIIHHHHHH", data, 16)
+        if e_machine != 40:
+            raise FlmError("not an ARM image (e_machine %d)" % e_machine)
+        if e_shentsize != 40 or e_shnum == 0 or e_shstrndx >= e_shnum or \
+           e_shoff + e_shnum * 40 > len(data):
+            raise FlmError("bad section header table")
+
+        headers = [struct.unpack_from("<IIIIIIIIII", data, e_shoff + i * 40) for i in range(e_shnum)]
+        strtab = headers[e_shstrndx]
+
+        def cstr(offset, table):
+            end = data.find(b"\0", table[4] + offset)
+            return data[table[4] + offset:end].decode("latin-1")
+
+        for index, sh in enumerate(headers):
+            name = cstr(sh[0], strtab)
+            sh_type, addr, offset, size = sh[1], sh[3], sh[4], sh[5]
+            if sh_type != 8 and offset + size > len(data):
+                raise FlmError("section %s outside the file" % name)
+            # NOBITS sections (zero initialised PrgData) have no file contents
+            body = bytes(size) if sh_type == 8 else data[offset:offset + size]
+            self.sections[name] = {"index": index, "type": sh_type, "addr": addr, "data": body,
+                                   "link": sh[6], "entsize": sh[9]}
+
+        for name in ("PrgCode", "PrgData", "DevDscr"):
+            if name not in self.sections:
+                raise FlmError("no %s section" % name)
+        code, prg_data = self.sections["PrgCode"], self.sections["PrgData"]
+        if code["addr"] != 0 or prg_data["addr"] < len(code["data"]) or prg_data["addr"] % 4 != 0:
+            raise FlmError("PrgCode must start at 0 and PrgData follow it word aligned")
+
+        symtab = self.sections.get(".symtab")
+        if symtab is None:
+            raise FlmError("no .symtab section")
+        names = headers[symtab["link"]]
+        for offset in range(0, len(symtab["data"]) - 15, 16):
+            st_name, st_value, st_size, st_info, _, st_shndx = struct.unpack_from("<IIIBBH", symtab["data"],
+                                                                                  offset)
+            if st_info >> 4 != 1 or st_name == 0:
+                continue    # global symbols only
+            self.symbols[cstr(st_name, names)] = (st_value, st_shndx)
+
+        self.entries = {}
+        for symbol, member, mandatory in ENTRIES:
+            if symbol not in self.symbols:
+                if mandatory:
+                    raise FlmError("no %s function" % symbol)
+                continue
+            value, shndx = self.symbols[symbol]
+            if shndx != code["index"] or value & 1 == 0 or value >= len(code["data"]):
+                raise FlmError("%s is not a Thumb function in PrgCode" % symbol)
+            self.entries[member] = value
+        # BlankCheck and Verify have no flash_ops_t member, flash_blob reads back itself
+        self.unused = [s for s in ("BlankCheck", "Verify") if s in self.symbols]
+
+    def _parse_dev(self):
+        dscr = self.sections["DevDscr"]["data"]
+        fixed = 2 + FLM_NAME_LEN + 2 + 4 * 4 + 4 + 4 * 2
+        if len(dscr) < fixed + 8:
+            raise FlmError("DevDscr too short")
+        self.vers, = struct.unpack_from("<H", dscr, 0)
+        raw_name = dscr[2:2 + FLM_NAME_LEN]
+        self.dev_name = raw_name[:raw_name.find(b"\0") if b"\0" in raw_name else None].decode("latin-1")
+        (self.dev_type, self.dev_adr, self.sz_dev, self.sz_page, _res, self.val_empty,
+         self.to_prog, self.to_erase) = struct.unpack_from("<HIIII B3x II", dscr, 2 + FLM_NAME_LEN)
+
+        self.sectors = []
+        for offset in range(fixed, min(len(dscr), fixed + FLM_SECTOR_MAX * 8) - 7, 8):
+            size, addr = struct.unpack_from("<II", dscr, offset)
+            if size == 0xFFFFFFFF:
+                break
+            self.sectors.append((size, addr))
+        else:
+            raise FlmError("sector list not terminated")
+
+        if self.dev_type not in DEV_TYPES:
+            raise FlmError("unknown device type %d" % self.dev_type)
+        if self.sz_dev == 0 or self.dev_adr + self.sz_dev > 1 << 32 or self.sz_page == 0:
+            raise FlmError("bad device range or page size")
+        if len(self.sectors) > SECTOR_NUM - 1:
+            raise FlmError("%d sector regions, flash_dev_t holds %d" % (len(self.sectors), SECTOR_NUM - 1))
+
+    def _build_geometry(self):
+        """Same flattening as flash_dev_sector_map_build() in src/flash_blob.c."""
+        if not self.sectors or self.sectors[0][1] != 0:
+            raise FlmError("sector list must start at offset 0")
+        self.regions = []
+        first = 0
+        for i, (size, offset) in enumerate(self.sectors):
+            end = self.sectors[i + 1][1] if i + 1 < len(self.sectors) else self.sz_dev
+            if size == 0 or end <= offset or (end - offset) % size != 0:
+                raise FlmError("sector region at 0x%X does not tile the device" % offset)
+            shift = size.bit_length() - 1 if size & (size - 1) == 0 else 0
+            self.regions.append((offset, size, first, shift))
+            first += (end - offset) // size
+        self.sector_num = first
+
+    def image(self):
+        """PrgCode up to the end of PrgData as little endian words."""
+        prg_data = self.sections["PrgData"]
+        end = prg_data["addr"] + len(prg_data["data"])
+        blob = bytearray(end + (-end % 4))
+        code = self.sections["PrgCode"]["data"]
+        blob[:len(code)] = code
+        blob[prg_data["addr"]:end] = prg_data["data"]
+        if not blob:
+            blob = bytearray(4)
+        return struct.unpack("<%dI" % (len(blob) // 4), blob)
+
+
+def identifier(path):
+    base = os.path.basename(path)
+    stem = base[:-4] if base.lower().endswith(".flm") else base
+    ident = re.sub(r"[^0-9a-zA-Z]+", "_", stem).strip("_").lower()
+    return "flm_" + ident if not ident or ident[0].isdigit() else ident
+
+
+def size_text(size):
+    return "%dMB" % (size >> 20) if size >= 1 << 20 and size % (1 << 20) == 0 else "%dkB" % (size >> 10)
+
+
+def emit(flm, source, ident):
+    out = []
+    w = out.append
+    dev_name = flm.dev_name[:DEV_NAME_LEN - 1].replace("\\", "\\\\").replace('"', '\\"')
+
+    w("/*")
+    w(" * %s: %s, 0x%08X - 0x%08X" % (os.path.basename(source), flm.dev_name, flm.dev_adr,
+                                      flm.dev_adr + flm.sz_dev - 1))
+    w(" * Generated by tools/flm2c.py, do not edit.")
+    if flm.unused:
+        w(" * Not used: %s, flash_blob verifies by reading back." % ", ".join(flm.unused))
+    w(" */")
+    w('#include "flash_blob.h"')
+    w('#include "flash_flm.h"')
+    w("")
+    prg_data = flm.sections["PrgData"]["addr"]
+    w("/* PrgCode, then PrgData at byte 0x%X, the static base of the algorithm */" % prg_data)
+    w("static uint32_t flash_code[] FLASH_FLM_CODE_SECTION = {")
+    words = flm.image()
+    for i in range(0, len(words), 8):
+        w("    " + ",".join("0x%08X" % x for x in words[i:i + 8]) + ",")
+    w("};")
+    w("")
+    w("#define FLM_ENTRY(__OFFSET)     ((uintptr_t)flash_code + (__OFFSET))")
+    w("#define FLM_STATIC_BASE         ((void *)&flash_code[0x%X / 4])" % prg_data)
+    w("")
+
+    params = {"Init": ("uint32_t adr, uint32_t clk, uint32_t fnc", "adr, clk, fnc"),
+              "UnInit": ("uint32_t fnc", "fnc, 0, 0"),
+              "EraseChip": ("void", "0, 0, 0"),
+              "EraseSector": ("uint32_t adr", "adr, 0, 0"),
+              "Program": ("uint32_t adr, uint32_t sz, uint8_t *buf", "adr, sz, (uintptr_t)buf")}
+    for _, member, _ in ENTRIES:
+        if member not in flm.entries:
+            continue
+        proto, args = params[member]
+        w("static int32_t %s(%s)" % (member, proto))
+        w("{")
+        w("    return flash_flm_call(FLM_ENTRY(0x%04X), FLM_STATIC_BASE, %s);" % (flm.entries[member], args))
+        w("}")
+        w("")
+
+    w("static const flash_dev_t flash_dev = {")
+    w("    %-28s// Driver Version" % ("0x%04X," % flm.vers))
+    w("    %-28s// Device Name" % ('"%s",' % dev_name))
+    w("    %-28s// Device Type" % (DEV_TYPES[flm.dev_type] + ","))
+    w("    %-28s// Device Start Address" % ("0x%08X," % flm.dev_adr))
+    w("    %-28s// Device Size in Bytes (%s)" % ("0x%08X," % flm.sz_dev, size_text(flm.sz_dev)))
+    w("    %-28s// Programming Page Size" % ("%d," % flm.sz_page))
+    w("    %-28s// Reserved, must be 0" % "0,")
+    w("    %-28s// Initial Content of Erased Memory" % ("0x%02X," % flm.val_empty))
+    w("    %-28s// Program Page Timeout %d mSec" % ("%d," % flm.to_prog, flm.to_prog))
+    w("    %-28s// Erase Sector Timeout %d mSec" % ("%d," % flm.to_erase, flm.to_erase))
+    w("")
+    w("// Specify Size and Address of Sectors")
+    firsts = [region[2] for region in flm.regions] + [flm.sector_num]
+    for i, (size, offset) in enumerate(flm.sectors):
+        count = firsts[i + 1] - firsts[i]
+        w("    %-28s// Sector Size %s (%d Sectors)" % ("0x%06X, 0x%06X," % (size, offset), size_text(size), count))
+    w("    SECTOR_END")
+    w("};")
+    w("")
+    w("/* sectors[] flattened at build time: offset, sector size, first sector index, log2 of the size */")
+    w("static const flash_geometry_t flash_geometry = {")
+    w("    %-28s// sectors" % ("%d," % flm.sector_num))
+    w("    %-28s// regions" % ("%d," % len(flm.regions)))
+    w("    {")
+    for offset, size, first, shift in flm.regions:
+        w("        {0x%08X, 0x%08X, %d, %d}," % (offset, size, first, shift))
+    w("    },")
+    w("};")
+    w("")
+    w("const flash_blob_t %s_flash_device = {" % ident)
+    w("    .ptFlashDev = &flash_dev,")
+    for _, member, _ in ENTRIES:
+        w("    .tFlashops.%s = %s," % (member, member if member in flm.entries else "NULL"))
+    w("    .tFlashops.Read = NULL,")
+    w("    .ptGeometry = &flash_geometry,")
+    w("};")
+    return "\n".join(out) + "\n"
+
+
+def emit_header(devices):
+    out = []
+    w = out.append
+    w("/*")
+    w(" * Devices converted by tools/flm2c.py, do not edit. List the ones the")
+    w(" * board has in FLASH_DEV_TABLE, their address ranges must not overlap.")
+    w(" */")
+    w("#ifndef FLASH_FLM_DEVICES_H")
+    w("#define FLASH_FLM_DEVICES_H")
+    w('#include "flash_blob.h"')
+    w("")
+    width = max(len(ident) for ident, _, _ in devices) + len("_flash_device;")
+    for ident, flm, source in devices:
+        w("extern const flash_blob_t %-*s// 0x%08X - 0x%08X %s" % (
+            width, ident + "_flash_device;", flm.dev_adr, flm.dev_adr + flm.sz_dev - 1, os.path.basename(source)))
+    w("#endif")
+    return "\n".join(out) + "\n"
+
+
+def collect(paths):
+    """Yields (source name, contents) of every FLM named or found."""
+    for path in paths:
+        if os.path.isdir(path):
+            for root, _, files in sorted(os.walk(path)):
+                for name in sorted(files):
+                    if name.lower().endswith(".flm"):
+                        with open(os.path.join(root, name), "rb") as f:
+                            yield os.path.join(root, name), f.read()
+        elif zipfile.is_zipfile(path):
+            with zipfile.ZipFile(path) as pack:
+                for name in sorted(pack.namelist()):
+                    if name.lower().endswith(".flm") and "/flash/" in "/" + name.lower():
+                        yield "%s:%s" % (os.path.basename(path), name), pack.read(name)
+        else:
+            with open(path, "rb") as f:
+                yield path, f.read()
+
+
+def main(argv=None):
+    parser = argparse.ArgumentParser(description="Convert Keil FLM flash algorithms into flash_blob drivers.")
+    parser.add_argument("inputs", nargs="+", metavar="FLM|DIR|PACK")
+    parser.add_argument("-o", "--output", default=".", help="output directory (default: current)")
+    parser.add_argument("--header", default="flash_flm_devices.h",
+                        help="declarations of all converted devices, written for more than one FLM")
+    args = parser.parse_args(argv)
+
+    os.makedirs(args.output, exist_ok=True)
+    devices, failed, used = [], 0, set()
+    for source, data in collect(args.inputs):
+        try:
+            flm = Flm(source, data)
+        except FlmError as e:
+            print("%s: %s" % (source, e), file=sys.stderr)
+            failed += 1
+            continue
+        base = identifier(source.split(":")[-1])
+        ident, n = base, 1
+        while ident in used:
+            n += 1
+            ident = "%s_%d" % (base, n)
+        used.add(ident)
+        # the identifier is unique in this run, the file name must be too
+        target = os.path.join(args.output, ident + ".c")
+        with open(target, "w", newline="\n") as f:
+            f.write(emit(flm, source.split(":")[-1], ident))
+        devices.append((ident, flm, source))
+        print("%s -> %s (%s_flash_device, %s at 0x%08X, %d sectors)" % (
+            source, target, ident, size_text(flm.sz_dev), flm.dev_adr, flm.sector_num))
+
+    devices.sort(key=lambda d: d[1].dev_adr)
+    for (a, fa, _), (b, fb, _) in zip(devices, devices[1:]):
+        if fb.dev_adr < fa.dev_adr + fa.sz_dev:
+            print("note: %s and %s overlap, only one of them fits in FLASH_DEV_TABLE" % (a, b), file=sys.stderr)
+    if len(devices) > 1:
+        with open(os.path.join(args.output, args.header), "w", newline="\n") as f:
+            f.write(emit_header(devices))
+
+    if not devices and not failed:
+        print("no FLM files found", file=sys.stderr)
+        return 1
+    return 1 if failed else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())